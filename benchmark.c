@@ -4,10 +4,31 @@
 //   - B: large array, accessed in "chunks" with either dense or strided pattern
 //   - The total logical B footprint per run is always B_bytes (independent of stride).
 
+#define _GNU_SOURCE  // CPU_SET / pthread_setaffinity_np (--threads)
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 /*
  * BENCH_PRINTF:
@@ -22,86 +43,2055 @@
 #endif
 
 /*
- * TRACE_MODE:
- *   - When defined, we do NOT initialize B in order to avoid large init cost.
- *   - Only A is initialized. This is intended for trace-only builds where the
- *     numeric values of B do not matter (only the address pattern matters).
+ * TRACE_MODE:
+ *   - When defined, we do NOT initialize B in order to avoid large init cost.
+ *   - Only A is initialized. This is intended for trace-only builds where the
+ *     numeric values of B do not matter (only the address pattern matters).
+ */
+#ifdef TRACE_MODE
+#warning "Compiling with TRACE_MODE: B array is NOT initialized (trace-only build)"
+#endif
+
+// Global sink to prevent the compiler from optimizing the kernel away.
+static volatile double sink = 0.0;
+
+/*
+ * In-process hardware counters (--pmu):
+ *   - One perf_event_open group, enabled only around the run_kernel loop, so
+ *     process startup, malloc and init_array are not counted (unlike
+ *     `perf stat` in scripts/run_perf_mpki.py).
+ *   - User-mode counts only (works with perf_event_paranoid <= 2).
+ *   - The L2 / DRAM events are AMD Zen raw events (same names as in
+ *     run_perf_mpki.py); on other CPUs they are reported as n/a.
+ *   - The group holds 6 events, which fits the 6 general-purpose counters of
+ *     Zen without multiplexing. If the kernel still has to multiplex (e.g. the
+ *     NMI watchdog holds a counter), the values are scaled and a note is printed.
+ */
+enum {
+    PMU_CYCLES,
+    PMU_INSTRUCTIONS,
+    PMU_L1D_MISSES,
+    PMU_L2_MISSES,
+    PMU_DRAM_LOCAL,
+    PMU_DRAM_REMOTE,
+    PMU_N_EVENTS
+};
+
+struct pmu_counters {
+    int      fd[PMU_N_EVENTS];       // -1 = not open
+    int      have[PMU_N_EVENTS];     // event was counted (kept after pmu_close)
+    uint64_t value[PMU_N_EVENTS];
+    uint64_t time_enabled;
+    uint64_t time_running;
+#ifdef __linux__
+    // User pages of the events for rdpmc (--sample), NULL = not mapped
+    volatile struct perf_event_mmap_page *page[PMU_N_EVENTS];
+#endif
+};
+
+#ifdef __linux__
+struct pmu_event_desc {
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+    int         amd_only;
+};
+
+static const struct pmu_event_desc pmu_events[PMU_N_EVENTS] = {
+    { "cycles",                PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,   0 },
+    { "instructions",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0 },
+    { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+      PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),                              0 },
+    // Zen PMCx064 L2CacheReqStat / PMCx043 LsRefillsFromSys: (umask << 8) | event
+    { "l2_cache_misses_from_dc_misses",           PERF_TYPE_RAW, 0x0864,  1 },
+    { "ls_refills_from_sys.ls_mabresp_lcl_dram",  PERF_TYPE_RAW, 0x0843,  1 },
+    { "ls_refills_from_sys.ls_mabresp_rmt_dram",  PERF_TYPE_RAW, 0x4043,  1 },
+};
+
+static int cpu_is_amd(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_is("amd");
+#else
+    return 0;
+#endif
+}
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd)
+{
+    return (int)syscall(SYS_perf_event_open, attr, 0 /* this process */, -1 /* any cpu */,
+                        group_fd, 0);
+}
+#endif
+
+/*
+ * Open the counter group (disabled). Events other than cycles that the CPU
+ * or kernel does not support are left out with a note on stderr.
+ * Returns 0, or -1 if the group cannot be opened at all.
+ */
+static int pmu_open(struct pmu_counters *pc)
+{
+    memset(pc, 0, sizeof(*pc));
+    for (int e = 0; e < PMU_N_EVENTS; e++) {
+        pc->fd[e] = -1;
+    }
+#ifdef __linux__
+    int amd = cpu_is_amd();
+    for (int e = 0; e < PMU_N_EVENTS; e++) {
+        if (pmu_events[e].amd_only && !amd) {
+            fprintf(stderr, "# PMU: %s skipped (AMD Zen event, not an AMD CPU)\n", pmu_events[e].name);
+            continue;
+        }
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = pmu_events[e].type;
+        attr.config         = pmu_events[e].config;
+        attr.disabled       = (e == PMU_CYCLES);  // members follow the leader
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP |
+                              PERF_FORMAT_TOTAL_TIME_ENABLED |
+                              PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        pc->fd[e] = perf_event_open(&attr, (e == PMU_CYCLES) ? -1 : pc->fd[PMU_CYCLES]);
+        if (pc->fd[e] < 0) {
+            if (e == PMU_CYCLES) {
+                fprintf(stderr, "perf_event_open(cycles) failed: %s "
+                                "(check /proc/sys/kernel/perf_event_paranoid)\n", strerror(errno));
+                return -1;
+            }
+            fprintf(stderr, "# PMU: %s not available: %s\n", pmu_events[e].name, strerror(errno));
+            continue;
+        }
+        pc->have[e] = 1;
+    }
+    return 0;
+#else
+    fprintf(stderr, "--pmu needs Linux perf_event_open\n");
+    return -1;
+#endif
+}
+
+static void pmu_start(struct pmu_counters *pc)
+{
+#ifdef __linux__
+    ioctl(pc->fd[PMU_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pc->fd[PMU_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#else
+    (void)pc;
+#endif
+}
+
+/* Stop counting and read the group. Returns 0, or -1 on a read error. */
+static int pmu_stop(struct pmu_counters *pc)
+{
+#ifdef __linux__
+    ioctl(pc->fd[PMU_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // { nr, time_enabled, time_running, value[nr] } in the order the events were opened
+    uint64_t buf[3 + PMU_N_EVENTS];
+    if (read(pc->fd[PMU_CYCLES], buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t))) {
+        fprintf(stderr, "read(perf group) failed: %s\n", strerror(errno));
+        return -1;
+    }
+    pc->time_enabled = buf[1];
+    pc->time_running = buf[2];
+    uint64_t k = 0;
+    for (int e = 0; e < PMU_N_EVENTS; e++) {
+        if (pc->have[e] && k < buf[0]) {
+            pc->value[e] = buf[3 + k++];
+            if (pc->time_running > 0 && pc->time_running < pc->time_enabled) {
+                pc->value[e] = (uint64_t)((double)pc->value[e] *
+                                          (double)pc->time_enabled / (double)pc->time_running);
+            }
+        }
+    }
+    return 0;
+#else
+    (void)pc;
+    return -1;
+#endif
+}
+
+static void pmu_close(struct pmu_counters *pc)
+{
+    for (int e = PMU_N_EVENTS - 1; e >= 0; e--) {
+#ifdef __linux__
+        if (pc->page[e]) {
+            munmap((void *)pc->page[e], (size_t)sysconf(_SC_PAGESIZE));
+            pc->page[e] = NULL;
+        }
+        if (pc->fd[e] >= 0) {
+            close(pc->fd[e]);
+        }
+#endif
+        pc->fd[e] = -1;
+    }
+}
+
+/*
+ * Map the user page of every open event so that pmu_read_user() can read
+ * the counters with rdpmc. Returns the number of events readable that way
+ * (the kernel must allow user rdpmc: /sys/bus/event_source/devices/cpu/rdpmc).
+ */
+static int pmu_map_user(struct pmu_counters *pc)
+{
+    int n = 0;
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (int e = 0; e < PMU_N_EVENTS; e++) {
+        if (!pc->have[e]) {
+            continue;
+        }
+        void *p = mmap(NULL, page_size, PROT_READ, MAP_SHARED, pc->fd[e], 0);
+        if (p == MAP_FAILED) {
+            continue;
+        }
+        pc->page[e] = p;
+        if (pc->page[e]->cap_user_rdpmc) {
+            n++;
+        } else {
+            munmap(p, page_size);
+            pc->page[e] = NULL;
+        }
+    }
+#else
+    (void)pc;
+#endif
+    return n;
+}
+
+/*
+ * Current count of event e without a system call: the kernel's offset plus
+ * the live hardware counter (rdpmc), under the page's sequence lock. While
+ * the event is not scheduled on a counter (index 0) only the offset counts.
+ */
+static inline uint64_t pmu_read_user(const struct pmu_counters *pc, int e)
+{
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+    volatile struct perf_event_mmap_page *pg = pc->page[e];
+    uint32_t seq;
+    uint64_t count;
+    do {
+        seq = pg->lock;
+        __asm__ __volatile__("" ::: "memory");
+        uint32_t idx = pg->index;
+        count = (uint64_t)pg->offset;
+        if (idx) {
+            unsigned shift = 64 - pg->pmc_width;
+            int64_t pmc = (int64_t)((uint64_t)__rdpmc((int)(idx - 1)) << shift) >> shift;
+            count += (uint64_t)pmc;
+        }
+        __asm__ __volatile__("" ::: "memory");
+    } while (pg->lock != seq);
+    return count;
+#else
+    (void)pc;
+    (void)e;
+    return 0;
+#endif
+}
+
+static void print_count(const char *label, const struct pmu_counters *pc, int e)
+{
+    if (pc->have[e]) {
+        printf("%s: %llu\n", label, (unsigned long long)pc->value[e]);
+    } else {
+        printf("%s: n/a\n", label);
+    }
+}
+
+static void print_pki(const char *label, const struct pmu_counters *pc, int e, uint64_t extra)
+{
+    uint64_t insts = pc->value[PMU_INSTRUCTIONS];
+    if (pc->have[e] && pc->have[PMU_INSTRUCTIONS] && insts > 0) {
+        printf("%s: %.3f\n", label, 1000.0 * (double)(pc->value[e] + extra) / (double)insts);
+    } else {
+        printf("%s: n/a\n", label);
+    }
+}
+
+/*
+ * Same summary layout as scripts/run_perf_mpki.py, so that run_cases.py
+ * parses either output.
+ */
+static void pmu_print(const struct pmu_counters *pc)
+{
+    uint64_t dram_local  = pc->have[PMU_DRAM_LOCAL]  ? pc->value[PMU_DRAM_LOCAL]  : 0;
+    uint64_t dram_remote = pc->have[PMU_DRAM_REMOTE] ? pc->value[PMU_DRAM_REMOTE] : 0;
+
+    printf("=== Parsed counters (in-process, run_kernel only) ===\n");
+    if (pc->time_running == 0) {
+        printf("# PMU: the counter group was never scheduled (too many events for the PMU?)\n");
+    } else if (pc->time_running < pc->time_enabled) {
+        printf("# PMU: multiplexed, counted %.1f%% of the time; values are scaled\n",
+               100.0 * (double)pc->time_running / (double)pc->time_enabled);
+    }
+    print_count("cycles                 ", pc, PMU_CYCLES);
+    print_count("instructions           ", pc, PMU_INSTRUCTIONS);
+    print_count("L1-dcache-load-misses  ", pc, PMU_L1D_MISSES);
+    print_count("l2_cache_misses_from_dc_misses   ", pc, PMU_L2_MISSES);
+    if (pc->have[PMU_DRAM_LOCAL]) {
+        printf("Demand DRAM fills (L1D): %llu (local=%llu, remote=%llu)\n",
+               (unsigned long long)(dram_local + dram_remote),
+               (unsigned long long)dram_local, (unsigned long long)dram_remote);
+    } else {
+        printf("Demand DRAM fills (L1D): n/a\n");
+    }
+    printf("\n");
+
+    printf("=== Rates / IPC ===\n");
+    if (pc->value[PMU_CYCLES] > 0 && pc->have[PMU_INSTRUCTIONS]) {
+        printf("IPC                    : %.3f\n",
+               (double)pc->value[PMU_INSTRUCTIONS] / (double)pc->value[PMU_CYCLES]);
+    } else {
+        printf("IPC                    : n/a\n");
+    }
+    printf("\n");
+
+    printf("=== Per-1K-instruction metrics (MPKI/PKI) ===\n");
+    print_pki("L1 MPKI                ", pc, PMU_L1D_MISSES, 0);
+    print_pki("L2 MPKI                ", pc, PMU_L2_MISSES, 0);
+    print_pki("Demand DRAM fills (L1D) PKI ", pc, PMU_DRAM_LOCAL, dram_remote);
+}
+
+/*
+ * Time series (--sample N):
+ *   - Every N outer iterations the loop takes a sample: the timestamp counter
+ *     and the running count of every group event read with rdpmc, so the hot
+ *     loop makes no system calls.
+ *   - Samples go into a ring buffer allocated before the run; when it wraps,
+ *     the oldest samples are overwritten (and counted as dropped).
+ *   - After the run the buffer is dumped as CSV, one row per sample with the
+ *     deltas since the previous one.
+ */
+struct sample {
+    uint64_t rep;
+    uint64_t outer;                  // outer iterations of this rep done so far
+    uint64_t tsc;
+    uint64_t value[PMU_N_EVENTS];
+};
+
+struct sampler {
+    struct sample *ring;
+    uint64_t cap;
+    uint64_t n;                      // samples taken (ring holds the last min(n, cap))
+    const struct pmu_counters *pc;   // NULL = timestamps only
+    int user_read[PMU_N_EVENTS];     // event is readable with rdpmc
+};
+
+static inline uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);  // vDSO, no system call
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline void sampler_take(struct sampler *sp, uint64_t rep, uint64_t outer)
+{
+    struct sample *s = &sp->ring[sp->n % sp->cap];
+    s->rep   = rep;
+    s->outer = outer;
+    s->tsc   = read_tsc();
+    for (int e = 0; e < PMU_N_EVENTS; e++) {
+        s->value[e] = sp->user_read[e] ? pmu_read_user(sp->pc, e) : 0;
+    }
+    sp->n++;
+}
+
+static int sampler_dump(const struct sampler *sp, FILE *fp)
+{
+    static const char *const names[PMU_N_EVENTS] = {
+        "cycles", "instructions", "l1d_misses", "l2_misses", "dram_local", "dram_remote"
+    };
+    uint64_t kept  = (sp->n < sp->cap) ? sp->n : sp->cap;
+    uint64_t first = sp->n - kept;
+
+    if (first > 0) {
+        fprintf(stderr, "# Samples: ring buffer of %llu wrapped, %llu oldest samples dropped\n",
+                (unsigned long long)sp->cap, (unsigned long long)first);
+    }
+    fprintf(fp, "sample,rep,outer_end,tsc_delta");
+    for (int e = 0; e < PMU_N_EVENTS; e++) {
+        fprintf(fp, ",%s", names[e]);
+    }
+    fprintf(fp, "\n");
+
+    // The oldest kept sample is the baseline of the next one
+    for (uint64_t k = first + 1; k < sp->n; k++) {
+        const struct sample *s    = &sp->ring[k % sp->cap];
+        const struct sample *prev = &sp->ring[(k - 1) % sp->cap];
+        fprintf(fp, "%llu,%llu,%llu,%llu", (unsigned long long)k, (unsigned long long)s->rep,
+                (unsigned long long)s->outer, (unsigned long long)(s->tsc - prev->tsc));
+        for (int e = 0; e < PMU_N_EVENTS; e++) {
+            if (sp->user_read[e]) {
+                fprintf(fp, ",%llu", (unsigned long long)(s->value[e] - prev->value[e]));
+            } else {
+                fprintf(fp, ",");
+            }
+        }
+        fprintf(fp, "\n");
+    }
+    return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * NUMA placement (--a-node / --b-node SPEC):
+ *   N             bind to node N
+ *   local         bind to the node of the CPU we run on
+ *   remote        bind to another node (the next online one)
+ *   interleave    interleave over all online nodes
+ *   interleave:L  interleave over the node list L (e.g. 0-1,3)
+ *
+ *   - The policy is set with the mbind system call (no libnuma needed) on an
+ *     mmap'd region before it is touched, so it decides where the pages land
+ *     at first touch. Without an option the array comes from malloc as before.
+ *   - local / remote are resolved against the node of the calling thread
+ *     (each thread's own node with --threads); a single-threaded run is
+ *     pinned to its current CPU so that it stays on that node.
+ */
+#define NUMA_MAX_NODES   1024
+#define NUMA_MASK_WORDS  (NUMA_MAX_NODES / (8 * sizeof(unsigned long)))
+
+enum numa_kind {
+    NUMA_DEFAULT,
+    NUMA_BIND,
+    NUMA_LOCAL,
+    NUMA_REMOTE,
+    NUMA_INTERLEAVE,
+};
+
+struct numa_policy {
+    enum numa_kind kind;
+    unsigned long  mask[NUMA_MASK_WORDS];  // NUMA_BIND / NUMA_INTERLEAVE
+};
+
+static void mask_set(unsigned long *mask, unsigned n)
+{
+    mask[n / (8 * sizeof(unsigned long))] |= 1ul << (n % (8 * sizeof(unsigned long)));
+}
+
+static int mask_test(const unsigned long *mask, unsigned n)
+{
+    return (mask[n / (8 * sizeof(unsigned long))] >> (n % (8 * sizeof(unsigned long)))) & 1;
+}
+
+/* "0-3,5" -> mask. Returns 0, or -1 if malformed. */
+static int parse_node_list(const char *s, unsigned long *mask)
+{
+    memset(mask, 0, NUMA_MASK_WORDS * sizeof(unsigned long));
+    while (*s && *s != '\n') {
+        char *end;
+        unsigned long lo = strtoul(s, &end, 10);
+        unsigned long hi = lo;
+        if (end == s) {
+            return -1;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtoul(s, &end, 10);
+            if (end == s) {
+                return -1;
+            }
+        }
+        if (lo > hi || hi >= NUMA_MAX_NODES) {
+            return -1;
+        }
+        for (unsigned long n = lo; n <= hi; n++) {
+            mask_set(mask, (unsigned)n);
+        }
+        s = end;
+        if (*s == ',') {
+            s++;
+        } else if (*s && *s != '\n') {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Online nodes from sysfs (node 0 only if unavailable) */
+static void numa_online(unsigned long *mask)
+{
+    char buf[256];
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if (!fp || !fgets(buf, sizeof(buf), fp) || parse_node_list(buf, mask) != 0) {
+        memset(mask, 0, NUMA_MASK_WORDS * sizeof(unsigned long));
+        mask_set(mask, 0);
+    }
+    if (fp) {
+        fclose(fp);
+    }
+}
+
+static int numa_parse(const char *spec, struct numa_policy *pol)
+{
+    memset(pol, 0, sizeof(*pol));
+    if (strcmp(spec, "local") == 0) {
+        pol->kind = NUMA_LOCAL;
+    } else if (strcmp(spec, "remote") == 0) {
+        pol->kind = NUMA_REMOTE;
+    } else if (strcmp(spec, "interleave") == 0) {
+        pol->kind = NUMA_INTERLEAVE;
+        numa_online(pol->mask);
+    } else if (strncmp(spec, "interleave:", 11) == 0) {
+        pol->kind = NUMA_INTERLEAVE;
+        if (parse_node_list(spec + 11, pol->mask) != 0) {
+            return -1;
+        }
+    } else {
+        pol->kind = NUMA_BIND;
+        if (parse_node_list(spec, pol->mask) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Node of the CPU the calling thread runs on (0 if unknown) */
+static unsigned numa_current_node(void)
+{
+    unsigned cpu = 0, node = 0;
+#if defined(__linux__) && defined(SYS_getcpu)
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        node = 0;
+    }
+#endif
+    (void)cpu;
+    return node;
+}
+
+/*
+ * Turn pol into an mbind mode + node mask for a thread on node `here`, and
+ * describe it in desc. Returns 0, or -1 if there is no such node.
+ */
+static int numa_resolve(const struct numa_policy *pol, unsigned here,
+                        int *mode, unsigned long *mask, char *desc, size_t desc_len)
+{
+    unsigned long online[NUMA_MASK_WORDS];
+    memset(mask, 0, NUMA_MASK_WORDS * sizeof(unsigned long));
+    switch (pol->kind) {
+        case NUMA_DEFAULT:
+            *mode = MPOL_DEFAULT;
+            snprintf(desc, desc_len, "default (malloc, first touch)");
+            return 0;
+        case NUMA_LOCAL:
+            *mode = MPOL_BIND;
+            mask_set(mask, here);
+            snprintf(desc, desc_len, "bind:%u (local to the running CPU)", here);
+            return 0;
+        case NUMA_REMOTE:
+            numa_online(online);
+            for (unsigned k = 1; k < NUMA_MAX_NODES; k++) {
+                unsigned n = (here + k) % NUMA_MAX_NODES;
+                if (mask_test(online, n)) {
+                    *mode = MPOL_BIND;
+                    mask_set(mask, n);
+                    snprintf(desc, desc_len, "bind:%u (remote, running CPU on node %u)", n, here);
+                    return 0;
+                }
+            }
+            fprintf(stderr, "NUMA: no remote node (only node %u is online)\n", here);
+            return -1;
+        case NUMA_BIND:
+        case NUMA_INTERLEAVE:
+            *mode = (pol->kind == NUMA_BIND) ? MPOL_BIND : MPOL_INTERLEAVE;
+            memcpy(mask, pol->mask, NUMA_MASK_WORDS * sizeof(unsigned long));
+            size_t len = (size_t)snprintf(desc, desc_len, "%s:",
+                                          (pol->kind == NUMA_BIND) ? "bind" : "interleave");
+            for (unsigned n = 0; n < NUMA_MAX_NODES && len < desc_len; n++) {
+                if (mask_test(mask, n)) {
+                    len += (size_t)snprintf(desc + len, desc_len - len, "%s%u",
+                                            desc[len - 1] == ':' ? "" : ",", n);
+                }
+            }
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * Page backing of B (--b-alloc MODE):
+ *   malloc  plain malloc (4 KB pages unless THP is "always")
+ *   thp     posix_memalign to 2 MB + madvise(MADV_HUGEPAGE)
+ *   2m / 1g mmap(MAP_HUGETLB) with 2 MB / 1 GB pages; needs reserved pages
+ *           (/sys/kernel/mm/hugepages/hugepages-*kB/nr_hugepages)
+ *
+ *   What was actually obtained is read back from /proc/self/smaps
+ *   (smaps_page_size), since THP is only a hint.
+ */
+enum page_mode {
+    PAGES_MALLOC,
+    PAGES_THP,
+    PAGES_HUGETLB_2M,
+    PAGES_HUGETLB_1G,
+};
+
+static const char *const page_mode_names[] = { "malloc", "thp", "2m", "1g" };
+
+#define HUGE_2M  (2ul << 20)
+#define HUGE_1G  (1ul << 30)
+
+/* Size the region of n doubles really occupies (hugetlb / THP are rounded up) */
+static size_t array_span(size_t n, enum page_mode pages)
+{
+    size_t bytes = sizeof(double) * n;
+    size_t align = (pages == PAGES_HUGETLB_1G) ? HUGE_1G :
+                   (pages == PAGES_MALLOC)     ? 1 : HUGE_2M;
+    return (bytes + align - 1) / align * align;
+}
+
+/*
+ * Allocate n doubles backed by `pages` and placed by pol (as seen from the
+ * calling thread), not yet touched. malloc + NUMA_DEFAULT is a plain malloc.
+ * With populate, an mmap without NUMA policy is made with MAP_POPULATE (with
+ * a policy the pages must be faulted after mbind, see fill_array()).
+ * Release with free_array().
+ */
+static double *alloc_array(size_t n, const struct numa_policy *pol, enum page_mode pages,
+                           int populate, char *desc, size_t desc_len)
+{
+    int mode;
+    unsigned long mask[NUMA_MASK_WORDS];
+    if (numa_resolve(pol, numa_current_node(), &mode, mask, desc, desc_len) != 0) {
+        return NULL;
+    }
+    if (pages == PAGES_MALLOC && pol->kind == NUMA_DEFAULT) {
+        return (double *)malloc(sizeof(double) * n);
+    }
+#ifdef __linux__
+    size_t bytes = array_span(n, pages);
+    void *p;
+    if (pages == PAGES_THP) {
+        if (posix_memalign(&p, HUGE_2M, bytes) != 0) {
+            return NULL;
+        }
+        if (madvise(p, bytes, MADV_HUGEPAGE) != 0) {
+            fprintf(stderr, "madvise(MADV_HUGEPAGE) failed: %s (THP disabled?)\n", strerror(errno));
+        }
+    } else {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (populate && pol->kind == NUMA_DEFAULT) {
+            flags |= MAP_POPULATE;
+        }
+        if (pages == PAGES_HUGETLB_2M) {
+            flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+        } else if (pages == PAGES_HUGETLB_1G) {
+            flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+        }
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            if (flags & MAP_HUGETLB) {
+                fprintf(stderr, "mmap(MAP_HUGETLB, %s) of %zu bytes failed: %s\n"
+                                "  reserve pages first, e.g. echo N > /sys/kernel/mm/hugepages/hugepages-%skB/nr_hugepages\n",
+                        page_mode_names[pages], bytes, strerror(errno),
+                        (pages == PAGES_HUGETLB_1G) ? "1048576" : "2048");
+            }
+            return NULL;
+        }
+    }
+    if (pol->kind != NUMA_DEFAULT &&
+        syscall(SYS_mbind, p, bytes, mode, mask, (unsigned long)NUMA_MAX_NODES, 0) != 0) {
+        fprintf(stderr, "mbind(%s) failed: %s\n", desc, strerror(errno));
+        if (pages == PAGES_THP) {
+            free(p);
+        } else {
+            munmap(p, bytes);
+        }
+        return NULL;
+    }
+    return (double *)p;
+#else
+    fprintf(stderr, "NUMA placement / huge pages need Linux\n");
+    return NULL;
+#endif
+}
+
+static void free_array(double *p, size_t n, const struct numa_policy *pol, enum page_mode pages)
+{
+    if (pages == PAGES_THP || (pages == PAGES_MALLOC && pol->kind == NUMA_DEFAULT)) {
+        free(p);
+        return;
+    }
+#ifdef __linux__
+    if (p) {
+        munmap(p, array_span(n, pages));
+    }
+#endif
+}
+
+/*
+ * Page size actually backing [p, p + bytes), from /proc/self/smaps: the
+ * KernelPageSize of the mappings and how much of them is THP (AnonHugePages)
+ * or hugetlb, e.g. "4 kB pages, THP (AnonHugePages) 1046528 of 1048576 kB"
+ * or "2048 kB pages (hugetlb), 1048576 kB mapped".
+ */
+static void smaps_page_size(const void *p, size_t bytes, char *desc, size_t desc_len)
+{
+    snprintf(desc, desc_len, "unknown (no /proc/self/smaps)");
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (!fp) {
+        return;
+    }
+    uintptr_t lo = (uintptr_t)p, hi = lo + bytes;
+    unsigned long size_kb = 0, thp_kb = 0, hugetlb_kb = 0, page_kb = 0;
+    int inside = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long long start, end, v;
+        if (sscanf(line, "%llx-%llx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+            inside = (start < hi && end > lo);
+        } else if (!inside) {
+            continue;
+        } else if (sscanf(line, "Size: %llu kB", &v) == 1) {
+            size_kb += (unsigned long)v;
+        } else if (sscanf(line, "KernelPageSize: %llu kB", &v) == 1) {
+            if (page_kb == 0 || v > page_kb) {
+                page_kb = (unsigned long)v;
+            }
+        } else if (sscanf(line, "AnonHugePages: %llu kB", &v) == 1) {
+            thp_kb += (unsigned long)v;
+        } else if (sscanf(line, "Private_Hugetlb: %llu kB", &v) == 1 ||
+                   sscanf(line, "Shared_Hugetlb: %llu kB", &v) == 1) {
+            hugetlb_kb += (unsigned long)v;
+        }
+    }
+    fclose(fp);
+    if (page_kb == 0) {
+        return;
+    }
+    if (hugetlb_kb > 0 || page_kb > 4) {
+        snprintf(desc, desc_len, "%lu kB pages (hugetlb), %lu kB mapped", page_kb, size_kb);
+    } else {
+        snprintf(desc, desc_len, "%lu kB pages, THP (AnonHugePages) %lu of %lu kB",
+                 page_kb, thp_kb, size_kb);
+    }
+}
+
+/*
+ * Where the pages of p actually are: up to 64 evenly spaced pages are looked
+ * up with move_pages (no move, status only), e.g. "node0:48 node1:16".
+ */
+static void numa_page_nodes(const double *p, size_t n, char *desc, size_t desc_len)
+{
+    snprintf(desc, desc_len, "unknown");
+#if defined(__linux__) && defined(SYS_move_pages)
+    enum { MAX_PAGES = 64 };
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t bytes = sizeof(double) * n;
+    size_t pages = (bytes + page_size - 1) / page_size;
+    size_t count = pages < MAX_PAGES ? pages : MAX_PAGES;
+    void *addr[MAX_PAGES];
+    int status[MAX_PAGES];
+    for (size_t i = 0; i < count; i++) {
+        addr[i] = (char *)p + (i * pages / count) * page_size;
+    }
+    if (syscall(SYS_move_pages, 0, (unsigned long)count, addr, NULL, status, 0) != 0) {
+        return;
+    }
+
+    unsigned per_node[64] = {0};
+    unsigned not_present = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (status[i] >= 0 && status[i] < 64) {
+            per_node[status[i]]++;
+        } else {
+            not_present++;
+        }
+    }
+    size_t len = 0;
+    desc[0] = '\0';
+    for (int node = 0; node < 64 && len < desc_len; node++) {
+        if (per_node[node]) {
+            len += (size_t)snprintf(desc + len, desc_len - len, "node%d:%u ", node, per_node[node]);
+        }
+    }
+    if (not_present && len < desc_len) {
+        len += (size_t)snprintf(desc + len, desc_len - len, "not-faulted:%u ", not_present);
+    }
+    if (len < desc_len) {
+        snprintf(desc + len, desc_len - len, "(%zu sampled pages)", count);
+    }
+#else
+    (void)p;
+    (void)n;
+#endif
+}
+
+/*
+ * Initialize an array with simple increasing values so that the compiler
+ * cannot easily optimize away the loads.
+ */
+static void init_array(double *p, size_t n, double base)
+{
+    for (size_t i = 0; i < n; i++) {
+        p[i] = base + (double)i * 0.000001;
+    }
+}
+
+/*
+ * First touch of B (--b-fill MODE, --init-threads N):
+ *   values    init_array() values (the default of the normal build)
+ *   touch     write one element per 4 KB page: page tables populated, values 0
+ *   populate  MAP_POPULATE / madvise(MADV_POPULATE_WRITE): the kernel faults
+ *             the pages in, nothing is written from user space
+ *   none      leave B untouched (the default of the TRACE_MODE build)
+ *
+ *   values / touch are split over N threads pinned to the CPUs of the
+ *   calling thread's node, so first-touch placement is the same as with one
+ *   thread (an mbind policy decides anyway). The values do not depend on N.
+ */
+enum b_fill {
+    FILL_VALUES,
+    FILL_TOUCH,
+    FILL_POPULATE,
+    FILL_NONE,
+};
+
+static const char *const b_fill_names[] = { "values", "touch", "populate", "none" };
+
+#define TOUCH_STEP (4096 / sizeof(double))
+
+struct fill_job {
+    double     *p;
+    size_t      begin;
+    size_t      end;
+    double      base;
+    enum b_fill fill;
+    int         cpu;    // -1 = not pinned
+};
+
+static void fill_range(const struct fill_job *job)
+{
+    if (job->fill == FILL_VALUES) {
+        for (size_t i = job->begin; i < job->end; i++) {
+            job->p[i] = job->base + (double)i * 0.000001;
+        }
+    } else {
+        // One write per page, stepping on page boundaries so that a B that
+        // is not page-aligned (malloc) has no partial page left untouched
+        volatile double *p = job->p;
+        const uintptr_t page = TOUCH_STEP * sizeof(double);
+        size_t i = job->begin;
+        while (i < job->end) {
+            p[i] = 0.0;
+            uintptr_t addr = (uintptr_t)&p[i];
+            i += ((addr & ~(page - 1)) + page - addr) / sizeof(double);
+        }
+    }
+}
+
+static void *fill_worker(void *arg)
+{
+    struct fill_job *job = arg;
+    if (job->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(job->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    fill_range(job);
+    return NULL;
+}
+
+/* Allowed CPUs on the node of the calling thread; returns how many (0 if unknown) */
+static int node_cpus(int *cpus, int max)
+{
+    char path[64], buf[1024];
+    unsigned long mask[NUMA_MASK_WORDS];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", numa_current_node());
+    FILE *fp = fopen(path, "r");
+    int ok = fp && fgets(buf, sizeof(buf), fp) && parse_node_list(buf, mask) == 0;
+    if (fp) {
+        fclose(fp);
+    }
+    cpu_set_t allowed;
+    if (!ok || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return 0;
+    }
+    int n = 0;
+    for (int c = 0; c < CPU_SETSIZE && c < NUMA_MAX_NODES && n < max; c++) {
+        if (CPU_ISSET(c, &allowed) && mask_test(mask, (unsigned)c)) {
+            cpus[n++] = c;
+        }
+    }
+    return n;
+}
+
+/* First touch of p[0..n) as selected by fill, on nthreads threads */
+static void fill_array(double *p, size_t n, double base, enum b_fill fill, int nthreads)
+{
+    if (fill == FILL_NONE) {
+        return;
+    }
+    if (fill == FILL_POPULATE) {
+#if defined(__linux__) && defined(MADV_POPULATE_WRITE)
+        // Page-aligned interior; malloc'd arrays start just after a header
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        uintptr_t lo = ((uintptr_t)p + page_size - 1) & ~(uintptr_t)(page_size - 1);
+        uintptr_t hi = ((uintptr_t)(p + n)) & ~(uintptr_t)(page_size - 1);
+        if (hi <= lo || madvise((void *)lo, hi - lo, MADV_POPULATE_WRITE) == 0) {
+            // The partial pages at both ends are faulted by the kernel's first access
+            return;
+        }
+        fprintf(stderr, "# madvise(MADV_POPULATE_WRITE) failed: %s, touching pages instead\n",
+                strerror(errno));
+#endif
+        fill = FILL_TOUCH;
+    }
+
+    if (nthreads <= 1) {
+        struct fill_job job = { p, 0, n, base, fill, -1 };
+        fill_range(&job);
+        return;
+    }
+
+    int cpus[CPU_SETSIZE];
+    int ncpus = node_cpus(cpus, CPU_SETSIZE);
+    struct fill_job *jobs = calloc((size_t)nthreads, sizeof(*jobs));
+    pthread_t *tids = calloc((size_t)nthreads, sizeof(*tids));
+    int *started = calloc((size_t)nthreads, sizeof(*started));
+    if (!jobs || !tids || !started) {
+        free(jobs);
+        free(tids);
+        free(started);
+        struct fill_job job = { p, 0, n, base, fill, -1 };
+        fill_range(&job);
+        return;
+    }
+
+    // Slices of whole TOUCH_STEP blocks (one touch each)
+    size_t pages = (n + TOUCH_STEP - 1) / TOUCH_STEP;
+    for (int i = 0; i < nthreads; i++) {
+        size_t begin = pages * (size_t)i / (size_t)nthreads * TOUCH_STEP;
+        size_t end   = pages * (size_t)(i + 1) / (size_t)nthreads * TOUCH_STEP;
+        jobs[i] = (struct fill_job){ p, begin, end < n ? end : n, base, fill,
+                                     ncpus > 0 ? cpus[i % ncpus] : -1 };
+    }
+    // The calling thread takes slice 0, and any slice whose thread failed to start
+    for (int i = 1; i < nthreads; i++) {
+        started[i] = (pthread_create(&tids[i], NULL, fill_worker, &jobs[i]) == 0);
+    }
+    fill_range(&jobs[0]);
+    for (int i = 1; i < nthreads; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        } else {
+            fill_range(&jobs[i]);
+        }
+    }
+    free(started);
+    free(jobs);
+    free(tids);
+}
+
+/*
+ * Kernel variants (compile time; `make KERNEL=... PREFETCH_DIST=...`):
+ *
+ *   BENCH_KERNEL selects how the A sweep adds up A:
+ *     0 scalar    one serial `sum += A[i]` chain (the original kernel)
+ *     1 multiacc  BENCH_ACCS independent scalar accumulators
+ *     2 avx2      256-bit loads, 4 vector accumulators
+ *     3 avx512    512-bit loads, 4 vector accumulators
+ *   The serial chain is bound by the FP add latency, not by L1; the other
+ *   variants let the A sweep run at load throughput. Every variant loads
+ *   exactly the same addresses (only the summation order changes).
+ *
+ *   BENCH_PREFETCH_DIST = D > 0 adds __builtin_prefetch of every line of
+ *   B chunk outer + D before the A sweep of iteration outer ("ideal
+ *   wrong-path prefetch": the chunk is requested D iterations early). The
+ *   demand loads are unchanged. Not applied to the pointer chase.
+ */
+#ifndef BENCH_KERNEL
+#define BENCH_KERNEL 0
+#endif
+#ifndef BENCH_PREFETCH_DIST
+#define BENCH_PREFETCH_DIST 0
+#endif
+#ifndef BENCH_ACCS
+#define BENCH_ACCS 8
+#endif
+
+#if BENCH_KERNEL == 2 && !defined(__AVX2__)
+#error "KERNEL=avx2 needs an AVX2 target (-mavx2 or -march=native on an AVX2 CPU)"
+#endif
+#if BENCH_KERNEL == 3 && !defined(__AVX512F__)
+#error "KERNEL=avx512 needs an AVX-512 target (-mavx512f or -march=native on an AVX-512 CPU)"
+#endif
+#if BENCH_KERNEL == 2 || BENCH_KERNEL == 3
+#include <immintrin.h>
+#endif
+
+#if BENCH_KERNEL == 0
+#  define BENCH_KERNEL_NAME "scalar"
+#elif BENCH_KERNEL == 1
+#  define BENCH_KERNEL_NAME "multiacc"
+#elif BENCH_KERNEL == 2
+#  define BENCH_KERNEL_NAME "avx2"
+#else
+#  define BENCH_KERNEL_NAME "avx512"
+#endif
+
+/* 1) of the kernel: add all of A to sum, as selected by BENCH_KERNEL */
+static inline double sweep_A(const double *A, size_t A_elems, double sum)
+{
+#if BENCH_KERNEL == 0
+    for (size_t i = 0; i < A_elems; i++) {
+        sum += A[i];
+    }
+    return sum;
+#elif BENCH_KERNEL == 1
+    double acc[BENCH_ACCS] = {0};
+    size_t i = 0;
+    for (; i + BENCH_ACCS <= A_elems; i += BENCH_ACCS) {
+        for (int k = 0; k < BENCH_ACCS; k++) {
+            acc[k] += A[i + k];
+        }
+    }
+    for (; i < A_elems; i++) {
+        sum += A[i];
+    }
+    for (int k = 0; k < BENCH_ACCS; k++) {
+        sum += acc[k];
+    }
+    return sum;
+#elif BENCH_KERNEL == 2
+    __m256d v0 = _mm256_setzero_pd(), v1 = v0, v2 = v0, v3 = v0;
+    size_t i = 0;
+    for (; i + 16 <= A_elems; i += 16) {
+        v0 = _mm256_add_pd(v0, _mm256_loadu_pd(A + i));
+        v1 = _mm256_add_pd(v1, _mm256_loadu_pd(A + i + 4));
+        v2 = _mm256_add_pd(v2, _mm256_loadu_pd(A + i + 8));
+        v3 = _mm256_add_pd(v3, _mm256_loadu_pd(A + i + 12));
+    }
+    for (; i < A_elems; i++) {
+        sum += A[i];
+    }
+    __m256d v = _mm256_add_pd(_mm256_add_pd(v0, v1), _mm256_add_pd(v2, v3));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return sum + (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif BENCH_KERNEL == 3
+    __m512d v0 = _mm512_setzero_pd(), v1 = v0, v2 = v0, v3 = v0;
+    size_t i = 0;
+    for (; i + 32 <= A_elems; i += 32) {
+        v0 = _mm512_add_pd(v0, _mm512_loadu_pd(A + i));
+        v1 = _mm512_add_pd(v1, _mm512_loadu_pd(A + i + 8));
+        v2 = _mm512_add_pd(v2, _mm512_loadu_pd(A + i + 16));
+        v3 = _mm512_add_pd(v3, _mm512_loadu_pd(A + i + 24));
+    }
+    for (; i < A_elems; i++) {
+        sum += A[i];
+    }
+    return sum + _mm512_reduce_add_pd(_mm512_add_pd(_mm512_add_pd(v0, v1), _mm512_add_pd(v2, v3)));
+#else
+#error "BENCH_KERNEL must be 0 (scalar), 1 (multiacc), 2 (avx2) or 3 (avx512)"
+#endif
+}
+
+/* Prefetch every 64B line that chunk `chunk` of B will load (BENCH_PREFETCH_DIST) */
+static inline void prefetch_chunk(const double *B, size_t chunk, size_t outer_iters,
+                                  size_t elems_per_iter, size_t stride_elems)
+{
+#if BENCH_PREFETCH_DIST > 0
+    if (chunk >= outer_iters) {
+        return;
+    }
+    size_t base = chunk * elems_per_iter * stride_elems;
+    size_t step = (stride_elems >= 8) ? 1 : 8 / stride_elems;  // elements per line
+    for (size_t j = 0; j < elems_per_iter; j += step) {
+        __builtin_prefetch(&B[base + j * stride_elems], 0, 3);
+    }
+#else
+    (void)B;
+    (void)chunk;
+    (void)outer_iters;
+    (void)elems_per_iter;
+    (void)stride_elems;
+#endif
+}
+
+/*
+ * Kernel:
+ *   - outer_iters = B_elems / elems_per_iter (fixed for given B_bytes, chunk_bytes)
+ *   - For each outer iteration:
+ *       1) Sweep entire A once (intended to disturb / thrash L1).
+ *       2) Access one "chunk" of B, consisting of elems_per_iter elements,
+ *          using the given stride_elems.
+ *
+ *   Logical B coverage:
+ *     base index for this chunk = outer * elems_per_iter * stride_elems
+ *     then we access:
+ *       B[base + 0 * stride_elems],
+ *       B[base + 1 * stride_elems],
+ *       ...
+ *       B[base + (elems_per_iter - 1) * stride_elems]
+ *
+ *   - If stride_elems = 1 (dense), we simply sweep B in order.
+ *   - If stride_elems > 1 (strided), we jump by that stride within each chunk.
+ */
+static double run_kernel(double *A, double *B,
+                         size_t A_elems,
+                         size_t B_elems,      // logical B size when stride=1
+                         size_t elems_per_iter,
+                         size_t stride_elems)
+{
+    // Number of outer-loop iterations (independent of stride)
+    size_t outer_iters = B_elems / elems_per_iter;
+
+    double sum = 0.0;
+
+    for (size_t outer = 0; outer < outer_iters; outer++) {
+        prefetch_chunk(B, outer + BENCH_PREFETCH_DIST, outer_iters, elems_per_iter, stride_elems);
+
+        // 1) Sweep entire A to disturb / thrash L1
+        sum = sweep_A(A, A_elems, sum);
+
+        // 2) Access one chunk of B
+        size_t base = outer * elems_per_iter * stride_elems;
+
+        for (size_t j = 0; j < elems_per_iter; j++) {
+            size_t idx = base + j * stride_elems;
+            sum += B[idx];
+        }
+    }
+
+    return sum;
+}
+
+/*
+ * Specialized kernels:
+ *   run_kernel() gets stride_elems and elems_per_iter at run time, so the B
+ *   loop pays for generic address arithmetic and loop control on every
+ *   access. For the strides and chunk sizes of configs/cases.csv main()
+ *   dispatches to instances of the same loop with both as constants, and
+ *   the B loop unrolled BENCH_UNROLL times: per B access one load + add plus
+ *   1/BENCH_UNROLL of the loop overhead, the same for every stride.
+ *   Other values fall back to a stride-only instance, then to run_kernel().
+ *   The load addresses and their order are those of run_kernel().
+ *
+ *   benchmark_trace uses run_kernel() unless --specialize yes: the unrolled
+ *   loop has BENCH_UNROLL B load IPs, while the trace tools expect one.
+ */
+#ifndef BENCH_UNROLL
+#define BENCH_UNROLL 8
+#endif
+
+#define BENCH_PRAGMA(x)      _Pragma(#x)
+#define BENCH_UNROLL_LOOP(n) BENCH_PRAGMA(GCC unroll n)
+
+typedef double (*kernel_fn)(double *A, double *B,
+                            size_t A_elems,
+                            size_t B_elems,
+                            size_t elems_per_iter,
+                            size_t stride_elems);
+
+/* run_kernel() body; inlined into the instances below with constant arguments */
+static inline __attribute__((always_inline))
+double run_kernel_fixed(double *A, const double *B,
+                        size_t A_elems,
+                        size_t B_elems,
+                        const size_t elems_per_iter,
+                        const size_t stride_elems)
+{
+    size_t outer_iters = B_elems / elems_per_iter;
+
+    double sum = 0.0;
+
+    for (size_t outer = 0; outer < outer_iters; outer++) {
+        prefetch_chunk(B, outer + BENCH_PREFETCH_DIST, outer_iters, elems_per_iter, stride_elems);
+
+        sum = sweep_A(A, A_elems, sum);
+
+        const double *chunk = B + outer * elems_per_iter * stride_elems;
+
+        BENCH_UNROLL_LOOP(BENCH_UNROLL)
+        for (size_t j = 0; j < elems_per_iter; j++) {
+            sum += chunk[j * stride_elems];
+        }
+    }
+
+    return sum;
+}
+
+/* Instance for stride S and chunk C elements (C = 0: chunk size at run time) */
+#define FIXED_KERNEL(S, C)                                                          \
+    static double run_kernel_s##S##_c##C(double *A, double *B,                      \
+                                         size_t A_elems,                            \
+                                         size_t B_elems,                            \
+                                         size_t elems_per_iter,                     \
+                                         size_t stride_elems)                       \
+    {                                                                               \
+        (void)stride_elems;                                                         \
+        return run_kernel_fixed(A, B, A_elems, B_elems,                             \
+                                (C) ? (size_t)(C) : elems_per_iter, S);             \
+    }
+
+// Chunks of configs/cases.csv: 32 KB and 512 KB
+#define FIXED_KERNELS(S) FIXED_KERNEL(S, 4096) FIXED_KERNEL(S, 65536) FIXED_KERNEL(S, 0)
+FIXED_KERNELS(1)
+FIXED_KERNELS(8)
+FIXED_KERNELS(16)
+FIXED_KERNELS(32)
+FIXED_KERNELS(64)
+
+#define FIXED_ENTRY(S, C) { S, C, run_kernel_s##S##_c##C, "s" #S "_c" #C }
+#define FIXED_ENTRIES(S) FIXED_ENTRY(S, 4096), FIXED_ENTRY(S, 65536), FIXED_ENTRY(S, 0)
+
+static const struct {
+    size_t      stride_elems;
+    size_t      elems_per_iter;  // 0 = any
+    kernel_fn   fn;
+    const char *name;
+} fixed_kernels[] = {
+    FIXED_ENTRIES(1),
+    FIXED_ENTRIES(8),
+    FIXED_ENTRIES(16),
+    FIXED_ENTRIES(32),
+    FIXED_ENTRIES(64),
+};
+
+/* Most specialized kernel for (stride_elems, elems_per_iter), run_kernel() if none */
+static kernel_fn select_kernel(size_t stride_elems, size_t elems_per_iter, const char **name)
+{
+    size_t n = sizeof(fixed_kernels) / sizeof(fixed_kernels[0]);
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t k = 0; k < n; k++) {
+            size_t epi = (pass == 0) ? elems_per_iter : 0;
+            if (fixed_kernels[k].stride_elems == stride_elems &&
+                fixed_kernels[k].elems_per_iter == epi) {
+                *name = fixed_kernels[k].name;
+                return fixed_kernels[k].fn;
+            }
+        }
+    }
+    *name = "generic";
+    return run_kernel;
+}
+
+/*
+ * Pointer chase (access_mode = 2):
+ *   - The B elements the strided mode would load (node k at B[k * stride_elems],
+ *     k < B_elems) form one cycle; each holds the element index of the next
+ *     node, so every load's address depends on the previous load.
+ *   - One run_kernel_chase call takes B_elems steps (elems_per_iter per outer
+ *     iteration, after the A sweep as usual) and ends where it started.
+ *   - Chain order (--chase ORDER):
+ *       random  one random cycle over all nodes (Sattolo's algorithm)
+ *       chunk   chunk by chunk (elems_per_iter nodes each), random inside a
+ *               chunk; each chunk is entered at its first node
+ *       stride  node k -> k + 1: the strided addresses, but serialized
+ */
+enum chase_order {
+    CHASE_RANDOM,
+    CHASE_CHUNK,
+    CHASE_STRIDE,
+};
+
+static const char *const chase_order_names[] = { "random", "chunk", "stride" };
+
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/* Link the nodes of B (viewed as uint64_t) into one cycle. Returns 0, or -1 on malloc failure. */
+static int build_chase(uint64_t *next, size_t nodes, size_t stride, size_t chunk_nodes,
+                       enum chase_order order, uint64_t seed)
+{
+    uint64_t rng = seed;
+
+    switch (order) {
+        case CHASE_RANDOM:
+            // Sattolo on node numbers in place, then scale to element indices
+            for (size_t k = 0; k < nodes; k++) {
+                next[k * stride] = k;
+            }
+            for (size_t i = nodes - 1; i > 0; i--) {
+                size_t j = (size_t)(splitmix64(&rng) % i);
+                uint64_t tmp = next[i * stride];
+                next[i * stride] = next[j * stride];
+                next[j * stride] = tmp;
+            }
+            for (size_t k = 0; k < nodes; k++) {
+                next[k * stride] *= stride;
+            }
+            return 0;
+
+        case CHASE_CHUNK: {
+            uint64_t *perm = malloc(chunk_nodes * sizeof(*perm));
+            if (!perm) {
+                return -1;
+            }
+            size_t chunks = nodes / chunk_nodes;
+            for (size_t c = 0; c < chunks; c++) {
+                for (size_t i = 0; i < chunk_nodes; i++) {
+                    perm[i] = c * chunk_nodes + i;
+                }
+                // Fisher-Yates over perm[1..], so the chunk starts at its first node
+                for (size_t i = chunk_nodes - 1; i > 1; i--) {
+                    size_t j = 1 + (size_t)(splitmix64(&rng) % i);
+                    uint64_t tmp = perm[i];
+                    perm[i] = perm[j];
+                    perm[j] = tmp;
+                }
+                for (size_t i = 0; i + 1 < chunk_nodes; i++) {
+                    next[perm[i] * stride] = perm[i + 1] * stride;
+                }
+                next[perm[chunk_nodes - 1] * stride] = ((c + 1) % chunks) * chunk_nodes * stride;
+            }
+            free(perm);
+            return 0;
+        }
+
+        case CHASE_STRIDE:
+            for (size_t k = 0; k < nodes; k++) {
+                next[k * stride] = ((k + 1) % nodes) * stride;
+            }
+            return 0;
+    }
+    return -1;
+}
+
+static double run_kernel_chase(double *A, const uint64_t *next,
+                               size_t A_elems,
+                               size_t B_elems,
+                               size_t elems_per_iter)
+{
+    size_t outer_iters = B_elems / elems_per_iter;
+
+    double sum = 0.0;
+    uint64_t idx = 0;
+
+    for (size_t outer = 0; outer < outer_iters; outer++) {
+        sum = sweep_A(A, A_elems, sum);
+
+        for (size_t j = 0; j < elems_per_iter; j++) {
+            idx = next[idx];
+        }
+    }
+
+    return sum + (double)idx;
+}
+
+/*
+ * Store modes (access_mode = 3, 4, 5):
+ *   The B chunk geometry of the strided mode (base + j * stride_elems, with
+ *   stride_elems = user_stride), but B is written:
+ *     3 store    B[idx] = value             (RFO + dirty lines / writebacks)
+ *     4 rmw      B[idx] += 1.0              (load + store to the same line)
+ *     5 ntstore  non-temporal 8-byte store  (MOVNTI: write-combining, no RFO)
+ *   The non-temporal store writes exactly one element like the other modes
+ *   (_mm_stream_pd would write two); an sfence ends every run. The A sweep is
+ *   unchanged; BENCH_PREFETCH_DIST is not applied.
  */
-#ifdef TRACE_MODE
-#warning "Compiling with TRACE_MODE: B array is NOT initialized (trace-only build)"
+enum store_mode {
+    STORE_NONE,
+    STORE_PLAIN,
+    STORE_RMW,
+    STORE_NT,
+};
+
+static double run_kernel_store(double *A, double *B,
+                               size_t A_elems,
+                               size_t B_elems,
+                               size_t elems_per_iter,
+                               size_t stride_elems,
+                               enum store_mode mode)
+{
+    size_t outer_iters = B_elems / elems_per_iter;
+
+    double sum = 0.0;
+
+    for (size_t outer = 0; outer < outer_iters; outer++) {
+        sum = sweep_A(A, A_elems, sum);
+
+        size_t base = outer * elems_per_iter * stride_elems;
+        double value = (double)outer;
+
+        if (mode == STORE_PLAIN) {
+            for (size_t j = 0; j < elems_per_iter; j++) {
+                B[base + j * stride_elems] = value;
+            }
+        } else if (mode == STORE_RMW) {
+            for (size_t j = 0; j < elems_per_iter; j++) {
+                B[base + j * stride_elems] += 1.0;
+            }
+        } else {
+#if defined(__x86_64__)
+            long long bits;
+            memcpy(&bits, &value, sizeof(bits));
+            for (size_t j = 0; j < elems_per_iter; j++) {
+                _mm_stream_si64((long long *)&B[base + j * stride_elems], bits);
+            }
+#endif
+        }
+    }
+#if defined(__x86_64__)
+    if (mode == STORE_NT) {
+        _mm_sfence();
+    }
 #endif
 
-// Global sink to prevent the compiler from optimizing the kernel away.
-static volatile double sink = 0.0;
+    return sum;
+}
 
 /*
- * Initialize an array with simple increasing values so that the compiler
- * cannot easily optimize away the loads.
+ * Software wrong-path access (--wp load|prefetch):
+ *   The native counterpart of tools/trace_insert_all_iters. In every
+ *   `every`-th outer iteration the A sweep is split at a_pos, and the first
+ *   b_ratio of a B chunk is touched there, ahead of its demand loads:
+ *     insert_at = (size_t)(A_elems * a_pos)
+ *     wp_len    = (size_t)(elems_per_iter * b_ratio), at least 1
+ *   The chunk is the one that follows this A sweep (the chunk the surgery
+ *   tools copy), or `ahead` chunks further with --wp-ahead.
+ *   kind load issues real loads (into their own accumulator, so they do not
+ *   lengthen the A chain), kind prefetch issues __builtin_prefetch instead.
+ *   Demand loads are those of run_kernel(); every = 0 disables the insertion.
  */
-static void init_array(double *p, size_t n, double base)
+enum wp_kind {
+    WP_NONE,
+    WP_LOAD,
+    WP_PREFETCH,
+};
+
+struct wp_config {
+    enum wp_kind kind;
+    double a_pos;
+    double b_ratio;
+    size_t every;
+    size_t ahead;
+};
+
+static double run_kernel_wp(double *A, double *B,
+                            size_t A_elems,
+                            size_t B_elems,
+                            size_t elems_per_iter,
+                            size_t stride_elems,
+                            const struct wp_config *wp)
 {
-    for (size_t i = 0; i < n; i++) {
-        p[i] = base + (double)i * 0.000001;
+    size_t outer_iters = B_elems / elems_per_iter;
+    size_t insert_at   = (size_t)((double)A_elems * wp->a_pos);
+    size_t wp_len      = (size_t)((double)elems_per_iter * wp->b_ratio);
+    if (wp_len == 0) {
+        wp_len = 1;
+    }
+
+    double sum = 0.0;
+    double wp_sum = 0.0;
+
+    for (size_t outer = 0; outer < outer_iters; outer++) {
+        size_t wp_chunk = outer + wp->ahead;
+
+        if (wp->every > 0 && outer % wp->every == 0 && wp_chunk < outer_iters) {
+            sum = sweep_A(A, insert_at, sum);
+
+            size_t wp_base = wp_chunk * elems_per_iter * stride_elems;
+            if (wp->kind == WP_LOAD) {
+                for (size_t j = 0; j < wp_len; j++) {
+                    wp_sum += B[wp_base + j * stride_elems];
+                }
+            } else {
+                for (size_t j = 0; j < wp_len; j++) {
+                    __builtin_prefetch(&B[wp_base + j * stride_elems], 0, 3);
+                }
+            }
+
+            sum = sweep_A(A + insert_at, A_elems - insert_at, sum);
+        } else {
+            sum = sweep_A(A, A_elems, sum);
+        }
+
+        size_t base = outer * elems_per_iter * stride_elems;
+
+        for (size_t j = 0; j < elems_per_iter; j++) {
+            size_t idx = base + j * stride_elems;
+            sum += B[idx];
+        }
     }
+
+    return sum + wp_sum;
 }
 
 /*
- * Kernel:
- *   - outer_iters = B_elems / elems_per_iter (fixed for given B_bytes, chunk_bytes)
- *   - For each outer iteration:
- *       1) Sweep entire A once (intended to disturb / thrash L1).
- *       2) Access one "chunk" of B, consisting of elems_per_iter elements,
- *          using the given stride_elems.
- *
- *   Logical B coverage:
- *     base index for this chunk = outer * elems_per_iter * stride_elems
- *     then we access:
- *       B[base + 0 * stride_elems],
- *       B[base + 1 * stride_elems],
- *       ...
- *       B[base + (elems_per_iter - 1) * stride_elems]
- *
- *   - If stride_elems = 1 (dense), we simply sweep B in order.
- *   - If stride_elems > 1 (strided), we jump by that stride within each chunk.
+ * run_kernel() with a sample every sample_every outer iterations (--sample).
+ * The loop body is a copy of run_kernel()'s, which itself stays untouched so
+ * that the traced instruction stream of the normal build does not change.
  */
-static double run_kernel(double *A, double *B,
-                         size_t A_elems,
-                         size_t B_elems,      // logical B size when stride=1
-                         size_t elems_per_iter,
-                         size_t stride_elems)
+static double run_kernel_sampled(double *A, double *B,
+                                 size_t A_elems,
+                                 size_t B_elems,
+                                 size_t elems_per_iter,
+                                 size_t stride_elems,
+                                 size_t sample_every,
+                                 struct sampler *sp,
+                                 size_t rep)
 {
-    // Number of outer-loop iterations (independent of stride)
     size_t outer_iters = B_elems / elems_per_iter;
 
     double sum = 0.0;
 
     for (size_t outer = 0; outer < outer_iters; outer++) {
-        // 1) Sweep entire A to disturb / thrash L1
-        for (size_t i = 0; i < A_elems; i++) {
-            sum += A[i];
-        }
+        prefetch_chunk(B, outer + BENCH_PREFETCH_DIST, outer_iters, elems_per_iter, stride_elems);
+
+        sum = sweep_A(A, A_elems, sum);
 
-        // 2) Access one chunk of B
         size_t base = outer * elems_per_iter * stride_elems;
 
         for (size_t j = 0; j < elems_per_iter; j++) {
             size_t idx = base + j * stride_elems;
             sum += B[idx];
         }
+
+        if ((outer + 1) % sample_every == 0 || outer + 1 == outer_iters) {
+            sampler_take(sp, rep, outer + 1);
+        }
     }
 
     return sum;
 }
 
+/*
+ * Multi-threaded mode (--threads N):
+ *   - Every thread is pinned to its own CPU (the i-th CPU of the process
+ *     affinity mask), allocates and first-touches its own A and B, so the
+ *     pages land on the thread's local node.
+ *   - With --shared-b, thread 0 allocates and first-touches one B that every
+ *     thread reads (LLC / DRAM sharing); A stays private.
+ *   - All threads wait on a barrier after setup and then run the same
+ *     run_kernel loop; each times its own loop, and the aggregate bandwidth
+ *     uses the span from the first start to the last finish.
+ *   - With --pmu every thread counts its own group (pmu_open counts the
+ *     calling thread) and the summary sums them.
+ */
+struct bench_config {
+    size_t A_elems;
+    size_t B_elems;
+    size_t B_elems_alloc;
+    size_t elems_per_iter;
+    size_t stride_elems;
+    size_t outer_scale;
+    int    use_pmu;
+    const struct numa_policy *a_numa;
+    const struct numa_policy *b_numa;
+    enum page_mode b_pages;
+    int    chase;                    // access_mode 2: B holds a chase chain
+    enum store_mode store;           // access_mode 3..5
+    enum chase_order chase_order;
+    uint64_t chase_seed;
+    const struct wp_config *wp;
+    kernel_fn kernel;                // run_kernel() or a specialized instance
+    enum b_fill b_fill;
+    int    init_threads;             // for the shared B
+};
+
+struct bench_thread {
+    pthread_t tid;
+    int       id;
+    int       cpu;                   // -1 = not pinned
+    unsigned  node;                  // NUMA node of the CPU
+    const struct bench_config *cfg;
+    pthread_barrier_t *ready;
+    double  **shared_B;              // non-NULL in --shared-b mode (set by thread 0)
+
+    // Results
+    double   *A;
+    double   *B;
+    double    sum;
+    struct timespec start;
+    struct timespec end;
+    struct pmu_counters pmu;
+    int       have_pmu;
+    int       err;
+};
+
+static double ts_diff(const struct timespec *a, const struct timespec *b)
+{
+    return (double)(b->tv_sec - a->tv_sec) + 1e-9 * (double)(b->tv_nsec - a->tv_nsec);
+}
+
+static void *bench_thread_main(void *arg)
+{
+    struct bench_thread *t = arg;
+    const struct bench_config *cfg = t->cfg;
+
+    if (t->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(t->cpu, &set);
+        int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (rc != 0) {
+            fprintf(stderr, "thread %d: pinning to CPU %d failed: %s\n", t->id, t->cpu, strerror(rc));
+        }
+    }
+
+    // Allocate and first-touch after pinning, so the pages are local
+    // (or placed by --a-node / --b-node relative to this thread's node)
+    char desc[128];
+    t->node = numa_current_node();
+    t->A = alloc_array(cfg->A_elems, cfg->a_numa, PAGES_MALLOC, 0, desc, sizeof(desc));
+    if (!t->shared_B || t->id == 0) {
+        t->B = alloc_array(cfg->B_elems_alloc, cfg->b_numa, cfg->b_pages,
+                           cfg->b_fill == FILL_POPULATE, desc, sizeof(desc));
+    }
+    if (!t->A || (!t->B && (!t->shared_B || t->id == 0))) {
+        fprintf(stderr, "thread %d: malloc failed\n", t->id);
+        t->err = 1;
+    } else {
+        init_array(t->A, cfg->A_elems, 1.0);
+        // With --shared-b only thread 0 has B here; it may use init threads for it
+        if (t->B) {
+            fill_array(t->B, cfg->B_elems_alloc, 1000.0, cfg->b_fill, t->shared_B ? cfg->init_threads : 1);
+        }
+        if (cfg->chase && t->B &&
+            build_chase((uint64_t *)t->B, cfg->B_elems, cfg->stride_elems,
+                        cfg->elems_per_iter, cfg->chase_order, cfg->chase_seed + (uint64_t)t->id) != 0) {
+            fprintf(stderr, "thread %d: malloc failed\n", t->id);
+            t->err = 1;
+        }
+    }
+    if (t->shared_B && t->id == 0) {
+        *t->shared_B = t->B;
+    }
+    if (!t->err && cfg->use_pmu) {
+        t->have_pmu = (pmu_open(&t->pmu) == 0);
+        t->err = !t->have_pmu;
+    }
+
+    pthread_barrier_wait(t->ready);
+
+    if (t->shared_B && t->id != 0) {
+        t->B = *t->shared_B;
+    }
+    if (t->err || !t->B) {
+        t->err = 1;
+        return NULL;
+    }
+
+    if (t->have_pmu) {
+        pmu_start(&t->pmu);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+
+    double sum = 0.0;
+    for (size_t rep = 0; rep < cfg->outer_scale; rep++) {
+        if (cfg->chase) {
+            sum += run_kernel_chase(t->A, (const uint64_t *)t->B,
+                                    cfg->A_elems,
+                                    cfg->B_elems,
+                                    cfg->elems_per_iter);
+            continue;
+        }
+        if (cfg->store != STORE_NONE) {
+            sum += run_kernel_store(t->A, t->B,
+                                    cfg->A_elems,
+                                    cfg->B_elems,
+                                    cfg->elems_per_iter,
+                                    cfg->stride_elems,
+                                    cfg->store);
+            continue;
+        }
+        if (cfg->wp->kind != WP_NONE) {
+            sum += run_kernel_wp(t->A, t->B,
+                                 cfg->A_elems,
+                                 cfg->B_elems,
+                                 cfg->elems_per_iter,
+                                 cfg->stride_elems,
+                                 cfg->wp);
+            continue;
+        }
+        sum += cfg->kernel(t->A, t->B,
+                          cfg->A_elems,
+                          cfg->B_elems,
+                          cfg->elems_per_iter,
+                          cfg->stride_elems);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t->end);
+    if (t->have_pmu) {
+        t->err = (pmu_stop(&t->pmu) != 0);
+        pmu_close(&t->pmu);
+    }
+    t->sum = sum;
+    return NULL;
+}
+
+/*
+ * Run the kernel on nthreads pinned threads and print per-thread and
+ * aggregate bandwidth / IPC. Returns the process exit code.
+ */
+static int run_threads(const struct bench_config *cfg, int nthreads, int shared_b)
+{
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) {
+                cpus[ncpus++] = c;
+            }
+        }
+    }
+    if (ncpus > 0 && nthreads > ncpus) {
+        fprintf(stderr, "# threads: %d threads on %d allowed CPUs, CPUs are shared\n", nthreads, ncpus);
+    }
+
+    struct bench_thread *threads = calloc((size_t)nthreads, sizeof(*threads));
+    pthread_barrier_t ready;
+    double *shared_B = NULL;
+    if (!threads || pthread_barrier_init(&ready, NULL, (unsigned)nthreads) != 0) {
+        fprintf(stderr, "thread setup failed\n");
+        free(threads);
+        return 1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < nthreads; i++) {
+        struct bench_thread *t = &threads[i];
+        t->id       = i;
+        t->cpu      = (ncpus > 0) ? cpus[i % ncpus] : -1;
+        t->cfg      = cfg;
+        t->ready    = &ready;
+        t->shared_B = shared_b ? &shared_B : NULL;
+        int rc = pthread_create(&t->tid, NULL, bench_thread_main, t);
+        if (rc != 0) {
+            // The barrier counts nthreads, so the others would wait forever
+            fprintf(stderr, "pthread_create failed: %s\n", strerror(rc));
+            exit(1);
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i].tid, NULL);
+    }
+    pthread_barrier_destroy(&ready);
+
+    /*
+     * Bytes per thread and run_kernel call:
+     *   loaded = outer_iters * (A_elems + elems_per_iter) * sizeof(double)
+     *   B lines = distinct 64B lines of B touched (B_elems lines once the stride
+     *             reaches a line), i.e. the DRAM traffic when B does not fit in cache
+     */
+    size_t outer_iters  = cfg->B_elems / cfg->elems_per_iter;
+    double loaded_bytes = (double)cfg->outer_scale * (double)outer_iters *
+                          (double)(cfg->A_elems + cfg->elems_per_iter) * sizeof(double);
+    size_t span_bytes   = cfg->stride_elems * sizeof(double);
+    double b_line_bytes = (double)cfg->outer_scale * (double)cfg->B_elems *
+                          (span_bytes >= 64 ? 64.0 : (double)span_bytes);
+
+    int err = 0;
+    double sum = 0.0;
+    struct timespec first = {0, 0}, last = {0, 0};
+    struct pmu_counters total;
+    memset(&total, 0, sizeof(total));
+    int have_total = cfg->use_pmu;
+
+    printf("# Threads: %d (%s B)\n", nthreads, shared_b ? "shared" : "private");
+    printf("thread,cpu,node,A,B,seconds,load_GBps,B_line_GBps,cycles,instructions,IPC\n");
+    for (int i = 0; i < nthreads; i++) {
+        struct bench_thread *t = &threads[i];
+        if (t->err) {
+            err = 1;
+            continue;
+        }
+        double sec = ts_diff(&t->start, &t->end);
+        if (i == 0 || ts_diff(&t->start, &first) > 0) {
+            first = t->start;
+        }
+        if (i == 0 || ts_diff(&last, &t->end) > 0) {
+            last = t->end;
+        }
+        sum += t->sum;
+
+        printf("%d,%d,%u,%p,%p,%.6f,%.3f,%.3f", t->id, t->cpu, t->node, (void *)t->A, (void *)t->B, sec,
+               loaded_bytes / sec * 1e-9, b_line_bytes / sec * 1e-9);
+        if (t->have_pmu && t->pmu.have[PMU_CYCLES] && t->pmu.value[PMU_CYCLES] > 0) {
+            printf(",%llu,%llu,%.3f\n", (unsigned long long)t->pmu.value[PMU_CYCLES],
+                   (unsigned long long)t->pmu.value[PMU_INSTRUCTIONS],
+                   (double)t->pmu.value[PMU_INSTRUCTIONS] / (double)t->pmu.value[PMU_CYCLES]);
+        } else {
+            printf(",,,\n");
+        }
+
+        if (t->have_pmu) {
+            for (int e = 0; e < PMU_N_EVENTS; e++) {
+                if (i == 0) {
+                    total.have[e] = t->pmu.have[e];
+                }
+                total.have[e] &= t->pmu.have[e];
+                total.value[e] += t->pmu.value[e];
+            }
+            total.time_enabled += t->pmu.time_enabled;
+            total.time_running += t->pmu.time_running;
+        } else {
+            have_total = 0;
+        }
+    }
+
+    if (!err) {
+        double wall = ts_diff(&first, &last);
+        printf("# Aggregate: wall=%.6f s  load=%.3f GB/s  B_line=%.3f GB/s",
+               wall, nthreads * loaded_bytes / wall * 1e-9, nthreads * b_line_bytes / wall * 1e-9);
+        if (have_total && total.have[PMU_CYCLES] && total.value[PMU_CYCLES] > 0) {
+            printf("  IPC(sum insts / sum cycles)=%.3f",
+                   (double)total.value[PMU_INSTRUCTIONS] / (double)total.value[PMU_CYCLES]);
+        }
+        printf("\n");
+        if (have_total) {
+            pmu_print(&total);
+        }
+    }
+
+    // Prevent the compiler from optimizing away the whole computation.
+    sink = sum;
+    BENCH_PRINTF("sum = %.6f\n", sum);
+
+    for (int i = 0; i < nthreads; i++) {
+        free_array(threads[i].A, cfg->A_elems, cfg->a_numa, PAGES_MALLOC);
+        if (!shared_b || i == 0) {
+            free_array(threads[i].B, cfg->B_elems_alloc, cfg->b_numa, cfg->b_pages);
+        }
+    }
+    free(threads);
+    return err;
+}
+
 int main(int argc, char **argv)
 {
+    const char *prog = argv[0];
+    int use_pmu = 0;
+    size_t sample_every = 0;        // 0 = no time series
+    size_t sample_cap = 65536;
+    const char *sample_out = NULL;  // NULL = stdout
+    int nthreads = 0;               // 0 = single-threaded (original path)
+    int shared_b = 0;
+    struct numa_policy a_numa, b_numa;  // kind NUMA_DEFAULT = malloc
+    memset(&a_numa, 0, sizeof(a_numa));
+    memset(&b_numa, 0, sizeof(b_numa));
+    enum page_mode b_pages = PAGES_MALLOC;
+    enum chase_order chase_order = CHASE_RANDOM;
+    uint64_t chase_seed = 1;
+    struct wp_config wp = { WP_NONE, 0.5, 1.0, 1, 0 };
+#ifndef TRACE_MODE
+    int specialize = 1;             // dispatch to a fixed stride / chunk kernel
+    enum b_fill b_fill = FILL_VALUES;
+#else
+    int specialize = 0;             // keep the single B load IP the trace tools expect
+    enum b_fill b_fill = FILL_NONE;
+#endif
+    int init_threads = 1;
+
+    static struct option long_options[] = {
+        {"pmu",        no_argument,       0, 'p'},
+        {"sample",     required_argument, 0, 's'},
+        {"sample-cap", required_argument, 0, 'c'},
+        {"sample-out", required_argument, 0, 'o'},
+        {"threads",    required_argument, 0, 't'},
+        {"shared-b",   no_argument,       0, 'S'},
+        {"a-node",     required_argument, 0, 'A'},
+        {"b-node",     required_argument, 0, 'B'},
+        {"b-alloc",    required_argument, 0, 'H'},
+        {"chase",      required_argument, 0, 'C'},
+        {"seed",       required_argument, 0, 'R'},
+        {"wp",         required_argument, 0, 'W'},
+        {"a-pos",      required_argument, 0, 'a'},
+        {"b-ratio",    required_argument, 0, 'b'},
+        {"every",      required_argument, 0, 'e'},
+        {"wp-ahead",   required_argument, 0, 'w'},
+        {"specialize", required_argument, 0, 'k'},
+        {"b-fill",     required_argument, 0, 'f'},
+        {"init-threads", required_argument, 0, 'i'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                use_pmu = 1;
+                break;
+            case 's':
+                sample_every = strtoull(optarg, NULL, 0);
+                break;
+            case 'c':
+                sample_cap = strtoull(optarg, NULL, 0);
+                break;
+            case 'o':
+                sample_out = optarg;
+                break;
+            case 't':
+                nthreads = atoi(optarg);
+                if (nthreads < 1) {
+                    fprintf(stderr, "--threads must be >= 1\n");
+                    return 1;
+                }
+                break;
+            case 'S':
+                shared_b = 1;
+                break;
+            case 'A':
+            case 'B':
+                if (numa_parse(optarg, (opt == 'A') ? &a_numa : &b_numa) != 0) {
+                    fprintf(stderr, "bad NUMA spec '%s' (N, local, remote, interleave[:LIST])\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'H':
+                for (b_pages = PAGES_MALLOC; b_pages <= PAGES_HUGETLB_1G; b_pages++) {
+                    if (strcmp(optarg, page_mode_names[b_pages]) == 0) {
+                        break;
+                    }
+                }
+                if (b_pages > PAGES_HUGETLB_1G) {
+                    fprintf(stderr, "bad --b-alloc '%s' (malloc, thp, 2m, 1g)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'C':
+                for (chase_order = CHASE_RANDOM; chase_order <= CHASE_STRIDE; chase_order++) {
+                    if (strcmp(optarg, chase_order_names[chase_order]) == 0) {
+                        break;
+                    }
+                }
+                if (chase_order > CHASE_STRIDE) {
+                    fprintf(stderr, "bad --chase '%s' (random, chunk, stride)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'R':
+                chase_seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'W':
+                if (strcmp(optarg, "load") == 0) {
+                    wp.kind = WP_LOAD;
+                } else if (strcmp(optarg, "prefetch") == 0) {
+                    wp.kind = WP_PREFETCH;
+                } else {
+                    fprintf(stderr, "bad --wp '%s' (load, prefetch)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'a':
+                wp.a_pos = strtod(optarg, NULL);
+                break;
+            case 'b':
+                wp.b_ratio = strtod(optarg, NULL);
+                break;
+            case 'e':
+                wp.every = strtoull(optarg, NULL, 0);
+                break;
+            case 'w':
+                wp.ahead = strtoull(optarg, NULL, 0);
+                break;
+            case 'k':
+                if (strcmp(optarg, "yes") != 0 && strcmp(optarg, "no") != 0) {
+                    fprintf(stderr, "bad --specialize '%s' (yes, no)\n", optarg);
+                    return 1;
+                }
+                specialize = (strcmp(optarg, "yes") == 0);
+                break;
+            case 'f':
+                for (b_fill = FILL_VALUES; b_fill <= FILL_NONE; b_fill++) {
+                    if (strcmp(optarg, b_fill_names[b_fill]) == 0) {
+                        break;
+                    }
+                }
+                if (b_fill > FILL_NONE) {
+                    fprintf(stderr, "bad --b-fill '%s' (values, touch, populate, none)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'i':
+                init_threads = atoi(optarg);
+                if (init_threads < 1) {
+                    fprintf(stderr, "--init-threads must be >= 1\n");
+                    return 1;
+                }
+                break;
+            default:
+                argc = 0;  // print usage below
+                break;
+        }
+    }
+    // Positional arguments keep their historical indices argv[1..6]
+    argc -= optind - 1;
+    argv += optind - 1;
+
     if (argc < 4) {
         fprintf(stderr,
-            "Usage: %s A_bytes B_bytes chunk_bytes [access_mode] [stride_elems] [outer_scale]\n"
-            "  access_mode : 0=dense, 1=strided (default=0)\n"
-            "  stride_elems: used only when access_mode=1, but also controls B allocation (default=8)\n"
-            "  outer_scale : repeat run_kernel this many times (default=1)\n",
-            argv[0]);
+            "Usage: %s [--pmu] [--sample N [--sample-cap M] [--sample-out FILE]]\n"
+            "       [--threads N [--shared-b]] [--a-node SPEC] [--b-node SPEC]\n"
+            "       [--b-alloc malloc|thp|2m|1g] [--chase random|chunk|stride] [--seed N]\n"
+            "       [--wp load|prefetch [--a-pos R] [--b-ratio R] [--every N] [--wp-ahead K]]\n"
+            "       [--specialize yes|no] [--b-fill values|touch|populate|none] [--init-threads N]\n"
+            "       A_bytes B_bytes chunk_bytes [access_mode] [stride_elems] [outer_scale]\n"
+            "  access_mode : 0=dense, 1=strided, 2=pointer chase, 3=store, 4=read-modify-write,\n"
+            "                5=non-temporal store (default=0)\n"
+            "  stride_elems: used when access_mode>=1 (node spacing for 2), but also controls\n"
+            "                B allocation (default=8)\n"
+            "  outer_scale : repeat run_kernel this many times (default=1)\n"
+            "  --pmu       : count cycles / instructions / L1D, L2 misses / DRAM fills with\n"
+            "                perf_event_open around the run_kernel loop only, and print\n"
+            "                IPC / MPKI / DRAM PKI (same format as scripts/run_perf_mpki.py)\n"
+            "  --sample N  : every N outer iterations, record rdtsc and the counters (rdpmc)\n"
+            "                into a ring buffer of M samples (default 65536); dumped as CSV\n"
+            "                after the run to FILE (default: stdout)\n"
+            "  --threads N : run the kernel on N pinned threads, each with its own A and B\n"
+            "                (first-touched by the thread), started together behind a barrier;\n"
+            "                prints per-thread and aggregate bandwidth (and IPC with --pmu)\n"
+            "  --shared-b  : with --threads, all threads read one B (private A each)\n"
+            "  --a-node / --b-node SPEC : NUMA placement of A / B (mbind before first touch)\n"
+            "                N | local | remote | interleave | interleave:LIST (e.g. 0-1,3)\n"
+            "  --b-alloc   : page backing of B: malloc (default), thp (2MB-aligned +\n"
+            "                MADV_HUGEPAGE), 2m / 1g (MAP_HUGETLB, needs reserved huge pages)\n"
+            "  --chase     : chain order for access_mode=2: random (default), chunk (random\n"
+            "                inside each chunk), stride (in address order); --seed N for random\n"
+            "  --wp        : wrong-path emulation: in every N-th outer iteration (default 1), at\n"
+            "                a_pos (default 0.5) of the A sweep, load / prefetch the first\n"
+            "                b_ratio (default 1.0) of the next B chunk (K chunks further with\n"
+            "                --wp-ahead), like tools/trace_insert_all_iters\n"
+            "  --specialize: use a kernel instance with constant stride / chunk (strides\n"
+            "                1,8,16,32,64; chunks 32KB,512KB) when one exists (default: yes,\n"
+            "                no in benchmark_trace)\n"
+            "  --b-fill    : first touch of B: values (init_array, default), touch (one write\n"
+            "                per page), populate (MAP_POPULATE / MADV_POPULATE_WRITE), none\n"
+            "                (default in benchmark_trace)\n"
+            "  --init-threads N : split values / touch of B over N threads on this node\n",
+            prog);
+        return 1;
+    }
+    if (sample_cap < 2) {
+        fprintf(stderr, "--sample-cap must be >= 2\n");
+        return 1;
+    }
+    if (nthreads > 0 && sample_every > 0) {
+        fprintf(stderr, "--sample is not supported with --threads\n");
+        return 1;
+    }
+    if (wp.kind != WP_NONE) {
+        if (wp.a_pos < 0.0 || wp.a_pos > 1.0) {
+            fprintf(stderr, "--a-pos (%.4f) must be in range [0.0, 1.0]\n", wp.a_pos);
+            return 1;
+        }
+        if (wp.b_ratio <= 0.0 || wp.b_ratio > 1.0) {
+            fprintf(stderr, "--b-ratio (%.4f) must be in range (0.0, 1.0]\n", wp.b_ratio);
+            return 1;
+        }
+        if (sample_every > 0) {
+            fprintf(stderr, "--sample is not supported with --wp\n");
+            return 1;
+        }
+    }
+    if (shared_b && nthreads == 0) {
+        fprintf(stderr, "--shared-b needs --threads\n");
         return 1;
     }
 
@@ -109,12 +2099,22 @@ int main(int argc, char **argv)
     size_t B_bytes     = strtoull(argv[2], NULL, 0);
     size_t chunk_bytes = strtoull(argv[3], NULL, 0);
 
-    int    access_mode = 0;  // 0 = dense, 1 = strided
+    int    access_mode = 0;  // 0 = dense, 1 = strided, 2 = pointer chase, 3..5 = stores
     size_t user_stride = 8;  // also used to size the B allocation
     size_t outer_scale = 1;  // how many times to call run_kernel
 
     if (argc >= 5) {
-        access_mode = atoi(argv[4]);  // 0 or 1
+        access_mode = atoi(argv[4]);  // 0..5
+        if (access_mode < 0 || access_mode > 5) {
+            fprintf(stderr, "access_mode must be 0..5\n");
+            return 1;
+        }
+#if !defined(__x86_64__)
+        if (access_mode == 5) {
+            fprintf(stderr, "access_mode=5 (non-temporal store) needs x86-64\n");
+            return 1;
+        }
+#endif
     }
     if (argc >= 6) {
         user_stride = strtoull(argv[5], NULL, 0);
@@ -131,6 +2131,14 @@ int main(int argc, char **argv)
         }
     }
 
+    if (access_mode >= 2 && (sample_every > 0 || wp.kind != WP_NONE)) {
+        fprintf(stderr, "--sample / --wp are not supported with access_mode=%d\n", access_mode);
+        return 1;
+    }
+    enum store_mode store = (access_mode == 3) ? STORE_PLAIN :
+                            (access_mode == 4) ? STORE_RMW   :
+                            (access_mode == 5) ? STORE_NT    : STORE_NONE;
+
     // Treat dense mode as stride=1 inside the kernel (no branch inside run_kernel).
     size_t stride_elems = (access_mode == 0) ? 1 : user_stride;
 
@@ -187,7 +2195,27 @@ int main(int argc, char **argv)
     BENCH_PRINTF("#   B_elems        = %zu\n", B_elems);
     BENCH_PRINTF("#   B_elems_alloc  = %zu  (allocated)\n", B_elems_alloc);
     BENCH_PRINTF("#   elems_per_iter = %zu\n", elems_per_iter);
-    BENCH_PRINTF("#   access_mode    = %d (0=dense,1=strided)\n", access_mode);
+    BENCH_PRINTF("#   access_mode    = %d (0=dense,1=strided,2=chase,3=store,4=rmw,5=ntstore)\n",
+                 access_mode);
+    BENCH_PRINTF("#   kernel         = %s, prefetch_dist = %d chunks (compile time)\n",
+                 BENCH_KERNEL_NAME, BENCH_PREFETCH_DIST);
+    const char *kernel_name = "generic";
+    kernel_fn kernel = run_kernel;
+    if (specialize) {
+        kernel = select_kernel(stride_elems, elems_per_iter, &kernel_name);
+    }
+    if (access_mode <= 1 && wp.kind == WP_NONE && sample_every == 0) {
+        BENCH_PRINTF("#   kernel_instance = %s\n", kernel_name);
+    }
+    if (wp.kind != WP_NONE) {
+        BENCH_PRINTF("#   wrong_path     = %s, a_pos=%.4f, b_ratio=%.4f, every=%zu, ahead=%zu\n",
+                     (wp.kind == WP_LOAD) ? "load" : "prefetch",
+                     wp.a_pos, wp.b_ratio, wp.every, wp.ahead);
+    }
+    if (access_mode == 2) {
+        BENCH_PRINTF("#   chase_order    = %s (seed %llu)\n", chase_order_names[chase_order],
+                     (unsigned long long)chase_seed);
+    }
     BENCH_PRINTF("#   user_stride    = %zu (for allocation)\n", user_stride);
     BENCH_PRINTF("#   stride_elems   = %zu (effective in kernel)\n", stride_elems);
     BENCH_PRINTF("#   base_outer_iters = %zu (per run_kernel)\n", base_outer_iters);
@@ -199,23 +2227,112 @@ int main(int argc, char **argv)
     BENCH_PRINTF("#   TRACE_MODE: B is not initialized (values arbitrary, address pattern only)\n");
 #endif
 
-    double *A = (double *)malloc(sizeof(double) * A_elems);
-    double *B = (double *)malloc(sizeof(double) * B_elems_alloc);
+    if (nthreads > 0) {
+        BENCH_PRINTF("#   threads          = %d (%s B)\n", nthreads, shared_b ? "shared" : "private");
+        if (a_numa.kind != NUMA_DEFAULT || b_numa.kind != NUMA_DEFAULT) {
+            BENCH_PRINTF("#   numa             = --a-node / --b-node resolved per thread\n");
+        }
+        struct bench_config cfg = {
+            .A_elems        = A_elems,
+            .B_elems        = B_elems,
+            .B_elems_alloc  = B_elems_alloc,
+            .elems_per_iter = elems_per_iter,
+            .stride_elems   = stride_elems,
+            .outer_scale    = outer_scale,
+            .use_pmu        = use_pmu,
+            .a_numa         = &a_numa,
+            .b_numa         = &b_numa,
+            .b_pages        = b_pages,
+            .chase          = (access_mode == 2),
+            .store          = store,
+            .chase_order    = chase_order,
+            .chase_seed     = chase_seed,
+            .wp             = &wp,
+            .kernel         = kernel,
+            .b_fill         = (access_mode == 2 && b_fill == FILL_VALUES) ? FILL_NONE : b_fill,
+            .init_threads   = init_threads,
+        };
+        return run_threads(&cfg, nthreads, shared_b);
+    }
+
+    /*
+     * local / remote refer to the node we run on now; stay on this CPU so the
+     * placement keeps meaning what it says.
+     */
+#ifdef __linux__
+    if (a_numa.kind == NUMA_LOCAL || a_numa.kind == NUMA_REMOTE ||
+        b_numa.kind == NUMA_LOCAL || b_numa.kind == NUMA_REMOTE) {
+        int cpu = sched_getcpu();
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (cpu < 0 || sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "pinning to the current CPU failed: %s\n", strerror(errno));
+            return 1;
+        }
+        BENCH_PRINTF("#   pinned_cpu     = %d (node %u)\n", cpu, numa_current_node());
+    }
+#endif
+
+    char A_numa_desc[128], B_numa_desc[128];
+    double *A = alloc_array(A_elems, &a_numa, PAGES_MALLOC, 0, A_numa_desc, sizeof(A_numa_desc));
+    double *B = alloc_array(B_elems_alloc, &b_numa, b_pages, b_fill == FILL_POPULATE,
+                            B_numa_desc, sizeof(B_numa_desc));
     if (!A || !B) {
-        fprintf(stderr, "malloc failed\n");
-        free(A);
-        free(B);
+        fprintf(stderr, "allocation of A / B failed\n");
+        if (A) {
+            free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+        }
+        if (B) {
+            free_array(B, B_elems_alloc, &b_numa, b_pages);
+        }
         return 1;
     }
+    BENCH_PRINTF("#   A_numa         = %s\n", A_numa_desc);
+    BENCH_PRINTF("#   B_numa         = %s\n", B_numa_desc);
+    BENCH_PRINTF("#   B_alloc        = %s\n", page_mode_names[b_pages]);
 
-#ifndef TRACE_MODE
-    // Normal build: initialize both A and B for correct numeric behavior / perf.
-    init_array(A, A_elems, 1.0);
-    init_array(B, B_elems_alloc, 1000.0);
-#else
-    // Trace-only build: only A is initialized; B is left as-is.
     init_array(A, A_elems, 1.0);
-#endif
+
+    /*
+     * B: values in the normal build, left as-is in the trace-only build
+     * unless --b-fill says otherwise. The chase chain below is B's content,
+     * so values are skipped for it.
+     */
+    {
+        enum b_fill fill = (access_mode == 2 && b_fill == FILL_VALUES) ? FILL_NONE : b_fill;
+        struct timespec f_start, f_end;
+        clock_gettime(CLOCK_MONOTONIC, &f_start);
+        fill_array(B, B_elems_alloc, 1000.0, fill, init_threads);
+        clock_gettime(CLOCK_MONOTONIC, &f_end);
+        BENCH_PRINTF("#   B_fill         = %s, %d thread(s), %.3f s\n",
+                     b_fill_names[fill], init_threads, ts_diff(&f_start, &f_end));
+    }
+
+    // The chase chain is B's content, so it is built in TRACE_MODE as well
+    if (access_mode == 2 &&
+        build_chase((uint64_t *)B, B_elems, stride_elems, elems_per_iter, chase_order, chase_seed) != 0) {
+        fprintf(stderr, "malloc failed\n");
+        free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+        free_array(B, B_elems_alloc, &b_numa, b_pages);
+        return 1;
+    }
+
+    // Page size B really got (after the first touch; B is untouched in TRACE_MODE)
+    {
+        char page_desc[160];
+        smaps_page_size(B, sizeof(double) * B_elems_alloc, page_desc, sizeof(page_desc));
+        BENCH_PRINTF("#   B_page_size    = %s\n", page_desc);
+    }
+
+    // Where the pages really went (only B pages touched so far are counted in TRACE_MODE)
+    if (a_numa.kind != NUMA_DEFAULT || b_numa.kind != NUMA_DEFAULT) {
+        char pages[256];
+        numa_page_nodes(A, A_elems, pages, sizeof(pages));
+        BENCH_PRINTF("#   A_pages        = %s\n", pages);
+        numa_page_nodes(B, B_elems_alloc, pages, sizeof(pages));
+        BENCH_PRINTF("#   B_pages        = %s\n", pages);
+    }
 
     // Print pointer values for trace analysis (Phase 2: find_b_accesses)
     // Always print these, even in TRACE_MODE, since they are essential for trace analysis.
@@ -223,24 +2340,163 @@ int main(int argc, char **argv)
     printf("#   B=%p\n", (void*)B);
     printf("#   B_alloc_bytes = %zu\n", sizeof(double) * B_elems_alloc);
 
+    /*
+     * The sampler reads the same counter group. Without a usable PMU (or user
+     * rdpmc) it still records timestamps; only --pmu makes a missing PMU fatal.
+     */
+    struct pmu_counters pmu;
+    int have_pmu = 0;
+    struct sampler sampler;
+    memset(&sampler, 0, sizeof(sampler));
+    if (use_pmu || sample_every > 0) {
+        have_pmu = (pmu_open(&pmu) == 0);
+        if (!have_pmu && use_pmu) {
+            free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+            free_array(B, B_elems_alloc, &b_numa, b_pages);
+            return 1;
+        }
+    }
+    if (sample_every > 0) {
+        sampler.cap  = sample_cap;
+        sampler.ring = malloc(sample_cap * sizeof(*sampler.ring));
+        if (!sampler.ring) {
+            fprintf(stderr, "malloc of %zu samples failed\n", sample_cap);
+            if (have_pmu) {
+                pmu_close(&pmu);
+            }
+            free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+            free_array(B, B_elems_alloc, &b_numa, b_pages);
+            return 1;
+        }
+        // Fault the ring in now, not inside the timed loop
+        memset(sampler.ring, 0, sample_cap * sizeof(*sampler.ring));
+        if (have_pmu && pmu_map_user(&pmu) > 0) {
+            sampler.pc = &pmu;
+            for (int e = 0; e < PMU_N_EVENTS; e++) {
+#ifdef __linux__
+                sampler.user_read[e] = (pmu.page[e] != NULL);
+#endif
+            }
+        } else {
+            fprintf(stderr, "# Samples: counters not readable with rdpmc, recording timestamps only\n");
+        }
+    }
+
     double sum = 0.0;
 
+    if (have_pmu) {
+        pmu_start(&pmu);
+    }
+    if (sample_every > 0) {
+        sampler_take(&sampler, 0, 0);  // baseline
+    }
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
     // Repeat the same kernel outer_scale times.
     // (Instruction stream is the same; we just extend runtime to gather statistics.)
     for (size_t rep = 0; rep < outer_scale; rep++) {
-        sum += run_kernel(A, B,
-                          A_elems,
-                          B_elems,
-                          elems_per_iter,
-                          stride_elems);
+        if (sample_every > 0) {
+            sum += run_kernel_sampled(A, B,
+                                      A_elems,
+                                      B_elems,
+                                      elems_per_iter,
+                                      stride_elems,
+                                      sample_every,
+                                      &sampler,
+                                      rep);
+            continue;
+        }
+        if (store != STORE_NONE) {
+            sum += run_kernel_store(A, B,
+                                    A_elems,
+                                    B_elems,
+                                    elems_per_iter,
+                                    stride_elems,
+                                    store);
+            continue;
+        }
+        if (access_mode == 2) {
+            sum += run_kernel_chase(A, (const uint64_t *)B,
+                                    A_elems,
+                                    B_elems,
+                                    elems_per_iter);
+            continue;
+        }
+        if (wp.kind != WP_NONE) {
+            sum += run_kernel_wp(A, B,
+                                 A_elems,
+                                 B_elems,
+                                 elems_per_iter,
+                                 stride_elems,
+                                 &wp);
+            continue;
+        }
+        sum += kernel(A, B,
+                      A_elems,
+                      B_elems,
+                      elems_per_iter,
+                      stride_elems);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    if (have_pmu) {
+        int rc = pmu_stop(&pmu);
+        pmu_close(&pmu);
+        if (rc != 0) {
+            free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+            free_array(B, B_elems_alloc, &b_numa, b_pages);
+            return 1;
+        }
     }
 
     // Prevent the compiler from optimizing away the whole computation.
     sink = sum;
 
+    if (use_pmu) {
+        pmu_print(&pmu);
+    }
+
+    if (sample_every > 0) {
+        FILE *fp = stdout;
+        if (sample_out) {
+            fp = fopen(sample_out, "w");
+            if (!fp) {
+                fprintf(stderr, "cannot open %s: %s\n", sample_out, strerror(errno));
+                free(sampler.ring);
+                free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+                free_array(B, B_elems_alloc, &b_numa, b_pages);
+                return 1;
+            }
+        } else {
+            printf("\n=== Samples (every %zu outer iterations) ===\n", sample_every);
+        }
+        int rc = sampler_dump(&sampler, fp);
+        if (sample_out && fclose(fp) != 0) {
+            rc = -1;
+        }
+        free(sampler.ring);
+        if (rc != 0) {
+            fprintf(stderr, "writing samples failed\n");
+            free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+            free_array(B, B_elems_alloc, &b_numa, b_pages);
+            return 1;
+        }
+    }
+
+    /*
+     * Average time per chase load. The A sweep is included, so use a tiny
+     * A_bytes (e.g. 8) for load-to-use latency curves.
+     */
+    if (access_mode == 2) {
+        BENCH_PRINTF("chase: %.3f ns per load (%zu loads, A sweep included)\n",
+                     1e9 * ts_diff(&t_start, &t_end) / ((double)B_elems * (double)outer_scale),
+                     B_elems * outer_scale);
+    }
+
     BENCH_PRINTF("sum = %.6f\n", sum);
 
-    free(A);
-    free(B);
+    free_array(A, A_elems, &a_numa, PAGES_MALLOC);
+    free_array(B, B_elems_alloc, &b_numa, b_pages);
     return 0;
 }
@@ -75,8 +75,12 @@ def build_argv_list(case):
     return args
 
 
-def run_one_case(case, outdir, bench_path: Path):
-    """1ケース分実行して、生ログとサマリ行を返す。"""
+def run_one_case(case, outdir, bench_path: Path, native: bool = False):
+    """1ケース分実行して、生ログとサマリ行を返す。
+
+    native=True なら perf stat を介さず benchmark --pmu を直接実行する
+    (run_kernel の区間だけを数えた同じ形式のサマリが benchmark 自身から出る)。
+    """
     case_id = case["case_id"]
     description = (case.get("description") or "").strip()  # あってもなくてもOK
 
@@ -110,7 +114,12 @@ def run_one_case(case, outdir, bench_path: Path):
         print(f"  description  : {description}")
     print()
 
-    cmd = ["python3", str(RUN_PERF), str(bench_path)] + [str(x) for x in argv]
+    if native:
+        cmd = [str(bench_path), "--pmu"] + [str(x) for x in argv]
+    else:
+        # ストア系 access_mode (3=store, 4=rmw, 5=ntstore) ではストアイベントも取る
+        stores = ["--stores"] if access_mode is not None and access_mode >= 3 else []
+        cmd = ["python3", str(RUN_PERF)] + stores + [str(bench_path)] + [str(x) for x in argv]
 
     # Python 3.6 対応の subprocess
     proc = subprocess.Popen(
@@ -123,15 +132,16 @@ def run_one_case(case, outdir, bench_path: Path):
 
     if proc.returncode != 0:
         raise RuntimeError(
-            "run_perf failed for case {cid} with code {code}\ncmd: {cmd}\nstderr:\n{stderr}".format(
+            "benchmark run failed for case {cid} with code {code}\ncmd: {cmd}\nstderr:\n{stderr}".format(
                 cid=case_id, code=proc.returncode, cmd=" ".join(cmd), stderr=stderr
             )
         )
 
     # ターミナルにも perf のまとめをそのまま出す
-    print("=== STDOUT (run_perf_mpki) ===")
+    runner = "benchmark --pmu" if native else "run_perf_mpki"
+    print("=== STDOUT ({}) ===".format(runner))
     print(stdout)
-    print("\n=== STDERR (run_perf_mpki) ===")
+    print("\n=== STDERR ({}) ===".format(runner))
     print(stderr)
     print()
 
@@ -216,6 +226,11 @@ def main():
         default=str(BENCH_DEFAULT),
         help="path to benchmark binary (default: ./benchmark)",
     )
+    parser.add_argument(
+        "--native",
+        action="store_true",
+        help="count with benchmark --pmu (perf_event_open around run_kernel only) instead of perf stat",
+    )
     args = parser.parse_args()
 
     cases = load_cases()
@@ -243,7 +258,7 @@ def main():
                 cid=cid, cfg=CONFIG_PATH
             ))
             continue
-        row = run_one_case(cases[cid], outdir, bench_path)
+        row = run_one_case(cases[cid], outdir, bench_path, args.native)
         summary_rows.append(row)
 
     if summary_rows:
@@ -19,6 +19,14 @@ EVENTS = [
     "ls_refills_from_sys.ls_mabresp_rmt_dram",
 ]
 
+# --stores 指定時に追加するイベント（AMD Zen）
+# store_dispatch: ディスパッチされたストア命令数
+# wcb_write     : L2 への write-combining バッファ書き込み（non-temporal store）
+STORE_EVENTS = [
+    "ls_dispatch.store_dispatch",
+    "l2_wcb_req.wcb_write",
+]
+
 # 実行ノード名（FQDN のまま。短くしたければ .split('.')[0] でもよい）
 NODE = socket.gethostname()
 
@@ -76,6 +84,11 @@ def main():
     parser = argparse.ArgumentParser(
         description="Run perf stat on benchmark and print IPC / MPKI summary."
     )
+    parser.add_argument(
+        "--stores",
+        action="store_true",
+        help="also count store dispatches / write-combining writes (access_mode 3..5)",
+    )
     parser.add_argument(
         "benchmark",
         help="path to benchmark binary (e.g., ./benchmark)",
@@ -94,7 +107,7 @@ def main():
     cmd = [
         "perf", "stat",
         "-x,",                # CSV 形式
-        "-e", ",".join(EVENTS),
+        "-e", ",".join(EVENTS + (STORE_EVENTS if args.stores else [])),
         "--",
         bench,
     ] + bench_args
@@ -128,6 +141,8 @@ def main():
     dram_local    = counters.get("ls_refills_from_sys.ls_mabresp_lcl_dram", 0)
     dram_remote   = counters.get("ls_refills_from_sys.ls_mabresp_rmt_dram", 0)
     dram_total    = dram_local + dram_remote
+    stores        = counters.get("ls_dispatch.store_dispatch", 0)
+    wcb_writes    = counters.get("l2_wcb_req.wcb_write", 0)
 
     print("=== Parsed counters ===")
     print("node                    : {}".format(NODE))
@@ -140,6 +155,9 @@ def main():
     print("Demand DRAM fills (L1D): {} (local={}, remote={})".format(
         dram_total, dram_local, dram_remote
     ))
+    if args.stores:
+        print("ls_dispatch.store_dispatch : {}".format(stores))
+        print("l2_wcb_req.wcb_write       : {}".format(wcb_writes))
     print()
 
     print("=== Rates / IPC ===")
@@ -174,6 +192,15 @@ def main():
     print("L1 MPKI                : {:.3f}".format(l1_mpki))
     print("L2 MPKI                : {:.3f}".format(l2_mpki))
     print("Demand DRAM fills (L1D) PKI : {:.3f}".format(dram_pki))
+    if args.stores:
+        # ストア系はミスではなく発行数なので PKI として出す
+        if instructions > 0:
+            store_pki = 1000.0 * stores / instructions
+            wcb_pki   = 1000.0 * wcb_writes / instructions
+        else:
+            store_pki = wcb_pki = 0.0
+        print("Store dispatch PKI     : {:.3f}".format(store_pki))
+        print("WCB write PKI          : {:.3f}".format(wcb_pki))
     print()
 
     if stdout.strip():
@@ -2,53 +2,389 @@
  * find_b_accesses.c - Find array B accesses in ChampSim trace (Phase 2)
  *
  * Usage: find_b_accesses --trace PATH --b-base 0x... --b-size N [--max-hits M]
+ *                         [--threads N] [--iters I:J]
  *
- * Scans a binary trace file and reports all memory accesses that fall
- * within the address range [b_base, b_base + b_size).
+ * Scans a binary trace file (raw, or .xz decoded on the fly) and reports all
+ * memory accesses that fall within the address range [b_base, b_base + b_size).
+ *
+ * With --threads N (raw traces only), the mapped trace is cut into shards that
+ * N worker threads scan in parallel. Each shard's CSV lines are buffered in
+ * memory and written out strictly in shard order, so the output is identical
+ * to the serial scan, including which hits --max-hits keeps.
+ *
+ * With --iters I:J only outer iterations [I, J) are scanned, located through
+ * the trace's .tidx index (see trace_build_index). The serial scan also uses
+ * the index's per-region address summaries to skip every region that has no
+ * operand inside the B range.
  */
 
+#define _GNU_SOURCE  /* open_memstream, sysconf(_SC_NPROCESSORS_ONLN) */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace_io.h"
+#include "trace_filter.h"
+#include "trace_index.h"
 
 /*
- * ChampSim trace format (from inc/trace_instruction.h)
+ * Upper bound on the records per shard (256 MiB of trace). Shards are the unit
+ * of work handed to the threads and of buffered output, so this bounds the
+ * memory held by in-flight CSV text for B-heavy traces.
  */
-#define NUM_INSTR_DESTINATIONS 2
-#define NUM_INSTR_SOURCES 4
-
-struct input_instr {
-    uint64_t ip;
-    uint8_t  is_branch;
-    uint8_t  branch_taken;
-    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS];
-    uint8_t  source_registers[NUM_INSTR_SOURCES];
-    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];
-    uint64_t source_memory[NUM_INSTR_SOURCES];
-};
+#define SHARD_MAX_RECORDS (1ULL << 22)
+
+/* Records handed to the range filter per call */
+#define FILTER_BATCH 65536
 
 static void print_usage(const char *prog) {
-    fprintf(stderr, "Usage: %s --trace PATH --b-base 0x... --b-size N [--max-hits M]\n", prog);
+    fprintf(stderr, "Usage: %s --trace PATH --b-base 0x... --b-size N [--max-hits M] [--threads N] [--iters I:J]\n", prog);
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  --trace PATH     Path to raw binary trace file (required)\n");
+    fprintf(stderr, "  --trace PATH     Path to trace file, raw or .xz (required)\n");
     fprintf(stderr, "  --b-base ADDR    Base address of array B in hex (required)\n");
     fprintf(stderr, "  --b-size BYTES   Size of array B in bytes (required)\n");
     fprintf(stderr, "  --max-hits N     Maximum number of B accesses to report (default: unlimited)\n");
+    fprintf(stderr, "  --threads N      Scan with N threads, 0 = all CPUs (default: 1; raw traces only)\n");
+    fprintf(stderr, "  --iters I:J      Scan only outer iterations [I, J), from PATH%s (trace_build_index)\n",
+            TRACE_INDEX_SUFFIX);
     fprintf(stderr, "\n");
     fprintf(stderr, "Output format (CSV):\n");
     fprintf(stderr, "  idx,kind,ip,addr,offset\n");
 }
 
+/*
+ * Print one CSV line per B operand of rec selected by lanes (a trace_filter
+ * lane mask): loads first, then stores. Returns 1 once max_hits (if non-zero)
+ * is reached.
+ */
+static int report_b_accesses(FILE *out, uint64_t idx, const struct input_instr *rec,
+                             unsigned lanes, uint64_t b_base,
+                             uint64_t max_hits, uint64_t *hit_count) {
+    static const unsigned order[] = {
+        TRACE_FILTER_LANE_SRC0, TRACE_FILTER_LANE_SRC0 + 1,
+        TRACE_FILTER_LANE_SRC0 + 2, TRACE_FILTER_LANE_SRC0 + 3,
+        TRACE_FILTER_LANE_DST0, TRACE_FILTER_LANE_DST0 + 1,
+    };
+
+    for (unsigned i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        unsigned lane = order[i];
+        if (!(lanes & (1u << lane))) {
+            continue;
+        }
+        uint64_t addr = trace_filter_lane_addr(rec, lane);
+        fprintf(out, "%lu,%s,0x%lx,0x%lx,0x%lx\n",
+                (unsigned long)idx,
+                (lane >= TRACE_FILTER_LANE_SRC0) ? "load" : "store",
+                (unsigned long)rec->ip,
+                (unsigned long)addr,
+                (unsigned long)(addr - b_base));
+        (*hit_count)++;
+        if (max_hits > 0 && *hit_count >= max_hits) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Filter n records (record index first_idx onwards) and report the B hits to
+ * out. hits is scratch space for FILTER_BATCH entries. Returns the number of
+ * records consumed: n, or fewer if max_hits was reached (*stop is then set).
+ */
+static uint64_t filter_and_report(FILE *out, const struct trace_filter *f,
+                                  struct trace_filter_hit *hits,
+                                  const struct input_instr *recs, uint64_t first_idx, uint64_t n,
+                                  uint64_t max_hits, uint64_t *hit_count, int *stop) {
+    uint64_t b_base = f->ranges[0].base;
+
+    for (uint64_t off = 0; off < n; off += FILTER_BATCH) {
+        uint64_t len = (n - off < FILTER_BATCH) ? n - off : FILTER_BATCH;
+        size_t k = trace_filter_scan(f, recs + off, len, hits);
+
+        for (size_t h = 0; h < k; h++) {
+            uint64_t i = off + hits[h].idx;
+            if (report_b_accesses(out, first_idx + i, &recs[i], trace_filter_lanes(hits[h].mask, 0),
+                                  b_base, max_hits, hit_count)) {
+                *stop = 1;
+                return i + 1;
+            }
+        }
+    }
+
+    return n;
+}
+
+/* Records [begin, end) to scan */
+struct scan_span {
+    uint64_t begin;
+    uint64_t end;
+};
+
+/*
+ * Single-threaded scan of the spans of r (in increasing order), printing CSV
+ * lines to stdout. Stores the number of records scanned (up to and including
+ * the one that reached max_hits) and the hit count. Returns 0 on success, -1
+ * on a read error.
+ */
+static int scan_serial(struct trace_reader *r, const struct trace_filter *f,
+                       const struct scan_span *spans, uint64_t n_spans,
+                       uint64_t max_hits, uint64_t *scanned, uint64_t *hit_count) {
+    struct trace_filter_hit *hits = malloc(FILTER_BATCH * sizeof(*hits));
+    if (!hits) {
+        fprintf(stderr, "Error: Cannot allocate filter buffer\n");
+        return -1;
+    }
+
+    const struct input_instr *recs;
+    int64_t n = 0;
+    int stop = 0;
+
+    *scanned = 0;
+    *hit_count = 0;
+    for (uint64_t k = 0; k < n_spans && !stop && n >= 0; k++) {
+        if (spans[k].begin > r->pos) {
+            /* Regions the index rules out are skipped, not filtered */
+            if (trace_reader_skip(r, spans[k].begin - r->pos) < 0) {
+                n = -1;
+                break;
+            }
+            if (r->pos < spans[k].begin) {
+                break;  /* end of trace */
+            }
+        }
+        uint64_t left = spans[k].end - r->pos;
+        while (!stop && left > 0 &&
+               (n = trace_reader_next(r, &recs, left < TRACE_READ_CHUNK ? left : TRACE_READ_CHUNK)) > 0) {
+            uint64_t first_idx = r->pos - (uint64_t)n;
+            *scanned += filter_and_report(stdout, f, hits, recs, first_idx, (uint64_t)n,
+                                          max_hits, hit_count, &stop);
+            left -= (uint64_t)n;
+        }
+    }
+
+    free(hits);
+    return (!stop && n < 0) ? -1 : 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Parallel scan (--threads)
+ * ------------------------------------------------------------------------ */
+
+struct scan_shard {
+    uint64_t begin;        /* first record index */
+    uint64_t end;          /* one past the last record index */
+    char *buf;             /* CSV lines for this shard (open_memstream) */
+    size_t len;
+    uint64_t hits;         /* number of lines in buf */
+    int failed;            /* out of memory while buffering */
+    int done;
+};
+
+struct scan_ctx {
+    const struct input_instr *recs;
+    const struct trace_filter *filter;
+    uint64_t max_hits;
+
+    struct scan_shard *shards;
+    uint64_t n_shards;
+    uint64_t next_shard;   /* next shard to hand to a worker */
+    uint64_t emitted;      /* shards already written by the main thread */
+    uint64_t window;       /* max shards scanned ahead of the writer */
+    int stop;              /* --max-hits reached: take no more shards */
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void scan_one_shard(const struct scan_ctx *ctx, struct scan_shard *sh,
+                           struct trace_filter_hit *hits) {
+    FILE *out = open_memstream(&sh->buf, &sh->len);
+    if (!out || !hits) {
+        sh->failed = 1;
+        if (out) {
+            fclose(out);
+        }
+        return;
+    }
+
+    /*
+     * A shard never needs more than max_hits lines: even if it turns out to
+     * be the first shard with any hits, only that many are printed.
+     */
+    int stop = 0;
+    filter_and_report(out, ctx->filter, hits, ctx->recs + sh->begin, sh->begin,
+                      sh->end - sh->begin, ctx->max_hits, &sh->hits, &stop);
+
+    if (ferror(out)) {
+        sh->failed = 1;
+    }
+    fclose(out);
+}
+
+static void *scan_worker(void *arg) {
+    struct scan_ctx *ctx = arg;
+    struct trace_filter_hit *hits = malloc(FILTER_BATCH * sizeof(*hits));
+
+    pthread_mutex_lock(&ctx->lock);
+    for (;;) {
+        while (!ctx->stop && ctx->next_shard < ctx->n_shards &&
+               ctx->next_shard >= ctx->emitted + ctx->window) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        if (ctx->stop || ctx->next_shard >= ctx->n_shards) {
+            break;
+        }
+        struct scan_shard *sh = &ctx->shards[ctx->next_shard++];
+        pthread_mutex_unlock(&ctx->lock);
+
+        scan_one_shard(ctx, sh, hits);
+
+        pthread_mutex_lock(&ctx->lock);
+        sh->done = 1;
+        pthread_cond_broadcast(&ctx->cond);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    free(hits);
+    return NULL;
+}
+
+/*
+ * Scan records [begin, end) of tm with n_threads workers and write the CSV
+ * lines to stdout in record order. On success stores the records covered by the output (as in the serial
+ * scan, the scan "ends" at the hit that reaches max_hits) and the hit count.
+ * Returns 0 on success, -1 on error.
+ */
+static int scan_parallel(const struct trace_map *tm, uint64_t begin, uint64_t end,
+                         const struct trace_filter *f, uint64_t max_hits, unsigned n_threads,
+                         uint64_t *scanned, uint64_t *hit_count) {
+    uint64_t n_records = end - begin;
+    uint64_t shard_len = (n_records + n_threads - 1) / n_threads;
+    if (shard_len > SHARD_MAX_RECORDS) {
+        shard_len = SHARD_MAX_RECORDS;
+    }
+    if (shard_len == 0) {
+        shard_len = 1;
+    }
+
+    struct scan_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.recs = tm->recs;
+    ctx.filter = f;
+    ctx.max_hits = max_hits;
+    ctx.n_shards = (n_records + shard_len - 1) / shard_len;
+    ctx.window = 2 * (uint64_t)n_threads;
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+
+    ctx.shards = calloc(ctx.n_shards ? ctx.n_shards : 1, sizeof(struct scan_shard));
+    if (!ctx.shards) {
+        fprintf(stderr, "Error: Cannot allocate %lu shards\n", (unsigned long)ctx.n_shards);
+        return -1;
+    }
+    for (uint64_t k = 0; k < ctx.n_shards; k++) {
+        ctx.shards[k].begin = begin + k * shard_len;
+        ctx.shards[k].end = begin + ((k + 1) * shard_len < n_records ? (k + 1) * shard_len : n_records);
+    }
+
+    pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+    if (!threads) {
+        fprintf(stderr, "Error: Cannot allocate %u threads\n", n_threads);
+        free(ctx.shards);
+        return -1;
+    }
+
+    unsigned started = 0;
+    for (; started < n_threads; started++) {
+        if (pthread_create(&threads[started], NULL, scan_worker, &ctx) != 0) {
+            break;
+        }
+    }
+
+    int rc = 0;
+    if (started == 0) {
+        fprintf(stderr, "Error: Cannot create scan threads\n");
+        rc = -1;
+    }
+
+    /* Write the shards out in order as they complete */
+    *scanned = n_records;
+    *hit_count = 0;
+    for (uint64_t k = 0; k < ctx.n_shards && rc == 0; k++) {
+        struct scan_shard *sh = &ctx.shards[k];
+
+        pthread_mutex_lock(&ctx.lock);
+        while (!sh->done) {
+            pthread_cond_wait(&ctx.cond, &ctx.lock);
+        }
+        pthread_mutex_unlock(&ctx.lock);
+
+        if (sh->failed) {
+            fprintf(stderr, "Error: Out of memory buffering hits for records [%lu, %lu)\n",
+                    (unsigned long)sh->begin, (unsigned long)sh->end);
+            rc = -1;
+        } else if (max_hits > 0 && *hit_count + sh->hits >= max_hits) {
+            /* Cut the shard after the line that reaches max_hits */
+            uint64_t need = max_hits - *hit_count;
+            size_t cut = 0;
+            const char *last = sh->buf;
+            for (uint64_t h = 0; h < need; h++) {
+                last = sh->buf + cut;
+                cut = (size_t)(strchr(last, '\n') - sh->buf) + 1;
+            }
+            fwrite(sh->buf, 1, cut, stdout);
+            *hit_count += need;
+            *scanned = strtoull(last, NULL, 10) + 1 - begin;
+        } else {
+            fwrite(sh->buf, 1, sh->len, stdout);
+            *hit_count += sh->hits;
+        }
+        free(sh->buf);
+        sh->buf = NULL;
+
+        pthread_mutex_lock(&ctx.lock);
+        ctx.emitted = k + 1;
+        if (rc != 0 || (max_hits > 0 && *hit_count >= max_hits)) {
+            ctx.stop = 1;
+        }
+        pthread_cond_broadcast(&ctx.cond);
+        int stop = ctx.stop;
+        pthread_mutex_unlock(&ctx.lock);
+        if (stop) {
+            break;
+        }
+    }
+
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    /* Shards scanned ahead of a --max-hits cut are discarded */
+    for (uint64_t k = 0; k < ctx.n_shards; k++) {
+        free(ctx.shards[k].buf);
+    }
+    free(threads);
+    free(ctx.shards);
+    pthread_mutex_destroy(&ctx.lock);
+    pthread_cond_destroy(&ctx.cond);
+    return rc;
+}
+
 int main(int argc, char *argv[]) {
     const char *trace_path = NULL;
     uint64_t b_base = 0;
     uint64_t b_size = 0;
     uint64_t max_hits = 0;  /* 0 = unlimited */
+    long n_threads = 1;
     int have_b_base = 0;
     int have_b_size = 0;
+    const char *iters_arg = NULL;
 
     /* Parse command line options */
     static struct option long_options[] = {
@@ -56,12 +392,14 @@ int main(int argc, char *argv[]) {
         {"b-base",   required_argument, 0, 'b'},
         {"b-size",   required_argument, 0, 's'},
         {"max-hits", required_argument, 0, 'm'},
+        {"threads",  required_argument, 0, 'j'},
+        {"iters",    required_argument, 0, 'k'},
         {"help",     no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "t:b:s:m:h", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:b:s:m:j:k:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 't':
                 trace_path = optarg;
@@ -77,6 +415,12 @@ int main(int argc, char *argv[]) {
             case 'm':
                 max_hits = strtoull(optarg, NULL, 10);
                 break;
+            case 'j':
+                n_threads = strtol(optarg, NULL, 10);
+                break;
+            case 'k':
+                iters_arg = optarg;
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -90,11 +434,97 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    /* Open trace file */
-    FILE *fp = fopen(trace_path, "rb");
-    if (!fp) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot open trace file: %s\n", trace_path);
+    if (n_threads < 0) {
+        fprintf(stderr, "Error: --threads must be >= 0\n");
+        return 1;
+    }
+    if (n_threads == 0) {
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_threads < 1) {
+            n_threads = 1;
+        }
+    }
+    if (n_threads > 1 && trace_path_is_xz(trace_path)) {
+        /* An xz stream can only be decoded front to back */
+        fprintf(stderr, "# Note: --threads ignored for .xz input (scanning serially)\n");
+        n_threads = 1;
+    }
+
+    /*
+     * Records to scan: the whole trace, or with --iters the regions of those
+     * iterations whose address summary overlaps B (the serial scan skips the
+     * rest; the parallel scan covers the iterations as one window).
+     */
+    uint64_t iter_first = 0, iter_end = 0;
+    struct scan_span whole = { 0, UINT64_MAX };
+    struct scan_span *spans = &whole;
+    uint64_t n_spans = 1;
+    uint64_t n_skipped = 0;
+    if (iters_arg) {
+        char *sep;
+        iter_first = strtoull(iters_arg, &sep, 10);
+        iter_end = (*sep == ':') ? strtoull(sep + 1, NULL, 10) : 0;
+        if (*sep != ':' || iter_end <= iter_first) {
+            fprintf(stderr, "Error: --iters expects I:J with I < J, got '%s'\n", iters_arg);
+            return 1;
+        }
+
+        struct trace_index ix;
+        uint64_t begin, end;
+        if (trace_index_load(&ix, trace_path) != 0) {
+            return 1;
+        }
+        if (trace_index_region(&ix, iter_end - 1, TRACE_REGIONS, &begin, &end) != 0) {
+            trace_index_free(&ix);
+            return 1;
+        }
+        spans = malloc((iter_end - iter_first) * TRACE_REGIONS * sizeof(*spans));
+        if (!spans) {
+            fprintf(stderr, "Error: Out of memory\n");
+            trace_index_free(&ix);
+            return 1;
+        }
+        n_spans = 0;
+        for (uint64_t k = iter_first; k < iter_end; k++) {
+            for (int r = 0; r < TRACE_REGIONS; r++) {
+                const struct trace_region_summary *sum = &ix.iters[k].region[r];
+                trace_index_region(&ix, k, r, &begin, &end);
+                if (begin == end) {
+                    continue;
+                }
+                if (n_threads == 1 && !trace_region_may_touch(sum, b_base, b_size)) {
+                    n_skipped++;
+                    continue;
+                }
+                if (n_spans > 0 && spans[n_spans - 1].end == begin) {
+                    spans[n_spans - 1].end = end;
+                } else {
+                    spans[n_spans].begin = begin;
+                    spans[n_spans++].end = end;
+                }
+            }
+        }
+        trace_index_free(&ix);
+    }
+
+    struct trace_range b_range = { "B", b_base, b_size };
+    struct trace_filter filter;
+    trace_filter_init(&filter, &b_range, 1);
+
+    /*
+     * Open trace file for a full scan: a plain forward reader for the serial
+     * scan, or a mapping that the worker threads fault in shard by shard.
+     */
+    struct trace_reader rd;
+    struct trace_map tm;
+    if (n_threads > 1) {
+        if (trace_map_open(&tm, trace_path, TRACE_MAP_SHARDED) != 0) {
+            return 1;
+        }
+    } else if (trace_reader_open(&rd, trace_path) != 0) {
+        if (spans != &whole) {
+            free(spans);
+        }
         return 1;
     }
 
@@ -107,63 +537,51 @@ int main(int argc, char *argv[]) {
     if (max_hits > 0) {
         fprintf(stderr, "# Max hits: %lu\n", (unsigned long)max_hits);
     }
+    if (n_threads > 1) {
+        fprintf(stderr, "# Threads: %ld\n", n_threads);
+    }
+    if (iters_arg) {
+        fprintf(stderr, "# Iterations: [%lu, %lu) (%lu regions skipped by the index)\n",
+                (unsigned long)iter_first, (unsigned long)iter_end, (unsigned long)n_skipped);
+    }
+    fprintf(stderr, "# Range filter: %s\n", filter.isa);
     fprintf(stderr, "#\n");
 
     /* Print CSV header to stdout */
     printf("idx,kind,ip,addr,offset\n");
 
     /* Scan trace */
-    struct input_instr rec;
-    uint64_t idx = 0;
     uint64_t hit_count = 0;
     uint64_t total_records = 0;
+    int rc;
 
-    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
-        total_records++;
-
-        /* Check source_memory (loads) */
-        for (int i = 0; i < NUM_INSTR_SOURCES; i++) {
-            uint64_t addr = rec.source_memory[i];
-            if (addr != 0 && addr >= b_base && addr < b_base + b_size) {
-                uint64_t offset = addr - b_base;
-                printf("%lu,load,0x%lx,0x%lx,0x%lx\n",
-                       (unsigned long)idx,
-                       (unsigned long)rec.ip,
-                       (unsigned long)addr,
-                       (unsigned long)offset);
-                hit_count++;
-                if (max_hits > 0 && hit_count >= max_hits) {
-                    goto done;
-                }
-            }
-        }
-
-        /* Check destination_memory (stores) */
-        for (int i = 0; i < NUM_INSTR_DESTINATIONS; i++) {
-            uint64_t addr = rec.destination_memory[i];
-            if (addr != 0 && addr >= b_base && addr < b_base + b_size) {
-                uint64_t offset = addr - b_base;
-                printf("%lu,store,0x%lx,0x%lx,0x%lx\n",
-                       (unsigned long)idx,
-                       (unsigned long)rec.ip,
-                       (unsigned long)addr,
-                       (unsigned long)offset);
-                hit_count++;
-                if (max_hits > 0 && hit_count >= max_hits) {
-                    goto done;
-                }
-            }
+    if (n_threads > 1) {
+        uint64_t begin = iters_arg ? spans[0].begin : 0;
+        uint64_t end = iters_arg ? spans[n_spans - 1].end : tm.n_records;
+        if (end > tm.n_records) {
+            fprintf(stderr, "Error: Index covers records up to %lu, trace has %lu\n",
+                    (unsigned long)end, (unsigned long)tm.n_records);
+            rc = -1;
+        } else {
+            rc = scan_parallel(&tm, begin, end, &filter, max_hits, (unsigned)n_threads,
+                               &total_records, &hit_count);
         }
-
-        idx++;
+        trace_map_close(&tm);
+    } else {
+        rc = scan_serial(&rd, &filter, spans, n_spans, max_hits, &total_records, &hit_count);
+        trace_reader_close(&rd);
+    }
+    if (spans != &whole) {
+        free(spans);
+    }
+    if (rc != 0) {
+        return 1;
     }
 
-done:
     /* Summary to stderr */
     fprintf(stderr, "#\n");
     fprintf(stderr, "# Scanned %lu records\n", (unsigned long)total_records);
     fprintf(stderr, "# Found %lu B accesses\n", (unsigned long)hit_count);
 
-    fclose(fp);
     return 0;
 }
@@ -0,0 +1,49 @@
+#!/bin/sh
+# find_b_accesses --iters on a surgered trace: every A sweep holds a
+# wrong-path copy of half its B chunk, with the B load IP as in
+# trace_insert_all_iters output, so the A regions straddle b_base.
+# trace_build_index must still find 8 iterations, and --iters 0:8 must find
+# all 96 B accesses (8 x 8 real + 8 x 4 wrong-path).
+#
+# Run from tools/ (make check).
+set -e
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+python3 - "$tmp/wp.trace" <<'PY'
+import struct, sys
+
+A_IP, B_IP, LOOP_IP = 0x401000, 0x401010, 0x401020
+A_BASE, B_BASE = 0x10000000, 0x20000000
+
+def rec(ip, src=0):
+    # struct input_instr: ip, is_branch, branch_taken, 2 dst regs, 4 src regs,
+    # 2 destination_memory, 4 source_memory
+    return struct.pack("<Q2B2B4B2Q4Q", ip, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, src, 0, 0, 0)
+
+with open(sys.argv[1], "wb") as f:
+    for outer in range(8):
+        for i in range(8):
+            f.write(rec(A_IP, A_BASE + 8 * i))
+            if i == 4:
+                for j in range(4):
+                    f.write(rec(B_IP, B_BASE + 64 * (8 * outer + j)))
+                    f.write(rec(LOOP_IP))
+        for j in range(8):
+            f.write(rec(B_IP, B_BASE + 64 * (8 * outer + j)))
+            f.write(rec(LOOP_IP))
+PY
+
+n_iters=$(./trace_build_index --trace "$tmp/wp.trace" --a-ip 0x401000 --b-ip 0x401010 2>&1 |
+          sed -n 's/^# Iterations: \([0-9]*\).*/\1/p')
+
+full=$(./find_b_accesses --trace "$tmp/wp.trace" --b-base 0x20000000 --b-size 0x10000 2>/dev/null | tail -n +2 | wc -l)
+iters=$(./find_b_accesses --trace "$tmp/wp.trace" --b-base 0x20000000 --b-size 0x10000 --iters 0:8 2>/dev/null | tail -n +2 | wc -l)
+
+if [ "$n_iters" != 8 ] || [ "$full" -ne 96 ] || [ "$iters" -ne "$full" ]; then
+    echo "FAIL: check_iters_straddle: $n_iters iterations indexed (expected 8)," \
+         "full scan $full hits, --iters 0:8 $iters hits (expected 96)"
+    exit 1
+fi
+echo "PASS: check_iters_straddle"
@@ -0,0 +1,436 @@
+/*
+ * trace_build_index.c - Write the .tidx index of a kernel trace
+ *
+ * Usage: trace_build_index --trace PATH (--loops FILE | --a-ip IP --b-ip IP)
+ *            [--out FILE] [--verify]
+ *
+ * Scans the trace once (raw, or .xz decoded on the fly) and records for every
+ * outer iteration where its A sweep, B chunk and loop overhead start, with a
+ * summary of each region and a hash of the whole trace (see trace_index.h).
+ * The A / B load IPs come from trace_detect_loops JSON or the command line.
+ *
+ * An iteration starts at the first A load after the previous iteration's B
+ * loads whose address wraps back to the sweep start, its B region at the
+ * first B load, and its overhead right after the last B load. B loads inside
+ * the A sweep (wrong-path copies that keep the B load IP) stay in the A
+ * region, since the A loads after them keep advancing. Iterations are found
+ * one by one, so irregular traces (e.g. outer_scale > 1) are indexed exactly,
+ * unlike the fixed period of --loops.
+ *
+ * --verify rehashes the trace and compares it with an existing index instead
+ * of writing one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "trace_io.h"
+#include "trace_loops.h"
+#include "trace_index.h"
+
+/* Scan states */
+#define SCAN_PRELUDE 0   /* before the first A load */
+#define SCAN_A       1   /* in an A sweep, no B load yet */
+#define SCAN_B       2   /* B loads seen; A starts the next iteration */
+
+struct index_builder {
+    const uint64_t *a_ips;
+    unsigned n_a;
+    const uint64_t *b_ips;
+    unsigned n_b;
+
+    int state;
+    struct trace_index_iter cur;
+    uint64_t last_b;                       /* last B load of cur */
+    uint64_t last_a_addr;                  /* address of the last A load of cur */
+    struct trace_region_summary pend;      /* records after last_b */
+    struct trace_region_summary pend_tail; /* same, within overhead_hint of last_b */
+    uint64_t overhead_hint;                /* overhead length of the previous iteration */
+
+    struct trace_index_iter *iters;
+    uint64_t n_iters;
+    uint64_t cap;
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s --trace PATH (--loops FILE | --a-ip IP --b-ip IP) [--out FILE] [--verify]\n", prog);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --trace PATH     Path to trace file, raw or .xz (required)\n");
+    fprintf(stderr, "  --loops FILE     Take the A / B load IPs from trace_detect_loops JSON\n");
+    fprintf(stderr, "  --a-ip IP        A sweep load IP (hex, repeatable)\n");
+    fprintf(stderr, "  --b-ip IP        B chunk load IP (hex, repeatable)\n");
+    fprintf(stderr, "  --out FILE       Index file (default: PATH%s)\n", TRACE_INDEX_SUFFIX);
+    fprintf(stderr, "  --verify         Check PATH%s against the trace contents instead of writing it\n",
+            TRACE_INDEX_SUFFIX);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The index is used by trace_inspect --iter, find_b_accesses --iters,\n");
+    fprintf(stderr, "trace_insert_b_at_a --iter and trace_insert_all_iters --index.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  trace_detect_loops --trace wp.trace.xz --out wp.loops.json\n");
+    fprintf(stderr, "  %s --trace wp.trace.xz --loops wp.loops.json\n", prog);
+}
+
+static int ip_in(const uint64_t *ips, unsigned n, uint64_t ip) {
+    for (unsigned k = 0; k < n; k++) {
+        if (ips[k] == ip) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void summary_init(struct trace_region_summary *s) {
+    s->n_mem = 0;
+    s->ip_min = UINT64_MAX;
+    s->ip_max = 0;
+    s->addr_min = UINT64_MAX;
+    s->addr_max = 0;
+}
+
+static void summary_add(struct trace_region_summary *s, const struct input_instr *rec) {
+    int mem = 0;
+    for (int k = 0; k < NUM_INSTR_SOURCES + NUM_INSTR_DESTINATIONS; k++) {
+        uint64_t addr = (k < NUM_INSTR_SOURCES) ? rec->source_memory[k]
+                                                 : rec->destination_memory[k - NUM_INSTR_SOURCES];
+        if (addr == 0) {
+            continue;
+        }
+        mem = 1;
+        s->addr_min = (addr < s->addr_min) ? addr : s->addr_min;
+        s->addr_max = (addr > s->addr_max) ? addr : s->addr_max;
+    }
+    if (mem) {
+        s->n_mem++;
+        s->ip_min = (rec->ip < s->ip_min) ? rec->ip : s->ip_min;
+        s->ip_max = (rec->ip > s->ip_max) ? rec->ip : s->ip_max;
+    }
+}
+
+static void summary_merge(struct trace_region_summary *dst, const struct trace_region_summary *src) {
+    if (src->n_mem == 0) {
+        return;
+    }
+    dst->n_mem += src->n_mem;
+    dst->ip_min = (src->ip_min < dst->ip_min) ? src->ip_min : dst->ip_min;
+    dst->ip_max = (src->ip_max > dst->ip_max) ? src->ip_max : dst->ip_max;
+    dst->addr_min = (src->addr_min < dst->addr_min) ? src->addr_min : dst->addr_min;
+    dst->addr_max = (src->addr_max > dst->addr_max) ? src->addr_max : dst->addr_max;
+}
+
+/* Close the current iteration with its overhead ending at end */
+static int builder_finish(struct index_builder *b, uint64_t end, const struct trace_region_summary *overhead) {
+    if (b->n_iters == b->cap) {
+        uint64_t cap = b->cap ? 2 * b->cap : 1024;
+        struct trace_index_iter *iters = realloc(b->iters, cap * sizeof(*iters));
+        if (!iters) {
+            fprintf(stderr, "Error: Out of memory for %lu index entries\n", (unsigned long)cap);
+            return -1;
+        }
+        b->iters = iters;
+        b->cap = cap;
+    }
+    b->cur.begin[TRACE_REGION_OVERHEAD] = b->last_b + 1;
+    b->cur.region[TRACE_REGION_OVERHEAD] = *overhead;
+    b->cur.end = end;
+    b->overhead_hint = end - (b->last_b + 1);
+    b->iters[b->n_iters++] = b->cur;
+    return 0;
+}
+
+static int builder_add(struct index_builder *b, uint64_t idx, const struct input_instr *rec) {
+    int is_a = ip_in(b->a_ips, b->n_a, rec->ip);
+    int is_b = !is_a && ip_in(b->b_ips, b->n_b, rec->ip);
+    uint64_t a_addr = is_a ? trace_record_addr(rec) : 0;
+
+    /*
+     * An A load after B loads only starts a new iteration if the sweep wraps
+     * back (its address does not advance). Otherwise the B loads were a burst
+     * inside the A sweep, e.g. a wrong-path copy of the B chunk inserted by
+     * trace_insert_all_iters, which keeps the B load IP: fold them back into
+     * the A region and carry on with the sweep.
+     */
+    if (is_a && b->state == SCAN_B && a_addr > b->last_a_addr) {
+        summary_merge(&b->cur.region[TRACE_REGION_A], &b->cur.region[TRACE_REGION_B]);
+        summary_merge(&b->cur.region[TRACE_REGION_A], &b->pend);
+        summary_init(&b->cur.region[TRACE_REGION_B]);
+        summary_init(&b->pend);
+        summary_init(&b->pend_tail);
+        b->cur.begin[TRACE_REGION_B] = 0;
+        b->state = SCAN_A;
+    }
+
+    if (is_a && b->state != SCAN_A) {
+        if (b->state == SCAN_B && builder_finish(b, idx, &b->pend) != 0) {
+            return -1;
+        }
+        memset(&b->cur, 0, sizeof(b->cur));
+        for (int r = 0; r < TRACE_REGIONS; r++) {
+            summary_init(&b->cur.region[r]);
+        }
+        b->cur.begin[TRACE_REGION_A] = idx;
+        b->state = SCAN_A;
+    } else if (is_b && b->state == SCAN_A) {
+        b->cur.begin[TRACE_REGION_B] = idx;
+        b->state = SCAN_B;
+    }
+
+    if (is_a) {
+        b->last_a_addr = a_addr;
+    }
+    if (b->state == SCAN_A) {
+        summary_add(&b->cur.region[TRACE_REGION_A], rec);
+    } else if (b->state == SCAN_B && is_b) {
+        /* Everything since the previous B load was still part of the B chunk */
+        summary_merge(&b->cur.region[TRACE_REGION_B], &b->pend);
+        summary_add(&b->cur.region[TRACE_REGION_B], rec);
+        summary_init(&b->pend);
+        summary_init(&b->pend_tail);
+        b->last_b = idx;
+    } else if (b->state == SCAN_B) {
+        summary_add(&b->pend, rec);
+        if (idx - b->last_b <= b->overhead_hint) {
+            summary_add(&b->pend_tail, rec);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = NULL;
+    const char *loops_path = NULL;
+    const char *out_path = NULL;
+    int verify = 0;
+    uint64_t a_ips[TRACE_LOOPS_MAX_IPS];
+    uint64_t b_ips[TRACE_LOOPS_MAX_IPS];
+    unsigned n_a = 0;
+    unsigned n_b = 0;
+
+    /* Parse command line options */
+    static struct option long_options[] = {
+        {"trace",  required_argument, 0, 't'},
+        {"loops",  required_argument, 0, 'L'},
+        {"a-ip",   required_argument, 0, 'a'},
+        {"b-ip",   required_argument, 0, 'b'},
+        {"out",    required_argument, 0, 'o'},
+        {"verify", no_argument,       0, 'v'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:L:a:b:o:vh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'L':
+                loops_path = optarg;
+                break;
+            case 'a':
+            case 'b': {
+                uint64_t *ips = (opt == 'a') ? a_ips : b_ips;
+                unsigned *n = (opt == 'a') ? &n_a : &n_b;
+                if (*n == TRACE_LOOPS_MAX_IPS) {
+                    fprintf(stderr, "Error: At most %d --%c-ip options\n", TRACE_LOOPS_MAX_IPS, opt);
+                    return 1;
+                }
+                ips[(*n)++] = strtoull(optarg, NULL, 16);
+                break;
+            }
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'v':
+                verify = 1;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!trace_path) {
+        fprintf(stderr, "Error: --trace is required\n\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char default_out[4096];
+    if (!out_path) {
+        if (trace_index_path(default_out, sizeof(default_out), trace_path) != 0) {
+            fprintf(stderr, "Error: Trace path too long: %s\n", trace_path);
+            return 1;
+        }
+        out_path = default_out;
+    }
+
+    /* --verify only needs the stored hash */
+    struct trace_index old;
+    memset(&old, 0, sizeof(old));
+    uint64_t overhead_len = 0;
+    if (verify) {
+        if (trace_index_load_file(&old, out_path) != 0) {
+            return 1;
+        }
+    } else {
+        if (loops_path) {
+            struct trace_loops lp;
+            if (trace_loops_load(&lp, loops_path) != 0) {
+                return 1;
+            }
+            if (n_a == 0) {
+                memcpy(a_ips, lp.a_ips, sizeof(a_ips));
+                n_a = lp.n_a_ips;
+            }
+            if (n_b == 0) {
+                memcpy(b_ips, lp.b_ips, sizeof(b_ips));
+                n_b = lp.n_b_ips;
+            }
+            overhead_len = lp.overhead_len;
+        }
+        if (n_a == 0 || n_b == 0) {
+            fprintf(stderr, "Error: The A and B load IPs are required (--loops FILE, or --a-ip and --b-ip)\n\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    struct trace_reader rd;
+    if (trace_reader_open(&rd, trace_path) != 0) {
+        trace_index_free(&old);
+        return 1;
+    }
+
+    fprintf(stderr, "# Trace file: %s\n", trace_path);
+    if (!verify) {
+        fprintf(stderr, "# A IPs:");
+        for (unsigned k = 0; k < n_a; k++) {
+            fprintf(stderr, " 0x%lx", (unsigned long)a_ips[k]);
+        }
+        fprintf(stderr, "\n# B IPs:");
+        for (unsigned k = 0; k < n_b; k++) {
+            fprintf(stderr, " 0x%lx", (unsigned long)b_ips[k]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    struct index_builder b;
+    memset(&b, 0, sizeof(b));
+    b.a_ips = a_ips;
+    b.n_a = n_a;
+    b.b_ips = b_ips;
+    b.n_b = n_b;
+    b.state = SCAN_PRELUDE;
+    b.overhead_hint = overhead_len;
+    summary_init(&b.pend);
+    summary_init(&b.pend_tail);
+
+    /* One pass: hash every record, and (unless verifying) track the iterations */
+    uint64_t hash = TRACE_HASH_INIT;
+    uint64_t idx = 0;
+    int rc = 0;
+    const struct input_instr *recs;
+    int64_t n;
+    while (rc == 0 && (n = trace_reader_next(&rd, &recs, TRACE_READ_CHUNK)) > 0) {
+        trace_hash_records(&hash, recs, (uint64_t)n);
+        for (int64_t i = 0; !verify && i < n; i++) {
+            if (builder_add(&b, idx + (uint64_t)i, &recs[i]) != 0) {
+                rc = -1;
+                break;
+            }
+        }
+        idx += (uint64_t)n;
+    }
+    if (n < 0) {
+        rc = -1;
+    }
+    trace_reader_close(&rd);
+    uint64_t total_records = idx;
+
+    if (rc == 0 && verify) {
+        int ok = (hash == old.h.content_hash && total_records == old.h.total_records);
+        fprintf(stderr, "# Index: %s (%lu iterations)\n", out_path, (unsigned long)old.h.n_iters);
+        fprintf(stderr, "# Records: %lu (index: %lu)\n",
+                (unsigned long)total_records, (unsigned long)old.h.total_records);
+        fprintf(stderr, "# Content hash: %016lx (index: %016lx)\n",
+                (unsigned long)hash, (unsigned long)old.h.content_hash);
+        if (!ok) {
+            fprintf(stderr, "Error: The index does not match the trace; rebuild it\n");
+            rc = -1;
+        } else {
+            fprintf(stderr, "# OK: index matches the trace\n");
+        }
+        trace_index_free(&old);
+        return rc == 0 ? 0 : 1;
+    }
+
+    /* The last iteration's overhead ends like the one before it (or at the end of the trace) */
+    if (rc == 0 && b.state == SCAN_B) {
+        uint64_t end = b.last_b + 1 + b.overhead_hint;
+        rc = builder_finish(&b, end < total_records ? end : total_records, &b.pend_tail);
+    }
+    if (rc != 0) {
+        free(b.iters);
+        return 1;
+    }
+    if (b.n_iters == 0) {
+        fprintf(stderr, "Error: No A sweep followed by B loads found; check the IPs\n");
+        free(b.iters);
+        return 1;
+    }
+
+    struct trace_index ix;
+    memset(&ix, 0, sizeof(ix));
+    memcpy(ix.h.magic, TRACE_INDEX_MAGIC, sizeof(ix.h.magic));
+    ix.h.version = TRACE_INDEX_VERSION;
+    ix.h.record_size = sizeof(struct input_instr);
+    ix.h.total_records = total_records;
+    ix.h.content_hash = hash;
+    ix.h.n_iters = b.n_iters;
+    ix.h.n_a_ips = n_a;
+    ix.h.n_b_ips = n_b;
+    memcpy(ix.h.a_ips, a_ips, n_a * sizeof(a_ips[0]));
+    memcpy(ix.h.b_ips, b_ips, n_b * sizeof(b_ips[0]));
+    ix.iters = b.iters;
+
+    /* Length ranges over all iterations, as a quick regularity check */
+    uint64_t len_min[TRACE_REGIONS], len_max[TRACE_REGIONS];
+    for (int r = 0; r < TRACE_REGIONS; r++) {
+        len_min[r] = UINT64_MAX;
+        len_max[r] = 0;
+    }
+    for (uint64_t k = 0; k < ix.h.n_iters; k++) {
+        for (int r = 0; r < TRACE_REGIONS; r++) {
+            uint64_t begin, end;
+            trace_index_region(&ix, k, r, &begin, &end);
+            len_min[r] = (end - begin < len_min[r]) ? end - begin : len_min[r];
+            len_max[r] = (end - begin > len_max[r]) ? end - begin : len_max[r];
+        }
+    }
+
+    fprintf(stderr, "# Total records: %lu\n", (unsigned long)total_records);
+    fprintf(stderr, "# Content hash: %016lx\n", (unsigned long)hash);
+    fprintf(stderr, "# Iterations: %lu (first A at %lu)\n",
+            (unsigned long)ix.h.n_iters, (unsigned long)ix.iters[0].begin[TRACE_REGION_A]);
+    for (int r = 0; r < TRACE_REGIONS; r++) {
+        fprintf(stderr, "#   %-8s length %lu..%lu\n", trace_region_name(r),
+                (unsigned long)len_min[r], (unsigned long)len_max[r]);
+    }
+
+    rc = trace_index_stamp(&ix.h, trace_path);
+    if (rc == 0) {
+        rc = trace_index_save(&ix, out_path);
+    }
+    if (rc == 0) {
+        fprintf(stderr, "# Wrote %s (%lu bytes)\n", out_path,
+                (unsigned long)(sizeof(ix.h) + ix.h.n_iters * sizeof(ix.iters[0])));
+    }
+    trace_index_free(&ix);
+    return rc == 0 ? 0 : 1;
+}
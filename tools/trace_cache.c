@@ -0,0 +1,219 @@
+/*
+ * trace_cache.c - Set-associative cache model (LRU / SRRIP)
+ *
+ * See trace_cache.h. Each set is a row of `ways` tags plus the replacement
+ * state of the policy in use; a lookup is a linear scan of the row.
+ */
+
+#include "trace_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* SRRIP with 2-bit RRPVs */
+#define RRPV_MAX    3
+#define RRPV_INSERT 2
+
+int cache_policy_parse(const char *name) {
+    if (strcmp(name, "lru") == 0) {
+        return CACHE_POLICY_LRU;
+    }
+    if (strcmp(name, "srrip") == 0) {
+        return CACHE_POLICY_SRRIP;
+    }
+    return -1;
+}
+
+const char *cache_policy_name(int policy) {
+    return (policy == CACHE_POLICY_SRRIP) ? "srrip" : "lru";
+}
+
+int cache_config_parse(struct cache_config *cfg, const char *name, const char *spec) {
+    char *end;
+    uint64_t size = strtoull(spec, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': size <<= 10; end++; break;
+        case 'M': case 'm': size <<= 20; end++; break;
+        case 'G': case 'g': size <<= 30; end++; break;
+        default: break;
+    }
+
+    cfg->name = name;
+    cfg->size = size;
+    if (size == 0 && *end == '\0') {
+        return 0;  /* level disabled */
+    }
+    if (*end != ':') {
+        fprintf(stderr, "Error: %s: expected SIZE:WAYS[:POLICY], got '%s'\n", name, spec);
+        return -1;
+    }
+    cfg->ways = (unsigned)strtoul(end + 1, &end, 10);
+    if (*end == ':') {
+        cfg->policy = cache_policy_parse(end + 1);
+        if (cfg->policy < 0) {
+            fprintf(stderr, "Error: %s: unknown policy '%s' (lru, srrip)\n", name, end + 1);
+            return -1;
+        }
+    } else if (*end != '\0') {
+        fprintf(stderr, "Error: %s: expected SIZE:WAYS[:POLICY], got '%s'\n", name, spec);
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t cache_config_sets(const struct cache_config *cfg) {
+    uint64_t set_bytes = (uint64_t)cfg->ways * cfg->line;
+    if (set_bytes == 0 || cfg->size < set_bytes || cfg->size % set_bytes != 0) {
+        return 0;
+    }
+    return cfg->size / set_bytes;
+}
+
+int cache_init(struct cache_level *c, const struct cache_config *cfg) {
+    return cache_init_shard(c, cfg, 0);
+}
+
+int cache_init_shard(struct cache_level *c, const struct cache_config *cfg, unsigned shard_shift) {
+    memset(c, 0, sizeof(*c));
+    c->cfg = *cfg;
+    if (cfg->line == 0 || (cfg->line & (cfg->line - 1)) != 0) {
+        fprintf(stderr, "Error: Line size %u is not a power of two\n", cfg->line);
+        return -1;
+    }
+    if (cache_config_sets(cfg) == 0) {
+        fprintf(stderr, "Error: %s: %lu bytes is not a multiple of %u ways x %u-byte lines\n",
+                cfg->name, (unsigned long)cfg->size, cfg->ways, cfg->line);
+        return -1;
+    }
+
+    while ((1u << c->line_shift) < cfg->line) {
+        c->line_shift++;
+    }
+    c->n_sets = cache_config_sets(cfg);
+    c->set_mask = ((c->n_sets & (c->n_sets - 1)) == 0) ? c->n_sets - 1 : 0;
+    c->shard_shift = shard_shift;
+    if (shard_shift >= 64 || c->n_sets % (1ULL << shard_shift) != 0) {
+        fprintf(stderr, "Error: %s: %lu sets cannot be split into 2^%u shards\n",
+                cfg->name, (unsigned long)c->n_sets, shard_shift);
+        return -1;
+    }
+
+    uint64_t n = (c->n_sets >> shard_shift) * cfg->ways;
+    c->tags = malloc(n * sizeof(*c->tags));
+    if (cfg->policy == CACHE_POLICY_SRRIP) {
+        c->rrpv = malloc(n * sizeof(*c->rrpv));
+    } else {
+        c->stamp = malloc(n * sizeof(*c->stamp));
+    }
+    if (!c->tags || (!c->rrpv && !c->stamp)) {
+        fprintf(stderr, "Error: Out of memory for %s (%lu lines)\n", cfg->name, (unsigned long)n);
+        cache_free(c);
+        return -1;
+    }
+    cache_reset(c);
+    return 0;
+}
+
+void cache_reset(struct cache_level *c) {
+    uint64_t n = (c->n_sets >> c->shard_shift) * c->cfg.ways;
+    for (uint64_t i = 0; i < n; i++) {
+        c->tags[i] = CACHE_TAG_INVALID;
+    }
+    if (c->rrpv) {
+        memset(c->rrpv, RRPV_MAX, n * sizeof(*c->rrpv));
+    }
+    if (c->stamp) {
+        memset(c->stamp, 0, n * sizeof(*c->stamp));
+    }
+    c->clock = 0;
+    c->last_line = CACHE_TAG_INVALID;
+    c->accesses = 0;
+    c->misses = 0;
+}
+
+void cache_free(struct cache_level *c) {
+    free(c->tags);
+    free(c->stamp);
+    free(c->rrpv);
+    c->tags = NULL;
+    c->stamp = NULL;
+    c->rrpv = NULL;
+}
+
+/* Returns the way of line in the set at base, or ways on a miss (after filling a victim) */
+static unsigned access_lru(struct cache_level *c, uint64_t *tags, uint64_t line, uint64_t base) {
+    unsigned ways = c->cfg.ways;
+    uint64_t *stamp = c->stamp + base;
+    uint64_t now = ++c->clock;
+
+    unsigned victim = 0;
+    for (unsigned w = 0; w < ways; w++) {
+        if (tags[w] == line) {
+            stamp[w] = now;
+            return w;
+        }
+        if (stamp[w] < stamp[victim]) {
+            victim = w;  /* empty ways have stamp 0 and are taken first */
+        }
+    }
+    tags[victim] = line;
+    stamp[victim] = now;
+    c->last_slot = base + victim;
+    return ways;
+}
+
+static unsigned access_srrip(struct cache_level *c, uint64_t *tags, uint64_t line, uint64_t base) {
+    unsigned ways = c->cfg.ways;
+    uint8_t *rrpv = c->rrpv + base;
+
+    for (unsigned w = 0; w < ways; w++) {
+        if (tags[w] == line) {
+            rrpv[w] = 0;
+            return w;
+        }
+    }
+
+    /* Victim: first way predicted for distant re-reference, ageing the set until one is */
+    for (;;) {
+        for (unsigned w = 0; w < ways; w++) {
+            if (rrpv[w] == RRPV_MAX) {
+                tags[w] = line;
+                rrpv[w] = RRPV_INSERT;
+                c->last_slot = base + w;
+                return ways;
+            }
+        }
+        for (unsigned w = 0; w < ways; w++) {
+            rrpv[w]++;
+        }
+    }
+}
+
+int cache_access(struct cache_level *c, uint64_t line) {
+    c->accesses++;
+
+    /*
+     * A repeat of the previous access hits without a set lookup: nothing else
+     * touched this level in between, so the line is still resident and (LRU)
+     * already the most recently used way. SRRIP only has to promote it, in
+     * case the previous access was the miss that inserted it.
+     */
+    if (line == c->last_line) {
+        if (c->rrpv) {
+            c->rrpv[c->last_slot] = 0;
+        }
+        return 1;
+    }
+    c->last_line = line;
+
+    uint64_t base = cache_set_of(c, line) * c->cfg.ways;
+    unsigned way = (c->cfg.policy == CACHE_POLICY_SRRIP) ? access_srrip(c, c->tags + base, line, base)
+                                                         : access_lru(c, c->tags + base, line, base);
+    if (way == c->cfg.ways) {
+        c->misses++;
+        return 0;
+    }
+    c->last_slot = base + way;
+    return 1;
+}
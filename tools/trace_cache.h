@@ -0,0 +1,114 @@
+/*
+ * trace_cache.h - Set-associative cache model for trace_cachesim
+ *
+ * One struct cache_level per level; a demand access looks the line up,
+ * updates the replacement state and fills it on a miss:
+ *
+ *     struct cache_config cfg;
+ *     struct cache_level l1;
+ *     cache_config_parse(&cfg, "L1D", "48K:12:lru");
+ *     cache_init(&l1, &cfg);
+ *     if (!cache_access(&l1, addr >> l1.line_shift)) { ...miss... }
+ *     cache_free(&l1);
+ *
+ * The model keeps tags and replacement state only (no data, no dirty bits,
+ * no prefetchers); it is meant to rank trace variants quickly, not to
+ * replace a ChampSim run.
+ *
+ * Sets never interact, so a cache can also be split into 2^k shards by the
+ * low bits of the set index (cache_init_shard): shard r holds only the sets
+ * with (set % 2^k) == r, and simulating each shard on its own part of the
+ * line stream gives exactly the counts of the whole cache.
+ */
+
+#ifndef TRACE_CACHE_H
+#define TRACE_CACHE_H
+
+#include <stdint.h>
+
+/* Replacement policies */
+#define CACHE_POLICY_LRU   0
+#define CACHE_POLICY_SRRIP 1   /* static RRIP, 2-bit RRPV, insert at 2 (Jaleel et al. 2010) */
+
+struct cache_config {
+    const char *name;       /* "L1D", "L2", "LLC" */
+    uint64_t size;          /* bytes; 0 = level disabled */
+    unsigned ways;
+    unsigned line;          /* bytes, power of two */
+    int policy;             /* CACHE_POLICY_* */
+};
+
+struct cache_level {
+    struct cache_config cfg;
+    uint64_t n_sets;        /* of the whole cache */
+    uint64_t set_mask;      /* n_sets - 1 when n_sets is a power of two, else 0 */
+    unsigned shard_shift;   /* this object holds 1 / 2^shard_shift of the sets */
+    unsigned line_shift;
+    uint64_t *tags;         /* (n_sets >> shard_shift) * ways line addresses, CACHE_TAG_INVALID = empty */
+    uint64_t *stamp;        /* LRU: last use of each way */
+    uint8_t *rrpv;          /* SRRIP: re-reference prediction value of each way */
+    uint64_t clock;
+    uint64_t last_line;     /* most recently accessed line (always resident) */
+    uint64_t last_slot;     /* its index in tags[] */
+
+    uint64_t accesses;
+    uint64_t misses;
+};
+
+#define CACHE_TAG_INVALID UINT64_MAX
+
+/*
+ * Parse "SIZE:WAYS[:POLICY]" (SIZE with optional K/M/G suffix; "0" disables
+ * the level) into cfg, keeping cfg->line and cfg->policy as defaults.
+ * Returns 0, or -1 on a malformed spec (message printed to stderr).
+ */
+int cache_config_parse(struct cache_config *cfg, const char *name, const char *spec);
+
+/* Parse "lru" / "srrip". Returns CACHE_POLICY_*, or -1 if unknown. */
+int cache_policy_parse(const char *name);
+const char *cache_policy_name(int policy);
+
+/*
+ * Allocate an empty cache. size must be a multiple of ways * line.
+ * Returns 0, or -1 on error (message printed to stderr).
+ */
+int cache_init(struct cache_level *c, const struct cache_config *cfg);
+
+/*
+ * Same, but allocate only one of 2^shard_shift shards: the object then
+ * accepts just the lines whose set index is congruent to its shard modulo
+ * 2^shard_shift (the caller routes lines; see cache_shard_of()). The number
+ * of sets must be a multiple of 2^shard_shift.
+ */
+int cache_init_shard(struct cache_level *c, const struct cache_config *cfg, unsigned shard_shift);
+
+/* Sets of cfg (0 if the geometry is invalid) */
+uint64_t cache_config_sets(const struct cache_config *cfg);
+
+/* Empty the cache and zero the counters, keeping the geometry */
+void cache_reset(struct cache_level *c);
+
+void cache_free(struct cache_level *c);
+
+/* Set index of a line address, within this object's shard */
+static inline uint64_t cache_set_of(const struct cache_level *c, uint64_t line) {
+    uint64_t set = c->set_mask ? (line & c->set_mask) : (line % c->n_sets);
+    return set >> c->shard_shift;
+}
+
+/*
+ * Shard (of 2^shard_shift) that holds line. Valid for every level whose set
+ * count is a multiple of 2^shard_shift, since set = line mod n_sets then
+ * agrees with line in those low bits.
+ */
+static inline uint64_t cache_shard_of(uint64_t line, unsigned shard_shift) {
+    return line & ((1ULL << shard_shift) - 1);
+}
+
+/*
+ * Access line (an address >> line_shift): returns 1 on a hit, 0 on a miss
+ * (the line is then filled, evicting a victim). Counts the access.
+ */
+int cache_access(struct cache_level *c, uint64_t line);
+
+#endif /* TRACE_CACHE_H */
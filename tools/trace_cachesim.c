@@ -0,0 +1,583 @@
+/*
+ * trace_cachesim.c - Trace-driven L1D / L2 / LLC miss model
+ *
+ * Usage: trace_cachesim --trace PATH [--trace PATH ...]
+ *            [--l1d SPEC] [--l2 SPEC] [--llc SPEC] [--line BYTES] [--policy lru|srrip]
+ *            [--warmup N] [--max N] [--threads N]
+ *
+ * Replays the source_memory / destination_memory operands of every record
+ * through a three-level set-associative hierarchy (see trace_cache.h) and
+ * reports accesses, misses and MPKI per level, one CSV line per trace.
+ * Every record counts as one instruction, as in ChampSim.
+ *
+ * The hierarchy is non-inclusive and fills every level on a miss; stores are
+ * write-allocate accesses like loads; writebacks and prefetchers are not
+ * modelled. Operands of one record that fall in the same line are one access.
+ * The numbers are meant for ranking trace variants before running ChampSim
+ * on the promising ones.
+ *
+ * With --threads N the sets of every level are split into N shards that N
+ * worker threads simulate side by side (see "Set-sharded simulation" below);
+ * the counts are identical to the single-threaded run.
+ */
+
+#define _GNU_SOURCE  /* clock_gettime, sysconf(_SC_NPROCESSORS_ONLN) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace_io.h"
+#include "trace_cache.h"
+
+#define N_LEVELS 3
+
+/* Most --trace options */
+#define MAX_TRACES 1024
+
+/* Defaults: the ChampSim default core (48 KiB L1D, 512 KiB L2, 2 MiB LLC slice) */
+#define DEFAULT_L1D  "48K:12"
+#define DEFAULT_L2   "512K:8"
+#define DEFAULT_LLC  "2M:16"
+#define DEFAULT_LINE 64
+
+struct sim_result {
+    uint64_t records;                  /* after warmup */
+    uint64_t accesses[N_LEVELS];
+    uint64_t misses[N_LEVELS];
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s --trace PATH [--trace PATH ...] [--l1d SPEC] [--l2 SPEC] [--llc SPEC]\n", prog);
+    fprintf(stderr, "           [--line BYTES] [--policy lru|srrip] [--warmup N] [--max N] [--threads N]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --trace PATH     Trace file, raw or .xz (required, repeatable)\n");
+    fprintf(stderr, "  --l1d SPEC       L1D as SIZE:WAYS[:POLICY] (default: %s)\n", DEFAULT_L1D);
+    fprintf(stderr, "  --l2 SPEC        L2 (default: %s)\n", DEFAULT_L2);
+    fprintf(stderr, "  --llc SPEC       LLC (default: %s)\n", DEFAULT_LLC);
+    fprintf(stderr, "                   SIZE takes K/M/G suffixes; 0 disables the level\n");
+    fprintf(stderr, "  --line BYTES     Line size of all levels (default: %d)\n", DEFAULT_LINE);
+    fprintf(stderr, "  --policy P       Replacement policy of levels without one: lru, srrip (default: lru)\n");
+    fprintf(stderr, "  --warmup N       Simulate the first N records without counting them (default: 0)\n");
+    fprintf(stderr, "  --max N          Stop after N counted records (default: 0 = whole trace)\n");
+    fprintf(stderr, "  --threads N      Simulate with N threads, each owning 1/N of every level's sets;\n");
+    fprintf(stderr, "                   rounded down to a power of two dividing all set counts,\n");
+    fprintf(stderr, "                   0 = all CPUs (default: 1)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Output (CSV, one line per trace):\n");
+    fprintf(stderr, "  trace,instructions,<level>_accesses,<level>_misses,<level>_mpki,...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  %s --trace wp.trace --trace wp_ins.trace --llc 4M:16:srrip --warmup 10000000\n", prog);
+}
+
+/* Send one line down the hierarchy until a level hits */
+static void sim_line(struct cache_level *levels, unsigned n_levels, uint64_t line) {
+    for (unsigned l = 0; l < n_levels && !cache_access(&levels[l], line); l++) {
+    }
+}
+
+static void clear_counters(struct cache_level *levels, unsigned n_levels) {
+    for (unsigned l = 0; l < n_levels; l++) {
+        levels[l].accesses = 0;
+        levels[l].misses = 0;
+    }
+}
+
+/* ------------------------------------------------------------------------
+ * Set-sharded simulation (--threads)
+ *
+ * Each worker owns one shard of every level (the sets whose index has the
+ * worker's number in its low bits, see cache_init_shard). Per batch of
+ * records:
+ *   1. every worker splits its slice of the batch into per-shard line lists
+ *      (record order is kept within a list);
+ *   2. every worker replays the lists addressed to its shard, slice by slice,
+ *      i.e. its own part of the line stream in the original order.
+ * The two phases are separated by barriers and no data is shared in either,
+ * so no locks are needed. While the workers replay, the main thread reads
+ * (or decompresses) the next batch. Since sets never interact, the summed
+ * counters are identical to the serial run.
+ * ------------------------------------------------------------------------ */
+
+struct line_list {
+    uint64_t *lines;
+    uint64_t n;
+    uint64_t cap;
+};
+
+struct shard_sim;
+
+struct shard_worker {
+    struct shard_sim *sim;
+    unsigned id;
+    pthread_t thread;
+    struct cache_level levels[N_LEVELS];
+    struct line_list *out;       /* [n_shards]: this worker's slice, split by shard */
+    int failed;
+};
+
+struct shard_sim {
+    unsigned n_shards;           /* = number of workers, a power of two */
+    unsigned shard_shift;
+    unsigned n_levels;
+    unsigned line_shift;
+    struct shard_worker *workers;
+    pthread_barrier_t start;     /* a batch is ready (or done is set) */
+    pthread_barrier_t parted;    /* every slice has been split */
+
+    /* Current batch; written by the main thread only while the workers are parked */
+    const struct input_instr *recs;
+    uint64_t n;
+    int clear_after;             /* the batch ends the warmup */
+    int done;
+};
+
+static int line_list_push(struct line_list *l, uint64_t line) {
+    if (l->n == l->cap) {
+        uint64_t cap = l->cap ? 2 * l->cap : 4096;
+        uint64_t *lines = realloc(l->lines, cap * sizeof(*lines));
+        if (!lines) {
+            return -1;
+        }
+        l->lines = lines;
+        l->cap = cap;
+    }
+    l->lines[l->n++] = line;
+    return 0;
+}
+
+static void *shard_worker_main(void *arg) {
+    struct shard_worker *w = arg;
+    struct shard_sim *s = w->sim;
+
+    for (;;) {
+        pthread_barrier_wait(&s->start);
+        if (s->done) {
+            break;
+        }
+        int clear_after = s->clear_after;
+
+        /* Phase 1: split this worker's slice of the batch by shard */
+        uint64_t begin = s->n * w->id / s->n_shards;
+        uint64_t end = s->n * (w->id + 1) / s->n_shards;
+        for (unsigned u = 0; u < s->n_shards; u++) {
+            w->out[u].n = 0;
+        }
+        for (uint64_t i = begin; i < end; i++) {
+            uint64_t lines[TRACE_RECORD_MAX_LINES];
+            unsigned n = trace_record_lines(&s->recs[i], s->line_shift, lines);
+            for (unsigned j = 0; j < n; j++) {
+                if (line_list_push(&w->out[cache_shard_of(lines[j], s->shard_shift)], lines[j]) != 0) {
+                    w->failed = 1;
+                }
+            }
+        }
+
+        pthread_barrier_wait(&s->parted);
+
+        /* Phase 2: replay this shard's lines, slices in record order */
+        for (unsigned src = 0; src < s->n_shards; src++) {
+            const struct line_list *l = &s->workers[src].out[w->id];
+            for (uint64_t k = 0; k < l->n; k++) {
+                sim_line(w->levels, s->n_levels, l->lines[k]);
+            }
+        }
+        if (clear_after) {
+            clear_counters(w->levels, s->n_levels);
+        }
+    }
+    return NULL;
+}
+
+static void shard_sim_free(struct shard_sim *s) {
+    for (unsigned t = 0; t < s->n_shards; t++) {
+        struct shard_worker *w = &s->workers[t];
+        for (unsigned l = 0; l < s->n_levels; l++) {
+            cache_free(&w->levels[l]);
+        }
+        for (unsigned u = 0; w->out && u < s->n_shards; u++) {
+            free(w->out[u].lines);
+        }
+        free(w->out);
+    }
+    free(s->workers);
+    s->workers = NULL;
+}
+
+/*
+ * Set up 2^shard_shift workers, each with its shard of levels[].
+ * Returns 0, or -1 on error (message printed to stderr).
+ */
+static int shard_sim_init(struct shard_sim *s, const struct cache_level *levels, unsigned n_levels,
+                          unsigned shard_shift) {
+    memset(s, 0, sizeof(*s));
+    s->n_shards = 1u << shard_shift;
+    s->shard_shift = shard_shift;
+    s->n_levels = n_levels;
+    s->line_shift = levels[0].line_shift;
+    s->workers = calloc(s->n_shards, sizeof(*s->workers));
+    if (!s->workers) {
+        fprintf(stderr, "Error: Out of memory for %u workers\n", s->n_shards);
+        return -1;
+    }
+    for (unsigned t = 0; t < s->n_shards; t++) {
+        struct shard_worker *w = &s->workers[t];
+        w->sim = s;
+        w->id = t;
+        w->out = calloc(s->n_shards, sizeof(*w->out));
+        if (!w->out) {
+            fprintf(stderr, "Error: Out of memory for %u workers\n", s->n_shards);
+            shard_sim_free(s);
+            return -1;
+        }
+        for (unsigned l = 0; l < n_levels; l++) {
+            if (cache_init_shard(&w->levels[l], &levels[l].cfg, shard_shift) != 0) {
+                shard_sim_free(s);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Empty the shards and start the workers */
+static void shard_sim_start(struct shard_sim *s) {
+    for (unsigned t = 0; t < s->n_shards; t++) {
+        for (unsigned l = 0; l < s->n_levels; l++) {
+            cache_reset(&s->workers[t].levels[l]);
+        }
+        s->workers[t].failed = 0;
+    }
+    s->done = 0;
+    pthread_barrier_init(&s->start, NULL, s->n_shards + 1);
+    pthread_barrier_init(&s->parted, NULL, s->n_shards + 1);
+
+    for (unsigned t = 0; t < s->n_shards; t++) {
+        if (pthread_create(&s->workers[t].thread, NULL, shard_worker_main, &s->workers[t]) != 0) {
+            fprintf(stderr, "Error: Cannot create simulation threads\n");
+            exit(1);  /* the started workers are parked on a barrier sized for all of them */
+        }
+    }
+}
+
+/*
+ * Hand one batch to the workers. Returns once it has been split, so the
+ * caller may then reuse the records' buffer.
+ */
+static void shard_sim_batch(struct shard_sim *s, const struct input_instr *recs, uint64_t n, int clear_after) {
+    s->recs = recs;
+    s->n = n;
+    s->clear_after = clear_after;
+    pthread_barrier_wait(&s->start);
+    pthread_barrier_wait(&s->parted);
+}
+
+/* Let the workers finish the last batch and exit. Returns 0, or -1 if a worker ran out of memory. */
+static int shard_sim_stop(struct shard_sim *s) {
+    s->done = 1;
+    pthread_barrier_wait(&s->start);
+    int rc = 0;
+    for (unsigned t = 0; t < s->n_shards; t++) {
+        pthread_join(s->workers[t].thread, NULL);
+        if (s->workers[t].failed) {
+            rc = -1;
+        }
+    }
+    pthread_barrier_destroy(&s->start);
+    pthread_barrier_destroy(&s->parted);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Out of memory splitting the line stream\n");
+    }
+    return rc;
+}
+
+/*
+ * Simulate one trace on freshly emptied levels, serially or (sh != NULL)
+ * on the set-sharded workers.
+ * Returns 0 on success, -1 on error.
+ */
+static int sim_trace(const char *path, struct cache_level *levels, unsigned n_levels,
+                     struct shard_sim *sh, uint64_t warmup, uint64_t max_records,
+                     struct sim_result *res) {
+    struct trace_reader rd;
+    if (trace_reader_open(&rd, path) != 0) {
+        return -1;
+    }
+    for (unsigned l = 0; l < n_levels; l++) {
+        cache_reset(&levels[l]);
+    }
+    if (sh) {
+        shard_sim_start(sh);
+    }
+    unsigned line_shift = levels[0].line_shift;
+
+    uint64_t idx = 0;
+    uint64_t limit = max_records ? warmup + max_records : UINT64_MAX;
+    const struct input_instr *recs;
+    int64_t n = 0;
+    while (idx < limit) {
+        /* Stop each batch at the end of the warmup so the counters can be cleared there */
+        uint64_t want = (idx < warmup) ? warmup - idx : limit - idx;
+        n = trace_reader_next(&rd, &recs, want < TRACE_READ_CHUNK ? want : TRACE_READ_CHUNK);
+        if (n <= 0) {
+            break;
+        }
+        idx += (uint64_t)n;
+        if (sh) {
+            shard_sim_batch(sh, recs, (uint64_t)n, idx == warmup);
+            continue;
+        }
+        for (int64_t i = 0; i < n; i++) {
+            uint64_t lines[TRACE_RECORD_MAX_LINES];
+            unsigned k = trace_record_lines(&recs[i], line_shift, lines);
+            for (unsigned j = 0; j < k; j++) {
+                sim_line(levels, n_levels, lines[j]);
+            }
+        }
+        if (idx == warmup) {
+            clear_counters(levels, n_levels);
+        }
+    }
+    int rc = (n < 0) ? -1 : 0;
+    if (sh && shard_sim_stop(sh) != 0) {
+        rc = -1;
+    }
+    trace_reader_close(&rd);
+    if (rc != 0) {
+        return -1;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->records = (idx > warmup) ? idx - warmup : 0;
+    for (unsigned l = 0; l < n_levels; l++) {
+        if (!sh) {
+            res->accesses[l] = levels[l].accesses;
+            res->misses[l] = levels[l].misses;
+            continue;
+        }
+        for (unsigned t = 0; t < sh->n_shards; t++) {
+            res->accesses[l] += sh->workers[t].levels[l].accesses;
+            res->misses[l] += sh->workers[t].levels[l].misses;
+        }
+    }
+    if (idx < warmup) {
+        fprintf(stderr, "# Warning: %s has only %lu records, all of them warmup\n",
+                path, (unsigned long)idx);
+    }
+    return 0;
+}
+
+static double per_kilo(uint64_t n, uint64_t records) {
+    return records ? 1000.0 * (double)n / (double)records : 0.0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *traces[MAX_TRACES];
+    unsigned n_traces = 0;
+    const char *specs[N_LEVELS] = { DEFAULT_L1D, DEFAULT_L2, DEFAULT_LLC };
+    static const char *const names[N_LEVELS] = { "L1D", "L2", "LLC" };
+    unsigned line = DEFAULT_LINE;
+    int policy = CACHE_POLICY_LRU;
+    uint64_t warmup = 0;
+    uint64_t max_records = 0;
+    long n_threads = 1;
+
+    /* Parse command line options */
+    static struct option long_options[] = {
+        {"trace",  required_argument, 0, 't'},
+        {"l1d",    required_argument, 0, '1'},
+        {"l2",     required_argument, 0, '2'},
+        {"llc",    required_argument, 0, '3'},
+        {"line",   required_argument, 0, 'l'},
+        {"policy", required_argument, 0, 'p'},
+        {"warmup", required_argument, 0, 'w'},
+        {"max",    required_argument, 0, 'm'},
+        {"threads", required_argument, 0, 'j'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:1:2:3:l:p:w:m:j:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                if (n_traces == MAX_TRACES) {
+                    fprintf(stderr, "Error: At most %d --trace options\n", MAX_TRACES);
+                    return 1;
+                }
+                traces[n_traces++] = optarg;
+                break;
+            case '1':
+            case '2':
+            case '3':
+                specs[opt - '1'] = optarg;
+                break;
+            case 'l':
+                line = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                policy = cache_policy_parse(optarg);
+                if (policy < 0) {
+                    fprintf(stderr, "Error: Unknown --policy '%s' (lru, srrip)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'w':
+                warmup = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                max_records = strtoull(optarg, NULL, 10);
+                break;
+            case 'j':
+                n_threads = strtol(optarg, NULL, 10);
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (n_traces == 0) {
+        fprintf(stderr, "Error: --trace is required\n\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (n_threads < 0) {
+        fprintf(stderr, "Error: --threads must be >= 0\n");
+        return 1;
+    }
+    if (n_threads == 0) {
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_threads < 1) {
+            n_threads = 1;
+        }
+    }
+
+    /* Build the hierarchy; disabled levels are left out */
+    struct cache_level levels[N_LEVELS];
+    const char *level_names[N_LEVELS];
+    unsigned n_levels = 0;
+    for (unsigned l = 0; l < N_LEVELS; l++) {
+        struct cache_config cfg;
+        cfg.line = line;
+        cfg.policy = policy;
+        cfg.ways = 0;
+        if (cache_config_parse(&cfg, names[l], specs[l]) != 0) {
+            return 1;
+        }
+        if (cfg.size == 0) {
+            continue;
+        }
+        if (cache_init(&levels[n_levels], &cfg) != 0) {
+            for (unsigned k = 0; k < n_levels; k++) {
+                cache_free(&levels[k]);
+            }
+            return 1;
+        }
+        level_names[n_levels++] = names[l];
+    }
+    if (n_levels == 0) {
+        fprintf(stderr, "Error: All cache levels are disabled\n");
+        return 1;
+    }
+
+    for (unsigned l = 0; l < n_levels; l++) {
+        const struct cache_level *c = &levels[l];
+        fprintf(stderr, "# %-3s %8lu KiB, %2u-way, %6lu sets, %u B lines, %s\n", level_names[l],
+                (unsigned long)(c->cfg.size >> 10), c->cfg.ways, (unsigned long)c->n_sets,
+                c->cfg.line, cache_policy_name(c->cfg.policy));
+    }
+    if (warmup > 0) {
+        fprintf(stderr, "# Warmup: %lu records\n", (unsigned long)warmup);
+    }
+
+    /*
+     * Shards must split every level's sets evenly: use the largest power of
+     * two <= n_threads that divides all set counts.
+     */
+    struct shard_sim shards;
+    struct shard_sim *sh = NULL;
+    if (n_threads > 1) {
+        unsigned shift = 0;
+        while ((2L << shift) <= n_threads) {
+            int fits = 1;
+            for (unsigned l = 0; l < n_levels; l++) {
+                fits &= (levels[l].n_sets % (2ULL << shift) == 0);
+            }
+            if (!fits) {
+                break;
+            }
+            shift++;
+        }
+        if (shift == 0) {
+            fprintf(stderr, "# Note: set counts are odd, cannot shard; running single-threaded\n");
+        } else {
+            if ((1L << shift) != n_threads) {
+                fprintf(stderr, "# Note: --threads %ld rounded down to %u set shards\n",
+                        n_threads, 1u << shift);
+            }
+            if (shard_sim_init(&shards, levels, n_levels, shift) != 0) {
+                for (unsigned l = 0; l < n_levels; l++) {
+                    cache_free(&levels[l]);
+                }
+                return 1;
+            }
+            sh = &shards;
+            fprintf(stderr, "# Threads: %u (set shards)\n", sh->n_shards);
+        }
+    }
+    fprintf(stderr, "#\n");
+
+    printf("trace,instructions");
+    for (unsigned l = 0; l < n_levels; l++) {
+        printf(",%s_accesses,%s_misses,%s_mpki", level_names[l], level_names[l], level_names[l]);
+    }
+    printf("\n");
+
+    int rc = 0;
+    for (unsigned t = 0; t < n_traces; t++) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        struct sim_result res;
+        if (sim_trace(traces[t], levels, n_levels, sh, warmup, max_records, &res) != 0) {
+            rc = -1;
+            continue;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double sec = (double)(t1.tv_sec - t0.tv_sec) + 1e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+        fprintf(stderr, "# %s: %lu records in %.2f s (%.1f M records/s)\n", traces[t],
+                (unsigned long)(res.records + warmup), sec,
+                sec > 0 ? (double)(res.records + warmup) / sec / 1e6 : 0.0);
+        for (unsigned l = 0; l < n_levels; l++) {
+            fprintf(stderr, "#   %-3s MPKI %8.3f  (miss rate %.4f)\n", level_names[l],
+                    per_kilo(res.misses[l], res.records),
+                    res.accesses[l] ? (double)res.misses[l] / (double)res.accesses[l] : 0.0);
+        }
+
+        printf("%s,%lu", traces[t], (unsigned long)res.records);
+        for (unsigned l = 0; l < n_levels; l++) {
+            printf(",%lu,%lu,%.4f", (unsigned long)res.accesses[l], (unsigned long)res.misses[l],
+                   per_kilo(res.misses[l], res.records));
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    if (sh) {
+        shard_sim_free(sh);
+    }
+    for (unsigned l = 0; l < n_levels; l++) {
+        cache_free(&levels[l]);
+    }
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,472 @@
+/*
+ * trace_detect_loops.c - Find the A sweep / B chunk loop structure of a trace
+ *
+ * Usage: trace_detect_loops --trace PATH [--out FILE] [--gap N]
+ *            [--a-ip IP] [--b-ip IP]
+ *
+ * Scans the trace once (raw, or .xz decoded on the fly) and finds the outer
+ * loop of run_kernel(): every iteration sweeps the whole of A, then reads
+ * one chunk of B, then runs a few loop-overhead instructions.
+ *
+ * Every memory-accessing IP is tracked in a hash table. Its occurrences are
+ * split into bursts (runs with gaps of at most --gap records); an inner-loop
+ * load of the kernel has one burst per outer iteration, all with the same
+ * period. Among the periodic IPs, A loads start every burst at the same
+ * address (A is re-swept) while B loads start at a new address each time
+ * (B advances chunk by chunk). From the first bursts the tool derives
+ * first_a_begin, a_len, b_len, the overhead length and the iteration count,
+ * and writes them as JSON (see trace_loops.h) for the surgery tools.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "trace_io.h"
+#include "trace_loops.h"
+
+/* Default maximum distance between two occurrences of an IP within one burst */
+#define DEFAULT_GAP 64
+
+/* Initial IP table size (power of two) */
+#define IP_TABLE_INIT 4096
+
+struct ip_stat {
+    uint64_t ip;                  /* 0 = empty slot */
+    uint64_t count;               /* memory-accessing records */
+    uint64_t last_idx;
+    uint64_t addr_min;
+    uint64_t addr_max;
+    uint64_t start_addr0;         /* address at the start of the first burst */
+    int start_const;              /* every burst starts at start_addr0 */
+
+    uint64_t n_bursts;
+    uint64_t burst_start;         /* current burst */
+    uint64_t first_burst_start;
+    uint64_t first_burst_last;    /* last occurrence in the first burst */
+    uint64_t second_burst_start;
+    uint64_t period0;             /* first burst start -> second burst start */
+    uint64_t n_period0;           /* burst intervals equal to period0 */
+    uint64_t period_min;
+    uint64_t period_max;
+};
+
+struct ip_table {
+    struct ip_stat *slots;
+    size_t cap;
+    size_t used;
+};
+
+static size_t ip_hash(uint64_t ip, size_t cap) {
+    return (size_t)((ip * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+}
+
+static int ip_table_grow(struct ip_table *t) {
+    size_t cap = t->cap ? 2 * t->cap : IP_TABLE_INIT;
+    struct ip_stat *slots = calloc(cap, sizeof(*slots));
+    if (!slots) {
+        fprintf(stderr, "Error: Out of memory for the IP table\n");
+        return -1;
+    }
+    for (size_t i = 0; i < t->cap; i++) {
+        if (t->slots[i].ip == 0) {
+            continue;
+        }
+        size_t h = ip_hash(t->slots[i].ip, cap);
+        while (slots[h].ip != 0) {
+            h = (h + 1) & (cap - 1);
+        }
+        slots[h] = t->slots[i];
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->cap = cap;
+    return 0;
+}
+
+static struct ip_stat *ip_table_get(struct ip_table *t, uint64_t ip) {
+    if (2 * (t->used + 1) > t->cap && ip_table_grow(t) != 0) {
+        return NULL;
+    }
+    size_t h = ip_hash(ip, t->cap);
+    while (t->slots[h].ip != 0 && t->slots[h].ip != ip) {
+        h = (h + 1) & (t->cap - 1);
+    }
+    if (t->slots[h].ip == 0) {
+        t->slots[h].ip = ip;
+        t->used++;
+    }
+    return &t->slots[h];
+}
+
+static void ip_stat_add(struct ip_stat *s, uint64_t idx, uint64_t addr, uint64_t gap) {
+    if (s->count == 0) {
+        s->n_bursts = 1;
+        s->burst_start = idx;
+        s->first_burst_start = idx;
+        s->start_addr0 = addr;
+        s->start_const = 1;
+        s->addr_min = addr;
+        s->addr_max = addr;
+    } else if (idx - s->last_idx > gap) {
+        uint64_t period = idx - s->burst_start;
+        if (s->n_bursts == 1) {
+            s->first_burst_last = s->last_idx;
+            s->second_burst_start = idx;
+            s->period0 = period;
+            s->period_min = period;
+            s->period_max = period;
+        }
+        if (period == s->period0) {
+            s->n_period0++;
+        }
+        if (period < s->period_min) {
+            s->period_min = period;
+        }
+        if (period > s->period_max) {
+            s->period_max = period;
+        }
+        if (addr != s->start_addr0) {
+            s->start_const = 0;
+        }
+        s->burst_start = idx;
+        s->n_bursts++;
+    }
+
+    if (addr < s->addr_min) {
+        s->addr_min = addr;
+    }
+    if (addr > s->addr_max) {
+        s->addr_max = addr;
+    }
+    s->count++;
+    s->last_idx = idx;
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s --trace PATH [--out FILE] [--gap N] [--a-ip IP] [--b-ip IP]\n", prog);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --trace PATH     Path to trace file, raw or .xz (required)\n");
+    fprintf(stderr, "  --out FILE       Write the JSON result to FILE (default: stdout)\n");
+    fprintf(stderr, "  --gap N          Max records between two loads of one burst (default: %d)\n", DEFAULT_GAP);
+    fprintf(stderr, "  --a-ip IP        Use this IP as the A load instead of detecting it (hex)\n");
+    fprintf(stderr, "  --b-ip IP        Use this IP as the B load instead of detecting it (hex)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Output: JSON with first_a_begin, a_len, b_begin, b_access_len, overhead_len,\n");
+    fprintf(stderr, "b_len and iterations, accepted by trace_insert_all_iters / trace_insert_b_at_a\n");
+    fprintf(stderr, "(--loops FILE) and trace_surgery (iters loops=FILE ...).\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  %s --trace wp.trace.xz --out wp.loops.json\n", prog);
+}
+
+static int ip_stat_cmp(const void *pa, const void *pb) {
+    const struct ip_stat *a = *(const struct ip_stat *const *)pa;
+    const struct ip_stat *b = *(const struct ip_stat *const *)pb;
+    return (a->ip > b->ip) - (a->ip < b->ip);
+}
+
+/* s as a JSON string literal: quotes, backslashes and control characters escaped */
+static void print_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_ip_list(FILE *out, struct ip_stat *const *group, unsigned n) {
+    fprintf(out, "[");
+    for (unsigned k = 0; k < n; k++) {
+        fprintf(out, "%s\"0x%lx\"", k ? ", " : "", (unsigned long)group[k]->ip);
+    }
+    fprintf(out, "]");
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = NULL;
+    const char *out_path = NULL;
+    uint64_t gap = DEFAULT_GAP;
+    uint64_t force_a_ip = 0;
+    uint64_t force_b_ip = 0;
+
+    /* Parse command line options */
+    static struct option long_options[] = {
+        {"trace", required_argument, 0, 't'},
+        {"out",   required_argument, 0, 'o'},
+        {"gap",   required_argument, 0, 'g'},
+        {"a-ip",  required_argument, 0, 'a'},
+        {"b-ip",  required_argument, 0, 'b'},
+        {"help",  no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:o:g:a:b:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'g':
+                gap = strtoull(optarg, NULL, 10);
+                break;
+            case 'a':
+                force_a_ip = strtoull(optarg, NULL, 16);
+                break;
+            case 'b':
+                force_b_ip = strtoull(optarg, NULL, 16);
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!trace_path) {
+        fprintf(stderr, "Error: --trace is required\n\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!force_a_ip != !force_b_ip) {
+        fprintf(stderr, "Error: --a-ip and --b-ip must be given together\n");
+        return 1;
+    }
+    if (gap == 0) {
+        fprintf(stderr, "Error: --gap must be >= 1\n");
+        return 1;
+    }
+
+    struct trace_reader rd;
+    if (trace_reader_open(&rd, trace_path) != 0) {
+        return 1;
+    }
+
+    fprintf(stderr, "# Trace file: %s\n", trace_path);
+    fprintf(stderr, "# Burst gap: %lu records\n", (unsigned long)gap);
+
+    /* One pass: per-IP occurrence / burst statistics */
+    struct ip_table table;
+    memset(&table, 0, sizeof(table));
+    uint64_t idx = 0;
+    int rc = 0;
+    const struct input_instr *recs;
+    int64_t n;
+    while (rc == 0 && (n = trace_reader_next(&rd, &recs, TRACE_READ_CHUNK)) > 0) {
+        for (int64_t i = 0; i < n; i++, idx++) {
+            uint64_t addr = trace_record_addr(&recs[i]);
+            if (addr == 0 || recs[i].ip == 0) {
+                continue;
+            }
+            struct ip_stat *s = ip_table_get(&table, recs[i].ip);
+            if (!s) {
+                rc = -1;
+                break;
+            }
+            ip_stat_add(s, idx, addr, gap);
+        }
+    }
+    if (n < 0) {
+        rc = -1;
+    }
+    trace_reader_close(&rd);
+    if (rc != 0) {
+        free(table.slots);
+        return 1;
+    }
+
+    uint64_t total_records = idx;
+    fprintf(stderr, "# Total records: %lu\n", (unsigned long)total_records);
+    fprintf(stderr, "# Memory-accessing IPs: %lu\n", (unsigned long)table.used);
+
+    /* Pick the kernel IPs: the hottest periodic IP sets the period */
+    struct ip_stat *hot = NULL;
+    for (size_t k = 0; k < table.cap; k++) {
+        struct ip_stat *s = &table.slots[k];
+        if (s->ip == 0) {
+            continue;
+        }
+        if (s->count > 0 && s->n_bursts == 1) {
+            s->first_burst_last = s->last_idx;
+        }
+        if (s->n_bursts >= 2 && (!hot || s->count > hot->count)) {
+            hot = s;
+        }
+    }
+
+    struct ip_stat *a_ips[TRACE_LOOPS_MAX_IPS];
+    struct ip_stat *b_ips[TRACE_LOOPS_MAX_IPS];
+    unsigned n_a = 0;
+    unsigned n_b = 0;
+    for (size_t k = 0; k < table.cap; k++) {
+        struct ip_stat *s = &table.slots[k];
+        if (s->ip == 0) {
+            continue;
+        }
+        int is_a;
+        if (force_a_ip || force_b_ip) {
+            if (s->ip != force_a_ip && s->ip != force_b_ip) {
+                continue;
+            }
+            is_a = (s->ip == force_a_ip);
+        } else {
+            if (!hot || s->n_bursts < 2 || s->period0 != hot->period0 || 2 * s->n_bursts < hot->n_bursts) {
+                continue;
+            }
+            is_a = s->start_const;
+        }
+        if (is_a && n_a < TRACE_LOOPS_MAX_IPS) {
+            a_ips[n_a++] = s;
+        } else if (!is_a && n_b < TRACE_LOOPS_MAX_IPS) {
+            b_ips[n_b++] = s;
+        }
+    }
+
+    if ((force_a_ip && n_a == 0) || (force_b_ip && n_b == 0)) {
+        fprintf(stderr, "Error: --a-ip / --b-ip not found among the memory-accessing IPs\n");
+        free(table.slots);
+        return 1;
+    }
+    if (n_a == 0 || n_b == 0) {
+        fprintf(stderr, "Error: No periodic A sweep / B chunk loads found (%u A, %u B candidate IPs); "
+                "try --gap or --a-ip/--b-ip\n", n_a, n_b);
+        free(table.slots);
+        return 1;
+    }
+
+    qsort(a_ips, n_a, sizeof(a_ips[0]), ip_stat_cmp);
+    qsort(b_ips, n_b, sizeof(b_ips[0]), ip_stat_cmp);
+
+    /* Derive the iteration layout from the first two bursts */
+    uint64_t first_a_begin = UINT64_MAX;
+    uint64_t next_a = UINT64_MAX;
+    uint64_t iterations = 0;
+    uint64_t a_addr_min = UINT64_MAX, a_addr_max = 0;
+    int regular = 1;
+    for (unsigned k = 0; k < n_a; k++) {
+        const struct ip_stat *s = a_ips[k];
+        if (s->first_burst_start < first_a_begin) {
+            first_a_begin = s->first_burst_start;
+        }
+        if (s->n_bursts >= 2 && s->second_burst_start < next_a) {
+            next_a = s->second_burst_start;
+        }
+        if (s->n_bursts > iterations) {
+            iterations = s->n_bursts;
+        }
+        if (s->n_period0 + 1 != s->n_bursts) {
+            regular = 0;
+        }
+        a_addr_min = s->addr_min < a_addr_min ? s->addr_min : a_addr_min;
+        a_addr_max = s->addr_max > a_addr_max ? s->addr_max : a_addr_max;
+    }
+
+    uint64_t b_begin = UINT64_MAX;
+    uint64_t b_last = 0;
+    uint64_t b_addr_min = UINT64_MAX, b_addr_max = 0;
+    for (unsigned k = 0; k < n_b; k++) {
+        const struct ip_stat *s = b_ips[k];
+        if (s->first_burst_start < b_begin) {
+            b_begin = s->first_burst_start;
+        }
+        if (s->first_burst_last > b_last) {
+            b_last = s->first_burst_last;
+        }
+        if (s->n_period0 + 1 != s->n_bursts) {
+            regular = 0;
+        }
+        b_addr_min = s->addr_min < b_addr_min ? s->addr_min : b_addr_min;
+        b_addr_max = s->addr_max > b_addr_max ? s->addr_max : b_addr_max;
+    }
+
+    if (next_a == UINT64_MAX || !(first_a_begin < b_begin && b_begin <= b_last && b_last < next_a)) {
+        fprintf(stderr, "Error: Burst layout is not A sweep -> B chunk -> next A sweep "
+                "(A at %lu, B [%lu, %lu], next A at %lu)\n",
+                (unsigned long)first_a_begin, (unsigned long)b_begin, (unsigned long)b_last,
+                (unsigned long)next_a);
+        free(table.slots);
+        return 1;
+    }
+
+    uint64_t iter_len = next_a - first_a_begin;
+    uint64_t a_len = b_begin - first_a_begin;
+    uint64_t b_len = iter_len - a_len;
+    uint64_t b_access_len = b_last - b_begin + 1;
+    uint64_t overhead_len = b_len - b_access_len;
+
+    /* Only whole iterations can be edited */
+    uint64_t whole = (total_records - first_a_begin) / iter_len;
+    if (iterations > whole) {
+        fprintf(stderr, "# Note: last iteration is cut off by the end of the trace; reporting %lu of %lu\n",
+                (unsigned long)whole, (unsigned long)iterations);
+        iterations = whole;
+    }
+
+    fprintf(stderr, "# Period: %lu records (A bursts: %lu, regular: %s)\n",
+            (unsigned long)iter_len, (unsigned long)a_ips[0]->n_bursts, regular ? "yes" : "no");
+    fprintf(stderr, "# first_a_begin = %lu, a_len = %lu, b_len = %lu (B accesses %lu + overhead %lu), iterations = %lu\n",
+            (unsigned long)first_a_begin, (unsigned long)a_len, (unsigned long)b_len,
+            (unsigned long)b_access_len, (unsigned long)overhead_len, (unsigned long)iterations);
+    if (!regular) {
+        fprintf(stderr, "# Warning: burst periods vary (e.g. outer_scale > 1 or a truncated trace);\n");
+        fprintf(stderr, "#          the values above describe the first iterations only\n");
+    }
+
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (!out) {
+            perror("fopen");
+            fprintf(stderr, "Error: Cannot open output file: %s\n", out_path);
+            free(table.slots);
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"trace\": ");
+    print_json_string(out, trace_path);
+    fprintf(out, ",\n");
+    fprintf(out, "  \"total_records\": %lu,\n", (unsigned long)total_records);
+    fprintf(out, "  \"a_ips\": ");
+    print_ip_list(out, a_ips, n_a);
+    fprintf(out, ",\n");
+    fprintf(out, "  \"b_ips\": ");
+    print_ip_list(out, b_ips, n_b);
+    fprintf(out, ",\n");
+    fprintf(out, "  \"a_addr_min\": \"0x%lx\",\n", (unsigned long)a_addr_min);
+    fprintf(out, "  \"a_addr_max\": \"0x%lx\",\n", (unsigned long)a_addr_max);
+    fprintf(out, "  \"b_addr_min\": \"0x%lx\",\n", (unsigned long)b_addr_min);
+    fprintf(out, "  \"b_addr_max\": \"0x%lx\",\n", (unsigned long)b_addr_max);
+    fprintf(out, "  \"first_a_begin\": %lu,\n", (unsigned long)first_a_begin);
+    fprintf(out, "  \"a_len\": %lu,\n", (unsigned long)a_len);
+    fprintf(out, "  \"b_begin\": %lu,\n", (unsigned long)b_begin);
+    fprintf(out, "  \"b_access_len\": %lu,\n", (unsigned long)b_access_len);
+    fprintf(out, "  \"overhead_len\": %lu,\n", (unsigned long)overhead_len);
+    fprintf(out, "  \"b_len\": %lu,\n", (unsigned long)b_len);
+    fprintf(out, "  \"iter_len\": %lu,\n", (unsigned long)iter_len);
+    fprintf(out, "  \"iterations\": %lu,\n", (unsigned long)iterations);
+    fprintf(out, "  \"b_ratio_access_only\": %.6f,\n", (double)b_access_len / (double)b_len);
+    fprintf(out, "  \"regular\": %s\n", regular ? "true" : "false");
+    fprintf(out, "}\n");
+
+    if (out != stdout && fclose(out) != 0) {
+        perror("fclose");
+        rc = -1;
+    }
+    free(table.slots);
+    return rc == 0 ? 0 : 1;
+}
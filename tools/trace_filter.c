@@ -0,0 +1,215 @@
+/*
+ * trace_filter.c - Vectorized address-range filter for trace records
+ *
+ * See trace_filter.h for the interface.
+ */
+
+#include "trace_filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TRACE_FILTER_X86 1
+#include <immintrin.h>
+#endif
+
+/* The kernels rely on the record being 8 qwords with the operands at qwords 2-7 */
+typedef char trace_filter_layout_check[
+    (sizeof(struct input_instr) == 64 &&
+     offsetof(struct input_instr, destination_memory) == 8 * TRACE_FILTER_LANE_DST0 &&
+     offsetof(struct input_instr, source_memory) == 8 * TRACE_FILTER_LANE_SRC0) ? 1 : -1];
+
+/* Records per block: one 64-bit "any hit" word covers 8 records x 8 lanes */
+#define BLOCK_RECORDS 8
+
+/* ------------------------------------------------------------------------
+ * Scalar
+ * ------------------------------------------------------------------------ */
+
+static unsigned scalar_lanes(const struct input_instr *rec, uint64_t base, uint64_t size) {
+    unsigned m = 0;
+    for (unsigned lane = TRACE_FILTER_LANE_DST0; lane < 8; lane++) {
+        uint64_t addr = trace_filter_lane_addr(rec, lane);
+        if (addr != 0 && addr - base < size) {
+            m |= 1u << lane;
+        }
+    }
+    return m;
+}
+
+/* Scan records [begin, n); also finishes the partial block for the vector kernels */
+static size_t scan_scalar_from(const struct trace_filter *f, const struct input_instr *recs,
+                               size_t begin, size_t n, struct trace_filter_hit *hits) {
+    size_t k = 0;
+    for (size_t i = begin; i < n; i++) {
+        uint64_t mask = 0;
+        for (unsigned r = 0; r < f->n_ranges; r++) {
+            mask |= (uint64_t)scalar_lanes(&recs[i], f->ranges[r].base, f->ranges[r].size) << (8 * r);
+        }
+        if (mask) {
+            hits[k].idx = i;
+            hits[k].mask = mask;
+            k++;
+        }
+    }
+    return k;
+}
+
+static size_t scan_scalar(const struct trace_filter *f, const struct input_instr *recs,
+                          size_t n, struct trace_filter_hit *hits) {
+    return scan_scalar_from(f, recs, 0, n, hits);
+}
+
+#ifdef TRACE_FILTER_X86
+
+/* ------------------------------------------------------------------------
+ * AVX2: a record is two ymm registers (qwords 0-3 and 4-7)
+ * ------------------------------------------------------------------------ */
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const struct trace_filter *f, const struct input_instr *recs,
+                        size_t n, struct trace_filter_hit *hits) {
+    /* AVX2 has no unsigned 64-bit compare: bias both sides by the sign bit */
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i base[TRACE_FILTER_MAX_RANGES];
+    __m256i size_x[TRACE_FILTER_MAX_RANGES];
+    unsigned nr = f->n_ranges;
+    size_t k = 0;
+
+    for (unsigned r = 0; r < nr; r++) {
+        base[r] = _mm256_set1_epi64x((long long)f->ranges[r].base);
+        size_x[r] = _mm256_xor_si256(_mm256_set1_epi64x((long long)f->ranges[r].size), sign);
+    }
+
+    size_t i = 0;
+    for (; i + BLOCK_RECORDS <= n; i += BLOCK_RECORDS) {
+        uint64_t m[BLOCK_RECORDS];
+        uint64_t any = 0;
+
+        for (unsigned j = 0; j < BLOCK_RECORDS; j++) {
+            const __m256i *p = (const __m256i *)&recs[i + j];
+            __m256i lo = _mm256_loadu_si256(p);
+            __m256i hi = _mm256_loadu_si256(p + 1);
+            __m256i lo_zero = _mm256_cmpeq_epi64(lo, zero);
+            __m256i hi_zero = _mm256_cmpeq_epi64(hi, zero);
+
+            m[j] = 0;
+            for (unsigned r = 0; r < nr; r++) {
+                __m256i lo_in = _mm256_cmpgt_epi64(size_x[r],
+                    _mm256_xor_si256(_mm256_sub_epi64(lo, base[r]), sign));
+                __m256i hi_in = _mm256_cmpgt_epi64(size_x[r],
+                    _mm256_xor_si256(_mm256_sub_epi64(hi, base[r]), sign));
+                unsigned lanes =
+                    ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_andnot_si256(lo_zero, lo_in)))
+                     & (TRACE_FILTER_DST_LANES & 0x0fu)) |
+                    ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_andnot_si256(hi_zero, hi_in))) << 4);
+                m[j] |= (uint64_t)lanes << (8 * r);
+            }
+            any |= m[j];
+        }
+
+        if (!any) {
+            continue;
+        }
+        for (unsigned j = 0; j < BLOCK_RECORDS; j++) {
+            if (m[j]) {
+                hits[k].idx = i + j;
+                hits[k].mask = m[j];
+                k++;
+            }
+        }
+    }
+
+    return k + scan_scalar_from(f, recs, i, n, hits + k);
+}
+
+/* ------------------------------------------------------------------------
+ * AVX-512F: a record is one zmm register
+ * ------------------------------------------------------------------------ */
+
+__attribute__((target("avx512f")))
+static size_t scan_avx512(const struct trace_filter *f, const struct input_instr *recs,
+                          size_t n, struct trace_filter_hit *hits) {
+    const __mmask8 operand_lanes = (__mmask8)(TRACE_FILTER_DST_LANES | TRACE_FILTER_SRC_LANES);
+    __m512i base[TRACE_FILTER_MAX_RANGES];
+    __m512i size[TRACE_FILTER_MAX_RANGES];
+    unsigned nr = f->n_ranges;
+    size_t k = 0;
+
+    for (unsigned r = 0; r < nr; r++) {
+        base[r] = _mm512_set1_epi64((long long)f->ranges[r].base);
+        size[r] = _mm512_set1_epi64((long long)f->ranges[r].size);
+    }
+
+    size_t i = 0;
+    for (; i + BLOCK_RECORDS <= n; i += BLOCK_RECORDS) {
+        uint64_t m[BLOCK_RECORDS];
+        uint64_t any = 0;
+
+        for (unsigned j = 0; j < BLOCK_RECORDS; j++) {
+            __m512i v = _mm512_loadu_si512((const void *)&recs[i + j]);
+            __mmask8 nonzero = _mm512_mask_test_epi64_mask(operand_lanes, v, v);
+
+            m[j] = 0;
+            for (unsigned r = 0; r < nr; r++) {
+                __mmask8 in = _mm512_mask_cmplt_epu64_mask(nonzero, _mm512_sub_epi64(v, base[r]), size[r]);
+                m[j] |= (uint64_t)in << (8 * r);
+            }
+            any |= m[j];
+        }
+
+        if (!any) {
+            continue;
+        }
+        for (unsigned j = 0; j < BLOCK_RECORDS; j++) {
+            if (m[j]) {
+                hits[k].idx = i + j;
+                hits[k].mask = m[j];
+                k++;
+            }
+        }
+    }
+
+    return k + scan_scalar_from(f, recs, i, n, hits + k);
+}
+
+#endif /* TRACE_FILTER_X86 */
+
+int trace_filter_init(struct trace_filter *f, const struct trace_range *ranges, unsigned n_ranges) {
+    memset(f, 0, sizeof(*f));
+    if (n_ranges == 0 || n_ranges > TRACE_FILTER_MAX_RANGES) {
+        return -1;
+    }
+    memcpy(f->ranges, ranges, n_ranges * sizeof(*ranges));
+    f->n_ranges = n_ranges;
+
+    const char *want = getenv("TRACE_FILTER_ISA");
+    f->isa = "scalar";
+    f->scan = scan_scalar;
+
+#ifdef TRACE_FILTER_X86
+    __builtin_cpu_init();
+    int use_avx512 = __builtin_cpu_supports("avx512f");
+    int use_avx2 = __builtin_cpu_supports("avx2");
+    if (want && strcmp(want, "avx512") != 0) {
+        use_avx512 = 0;
+        if (strcmp(want, "avx2") != 0) {
+            use_avx2 = 0;
+        }
+    }
+    if (use_avx512) {
+        f->isa = "avx512";
+        f->scan = scan_avx512;
+    } else if (use_avx2) {
+        f->isa = "avx2";
+        f->scan = scan_avx2;
+    }
+#else
+    (void)want;
+#endif
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * trace_filter.h - Vectorized address-range filter for trace records
+ *
+ * Tests the memory operands of every record against one or more address
+ * ranges and returns only the records that hit, e.g.:
+ *
+ *     struct trace_range b = { "B", b_base, b_size };
+ *     struct trace_filter f;
+ *     trace_filter_init(&f, &b, 1);
+ *     size_t k = trace_filter_scan(&f, recs, n, hits);
+ *     for (size_t h = 0; h < k; h++) { ... recs[hits[h].idx] ... }
+ *
+ * A 64-byte struct input_instr is exactly one AVX-512 register (two AVX2
+ * registers), so the kernels compare whole records in place: the
+ * destination_memory / source_memory qwords of 8 records are checked with a
+ * handful of vector ops and the per-record results are combined into one
+ * bitmask, letting hit-free blocks be skipped with a single test.
+ *
+ * The implementation (AVX-512F, AVX2 or scalar) is picked once at runtime
+ * via cpuid. Set TRACE_FILTER_ISA=scalar|avx2|avx512 in the environment to
+ * force a specific one (for testing; an unsupported choice falls back).
+ */
+
+#ifndef TRACE_FILTER_H
+#define TRACE_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace_io.h"
+
+/* Maximum number of ranges tested in one pass (8 lane bits per range) */
+#define TRACE_FILTER_MAX_RANGES 8
+
+/*
+ * Lane bits of a per-range hit mask: bit k is qword k of the record.
+ * Qwords 0-1 (ip, flags/registers) are never reported.
+ */
+#define TRACE_FILTER_LANE_DST0 2   /* destination_memory[0] */
+#define TRACE_FILTER_LANE_SRC0 4   /* source_memory[0] */
+#define TRACE_FILTER_DST_LANES 0x0cu
+#define TRACE_FILTER_SRC_LANES 0xf0u
+
+/* Address range [base, base + size). Addresses equal to 0 never match. */
+struct trace_range {
+    const char *name;
+    uint64_t base;
+    uint64_t size;
+};
+
+struct trace_filter_hit {
+    uint64_t idx;    /* record index, relative to the scanned span */
+    uint64_t mask;   /* bits 8*r .. 8*r+7: lane mask for range r */
+};
+
+struct trace_filter {
+    struct trace_range ranges[TRACE_FILTER_MAX_RANGES];
+    unsigned n_ranges;
+    const char *isa;   /* "avx512", "avx2" or "scalar" */
+    size_t (*scan)(const struct trace_filter *f, const struct input_instr *recs,
+                   size_t n, struct trace_filter_hit *hits);
+};
+
+/*
+ * Set up a filter for n_ranges ranges (1..TRACE_FILTER_MAX_RANGES).
+ * The range structs are copied. Returns 0 on success, -1 on bad arguments.
+ */
+int trace_filter_init(struct trace_filter *f, const struct trace_range *ranges, unsigned n_ranges);
+
+/*
+ * Scan n records and store one entry per record with at least one hit in
+ * hits (which must have room for n entries), in record order.
+ * Returns the number of entries stored.
+ */
+static inline size_t trace_filter_scan(const struct trace_filter *f, const struct input_instr *recs,
+                                       size_t n, struct trace_filter_hit *hits) {
+    return f->scan(f, recs, n, hits);
+}
+
+/* Lane mask of range r within a hit mask */
+static inline unsigned trace_filter_lanes(uint64_t mask, unsigned r) {
+    return (unsigned)(mask >> (8 * r)) & 0xffu;
+}
+
+/* Memory operand selected by a lane bit (TRACE_FILTER_LANE_DST0 .. 7) */
+static inline uint64_t trace_filter_lane_addr(const struct input_instr *rec, unsigned lane) {
+    return lane >= TRACE_FILTER_LANE_SRC0
+        ? rec->source_memory[lane - TRACE_FILTER_LANE_SRC0]
+        : rec->destination_memory[lane - TRACE_FILTER_LANE_DST0];
+}
+
+#endif /* TRACE_FILTER_H */
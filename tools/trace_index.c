@@ -0,0 +1,184 @@
+/*
+ * trace_index.c - Read and write .tidx trace index files
+ *
+ * See trace_index.h. The file is the header followed by n_iters
+ * struct trace_index_iter entries, both written as they are in memory.
+ */
+
+#define _GNU_SOURCE  /* struct stat st_mtim */
+
+#include "trace_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FNV64_PRIME 0x100000001b3ULL
+
+/* Refuse index files claiming more iterations than this (corrupt header) */
+#define TRACE_INDEX_MAX_ITERS (1ULL << 32)
+
+void trace_hash_records(uint64_t *h, const struct input_instr *recs, uint64_t n) {
+    uint64_t x = *h;
+    const unsigned words = sizeof(struct input_instr) / sizeof(uint64_t);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t w[sizeof(struct input_instr) / sizeof(uint64_t)];
+        memcpy(w, &recs[i], sizeof(w));
+        for (unsigned k = 0; k < words; k++) {
+            x = (x ^ w[k]) * FNV64_PRIME;
+        }
+    }
+    *h = x;
+}
+
+int trace_index_path(char *buf, size_t len, const char *trace_path) {
+    int n = snprintf(buf, len, "%s%s", trace_path, TRACE_INDEX_SUFFIX);
+    return (n < 0 || (size_t)n >= len) ? -1 : 0;
+}
+
+int trace_index_stamp(struct trace_index_header *h, const char *trace_path) {
+    struct stat st;
+    if (stat(trace_path, &st) != 0) {
+        perror("stat");
+        fprintf(stderr, "Error: Cannot stat trace file: %s\n", trace_path);
+        return -1;
+    }
+    h->file_bytes = (uint64_t)st.st_size;
+    h->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    h->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    return 0;
+}
+
+int trace_index_save(const struct trace_index *ix, const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror("fopen");
+        fprintf(stderr, "Error: Cannot open index file: %s\n", path);
+        return -1;
+    }
+    int rc = 0;
+    if (fwrite(&ix->h, sizeof(ix->h), 1, fp) != 1 ||
+        (ix->h.n_iters > 0 &&
+         fwrite(ix->iters, sizeof(ix->iters[0]), ix->h.n_iters, fp) != ix->h.n_iters)) {
+        perror("fwrite");
+        rc = -1;
+    }
+    if (fclose(fp) != 0) {
+        perror("fclose");
+        rc = -1;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "Error: Failed to write index file: %s\n", path);
+    }
+    return rc;
+}
+
+int trace_index_load_file(struct trace_index *ix, const char *index_path) {
+    memset(ix, 0, sizeof(*ix));
+    FILE *fp = fopen(index_path, "rb");
+    if (!fp) {
+        perror("fopen");
+        fprintf(stderr, "Error: Cannot open index file: %s (build it with trace_build_index)\n", index_path);
+        return -1;
+    }
+
+    int rc = 0;
+    if (fread(&ix->h, sizeof(ix->h), 1, fp) != 1 ||
+        memcmp(ix->h.magic, TRACE_INDEX_MAGIC, sizeof(ix->h.magic)) != 0) {
+        fprintf(stderr, "Error: %s is not a trace index\n", index_path);
+        rc = -1;
+    } else if (ix->h.version != TRACE_INDEX_VERSION ||
+               ix->h.record_size != sizeof(struct input_instr)) {
+        fprintf(stderr, "Error: %s: index version %u (record size %u), expected %u (%zu); rebuild it\n",
+                index_path, ix->h.version, ix->h.record_size, TRACE_INDEX_VERSION,
+                sizeof(struct input_instr));
+        rc = -1;
+    } else if (ix->h.n_iters > TRACE_INDEX_MAX_ITERS) {
+        fprintf(stderr, "Error: %s: corrupt header (%lu iterations)\n",
+                index_path, (unsigned long)ix->h.n_iters);
+        rc = -1;
+    } else if (ix->h.n_iters > 0) {
+        ix->iters = malloc(ix->h.n_iters * sizeof(ix->iters[0]));
+        if (!ix->iters) {
+            fprintf(stderr, "Error: Out of memory for %lu index entries\n", (unsigned long)ix->h.n_iters);
+            rc = -1;
+        } else if (fread(ix->iters, sizeof(ix->iters[0]), ix->h.n_iters, fp) != ix->h.n_iters) {
+            fprintf(stderr, "Error: %s: truncated index file\n", index_path);
+            rc = -1;
+        }
+    }
+    fclose(fp);
+
+    if (rc != 0) {
+        trace_index_free(ix);
+    }
+    return rc;
+}
+
+int trace_index_load(struct trace_index *ix, const char *trace_path) {
+    char path[4096];
+    if (trace_index_path(path, sizeof(path), trace_path) != 0) {
+        fprintf(stderr, "Error: Trace path too long: %s\n", trace_path);
+        return -1;
+    }
+    if (trace_index_load_file(ix, path) != 0) {
+        return -1;
+    }
+
+    struct trace_index_header now;
+    if (trace_index_stamp(&now, trace_path) != 0) {
+        trace_index_free(ix);
+        return -1;
+    }
+    if (now.file_bytes != ix->h.file_bytes || now.mtime_sec != ix->h.mtime_sec ||
+        now.mtime_nsec != ix->h.mtime_nsec) {
+        fprintf(stderr, "Error: %s is out of date (the trace changed after indexing); "
+                "rebuild it with trace_build_index\n", path);
+        trace_index_free(ix);
+        return -1;
+    }
+    return 0;
+}
+
+void trace_index_free(struct trace_index *ix) {
+    free(ix->iters);
+    ix->iters = NULL;
+    ix->h.n_iters = 0;
+}
+
+int trace_region_parse(const char *name) {
+    if (strcmp(name, "A") == 0 || strcmp(name, "a") == 0) {
+        return TRACE_REGION_A;
+    }
+    if (strcmp(name, "B") == 0 || strcmp(name, "b") == 0) {
+        return TRACE_REGION_B;
+    }
+    if (strcmp(name, "overhead") == 0 || strcmp(name, "O") == 0 || strcmp(name, "o") == 0) {
+        return TRACE_REGION_OVERHEAD;
+    }
+    return -1;
+}
+
+const char *trace_region_name(int region) {
+    static const char *const names[] = { "A", "B", "overhead", "iteration" };
+    return (region >= 0 && region <= TRACE_REGIONS) ? names[region] : "?";
+}
+
+int trace_index_region(const struct trace_index *ix, uint64_t iter, int region,
+                       uint64_t *begin, uint64_t *end) {
+    if (iter >= ix->h.n_iters) {
+        fprintf(stderr, "Error: Iteration %lu out of range (the index has %lu)\n",
+                (unsigned long)iter, (unsigned long)ix->h.n_iters);
+        return -1;
+    }
+    const struct trace_index_iter *it = &ix->iters[iter];
+    if (region == TRACE_REGIONS) {
+        *begin = it->begin[TRACE_REGION_A];
+        *end = it->end;
+    } else {
+        *begin = it->begin[region];
+        *end = (region + 1 < TRACE_REGIONS) ? it->begin[region + 1] : it->end;
+    }
+    return 0;
+}
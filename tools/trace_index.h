@@ -0,0 +1,156 @@
+/*
+ * trace_index.h - Persistent per-iteration index of a kernel trace (.tidx)
+ *
+ * trace_build_index scans a trace once and writes a sidecar file next to it
+ * (TRACE.tidx for TRACE or TRACE.xz.tidx for TRACE.xz). It records where
+ * every outer iteration of run_kernel() starts and how the iteration splits
+ * into regions:
+ *
+ *     A sweep     [begin[TRACE_REGION_A],        begin[TRACE_REGION_B])
+ *     B chunk     [begin[TRACE_REGION_B],        begin[TRACE_REGION_OVERHEAD])
+ *     overhead    [begin[TRACE_REGION_OVERHEAD], end)
+ *
+ * The B region runs from the first to the last B load; the overhead region is
+ * the loop code up to the next A sweep. Each region also has a summary of its
+ * memory-accessing records (IP and address ranges), and the header holds a
+ * hash of the trace contents.
+ *
+ * Tools then look an iteration up in O(1) instead of rescanning the trace:
+ *
+ *     struct trace_index ix;
+ *     if (trace_index_load(&ix, trace_path) != 0) return 1;
+ *     uint64_t begin, end;
+ *     trace_index_region(&ix, k, TRACE_REGION_B, &begin, &end);
+ *     trace_index_free(&ix);
+ *
+ * The file is written in host byte order; it is a cache, not an exchange
+ * format, and is rebuilt whenever the trace changes.
+ */
+
+#ifndef TRACE_INDEX_H
+#define TRACE_INDEX_H
+
+#include <stdint.h>
+
+#include "trace_io.h"
+#include "trace_loops.h"
+
+/* Appended to the trace path to name its index */
+#define TRACE_INDEX_SUFFIX ".tidx"
+
+#define TRACE_INDEX_MAGIC   "TRCIDX\0\0"
+#define TRACE_INDEX_VERSION 1
+
+/* Regions of one outer iteration */
+#define TRACE_REGION_A        0
+#define TRACE_REGION_B        1
+#define TRACE_REGION_OVERHEAD 2
+#define TRACE_REGIONS         3
+
+/* Records of a region that access memory (any non-zero operand) */
+struct trace_region_summary {
+    uint64_t n_mem;
+    uint64_t ip_min;       /* UINT64_MAX / 0 when n_mem == 0 */
+    uint64_t ip_max;
+    uint64_t addr_min;     /* over all non-zero operands */
+    uint64_t addr_max;
+};
+
+struct trace_index_iter {
+    uint64_t begin[TRACE_REGIONS];
+    uint64_t end;          /* next iteration's A start (or end of the last overhead) */
+    struct trace_region_summary region[TRACE_REGIONS];
+};
+
+struct trace_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;      /* sizeof(struct input_instr) */
+    uint64_t total_records;
+    uint64_t content_hash;     /* trace_hash_records() over the whole trace */
+    uint64_t file_bytes;       /* size and mtime of the trace when indexed */
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t n_iters;
+    uint32_t n_a_ips;
+    uint32_t n_b_ips;
+    uint64_t a_ips[TRACE_LOOPS_MAX_IPS];
+    uint64_t b_ips[TRACE_LOOPS_MAX_IPS];
+};
+
+struct trace_index {
+    struct trace_index_header h;
+    struct trace_index_iter *iters;
+};
+
+/* Initial value for trace_hash_records() */
+#define TRACE_HASH_INIT 0xcbf29ce484222325ULL
+
+/*
+ * Fold n records into the running content hash *h (FNV-1a over 64-bit
+ * words). Identifies a trace; not a cryptographic hash. Raw and .xz copies
+ * of the same trace hash the same.
+ */
+void trace_hash_records(uint64_t *h, const struct input_instr *recs, uint64_t n);
+
+/*
+ * Index path for a trace: trace_path + TRACE_INDEX_SUFFIX in buf.
+ * Returns 0, or -1 if it does not fit in len bytes.
+ */
+int trace_index_path(char *buf, size_t len, const char *trace_path);
+
+/*
+ * Record the size and mtime of trace_path in h (done when the index is built).
+ * Returns 0 on success, -1 on error (message printed to stderr).
+ */
+int trace_index_stamp(struct trace_index_header *h, const char *trace_path);
+
+/*
+ * Write ix to path. Returns 0 on success, -1 on error (message printed).
+ */
+int trace_index_save(const struct trace_index *ix, const char *path);
+
+/*
+ * Load the index of trace_path (its .tidx sidecar). Fails if the index is
+ * missing, malformed or older than the trace (size or mtime changed).
+ * Returns 0 on success, -1 on error (message printed to stderr).
+ */
+int trace_index_load(struct trace_index *ix, const char *trace_path);
+
+/* Same, from an explicit index file, without the staleness check */
+int trace_index_load_file(struct trace_index *ix, const char *index_path);
+
+void trace_index_free(struct trace_index *ix);
+
+/*
+ * Parse a region name: "A", "B" or "overhead" (also "O").
+ * Returns TRACE_REGION_*, or -1 if the name is unknown.
+ */
+int trace_region_parse(const char *name);
+
+/* Region name for messages */
+const char *trace_region_name(int region);
+
+/*
+ * Records [*begin, *end) of region (TRACE_REGION_* or TRACE_REGIONS for the
+ * whole iteration) of iteration iter.
+ * Returns 0, or -1 if iter is out of range (message printed to stderr).
+ */
+int trace_index_region(const struct trace_index *ix, uint64_t iter, int region,
+                       uint64_t *begin, uint64_t *end);
+
+/*
+ * Whether a region with summary sum can hold an access to [base, base + size):
+ * its address range overlaps that range. A region that straddles base (A and
+ * wrong-path B addresses mixed) counts. base + size is never formed, so this
+ * cannot overflow.
+ */
+static inline int trace_region_may_touch(const struct trace_region_summary *sum,
+                                         uint64_t base, uint64_t size) {
+    if (sum->n_mem == 0 || sum->addr_max < base) {
+        return 0;
+    }
+    return sum->addr_min <= base || sum->addr_min - base < size;
+}
+
+#endif /* TRACE_INDEX_H */
@@ -2,11 +2,17 @@
  * trace_insert_all_iters.c - Insert B chunks at A positions for all iterations (Phase 4)
  *
  * Usage: trace_insert_all_iters --in PATH --out PATH
- *            --first-a-begin IDX --a-len N --b-len N --iterations N
+ *            (--first-a-begin IDX --a-len N --b-len N --iterations N | --loops FILE | --index)
  *            --a-pos RATIO --b-ratio RATIO [--every N] [--dry-run]
  *
  * Applies the same insertion (a_pos, b_ratio) to all outer iterations.
  * Each iteration's B chunk is inserted at its corresponding A position.
+ * Input and output may be raw traces or .xz (compressed/decompressed on the fly).
+ *
+ * Iterations are normally assumed to repeat with a fixed period
+ * (a_len + b_len). With --index their actual boundaries are taken from the
+ * input's .tidx index (see trace_build_index), so a_pos and b_ratio apply to
+ * each iteration's own A and B lengths.
  */
 
 #include <stdio.h>
@@ -15,38 +21,31 @@
 #include <string.h>
 #include <getopt.h>
 
-/*
- * ChampSim trace format (from inc/trace_instruction.h)
- */
-#define NUM_INSTR_DESTINATIONS 2
-#define NUM_INSTR_SOURCES 4
-
-struct input_instr {
-    uint64_t ip;
-    uint8_t  is_branch;
-    uint8_t  branch_taken;
-    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS];
-    uint8_t  source_registers[NUM_INSTR_SOURCES];
-    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];
-    uint64_t source_memory[NUM_INSTR_SOURCES];
-};
+#include "trace_io.h"
+#include "trace_loops.h"
+#include "trace_index.h"
 
 static void print_usage(const char *prog) {
     fprintf(stderr, "Usage: %s --in PATH --out PATH \\\n", prog);
-    fprintf(stderr, "           --first-a-begin IDX --a-len N --b-len N --iterations N \\\n");
-    fprintf(stderr, "           --a-pos RATIO --b-ratio RATIO [--every N] [--dry-run]\n");
+    fprintf(stderr, "           (--first-a-begin IDX --a-len N --b-len N --iterations N | --loops FILE | --index) \\\n");
+    fprintf(stderr, "           --a-pos RATIO --b-ratio RATIO [--every N] [--xz-threads N] [--dry-run]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  --in PATH           Input trace file (required)\n");
-    fprintf(stderr, "  --out PATH          Output trace file (required, unless --dry-run)\n");
+    fprintf(stderr, "  --in PATH           Input trace file, raw or .xz (required)\n");
+    fprintf(stderr, "  --out PATH          Output trace file, raw or .xz (required, unless --dry-run)\n");
     fprintf(stderr, "  --first-a-begin IDX First A sweep start index (required)\n");
     fprintf(stderr, "  --a-len N           Length of each A sweep in records (required)\n");
     fprintf(stderr, "  --b-len N           Length of each B chunk in records (required)\n");
     fprintf(stderr, "  --iterations N      Total number of outer iterations (required)\n");
+    fprintf(stderr, "  --loops FILE        Take the four values above from trace_detect_loops JSON\n");
+    fprintf(stderr, "                      (options given explicitly take precedence)\n");
+    fprintf(stderr, "  --index             Take every iteration's A / B boundaries from PATH%s\n", TRACE_INDEX_SUFFIX);
+    fprintf(stderr, "                      (trace_build_index; --iterations N limits the count)\n");
     fprintf(stderr, "  --a-pos RATIO       Position within A to insert (0.0-1.0, required)\n");
     fprintf(stderr, "  --b-ratio RATIO     Fraction of B chunk to insert (0.0-1.0, required)\n");
     fprintf(stderr, "  --every N           Insert every Nth iteration (default: 1 = all)\n");
     fprintf(stderr, "                      0 = no insertions (validation only)\n");
+    fprintf(stderr, "  --xz-threads N      Compression threads for .xz output (default: 0 = all CPUs)\n");
     fprintf(stderr, "  --dry-run           Validate and show plan without writing\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Example:\n");
@@ -54,11 +53,54 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "  %s --in trace.bin --out out.bin \\\n", prog);
     fprintf(stderr, "      --first-a-begin 322141 --a-len 28679 --b-len 20476 \\\n");
     fprintf(stderr, "      --iterations 4096 --a-pos 0.5 --b-ratio 1.0 --every 8\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  # Same, with the loop structure detected automatically\n");
+    fprintf(stderr, "  trace_detect_loops --trace trace.bin --out trace.loops.json\n");
+    fprintf(stderr, "  %s --in trace.bin --out out.bin --loops trace.loops.json \\\n", prog);
+    fprintf(stderr, "      --a-pos 0.5 --b-ratio 1.0 --every 8\n");
+}
+
+/* One insertion: input positions of iteration i */
+struct iter_insert {
+    int64_t insert_at;      /* a_begin + a_pos of the A sweep */
+    int64_t b_begin;        /* first record of the B chunk (= end of the A sweep) */
+    int64_t b_insert_len;   /* b_ratio of the B chunk, at least 1 */
+    int64_t win_len;        /* [insert_at, b_begin + b_insert_len) */
+};
+
+/*
+ * Place the insertion of iteration i: with an index, in that iteration's own
+ * A sweep and B chunk (B chunk + overhead up to the next A sweep), otherwise
+ * at the fixed period a_len + b_len.
+ */
+static struct iter_insert iter_insert_at(const struct trace_index *ix, int64_t i,
+                                         int64_t first_a_begin, int64_t a_len, int64_t b_len,
+                                         double a_pos, double b_ratio) {
+    int64_t a_begin = first_a_begin + i * (a_len + b_len);
+    if (ix) {
+        const struct trace_index_iter *it = &ix->iters[i];
+        a_begin = (int64_t)it->begin[TRACE_REGION_A];
+        a_len = (int64_t)(it->begin[TRACE_REGION_B] - it->begin[TRACE_REGION_A]);
+        b_len = (int64_t)(it->end - it->begin[TRACE_REGION_B]);
+    }
+
+    struct iter_insert r;
+    int64_t a_offset = (int64_t)(a_len * a_pos);
+    r.insert_at = a_begin + a_offset;
+    r.b_begin = a_begin + a_len;
+    r.b_insert_len = (int64_t)(b_len * b_ratio);
+    if (r.b_insert_len == 0) {
+        r.b_insert_len = 1;  /* At minimum, insert 1 record */
+    }
+    r.win_len = (a_len - a_offset) + r.b_insert_len;
+    return r;
 }
 
 int main(int argc, char *argv[]) {
     const char *in_path = NULL;
     const char *out_path = NULL;
+    const char *loops_path = NULL;
+    int use_index = 0;
     int64_t first_a_begin = -1;
     int64_t a_len = -1;
     int64_t b_len = -1;
@@ -66,6 +108,7 @@ int main(int argc, char *argv[]) {
     double a_pos = -1.0;
     double b_ratio = -1.0;
     int64_t every = 1;  /* Default: insert every iteration */
+    uint32_t xz_threads = 0;
     int dry_run = 0;
 
     /* Parse command line options */
@@ -76,16 +119,19 @@ int main(int argc, char *argv[]) {
         {"a-len",          required_argument, 0, 'a'},
         {"b-len",          required_argument, 0, 'b'},
         {"iterations",     required_argument, 0, 'n'},
+        {"loops",          required_argument, 0, 'L'},
+        {"index",          no_argument,       0, 'I'},
         {"a-pos",          required_argument, 0, 'p'},
         {"b-ratio",        required_argument, 0, 'r'},
         {"every",          required_argument, 0, 'e'},
+        {"xz-threads",     required_argument, 0, 'x'},
         {"dry-run",        no_argument,       0, 'd'},
         {"help",           no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:o:f:a:b:n:p:r:e:dh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:f:a:b:n:L:Ip:r:e:x:dh", long_options, NULL)) != -1) {
         switch (opt) {
             case 'i':
                 in_path = optarg;
@@ -105,6 +151,12 @@ int main(int argc, char *argv[]) {
             case 'n':
                 iterations = strtoll(optarg, NULL, 10);
                 break;
+            case 'L':
+                loops_path = optarg;
+                break;
+            case 'I':
+                use_index = 1;
+                break;
             case 'p':
                 a_pos = strtod(optarg, NULL);
                 break;
@@ -114,6 +166,9 @@ int main(int argc, char *argv[]) {
             case 'e':
                 every = strtoll(optarg, NULL, 10);
                 break;
+            case 'x':
+                xz_threads = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
             case 'd':
                 dry_run = 1;
                 break;
@@ -135,84 +190,116 @@ int main(int argc, char *argv[]) {
         print_usage(argv[0]);
         return 1;
     }
+    if (loops_path) {
+        struct trace_loops lp;
+        if (trace_loops_load(&lp, loops_path) != 0) {
+            return 1;
+        }
+        first_a_begin = (first_a_begin < 0) ? (int64_t)lp.first_a_begin : first_a_begin;
+        a_len = (a_len < 0) ? (int64_t)lp.a_len : a_len;
+        b_len = (b_len < 0) ? (int64_t)lp.b_len : b_len;
+        iterations = (iterations < 0) ? (int64_t)lp.iterations : iterations;
+    }
+    struct trace_index ix;
+    memset(&ix, 0, sizeof(ix));
+    if (use_index) {
+        if (loops_path || first_a_begin >= 0 || a_len >= 0 || b_len >= 0) {
+            fprintf(stderr, "Error: --index replaces --first-a-begin, --a-len, --b-len and --loops\n");
+            return 1;
+        }
+        if (trace_index_load(&ix, in_path) != 0) {
+            return 1;
+        }
+        if (iterations > (int64_t)ix.h.n_iters) {
+            fprintf(stderr, "Error: --iterations %ld exceeds the %lu iterations in the index\n",
+                    (long)iterations, (unsigned long)ix.h.n_iters);
+            trace_index_free(&ix);
+            return 1;
+        }
+        if (iterations < 0) {
+            iterations = (int64_t)ix.h.n_iters;
+        }
+        /* Iteration 0, for the summary below */
+        first_a_begin = (int64_t)ix.iters[0].begin[TRACE_REGION_A];
+        a_len = (int64_t)(ix.iters[0].begin[TRACE_REGION_B] - ix.iters[0].begin[TRACE_REGION_A]);
+        b_len = (int64_t)(ix.iters[0].end - ix.iters[0].begin[TRACE_REGION_B]);
+    }
     if (first_a_begin < 0 || a_len <= 0 || b_len <= 0 || iterations <= 0) {
-        fprintf(stderr, "Error: --first-a-begin, --a-len, --b-len, --iterations are required\n\n");
+        fprintf(stderr, "Error: --first-a-begin, --a-len, --b-len, --iterations (or --loops / --index) are required\n\n");
         print_usage(argv[0]);
+        trace_index_free(&ix);
         return 1;
     }
     if (a_pos < 0.0 || b_ratio < 0.0) {
         fprintf(stderr, "Error: --a-pos and --b-ratio are required\n\n");
         print_usage(argv[0]);
+        trace_index_free(&ix);
         return 1;
     }
 
     /* Validate ratios */
     if (a_pos < 0.0 || a_pos > 1.0) {
         fprintf(stderr, "Error: a_pos (%.4f) must be in range [0.0, 1.0]\n", a_pos);
+        trace_index_free(&ix);
         return 1;
     }
     if (b_ratio <= 0.0 || b_ratio > 1.0) {
         fprintf(stderr, "Error: b_ratio (%.4f) must be in range (0.0, 1.0]\n", b_ratio);
+        trace_index_free(&ix);
         return 1;
     }
     if (every < 0) {
         fprintf(stderr, "Error: --every must be >= 0\n");
+        trace_index_free(&ix);
         return 1;
     }
 
     /* Calculate derived values */
+    const struct trace_index *layout_ix = use_index ? &ix : NULL;
     int64_t iter_len = a_len + b_len;
-    int64_t b_insert_len = (int64_t)(b_len * b_ratio);
-    if (b_insert_len == 0) {
-        b_insert_len = 1;  /* At minimum, insert 1 record */
-    }
-    int64_t a_offset = (int64_t)(a_len * a_pos);
+    struct iter_insert first = iter_insert_at(layout_ix, 0, first_a_begin, a_len, b_len, a_pos, b_ratio);
+    int64_t b_insert_len = first.b_insert_len;
+    int64_t a_offset = first.insert_at - first_a_begin;
 
-    /* Count active iterations */
+    /* Count active iterations and size the lookahead window */
     int64_t active_iters = 0;
-    if (every > 0) {
-        for (int64_t i = 0; i < iterations; i++) {
-            if (i % every == 0) {
-                active_iters++;
-            }
+    int64_t total_insert = 0;
+    int64_t win_max = 0;
+    int64_t insert_min = INT64_MAX, insert_max = 0;
+    for (int64_t i = 0; every > 0 && i < iterations; i++) {
+        if (i % every == 0) {
+            struct iter_insert it = iter_insert_at(layout_ix, i, first_a_begin, a_len, b_len, a_pos, b_ratio);
+            active_iters++;
+            total_insert += it.b_insert_len;
+            win_max = (it.win_len > win_max) ? it.win_len : win_max;
+            insert_min = (it.b_insert_len < insert_min) ? it.b_insert_len : insert_min;
+            insert_max = (it.b_insert_len > insert_max) ? it.b_insert_len : insert_max;
         }
     }
+    int64_t last_iter_end = use_index ? (int64_t)ix.iters[iterations - 1].end
+                                      : first_a_begin + iterations * iter_len;
 
     /* Open input file and get total records */
-    FILE *fp_in = fopen(in_path, "rb");
-    if (!fp_in) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot open input file: %s\n", in_path);
-        return 1;
-    }
-
-    fseek(fp_in, 0, SEEK_END);
-    long filesize = ftell(fp_in);
-    fseek(fp_in, 0, SEEK_SET);
-
-    if (filesize < 0) {
-        perror("ftell");
-        fclose(fp_in);
-        return 1;
-    }
-
-    if (filesize % sizeof(struct input_instr) != 0) {
-        fprintf(stderr, "Error: File size (%ld bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
-                filesize, sizeof(struct input_instr));
-        fclose(fp_in);
+    struct trace_reader rd;
+    if (trace_reader_open(&rd, in_path) != 0) {
+        trace_index_free(&ix);
         return 1;
     }
 
-    int64_t total_records = filesize / sizeof(struct input_instr);
-    int64_t total_insert = active_iters * b_insert_len;
+    int known_total = (rd.n_records != TRACE_RECORDS_UNKNOWN);
+    int64_t total_records = known_total ? (int64_t)rd.n_records : -1;
     int64_t output_records = total_records + total_insert;
 
     /* Print operation info */
     fprintf(stderr, "# Input file: %s\n", in_path);
-    fprintf(stderr, "# Total input records: %ld\n", (long)total_records);
+    if (known_total) {
+        fprintf(stderr, "# Total input records: %ld\n", (long)total_records);
+    } else {
+        fprintf(stderr, "# Total input records: unknown (xz without index; bounds are checked while streaming)\n");
+    }
     fprintf(stderr, "# sizeof(input_instr) = %zu bytes\n", sizeof(struct input_instr));
     fprintf(stderr, "#\n");
-    fprintf(stderr, "# Structure:\n");
+    fprintf(stderr, "# Structure:%s\n", use_index ? " (from the index; iteration 0 shown)" : "");
     fprintf(stderr, "#   first_a_begin = %ld\n", (long)first_a_begin);
     fprintf(stderr, "#   a_len = %ld, b_len = %ld\n", (long)a_len, (long)b_len);
     fprintf(stderr, "#   iter_len = %ld\n", (long)iter_len);
@@ -222,23 +309,34 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "#   a_pos = %.4f, b_ratio = %.4f\n", a_pos, b_ratio);
     fprintf(stderr, "#   every = %ld\n", (long)every);
     fprintf(stderr, "#\n");
-    fprintf(stderr, "# Per-iteration insert: %ld records at A+%ld\n",
-            (long)b_insert_len, (long)a_offset);
+    if (use_index && active_iters > 0 && insert_min != insert_max) {
+        fprintf(stderr, "# Per-iteration insert: %ld..%ld records (a_pos / b_ratio of each iteration)\n",
+                (long)insert_min, (long)insert_max);
+    } else {
+        fprintf(stderr, "# Per-iteration insert: %ld records at A+%ld\n",
+                (long)b_insert_len, (long)a_offset);
+    }
     fprintf(stderr, "# Active iterations: %ld (every %ldth of %ld)\n",
             (long)active_iters, (long)every, (long)iterations);
-    fprintf(stderr, "# Total insertions: %ld x %ld = %ld records\n",
-            (long)active_iters, (long)b_insert_len, (long)total_insert);
-    fprintf(stderr, "# Output records: %ld + %ld = %ld\n",
-            (long)total_records, (long)total_insert, (long)output_records);
+    if (use_index) {
+        fprintf(stderr, "# Total insertions: %ld records\n", (long)total_insert);
+    } else {
+        fprintf(stderr, "# Total insertions: %ld x %ld = %ld records\n",
+                (long)active_iters, (long)b_insert_len, (long)total_insert);
+    }
+    if (known_total) {
+        fprintf(stderr, "# Output records: %ld + %ld = %ld\n",
+                (long)total_records, (long)total_insert, (long)output_records);
+    }
     fprintf(stderr, "#\n");
 
     /* Validate structure against total records */
-    int64_t last_iter_end = first_a_begin + iterations * iter_len;
-    if (last_iter_end > total_records) {
+    if (known_total && last_iter_end > total_records) {
         fprintf(stderr, "Error: Structure exceeds trace bounds\n");
         fprintf(stderr, "       last_iter_end = %ld, total_records = %ld\n",
                 (long)last_iter_end, (long)total_records);
-        fclose(fp_in);
+        trace_reader_close(&rd);
+        trace_index_free(&ix);
         return 1;
     }
 
@@ -249,158 +347,167 @@ int main(int argc, char *argv[]) {
         int count = 0;
         for (int64_t i = 0; i < iterations && count < 5; i++) {
             if (every > 0 && i % every == 0) {
-                int64_t a_begin_i = first_a_begin + i * iter_len;
-                int64_t insert_at_i = a_begin_i + a_offset;
-                int64_t b_begin_i = a_begin_i + a_len;
+                struct iter_insert it = iter_insert_at(layout_ix, i, first_a_begin, a_len, b_len, a_pos, b_ratio);
                 fprintf(stderr, "#   iter %ld: insert_at=%ld, B src=[%ld, %ld)\n",
-                        (long)i, (long)insert_at_i, (long)b_begin_i, (long)(b_begin_i + b_insert_len));
+                        (long)i, (long)it.insert_at, (long)it.b_begin, (long)(it.b_begin + it.b_insert_len));
                 count++;
             }
         }
         if (active_iters > 5) {
             fprintf(stderr, "#   ... (%ld more)\n", (long)(active_iters - 5));
         }
-        fclose(fp_in);
+        trace_reader_close(&rd);
+        trace_index_free(&ix);
         return 0;
     }
 
-    /* Allocate buffer for B insert records */
-    struct input_instr *b_buf = malloc(b_insert_len * sizeof(struct input_instr));
-    if (!b_buf) {
-        fprintf(stderr, "Error: Cannot allocate memory for %ld B records (%ld bytes)\n",
-                (long)b_insert_len, (long)(b_insert_len * sizeof(struct input_instr)));
-        fclose(fp_in);
-        return 1;
+    /*
+     * Lookahead window for one insertion: input records
+     * [insert_at_i, b_begin_i + b_insert_len), i.e. the rest of the A sweep
+     * plus the part of the B chunk that is copied. For raw input the window is
+     * taken straight out of the mapping; a streamed .xz input is decoded into
+     * this buffer instead (sized for the largest iteration).
+     */
+    struct input_instr *win = NULL;
+    if (rd.is_xz && win_max > 0) {
+        win = malloc(win_max * sizeof(struct input_instr));
+        if (!win) {
+            fprintf(stderr, "Error: Cannot allocate memory for %ld lookahead records (%ld bytes)\n",
+                    (long)win_max, (long)(win_max * sizeof(struct input_instr)));
+            trace_reader_close(&rd);
+            trace_index_free(&ix);
+            return 1;
+        }
     }
 
     /* Open output file */
-    FILE *fp_out = fopen(out_path, "wb");
-    if (!fp_out) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot create output file: %s\n", out_path);
-        free(b_buf);
-        fclose(fp_in);
+    struct trace_writer wr;
+    if (trace_writer_open(&wr, out_path, xz_threads) != 0) {
+        free(win);
+        trace_reader_close(&rd);
+        trace_index_free(&ix);
         return 1;
     }
 
     fprintf(stderr, "# Writing output to: %s\n", out_path);
 
-    /* Build list of insertion points (input indices) */
-    /* We process in order, so we just need to track next insertion */
-    int64_t next_iter = 0;  /* Next iteration to check for insertion */
-    int64_t next_insert_at = -1;  /* Next insertion point (input index) */
-    int64_t next_b_begin = -1;  /* B chunk start for next insertion */
+    /*
+     * Process trace in a single forward pass; every input record is read
+     * exactly once and nothing is seeked. For each active iteration, one
+     * vectored write emits:
+     *   1) the original records up to the insertion point
+     *   2) the B prefix from the lookahead window (the inserted copy)
+     *   3) the window itself (the original records, unchanged)
+     */
+    int64_t in_idx = 0;   /* Next input record to copy */
+    int64_t out_idx = 0;
     int64_t insertions_done = 0;
+    int64_t next_progress = 50000000;
+    int rc = 0;
 
-    /* Find first insertion point */
-    while (next_iter < iterations) {
-        if (every > 0 && next_iter % every == 0) {
-            int64_t a_begin_i = first_a_begin + next_iter * iter_len;
-            next_insert_at = a_begin_i + a_offset;
-            next_b_begin = a_begin_i + a_len;
-            break;
+    for (int64_t i = 0; i < iterations && rc == 0; i++) {
+        if (every == 0 || i % every != 0) {
+            continue;
         }
-        next_iter++;
-    }
 
-    /* Process trace */
-    struct input_instr rec;
-    int64_t in_idx = 0;
-    int64_t out_idx = 0;
-    long current_pos = 0;  /* Track file position for seeking */
-
-    while (fread(&rec, sizeof(rec), 1, fp_in) == 1) {
-        current_pos = ftell(fp_in);
-
-        /* Check if we've reached an insertion point */
-        if (next_insert_at >= 0 && in_idx == next_insert_at) {
-            /* Save current position */
-            long saved_pos = current_pos;
-
-            /* Seek to B chunk and read */
-            if (fseek(fp_in, next_b_begin * sizeof(struct input_instr), SEEK_SET) != 0) {
-                perror("fseek");
-                fprintf(stderr, "Error: Cannot seek to B chunk at idx %ld\n", (long)next_b_begin);
-                free(b_buf);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-
-            size_t read_count = fread(b_buf, sizeof(struct input_instr), b_insert_len, fp_in);
-            if ((int64_t)read_count != b_insert_len) {
-                fprintf(stderr, "Error: Expected to read %ld B records, got %zu\n",
-                        (long)b_insert_len, read_count);
-                free(b_buf);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-
-            /* Write inserted B records */
-            if (fwrite(b_buf, sizeof(struct input_instr), b_insert_len, fp_out) != (size_t)b_insert_len) {
-                perror("fwrite");
-                fprintf(stderr, "Error: Write failed during insertion at output index %ld\n", (long)out_idx);
-                free(b_buf);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-            out_idx += b_insert_len;
-            insertions_done++;
-
-            /* Seek back to continue reading */
-            if (fseek(fp_in, saved_pos, SEEK_SET) != 0) {
-                perror("fseek");
-                fprintf(stderr, "Error: Cannot seek back to position %ld\n", saved_pos);
-                free(b_buf);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-
-            /* Find next insertion point */
-            next_iter++;
-            next_insert_at = -1;
-            while (next_iter < iterations) {
-                if (every > 0 && next_iter % every == 0) {
-                    int64_t a_begin_i = first_a_begin + next_iter * iter_len;
-                    next_insert_at = a_begin_i + a_offset;
-                    next_b_begin = a_begin_i + a_len;
-                    break;
-                }
-                next_iter++;
+        struct iter_insert it = iter_insert_at(layout_ix, i, first_a_begin, a_len, b_len, a_pos, b_ratio);
+        struct trace_span spans[3];
+        unsigned n_spans = 0;
+
+        /* Original records up to the insertion point */
+        int64_t gap = it.insert_at - in_idx;
+        int64_t got;
+        if (rd.is_xz) {
+            got = trace_copy_records(&rd, &wr, gap);
+        } else {
+            got = trace_reader_take(&rd, &spans[n_spans].recs, gap, NULL);
+            spans[n_spans++].n = (uint64_t)gap;
+        }
+        if (got != gap) {
+            rc = -1;
+            break;
+        }
+        in_idx = it.insert_at;
+
+        const struct input_instr *w;
+        got = trace_reader_take(&rd, &w, it.win_len, win);
+        if (got != it.win_len) {
+            if (got >= 0) {
+                fprintf(stderr, "Error: Input ended at record %ld inside iteration %ld\n",
+                        (long)(in_idx + got), (long)i);
             }
+            rc = -1;
+            break;
         }
 
-        /* Write original record */
-        if (fwrite(&rec, sizeof(struct input_instr), 1, fp_out) != 1) {
-            perror("fwrite");
-            fprintf(stderr, "Error: Write failed at output index %ld\n", (long)out_idx);
-            free(b_buf);
-            fclose(fp_in);
-            fclose(fp_out);
-            return 1;
+        /* Inserted B records, then the original A tail + B prefix */
+        spans[n_spans].recs = w + (it.b_begin - it.insert_at);
+        spans[n_spans++].n = (uint64_t)it.b_insert_len;
+        spans[n_spans].recs = w;
+        spans[n_spans++].n = (uint64_t)it.win_len;
+        if (trace_writer_writev(&wr, spans, n_spans) != 0) {
+            rc = -1;
+            break;
         }
-        in_idx++;
-        out_idx++;
+        out_idx = (int64_t)wr.n_written;
+        in_idx += it.win_len;
+        insertions_done++;
 
         /* Progress indicator for large traces */
-        if (in_idx % 50000000 == 0) {
+        if (in_idx >= next_progress) {
             fprintf(stderr, "#   Processed %ld M records, %ld insertions...\n",
                     (long)(in_idx / 1000000), (long)insertions_done);
+            next_progress = (in_idx / 50000000 + 1) * 50000000;
         }
     }
 
+    /* Remaining original records */
+    if (rc == 0) {
+        int64_t rest;
+        if (rd.is_xz) {
+            rest = trace_copy_records(&rd, &wr, UINT64_MAX);
+        } else {
+            struct trace_span tail;
+            rest = trace_reader_take(&rd, &tail.recs, UINT64_MAX, NULL);
+            tail.n = (uint64_t)rest;
+            if (rest > 0 && trace_writer_writev(&wr, &tail, 1) != 0) {
+                rest = -1;
+            }
+        }
+        if (rest < 0) {
+            rc = -1;
+        } else {
+            in_idx += rest;
+        }
+    }
+    out_idx = (int64_t)wr.n_written;
+    if (rc == 0 && in_idx < last_iter_end) {
+        fprintf(stderr, "Error: Structure exceeds trace bounds\n");
+        fprintf(stderr, "       last_iter_end = %ld, total_records = %ld\n",
+                (long)last_iter_end, (long)in_idx);
+        rc = -1;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "Error: Aborted at output index %ld\n", (long)out_idx);
+    }
+
+    if (trace_writer_close(&wr) != 0) {
+        rc = -1;
+    }
+    free(win);
+    trace_reader_close(&rd);
+    trace_index_free(&ix);
+    if (rc != 0) {
+        return 1;
+    }
+
     fprintf(stderr, "#\n");
-    fprintf(stderr, "# Read %ld input records\n", (long)in_idx);
-    fprintf(stderr, "# Wrote %ld output records\n", (long)out_idx);
+    fprintf(stderr, "# Read %ld input records (%.1f MiB, single forward pass)\n",
+            (long)in_idx, (double)in_idx * sizeof(struct input_instr) / (1024.0 * 1024.0));
+    fprintf(stderr, "# Wrote %ld output records (%.1f MiB)\n",
+            (long)out_idx, (double)out_idx * sizeof(struct input_instr) / (1024.0 * 1024.0));
     fprintf(stderr, "# Performed %ld insertions\n", (long)insertions_done);
     fprintf(stderr, "# Done.\n");
 
-    free(b_buf);
-    fclose(fp_in);
-    fclose(fp_out);
-
     return 0;
 }
@@ -2,8 +2,8 @@
  * trace_insert_b_at_a.c - Insert B chunk records at a position within A sweep (Phase 3.6)
  *
  * Usage: trace_insert_b_at_a --in PATH --out PATH
- *            --a-begin I --a-end J --b-begin K --b-end L
- *            --a-pos RATIO --b-ratio RATIO [--dry-run]
+ *            (--a-begin I --a-end J --b-begin K --b-end L | --loops FILE | --iter N)
+ *            --a-pos RATIO --b-ratio RATIO [--copy-mode MODE] [--dry-run]
  *
  * This tool provides a simplified interface for insertion experiments:
  * - a-pos: Where in A to insert (0.0=start, 0.5=middle, 1.0=end)
@@ -16,26 +16,14 @@
 #include <string.h>
 #include <getopt.h>
 
-/*
- * ChampSim trace format (from inc/trace_instruction.h)
- */
-#define NUM_INSTR_DESTINATIONS 2
-#define NUM_INSTR_SOURCES 4
-
-struct input_instr {
-    uint64_t ip;
-    uint8_t  is_branch;
-    uint8_t  branch_taken;
-    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS];
-    uint8_t  source_registers[NUM_INSTR_SOURCES];
-    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];
-    uint64_t source_memory[NUM_INSTR_SOURCES];
-};
+#include "trace_io.h"
+#include "trace_loops.h"
+#include "trace_index.h"
 
 static void print_usage(const char *prog) {
     fprintf(stderr, "Usage: %s --in PATH --out PATH \\\n", prog);
-    fprintf(stderr, "           --a-begin I --a-end J --b-begin K --b-end L \\\n");
-    fprintf(stderr, "           --a-pos RATIO --b-ratio RATIO [--dry-run]\n");
+    fprintf(stderr, "           (--a-begin I --a-end J --b-begin K --b-end L | --loops FILE | --iter N) \\\n");
+    fprintf(stderr, "           --a-pos RATIO --b-ratio RATIO [--copy-mode MODE] [--dry-run]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  --in PATH        Input trace file (required)\n");
@@ -44,10 +32,18 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "  --a-end J        A sweep end index, exclusive (required)\n");
     fprintf(stderr, "  --b-begin K      B chunk start index, inclusive (required)\n");
     fprintf(stderr, "  --b-end L        B chunk end index, exclusive (required)\n");
+    fprintf(stderr, "  --loops FILE     Take A/B of the first iteration from trace_detect_loops JSON\n");
+    fprintf(stderr, "                   (B = the B accesses; options given explicitly take precedence)\n");
+    fprintf(stderr, "  --iter N         Take A/B of outer iteration N from PATH%s (trace_build_index)\n",
+            TRACE_INDEX_SUFFIX);
     fprintf(stderr, "  --a-pos RATIO    Position within A to insert (0.0-1.0, required)\n");
     fprintf(stderr, "                   0.0 = at A start, 0.5 = at A middle, 1.0 = at A end\n");
     fprintf(stderr, "  --b-ratio RATIO  Fraction of B chunk to insert (0.0-1.0, required)\n");
     fprintf(stderr, "                   0.5 = first half of B, 1.0 = all of B\n");
+    fprintf(stderr, "  --copy-mode MODE How to move records copied from the input (default: write)\n");
+    fprintf(stderr, "                   write   = through userspace from the mapped input\n");
+    fprintf(stderr, "                   copy    = copy_file_range(2), data stays in the kernel\n");
+    fprintf(stderr, "                   reflink = FICLONERANGE where block-aligned (XFS/btrfs), else copy\n");
     fprintf(stderr, "  --dry-run        Validate and show calculated values without writing\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Example:\n");
@@ -61,31 +57,37 @@ static void print_usage(const char *prog) {
 int main(int argc, char *argv[]) {
     const char *in_path = NULL;
     const char *out_path = NULL;
+    const char *loops_path = NULL;
+    int64_t iter = -1;
     int64_t a_begin = -1;
     int64_t a_end = -1;
     int64_t b_begin = -1;
     int64_t b_end = -1;
     double a_pos = -1.0;
     double b_ratio = -1.0;
+    int copy_mode = TRACE_COPY_WRITE;
     int dry_run = 0;
 
     /* Parse command line options */
     static struct option long_options[] = {
-        {"in",       required_argument, 0, 'i'},
-        {"out",      required_argument, 0, 'o'},
-        {"a-begin",  required_argument, 0, 'A'},
-        {"a-end",    required_argument, 0, 'B'},
-        {"b-begin",  required_argument, 0, 'C'},
-        {"b-end",    required_argument, 0, 'D'},
-        {"a-pos",    required_argument, 0, 'p'},
-        {"b-ratio",  required_argument, 0, 'r'},
-        {"dry-run",  no_argument,       0, 'd'},
-        {"help",     no_argument,       0, 'h'},
+        {"in",        required_argument, 0, 'i'},
+        {"out",       required_argument, 0, 'o'},
+        {"a-begin",   required_argument, 0, 'A'},
+        {"a-end",     required_argument, 0, 'B'},
+        {"b-begin",   required_argument, 0, 'C'},
+        {"b-end",     required_argument, 0, 'D'},
+        {"loops",     required_argument, 0, 'L'},
+        {"iter",      required_argument, 0, 'k'},
+        {"a-pos",     required_argument, 0, 'p'},
+        {"b-ratio",   required_argument, 0, 'r'},
+        {"copy-mode", required_argument, 0, 'c'},
+        {"dry-run",   no_argument,       0, 'd'},
+        {"help",      no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:o:A:B:C:D:p:r:dh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:A:B:C:D:L:k:p:r:dc:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'i':
                 in_path = optarg;
@@ -105,6 +107,12 @@ int main(int argc, char *argv[]) {
             case 'D':
                 b_end = strtoll(optarg, NULL, 10);
                 break;
+            case 'L':
+                loops_path = optarg;
+                break;
+            case 'k':
+                iter = strtoll(optarg, NULL, 10);
+                break;
             case 'p':
                 a_pos = strtod(optarg, NULL);
                 break;
@@ -114,6 +122,13 @@ int main(int argc, char *argv[]) {
             case 'd':
                 dry_run = 1;
                 break;
+            case 'c':
+                copy_mode = trace_copy_mode_parse(optarg);
+                if (copy_mode < 0) {
+                    fprintf(stderr, "Error: Unknown --copy-mode '%s' (write, copy, reflink)\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -132,8 +147,39 @@ int main(int argc, char *argv[]) {
         print_usage(argv[0]);
         return 1;
     }
+    if (loops_path) {
+        struct trace_loops lp;
+        if (trace_loops_load(&lp, loops_path) != 0) {
+            return 1;
+        }
+        a_begin = (a_begin < 0) ? (int64_t)lp.first_a_begin : a_begin;
+        a_end = (a_end < 0) ? (int64_t)lp.b_begin : a_end;
+        b_begin = (b_begin < 0) ? (int64_t)lp.b_begin : b_begin;
+        b_end = (b_end < 0) ? (int64_t)(lp.b_begin + lp.b_access_len) : b_end;
+    }
+    if (iter >= 0) {
+        if (loops_path) {
+            fprintf(stderr, "Error: --iter and --loops are mutually exclusive\n");
+            return 1;
+        }
+        struct trace_index ix;
+        if (trace_index_load(&ix, in_path) != 0) {
+            return 1;
+        }
+        uint64_t begin, end;
+        if (trace_index_region(&ix, (uint64_t)iter, TRACE_REGION_A, &begin, &end) != 0) {
+            trace_index_free(&ix);
+            return 1;
+        }
+        a_begin = (a_begin < 0) ? (int64_t)begin : a_begin;
+        a_end = (a_end < 0) ? (int64_t)end : a_end;
+        trace_index_region(&ix, (uint64_t)iter, TRACE_REGION_B, &begin, &end);
+        b_begin = (b_begin < 0) ? (int64_t)begin : b_begin;
+        b_end = (b_end < 0) ? (int64_t)end : b_end;
+        trace_index_free(&ix);
+    }
     if (a_begin < 0 || a_end < 0 || b_begin < 0 || b_end < 0) {
-        fprintf(stderr, "Error: --a-begin, --a-end, --b-begin, --b-end are required\n\n");
+        fprintf(stderr, "Error: --a-begin, --a-end, --b-begin, --b-end (or --loops / --iter) are required\n\n");
         print_usage(argv[0]);
         return 1;
     }
@@ -178,32 +224,17 @@ int main(int argc, char *argv[]) {
     int64_t src_begin = b_begin;
     int64_t src_end = b_begin + b_insert_len;
 
-    /* Open input file and get total records */
-    FILE *fp_in = fopen(in_path, "rb");
-    if (!fp_in) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot open input file: %s\n", in_path);
+    /*
+     * Map input file and get total records. The kernel-side copy modes never
+     * read the mapping, so it is only prefaulted for a plain write.
+     */
+    struct trace_map tm;
+    int map_flags = (dry_run || copy_mode != TRACE_COPY_WRITE) ? 0 : TRACE_MAP_SEQUENTIAL;
+    if (trace_map_open(&tm, in_path, map_flags) != 0) {
         return 1;
     }
 
-    fseek(fp_in, 0, SEEK_END);
-    long filesize = ftell(fp_in);
-    fseek(fp_in, 0, SEEK_SET);
-
-    if (filesize < 0) {
-        perror("ftell");
-        fclose(fp_in);
-        return 1;
-    }
-
-    if (filesize % sizeof(struct input_instr) != 0) {
-        fprintf(stderr, "Error: File size (%ld bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
-                filesize, sizeof(struct input_instr));
-        fclose(fp_in);
-        return 1;
-    }
-
-    int64_t total_records = filesize / sizeof(struct input_instr);
+    int64_t total_records = (int64_t)tm.n_records;
     int64_t output_records = total_records + b_insert_len;
 
     /* Print operation info */
@@ -234,19 +265,19 @@ int main(int argc, char *argv[]) {
     if (a_end > total_records) {
         fprintf(stderr, "Error: a_end (%ld) exceeds total records (%ld)\n",
                 (long)a_end, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 1;
     }
     if (b_end > total_records) {
         fprintf(stderr, "Error: b_end (%ld) exceeds total records (%ld)\n",
                 (long)b_end, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 1;
     }
     if (insert_at > total_records) {
         fprintf(stderr, "Error: insert_at (%ld) exceeds total records (%ld)\n",
                 (long)insert_at, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 1;
     }
 
@@ -268,109 +299,61 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "#   [%ld, %ld) -> original [%ld, %ld)\n",
                 (long)(insert_at + b_insert_len), (long)output_records,
                 (long)insert_at, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 0;
     }
 
-    /* Load B records to insert into memory */
-    fprintf(stderr, "# Loading B records into memory...\n");
-    struct input_instr *b_records = malloc(b_insert_len * sizeof(struct input_instr));
-    if (!b_records) {
-        fprintf(stderr, "Error: Cannot allocate memory for %ld B records (%ld bytes)\n",
-                (long)b_insert_len, (long)(b_insert_len * sizeof(struct input_instr)));
-        fclose(fp_in);
-        return 1;
-    }
-
-    /* Seek to B range and read */
-    if (fseek(fp_in, src_begin * sizeof(struct input_instr), SEEK_SET) != 0) {
-        perror("fseek");
-        free(b_records);
-        fclose(fp_in);
-        return 1;
-    }
-
-    size_t read_count = fread(b_records, sizeof(struct input_instr), b_insert_len, fp_in);
-    if ((int64_t)read_count != b_insert_len) {
-        fprintf(stderr, "Error: Expected to read %ld records, got %zu\n", (long)b_insert_len, read_count);
-        free(b_records);
-        fclose(fp_in);
-        return 1;
-    }
-
-    /* Reset input file to beginning */
-    fseek(fp_in, 0, SEEK_SET);
-
     /* Open output file */
-    FILE *fp_out = fopen(out_path, "wb");
-    if (!fp_out) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot create output file: %s\n", out_path);
-        free(b_records);
-        fclose(fp_in);
+    struct trace_writer wr;
+    if (trace_writer_open(&wr, out_path, 0) != 0) {
+        trace_map_close(&tm);
         return 1;
     }
+    wr.copy_mode = copy_mode;
 
     fprintf(stderr, "# Writing output to: %s\n", out_path);
 
-    /* Process trace: insert mode */
-    struct input_instr rec;
-    int64_t in_idx = 0;
-    int64_t out_idx = 0;
-    int inserted = 0;
-
-    while (fread(&rec, sizeof(rec), 1, fp_in) == 1) {
-        /* Check if we've reached the insertion point */
-        if (!inserted && in_idx == insert_at) {
-            /* Insert B records */
-            if (fwrite(b_records, sizeof(struct input_instr), b_insert_len, fp_out) != (size_t)b_insert_len) {
-                perror("fwrite");
-                fprintf(stderr, "Error: Write failed during insertion at output index %ld\n", (long)out_idx);
-                free(b_records);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-            out_idx += b_insert_len;
-            inserted = 1;
-        }
-
-        /* Write original record */
-        if (fwrite(&rec, sizeof(struct input_instr), 1, fp_out) != 1) {
-            perror("fwrite");
-            fprintf(stderr, "Error: Write failed at output index %ld\n", (long)out_idx);
-            free(b_records);
-            fclose(fp_in);
-            fclose(fp_out);
-            return 1;
-        }
-        in_idx++;
-        out_idx++;
-    }
+    /*
+     * Process trace: insert mode.
+     * The output is three contiguous spans of the input, each moved with
+     * the selected copy mode:
+     *   [0, insert_at) + [src_begin, src_end) + [insert_at, total_records)
+     */
+    struct {
+        int64_t begin;
+        int64_t len;
+        int64_t out_idx;
+    } spans[3] = {
+        { 0,         insert_at,                 0                        },
+        { src_begin, b_insert_len,              insert_at                },
+        { insert_at, total_records - insert_at, insert_at + b_insert_len },
+    };
 
-    /* Handle insertion at the very end (insert_at == total_records) */
-    if (!inserted && insert_at == total_records) {
-        if (fwrite(b_records, sizeof(struct input_instr), b_insert_len, fp_out) != (size_t)b_insert_len) {
-            perror("fwrite");
-            fprintf(stderr, "Error: Write failed during insertion at end\n");
-            free(b_records);
-            fclose(fp_in);
-            fclose(fp_out);
+    for (int k = 0; k < 3; k++) {
+        if (trace_writer_copy_span(&wr, &tm, spans[k].begin, spans[k].len) != 0) {
+            fprintf(stderr, "Error: Write failed at output index %ld\n", (long)spans[k].out_idx);
+            trace_writer_close(&wr);
+            trace_map_close(&tm);
             return 1;
         }
-        out_idx += b_insert_len;
-        inserted = 1;
     }
 
     fprintf(stderr, "#\n");
-    fprintf(stderr, "# Read %ld input records\n", (long)in_idx);
-    fprintf(stderr, "# Wrote %ld output records\n", (long)out_idx);
+    fprintf(stderr, "# Read %ld input records\n", (long)total_records);
+    fprintf(stderr, "# Wrote %ld output records\n", (long)output_records);
     fprintf(stderr, "# Inserted %ld B records at position %ld\n", (long)b_insert_len, (long)insert_at);
+    if (copy_mode != TRACE_COPY_WRITE) {
+        fprintf(stderr, "# Output: %lu records reflinked, %lu copied in kernel, %lu written\n",
+                (unsigned long)wr.n_reflinked, (unsigned long)wr.n_kernel_copied,
+                (unsigned long)(wr.n_written - wr.n_reflinked - wr.n_kernel_copied));
+    }
     fprintf(stderr, "# Done.\n");
 
-    free(b_records);
-    fclose(fp_in);
-    fclose(fp_out);
+    int rc = trace_writer_close(&wr);
+    trace_map_close(&tm);
+    if (rc != 0) {
+        return 1;
+    }
 
     return 0;
 }
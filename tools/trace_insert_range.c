@@ -1,7 +1,8 @@
 /*
  * trace_insert_range.c - Insert a range of trace records at a specified position (Phase 3.5)
  *
- * Usage: trace_insert_range --in PATH --out PATH --src-begin I --src-end J --insert-at K [--dry-run]
+ * Usage: trace_insert_range --in PATH --out PATH --src-begin I --src-end J --insert-at K
+ *            [--copy-mode MODE] [--dry-run]
  *
  * Copies records from [src_begin, src_end) and inserts them at position insert_at.
  * Unlike overwrite mode, all original records are preserved and trace length increases.
@@ -13,24 +14,11 @@
 #include <string.h>
 #include <getopt.h>
 
-/*
- * ChampSim trace format (from inc/trace_instruction.h)
- */
-#define NUM_INSTR_DESTINATIONS 2
-#define NUM_INSTR_SOURCES 4
-
-struct input_instr {
-    uint64_t ip;
-    uint8_t  is_branch;
-    uint8_t  branch_taken;
-    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS];
-    uint8_t  source_registers[NUM_INSTR_SOURCES];
-    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];
-    uint64_t source_memory[NUM_INSTR_SOURCES];
-};
+#include "trace_io.h"
 
 static void print_usage(const char *prog) {
-    fprintf(stderr, "Usage: %s --in PATH --out PATH --src-begin I --src-end J --insert-at K [--dry-run]\n", prog);
+    fprintf(stderr, "Usage: %s --in PATH --out PATH --src-begin I --src-end J --insert-at K\n", prog);
+    fprintf(stderr, "           [--copy-mode MODE] [--dry-run]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  --in PATH        Input trace file (required)\n");
@@ -38,6 +26,10 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "  --src-begin I    Source range start index, inclusive (required)\n");
     fprintf(stderr, "  --src-end J      Source range end index, exclusive (required)\n");
     fprintf(stderr, "  --insert-at K    Insertion point - records are inserted BEFORE this index (required)\n");
+    fprintf(stderr, "  --copy-mode MODE How to move records copied from the input (default: write)\n");
+    fprintf(stderr, "                   write   = through userspace from the mapped input\n");
+    fprintf(stderr, "                   copy    = copy_file_range(2), data stays in the kernel\n");
+    fprintf(stderr, "                   reflink = FICLONERANGE where block-aligned (XFS/btrfs), else copy\n");
     fprintf(stderr, "  --dry-run        Validate ranges without writing output\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Behavior:\n");
@@ -52,6 +44,7 @@ int main(int argc, char *argv[]) {
     int64_t src_begin = -1;
     int64_t src_end = -1;
     int64_t insert_at = -1;
+    int copy_mode = TRACE_COPY_WRITE;
     int dry_run = 0;
 
     /* Parse command line options */
@@ -61,13 +54,14 @@ int main(int argc, char *argv[]) {
         {"src-begin", required_argument, 0, 's'},
         {"src-end",   required_argument, 0, 'e'},
         {"insert-at", required_argument, 0, 'a'},
+        {"copy-mode", required_argument, 0, 'c'},
         {"dry-run",   no_argument,       0, 'r'},
         {"help",      no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:o:s:e:a:rh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:s:e:a:rc:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 'i':
                 in_path = optarg;
@@ -87,6 +81,13 @@ int main(int argc, char *argv[]) {
             case 'r':
                 dry_run = 1;
                 break;
+            case 'c':
+                copy_mode = trace_copy_mode_parse(optarg);
+                if (copy_mode < 0) {
+                    fprintf(stderr, "Error: Unknown --copy-mode '%s' (write, copy, reflink)\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -120,32 +121,17 @@ int main(int argc, char *argv[]) {
 
     int64_t insert_len = src_end - src_begin;
 
-    /* Open input file and get total records */
-    FILE *fp_in = fopen(in_path, "rb");
-    if (!fp_in) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot open input file: %s\n", in_path);
-        return 1;
-    }
-
-    fseek(fp_in, 0, SEEK_END);
-    long filesize = ftell(fp_in);
-    fseek(fp_in, 0, SEEK_SET);
-
-    if (filesize < 0) {
-        perror("ftell");
-        fclose(fp_in);
+    /*
+     * Map input file and get total records. The kernel-side copy modes never
+     * read the mapping, so it is only prefaulted for a plain write.
+     */
+    struct trace_map tm;
+    int map_flags = (dry_run || copy_mode != TRACE_COPY_WRITE) ? 0 : TRACE_MAP_SEQUENTIAL;
+    if (trace_map_open(&tm, in_path, map_flags) != 0) {
         return 1;
     }
 
-    if (filesize % sizeof(struct input_instr) != 0) {
-        fprintf(stderr, "Error: File size (%ld bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
-                filesize, sizeof(struct input_instr));
-        fclose(fp_in);
-        return 1;
-    }
-
-    int64_t total_records = filesize / sizeof(struct input_instr);
+    int64_t total_records = (int64_t)tm.n_records;
     int64_t output_records = total_records + insert_len;
 
     /* Print operation info */
@@ -163,13 +149,13 @@ int main(int argc, char *argv[]) {
     if (src_end > total_records) {
         fprintf(stderr, "Error: src_end (%ld) exceeds total records (%ld)\n",
                 (long)src_end, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 1;
     }
     if (insert_at > total_records) {
         fprintf(stderr, "Error: insert_at (%ld) exceeds total records (%ld)\n",
                 (long)insert_at, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 1;
     }
 
@@ -192,109 +178,61 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "#   [%ld, %ld) -> original [%ld, %ld)\n",
                 (long)(insert_at + insert_len), (long)output_records,
                 (long)insert_at, (long)total_records);
-        fclose(fp_in);
+        trace_map_close(&tm);
         return 0;
     }
 
-    /* Load source records into memory */
-    fprintf(stderr, "# Loading source records into memory...\n");
-    struct input_instr *src_records = malloc(insert_len * sizeof(struct input_instr));
-    if (!src_records) {
-        fprintf(stderr, "Error: Cannot allocate memory for %ld source records (%ld bytes)\n",
-                (long)insert_len, (long)(insert_len * sizeof(struct input_instr)));
-        fclose(fp_in);
-        return 1;
-    }
-
-    /* Seek to source range and read */
-    if (fseek(fp_in, src_begin * sizeof(struct input_instr), SEEK_SET) != 0) {
-        perror("fseek");
-        free(src_records);
-        fclose(fp_in);
-        return 1;
-    }
-
-    size_t read_count = fread(src_records, sizeof(struct input_instr), insert_len, fp_in);
-    if ((int64_t)read_count != insert_len) {
-        fprintf(stderr, "Error: Expected to read %ld records, got %zu\n", (long)insert_len, read_count);
-        free(src_records);
-        fclose(fp_in);
-        return 1;
-    }
-
-    /* Reset input file to beginning */
-    fseek(fp_in, 0, SEEK_SET);
-
     /* Open output file */
-    FILE *fp_out = fopen(out_path, "wb");
-    if (!fp_out) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot create output file: %s\n", out_path);
-        free(src_records);
-        fclose(fp_in);
+    struct trace_writer wr;
+    if (trace_writer_open(&wr, out_path, 0) != 0) {
+        trace_map_close(&tm);
         return 1;
     }
+    wr.copy_mode = copy_mode;
 
     fprintf(stderr, "# Writing output to: %s\n", out_path);
 
-    /* Process trace: insert mode */
-    struct input_instr rec;
-    int64_t in_idx = 0;
-    int64_t out_idx = 0;
-    int inserted = 0;
-
-    while (fread(&rec, sizeof(rec), 1, fp_in) == 1) {
-        /* Check if we've reached the insertion point */
-        if (!inserted && in_idx == insert_at) {
-            /* Insert source records */
-            if (fwrite(src_records, sizeof(struct input_instr), insert_len, fp_out) != (size_t)insert_len) {
-                perror("fwrite");
-                fprintf(stderr, "Error: Write failed during insertion at output index %ld\n", (long)out_idx);
-                free(src_records);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-            out_idx += insert_len;
-            inserted = 1;
-        }
-
-        /* Write original record */
-        if (fwrite(&rec, sizeof(struct input_instr), 1, fp_out) != 1) {
-            perror("fwrite");
-            fprintf(stderr, "Error: Write failed at output index %ld\n", (long)out_idx);
-            free(src_records);
-            fclose(fp_in);
-            fclose(fp_out);
-            return 1;
-        }
-        in_idx++;
-        out_idx++;
-    }
+    /*
+     * Process trace: insert mode.
+     * The output is three contiguous spans of the input, each moved with
+     * the selected copy mode:
+     *   [0, insert_at) + [src_begin, src_end) + [insert_at, total_records)
+     */
+    struct {
+        int64_t begin;
+        int64_t len;
+        int64_t out_idx;
+    } spans[3] = {
+        { 0,         insert_at,                 0                      },
+        { src_begin, insert_len,                insert_at              },
+        { insert_at, total_records - insert_at, insert_at + insert_len },
+    };
 
-    /* Handle insertion at the very end (insert_at == total_records) */
-    if (!inserted && insert_at == total_records) {
-        if (fwrite(src_records, sizeof(struct input_instr), insert_len, fp_out) != (size_t)insert_len) {
-            perror("fwrite");
-            fprintf(stderr, "Error: Write failed during insertion at end\n");
-            free(src_records);
-            fclose(fp_in);
-            fclose(fp_out);
+    for (int k = 0; k < 3; k++) {
+        if (trace_writer_copy_span(&wr, &tm, spans[k].begin, spans[k].len) != 0) {
+            fprintf(stderr, "Error: Write failed at output index %ld\n", (long)spans[k].out_idx);
+            trace_writer_close(&wr);
+            trace_map_close(&tm);
             return 1;
         }
-        out_idx += insert_len;
-        inserted = 1;
     }
 
     fprintf(stderr, "#\n");
-    fprintf(stderr, "# Read %ld input records\n", (long)in_idx);
-    fprintf(stderr, "# Wrote %ld output records\n", (long)out_idx);
+    fprintf(stderr, "# Read %ld input records\n", (long)total_records);
+    fprintf(stderr, "# Wrote %ld output records\n", (long)output_records);
     fprintf(stderr, "# Inserted %ld records at position %ld\n", (long)insert_len, (long)insert_at);
+    if (copy_mode != TRACE_COPY_WRITE) {
+        fprintf(stderr, "# Output: %lu records reflinked, %lu copied in kernel, %lu written\n",
+                (unsigned long)wr.n_reflinked, (unsigned long)wr.n_kernel_copied,
+                (unsigned long)(wr.n_written - wr.n_reflinked - wr.n_kernel_copied));
+    }
     fprintf(stderr, "# Done.\n");
 
-    free(src_records);
-    fclose(fp_in);
-    fclose(fp_out);
+    int rc = trace_writer_close(&wr);
+    trace_map_close(&tm);
+    if (rc != 0) {
+        return 1;
+    }
 
     return 0;
 }
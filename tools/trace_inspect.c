@@ -1,10 +1,13 @@
 /*
  * trace_inspect.c - ChampSim binary trace inspector (Phase 1)
  *
- * Usage: trace_inspect [--trace PATH] [--max N]
+ * Usage: trace_inspect [--trace PATH] [--max N] [--start IDX | --iter K [--region R]]
  *
- * Reads a raw binary trace file and prints human-readable dump of records.
+ * Maps a raw binary trace file and prints human-readable dump of records.
  * Each record corresponds to struct input_instr from ChampSim's trace_instruction.h
+ *
+ * With --iter the window is looked up in the trace's .tidx index (see
+ * trace_build_index) instead of being given as a record index.
  */
 
 #include <stdio.h>
@@ -13,33 +16,19 @@
 #include <string.h>
 #include <getopt.h>
 
-/*
- * ChampSim trace format (from inc/trace_instruction.h)
- * This must match the exact binary layout used by the Pin tracer.
- */
-#define NUM_INSTR_DESTINATIONS 2
-#define NUM_INSTR_SOURCES 4
-
-struct input_instr {
-    uint64_t ip;                                      /* instruction pointer */
-
-    uint8_t  is_branch;                               /* branch flag */
-    uint8_t  branch_taken;                            /* branch taken/not-taken */
-
-    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS]; /* dest reg IDs */
-    uint8_t  source_registers[NUM_INSTR_SOURCES];           /* src reg IDs */
-
-    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];    /* dest mem addresses */
-    uint64_t source_memory[NUM_INSTR_SOURCES];              /* src mem addresses */
-};
+#include "trace_io.h"
+#include "trace_index.h"
 
 static void print_usage(const char *prog) {
-    fprintf(stderr, "Usage: %s --trace PATH [--max N] [--start IDX]\n", prog);
+    fprintf(stderr, "Usage: %s --trace PATH [--max N] [--start IDX | --iter K [--region R]]\n", prog);
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  --trace PATH   Path to raw binary trace file (required)\n");
     fprintf(stderr, "  --max N        Maximum number of records to display (default: 100)\n");
     fprintf(stderr, "  --start IDX    Start index (default: 0)\n");
+    fprintf(stderr, "  --iter K       Show outer iteration K, from PATH%s (trace_build_index)\n", TRACE_INDEX_SUFFIX);
+    fprintf(stderr, "  --region R     Only region R of the iteration: A, B or overhead\n");
+    fprintf(stderr, "                 (with --iter, --max defaults to the whole region)\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Output format:\n");
     fprintf(stderr, "  idx=<record#> ip=<hex> src_mem=[...] dst_mem=[...]\n");
@@ -49,28 +38,44 @@ int main(int argc, char *argv[]) {
     const char *trace_path = NULL;
     uint64_t max_records = 100;
     uint64_t start_idx = 0;
+    int64_t iter = -1;
+    int region = TRACE_REGIONS;  /* whole iteration */
+    int have_max = 0;
 
     /* Parse command line options */
     static struct option long_options[] = {
-        {"trace", required_argument, 0, 't'},
-        {"max",   required_argument, 0, 'm'},
-        {"start", required_argument, 0, 's'},
-        {"help",  no_argument,       0, 'h'},
+        {"trace",  required_argument, 0, 't'},
+        {"max",    required_argument, 0, 'm'},
+        {"start",  required_argument, 0, 's'},
+        {"iter",   required_argument, 0, 'k'},
+        {"region", required_argument, 0, 'r'},
+        {"help",   no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "t:m:s:h", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:m:s:k:r:h", long_options, NULL)) != -1) {
         switch (opt) {
             case 't':
                 trace_path = optarg;
                 break;
             case 'm':
                 max_records = strtoull(optarg, NULL, 10);
+                have_max = 1;
                 break;
             case 's':
                 start_idx = strtoull(optarg, NULL, 10);
                 break;
+            case 'k':
+                iter = strtoll(optarg, NULL, 10);
+                break;
+            case 'r':
+                region = trace_region_parse(optarg);
+                if (region < 0) {
+                    fprintf(stderr, "Error: Unknown --region '%s' (A, B, overhead)\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -84,73 +89,84 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    /* Open trace file */
-    FILE *fp = fopen(trace_path, "rb");
-    if (!fp) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot open trace file: %s\n", trace_path);
+    if (region != TRACE_REGIONS && iter < 0) {
+        fprintf(stderr, "Error: --region requires --iter\n");
         return 1;
     }
 
-    /* Sanity check: file size must be a multiple of sizeof(input_instr) */
-    fseek(fp, 0, SEEK_END);
-    long filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    if (filesize < 0) {
-        perror("ftell");
-        fclose(fp);
-        return 1;
+    /* Look the iteration up in the index: no scan needed */
+    struct trace_region_summary summary;
+    int have_summary = 0;
+    memset(&summary, 0, sizeof(summary));
+    if (iter >= 0) {
+        struct trace_index ix;
+        uint64_t end;
+        if (trace_index_load(&ix, trace_path) != 0) {
+            return 1;
+        }
+        if (trace_index_region(&ix, (uint64_t)iter, region, &start_idx, &end) != 0) {
+            trace_index_free(&ix);
+            return 1;
+        }
+        if (!have_max) {
+            max_records = end - start_idx;
+        }
+        if (region != TRACE_REGIONS) {
+            summary = ix.iters[iter].region[region];
+            have_summary = 1;
+        }
+        trace_index_free(&ix);
     }
 
-    if (filesize % sizeof(struct input_instr) != 0) {
-        fprintf(stderr, "Error: File size (%ld bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
-                filesize, sizeof(struct input_instr));
-        fprintf(stderr, "This may indicate a corrupted trace or mismatched trace format.\n");
-        fclose(fp);
+    /* Map trace file (only the displayed window is actually touched) */
+    struct trace_map tm;
+    if (trace_map_open(&tm, trace_path, 0) != 0) {
         return 1;
     }
 
-    uint64_t total_records = filesize / sizeof(struct input_instr);
+    uint64_t total_records = tm.n_records;
 
     /* Print header info */
     printf("# Trace file: %s\n", trace_path);
     printf("# sizeof(input_instr) = %zu bytes\n", sizeof(struct input_instr));
     printf("# Total records in file: %lu\n", (unsigned long)total_records);
+    if (iter >= 0) {
+        printf("# Iteration %ld, %s\n", (long)iter, trace_region_name(region));
+    }
+    if (have_summary && summary.n_mem > 0) {
+        printf("# Memory records: %lu, ip [0x%lx, 0x%lx], addr [0x%lx, 0x%lx]\n",
+               (unsigned long)summary.n_mem,
+               (unsigned long)summary.ip_min, (unsigned long)summary.ip_max,
+               (unsigned long)summary.addr_min, (unsigned long)summary.addr_max);
+    }
     printf("# Start index: %lu\n", (unsigned long)start_idx);
     printf("# Displaying up to %lu records\n", (unsigned long)max_records);
     printf("#\n");
 
-    /* Seek to start index if needed */
-    if (start_idx > 0) {
-        if (start_idx >= total_records) {
-            fprintf(stderr, "Error: start_idx (%lu) exceeds total records (%lu)\n",
-                    (unsigned long)start_idx, (unsigned long)total_records);
-            fclose(fp);
-            return 1;
-        }
-        if (fseek(fp, start_idx * sizeof(struct input_instr), SEEK_SET) != 0) {
-            perror("fseek");
-            fclose(fp);
-            return 1;
-        }
+    /* Validate start index */
+    if (start_idx > 0 && start_idx >= total_records) {
+        fprintf(stderr, "Error: start_idx (%lu) exceeds total records (%lu)\n",
+                (unsigned long)start_idx, (unsigned long)total_records);
+        trace_map_close(&tm);
+        return 1;
     }
 
-    /* Read and print records */
-    struct input_instr rec;
+    /* Print records */
     uint64_t idx = start_idx;
     uint64_t count = 0;
 
-    while (count < max_records && fread(&rec, sizeof(rec), 1, fp) == 1) {
+    while (count < max_records && idx < total_records) {
+        const struct input_instr *rec = &tm.recs[idx];
+
         /* Build source memory list (non-zero only) */
         char src_buf[256] = "[";
         int src_first = 1;
         for (int i = 0; i < NUM_INSTR_SOURCES; i++) {
-            if (rec.source_memory[i] != 0) {
+            if (rec->source_memory[i] != 0) {
                 char tmp[32];
                 snprintf(tmp, sizeof(tmp), "%s0x%lx",
                          src_first ? "" : ",",
-                         (unsigned long)rec.source_memory[i]);
+                         (unsigned long)rec->source_memory[i]);
                 strcat(src_buf, tmp);
                 src_first = 0;
             }
@@ -161,11 +177,11 @@ int main(int argc, char *argv[]) {
         char dst_buf[128] = "[";
         int dst_first = 1;
         for (int i = 0; i < NUM_INSTR_DESTINATIONS; i++) {
-            if (rec.destination_memory[i] != 0) {
+            if (rec->destination_memory[i] != 0) {
                 char tmp[32];
                 snprintf(tmp, sizeof(tmp), "%s0x%lx",
                          dst_first ? "" : ",",
-                         (unsigned long)rec.destination_memory[i]);
+                         (unsigned long)rec->destination_memory[i]);
                 strcat(dst_buf, tmp);
                 dst_first = 0;
             }
@@ -175,7 +191,7 @@ int main(int argc, char *argv[]) {
         /* Print record */
         printf("idx=%lu ip=0x%lx src_mem=%s dst_mem=%s\n",
                (unsigned long)idx,
-               (unsigned long)rec.ip,
+               (unsigned long)rec->ip,
                src_buf,
                dst_buf);
 
@@ -188,12 +204,12 @@ int main(int argc, char *argv[]) {
     printf("# Read %lu records\n", (unsigned long)count);
 
     /* Check if we hit EOF or max */
-    if (feof(fp)) {
+    if (count < max_records) {
         printf("# Reached end of file\n");
-    } else if (count >= max_records) {
+    } else {
         printf("# Stopped at --max limit\n");
     }
 
-    fclose(fp);
+    trace_map_close(&tm);
     return 0;
 }
@@ -0,0 +1,891 @@
+/*
+ * trace_io.c - Shared trace I/O for the trace surgery tools
+ *
+ * See trace_io.h for the interface.
+ */
+
+#define _GNU_SOURCE  /* MAP_POPULATE */
+
+#include "trace_io.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/fs.h>  /* FICLONERANGE */
+
+#ifndef TRACE_NO_XZ
+#include <lzma.h>
+#endif
+
+/* Size of the compressed-side I/O buffers for .xz input and output */
+#define XZ_IO_BUF_BYTES (1u << 20)
+
+int trace_map_open(struct trace_map *tm, const char *path, int flags) {
+    memset(tm, 0, sizeof(*tm));
+    tm->path = path;
+    tm->fd = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        fprintf(stderr, "Error: Cannot open trace file: %s\n", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+
+    /* Sanity check: file size must be a multiple of sizeof(input_instr) */
+    if (st.st_size % sizeof(struct input_instr) != 0) {
+        fprintf(stderr, "Error: File size (%ld bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
+                (long)st.st_size, sizeof(struct input_instr));
+        fprintf(stderr, "This may indicate a corrupted trace or mismatched trace format.\n");
+        close(fd);
+        return -1;
+    }
+
+    tm->fd = fd;
+    tm->bytes = (size_t)st.st_size;
+    tm->n_records = tm->bytes / sizeof(struct input_instr);
+
+    /* mmap() rejects zero-length mappings; an empty trace is just an empty span */
+    if (tm->bytes == 0) {
+        return 0;
+    }
+
+    int mmap_flags = MAP_PRIVATE;
+    if ((flags & TRACE_MAP_SEQUENTIAL) && !(flags & TRACE_MAP_SHARDED)) {
+        mmap_flags |= MAP_POPULATE;
+    }
+
+    void *p = mmap(NULL, tm->bytes, PROT_READ, mmap_flags, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        fprintf(stderr, "Error: Cannot map trace file: %s\n", path);
+        close(fd);
+        tm->fd = -1;
+        return -1;
+    }
+
+    if (flags & (TRACE_MAP_SEQUENTIAL | TRACE_MAP_SHARDED)) {
+        /* Advisory only: a failure here does not affect correctness */
+        madvise(p, tm->bytes, MADV_SEQUENTIAL);
+    }
+
+    tm->recs = (const struct input_instr *)p;
+    return 0;
+}
+
+void trace_map_close(struct trace_map *tm) {
+    if (tm->recs) {
+        munmap((void *)tm->recs, tm->bytes);
+        tm->recs = NULL;
+    }
+    if (tm->fd >= 0) {
+        close(tm->fd);
+        tm->fd = -1;
+    }
+}
+
+int trace_write_records(FILE *fp, const struct input_instr *recs, uint64_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    if (fwrite(recs, sizeof(struct input_instr), n, fp) != n) {
+        return -1;
+    }
+    return 0;
+}
+
+int trace_path_is_xz(const char *path) {
+    size_t len = strlen(path);
+    return len >= 3 && strcmp(path + len - 3, ".xz") == 0;
+}
+
+/* ========================================================================
+ * xz backend
+ * ======================================================================== */
+
+#ifndef TRACE_NO_XZ
+
+struct trace_xz_reader {
+    int fd;
+    lzma_stream strm;
+    int stream_end;
+    uint8_t *in_buf;
+    struct input_instr *rec_buf;   /* decoded records (TRACE_READ_CHUNK) */
+};
+
+struct trace_xz_writer {
+    lzma_stream strm;
+    uint8_t *out_buf;
+};
+
+static const char *xz_strerror(lzma_ret ret) {
+    switch (ret) {
+        case LZMA_MEM_ERROR:         return "out of memory";
+        case LZMA_MEMLIMIT_ERROR:    return "memory usage limit reached";
+        case LZMA_FORMAT_ERROR:      return "not an xz file";
+        case LZMA_OPTIONS_ERROR:     return "unsupported compression options";
+        case LZMA_DATA_ERROR:        return "compressed data is corrupt";
+        case LZMA_BUF_ERROR:         return "compressed data is truncated";
+        case LZMA_UNSUPPORTED_CHECK: return "unsupported integrity check";
+        default:                     return "internal liblzma error";
+    }
+}
+
+/*
+ * Sum the uncompressed sizes recorded in the index of every stream in the
+ * file, walking backwards from the end (stream footer -> index -> previous
+ * stream). Returns TRACE_RECORDS_UNKNOWN if the file cannot be parsed this
+ * way; the caller then just streams until the end.
+ */
+static uint64_t xz_total_bytes(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return TRACE_RECORDS_UNKNOWN;
+    }
+
+    uint64_t total = 0;
+    off_t end = st.st_size;
+
+    while (end > 0) {
+        /* Skip stream padding (multiples of four null bytes) */
+        uint8_t word[4];
+        while (end >= 4 && pread(fd, word, 4, end - 4) == 4 &&
+               word[0] == 0 && word[1] == 0 && word[2] == 0 && word[3] == 0) {
+            end -= 4;
+        }
+        if (end < 2 * LZMA_STREAM_HEADER_SIZE) {
+            return TRACE_RECORDS_UNKNOWN;
+        }
+
+        uint8_t footer[LZMA_STREAM_HEADER_SIZE];
+        lzma_stream_flags flags;
+        if (pread(fd, footer, sizeof(footer), end - LZMA_STREAM_HEADER_SIZE) != (ssize_t)sizeof(footer) ||
+            lzma_stream_footer_decode(&flags, footer) != LZMA_OK) {
+            return TRACE_RECORDS_UNKNOWN;
+        }
+
+        off_t index_pos = end - LZMA_STREAM_HEADER_SIZE - (off_t)flags.backward_size;
+        if (index_pos < LZMA_STREAM_HEADER_SIZE) {
+            return TRACE_RECORDS_UNKNOWN;
+        }
+
+        uint8_t *index_buf = malloc(flags.backward_size);
+        if (!index_buf) {
+            return TRACE_RECORDS_UNKNOWN;
+        }
+        if (pread(fd, index_buf, flags.backward_size, index_pos) != (ssize_t)flags.backward_size) {
+            free(index_buf);
+            return TRACE_RECORDS_UNKNOWN;
+        }
+
+        lzma_index *idx = NULL;
+        uint64_t memlimit = UINT64_MAX;
+        size_t in_pos = 0;
+        lzma_ret ret = lzma_index_buffer_decode(&idx, &memlimit, NULL,
+                                                index_buf, &in_pos, flags.backward_size);
+        free(index_buf);
+        if (ret != LZMA_OK) {
+            return TRACE_RECORDS_UNKNOWN;
+        }
+
+        total += lzma_index_uncompressed_size(idx);
+        lzma_vli stream_size = lzma_index_stream_size(idx);
+        lzma_index_end(idx, NULL);
+
+        if ((off_t)stream_size > end) {
+            return TRACE_RECORDS_UNKNOWN;
+        }
+        end -= (off_t)stream_size;
+    }
+
+    return total;
+}
+
+static int xz_reader_open(struct trace_reader *r) {
+    struct trace_xz_reader *xz = calloc(1, sizeof(*xz));
+    if (!xz) {
+        fprintf(stderr, "Error: Cannot allocate xz reader\n");
+        return -1;
+    }
+    xz->fd = -1;
+    r->xz = xz;
+
+    xz->fd = open(r->path, O_RDONLY);
+    if (xz->fd < 0) {
+        perror("open");
+        fprintf(stderr, "Error: Cannot open trace file: %s\n", r->path);
+        return -1;
+    }
+    posix_fadvise(xz->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    xz->in_buf = malloc(XZ_IO_BUF_BYTES);
+    xz->rec_buf = malloc(TRACE_READ_CHUNK * sizeof(struct input_instr));
+    if (!xz->in_buf || !xz->rec_buf) {
+        fprintf(stderr, "Error: Cannot allocate xz reader buffers\n");
+        return -1;
+    }
+
+    uint64_t total_bytes = xz_total_bytes(xz->fd);
+    if (total_bytes != TRACE_RECORDS_UNKNOWN) {
+        if (total_bytes % sizeof(struct input_instr) != 0) {
+            fprintf(stderr, "Error: Uncompressed size (%lu bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
+                    (unsigned long)total_bytes, sizeof(struct input_instr));
+            fprintf(stderr, "This may indicate a corrupted trace or mismatched trace format.\n");
+            return -1;
+        }
+        r->n_records = total_bytes / sizeof(struct input_instr);
+    }
+
+    lzma_stream init = LZMA_STREAM_INIT;
+    xz->strm = init;
+
+    lzma_ret ret;
+#if LZMA_VERSION >= 50040002
+    /* Decode independent blocks (as written by xz -T / our writer) in parallel */
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = lzma_cputhreads();
+    if (mt.threads == 0) {
+        mt.threads = 1;
+    }
+    mt.memlimit_threading = UINT64_MAX;
+    mt.memlimit_stop = UINT64_MAX;
+    ret = lzma_stream_decoder_mt(&xz->strm, &mt);
+#else
+    ret = lzma_stream_decoder(&xz->strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+    if (ret != LZMA_OK) {
+        fprintf(stderr, "Error: Cannot initialize xz decoder: %s\n", xz_strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+static int64_t xz_reader_next(struct trace_reader *r, const struct input_instr **recs, uint64_t max) {
+    struct trace_xz_reader *xz = r->xz;
+
+    if (max > TRACE_READ_CHUNK) {
+        max = TRACE_READ_CHUNK;
+    }
+    if (xz->stream_end || max == 0) {
+        *recs = xz->rec_buf;
+        return 0;
+    }
+
+    size_t want = max * sizeof(struct input_instr);
+    xz->strm.next_out = (uint8_t *)xz->rec_buf;
+    xz->strm.avail_out = want;
+
+    while (xz->strm.avail_out > 0) {
+        lzma_action action = LZMA_RUN;
+        if (xz->strm.avail_in == 0) {
+            ssize_t got = read(xz->fd, xz->in_buf, XZ_IO_BUF_BYTES);
+            if (got < 0) {
+                perror("read");
+                fprintf(stderr, "Error: Read failed on %s\n", r->path);
+                return -1;
+            }
+            xz->strm.next_in = xz->in_buf;
+            xz->strm.avail_in = (size_t)got;
+            if (got == 0) {
+                action = LZMA_FINISH;
+            }
+        }
+
+        lzma_ret ret = lzma_code(&xz->strm, action);
+        if (ret == LZMA_STREAM_END) {
+            xz->stream_end = 1;
+            break;
+        }
+        if (ret != LZMA_OK) {
+            fprintf(stderr, "Error: xz decoding failed on %s: %s\n", r->path, xz_strerror(ret));
+            return -1;
+        }
+    }
+
+    size_t got_bytes = want - xz->strm.avail_out;
+    if (got_bytes % sizeof(struct input_instr) != 0) {
+        fprintf(stderr, "Error: Uncompressed trace size is not a multiple of sizeof(input_instr) (%zu bytes)\n",
+                sizeof(struct input_instr));
+        return -1;
+    }
+
+    *recs = xz->rec_buf;
+    return (int64_t)(got_bytes / sizeof(struct input_instr));
+}
+
+static void xz_reader_close(struct trace_reader *r) {
+    struct trace_xz_reader *xz = r->xz;
+    if (!xz) {
+        return;
+    }
+    lzma_end(&xz->strm);
+    if (xz->fd >= 0) {
+        close(xz->fd);
+    }
+    free(xz->in_buf);
+    free(xz->rec_buf);
+    free(xz);
+    r->xz = NULL;
+}
+
+static int xz_writer_open(struct trace_writer *w, uint32_t xz_threads) {
+    struct trace_xz_writer *xz = calloc(1, sizeof(*xz));
+    if (!xz) {
+        fprintf(stderr, "Error: Cannot allocate xz writer\n");
+        return -1;
+    }
+    w->xz = xz;
+
+    xz->out_buf = malloc(XZ_IO_BUF_BYTES);
+    if (!xz->out_buf) {
+        fprintf(stderr, "Error: Cannot allocate xz writer buffer\n");
+        return -1;
+    }
+
+    if (xz_threads == 0) {
+        xz_threads = lzma_cputhreads();
+        if (xz_threads == 0) {
+            xz_threads = 1;
+        }
+    }
+
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(mt));
+    mt.threads = xz_threads;
+    mt.block_size = 0;      /* liblzma default: 3 x dictionary size */
+    mt.timeout = 0;
+    mt.preset = TRACE_XZ_PRESET;
+    mt.check = LZMA_CHECK_CRC64;
+
+    lzma_stream init = LZMA_STREAM_INIT;
+    xz->strm = init;
+
+    lzma_ret ret = lzma_stream_encoder_mt(&xz->strm, &mt);
+    if (ret != LZMA_OK) {
+        fprintf(stderr, "Error: Cannot initialize xz encoder: %s\n", xz_strerror(ret));
+        return -1;
+    }
+    xz->strm.next_out = xz->out_buf;
+    xz->strm.avail_out = XZ_IO_BUF_BYTES;
+    return 0;
+}
+
+/* Run the encoder on whatever is in strm.next_in, draining output to fp */
+static int xz_writer_code(struct trace_writer *w, lzma_action action) {
+    struct trace_xz_writer *xz = w->xz;
+
+    for (;;) {
+        lzma_ret ret = lzma_code(&xz->strm, action);
+
+        if (xz->strm.avail_out == 0 || ret == LZMA_STREAM_END) {
+            size_t n = XZ_IO_BUF_BYTES - xz->strm.avail_out;
+            if (n > 0 && fwrite(xz->out_buf, 1, n, w->fp) != n) {
+                perror("fwrite");
+                fprintf(stderr, "Error: Write failed on %s\n", w->path);
+                return -1;
+            }
+            xz->strm.next_out = xz->out_buf;
+            xz->strm.avail_out = XZ_IO_BUF_BYTES;
+        }
+
+        if (ret == LZMA_STREAM_END) {
+            return 0;
+        }
+        if (ret != LZMA_OK) {
+            fprintf(stderr, "Error: xz encoding failed on %s: %s\n", w->path, xz_strerror(ret));
+            return -1;
+        }
+        if (action == LZMA_RUN && xz->strm.avail_in == 0) {
+            return 0;
+        }
+    }
+}
+
+static int xz_writer_write(struct trace_writer *w, const struct input_instr *recs, uint64_t n) {
+    struct trace_xz_writer *xz = w->xz;
+    xz->strm.next_in = (const uint8_t *)recs;
+    xz->strm.avail_in = n * sizeof(struct input_instr);
+    return xz_writer_code(w, LZMA_RUN);
+}
+
+static int xz_writer_finish(struct trace_writer *w) {
+    w->xz->strm.next_in = NULL;
+    w->xz->strm.avail_in = 0;
+    return xz_writer_code(w, LZMA_FINISH);
+}
+
+static void xz_writer_free(struct trace_writer *w) {
+    struct trace_xz_writer *xz = w->xz;
+    if (!xz) {
+        return;
+    }
+    lzma_end(&xz->strm);
+    free(xz->out_buf);
+    free(xz);
+    w->xz = NULL;
+}
+
+#else /* TRACE_NO_XZ */
+
+struct trace_xz_reader { int unused; };
+struct trace_xz_writer { int unused; };
+
+static int xz_unsupported(const char *path) {
+    fprintf(stderr, "Error: %s is xz-compressed, but the tools were built without xz support (WITH_XZ=0)\n", path);
+    return -1;
+}
+
+static int xz_reader_open(struct trace_reader *r) { return xz_unsupported(r->path); }
+static int64_t xz_reader_next(struct trace_reader *r, const struct input_instr **recs, uint64_t max) {
+    (void)recs; (void)max;
+    return xz_unsupported(r->path);
+}
+static void xz_reader_close(struct trace_reader *r) { (void)r; }
+static int xz_writer_open(struct trace_writer *w, uint32_t xz_threads) {
+    (void)xz_threads;
+    return xz_unsupported(w->path);
+}
+static int xz_writer_write(struct trace_writer *w, const struct input_instr *recs, uint64_t n) {
+    (void)recs; (void)n;
+    return xz_unsupported(w->path);
+}
+static int xz_writer_finish(struct trace_writer *w) { return xz_unsupported(w->path); }
+static void xz_writer_free(struct trace_writer *w) { (void)w; }
+
+#endif /* TRACE_NO_XZ */
+
+/* ========================================================================
+ * Streaming reader
+ * ======================================================================== */
+
+int trace_reader_open(struct trace_reader *r, const char *path) {
+    return trace_reader_open_flags(r, path, TRACE_MAP_SEQUENTIAL);
+}
+
+int trace_reader_open_flags(struct trace_reader *r, const char *path, int map_flags) {
+    memset(r, 0, sizeof(*r));
+    r->path = path;
+    r->map.fd = -1;
+    r->is_xz = trace_path_is_xz(path);
+    r->n_records = TRACE_RECORDS_UNKNOWN;
+
+    if (r->is_xz) {
+        if (xz_reader_open(r) != 0) {
+            xz_reader_close(r);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (trace_map_open(&r->map, path, map_flags) != 0) {
+        return -1;
+    }
+    r->n_records = r->map.n_records;
+    return 0;
+}
+
+int64_t trace_reader_next(struct trace_reader *r, const struct input_instr **recs, uint64_t max) {
+    int64_t n;
+
+    if (r->is_xz) {
+        n = xz_reader_next(r, recs, max);
+    } else {
+        uint64_t left = r->map.n_records - r->pos;
+        n = (int64_t)(max < left ? max : left);
+        *recs = r->map.recs + r->pos;
+    }
+
+    if (n > 0) {
+        r->pos += (uint64_t)n;
+    }
+    return n;
+}
+
+int64_t trace_reader_read(struct trace_reader *r, struct input_instr *dst, uint64_t n) {
+    uint64_t done = 0;
+    while (done < n) {
+        const struct input_instr *recs;
+        int64_t got = trace_reader_next(r, &recs, n - done);
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        memcpy(dst + done, recs, (size_t)got * sizeof(struct input_instr));
+        done += (uint64_t)got;
+    }
+    return (int64_t)done;
+}
+
+int64_t trace_reader_take(struct trace_reader *r, const struct input_instr **recs, uint64_t n,
+                          struct input_instr *scratch) {
+    if (!r->is_xz) {
+        return trace_reader_next(r, recs, n);
+    }
+    if (!scratch) {
+        fprintf(stderr, "Error: %s: no lookahead buffer for compressed input\n", r->path);
+        return -1;
+    }
+    *recs = scratch;
+    return trace_reader_read(r, scratch, n);
+}
+
+int64_t trace_reader_skip(struct trace_reader *r, uint64_t n) {
+    if (!r->is_xz) {
+        uint64_t left = r->map.n_records - r->pos;
+        if (n > left) {
+            n = left;
+        }
+        r->pos += n;
+        return (int64_t)n;
+    }
+
+    uint64_t done = 0;
+    while (done < n) {
+        const struct input_instr *recs;
+        int64_t got = trace_reader_next(r, &recs, n - done);
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        done += (uint64_t)got;
+    }
+    return (int64_t)done;
+}
+
+void trace_reader_close(struct trace_reader *r) {
+    if (r->is_xz) {
+        xz_reader_close(r);
+    } else {
+        trace_map_close(&r->map);
+    }
+}
+
+/* ========================================================================
+ * Streaming writer
+ * ======================================================================== */
+
+int trace_writer_open(struct trace_writer *w, const char *path, uint32_t xz_threads) {
+    memset(w, 0, sizeof(*w));
+    w->path = path;
+    w->is_xz = trace_path_is_xz(path);
+
+    w->fp = fopen(path, "wb");
+    if (!w->fp) {
+        perror("fopen");
+        fprintf(stderr, "Error: Cannot create output file: %s\n", path);
+        return -1;
+    }
+
+    if (w->is_xz && xz_writer_open(w, xz_threads) != 0) {
+        xz_writer_free(w);
+        fclose(w->fp);
+        w->fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int trace_writer_write(struct trace_writer *w, const struct input_instr *recs, uint64_t n) {
+    if (n == 0) {
+        return 0;
+    }
+
+    int rc;
+    if (w->is_xz) {
+        rc = xz_writer_write(w, recs, n);
+    } else {
+        rc = trace_write_records(w->fp, recs, n);
+        if (rc != 0) {
+            perror("fwrite");
+            fprintf(stderr, "Error: Write failed on %s\n", w->path);
+        }
+    }
+
+    if (rc == 0) {
+        w->n_written += n;
+    }
+    return rc;
+}
+
+/* writev() until all of iov[0..cnt) is written, resuming after short writes */
+static int writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t put = writev(fd, iov, cnt);
+        if (put < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (cnt > 0 && (size_t)put >= iov->iov_len) {
+            put -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + put;
+            iov->iov_len -= (size_t)put;
+        }
+    }
+    return 0;
+}
+
+int trace_writer_writev(struct trace_writer *w, const struct trace_span *spans, unsigned n_spans) {
+    if (w->is_xz) {
+        for (unsigned i = 0; i < n_spans; i++) {
+            if (trace_writer_write(w, spans[i].recs, spans[i].n) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    /* Bypass stdio: flush what fwrite() buffered, then hand the spans to the kernel */
+    if (fflush(w->fp) != 0) {
+        perror("fflush");
+        fprintf(stderr, "Error: Write failed on %s\n", w->path);
+        return -1;
+    }
+
+    struct iovec iov[16];
+    unsigned i = 0;
+    while (i < n_spans) {
+        int cnt = 0;
+        uint64_t n = 0;
+        for (; i < n_spans && cnt < (int)(sizeof(iov) / sizeof(iov[0])); i++) {
+            if (spans[i].n == 0) {
+                continue;
+            }
+            iov[cnt].iov_base = (void *)spans[i].recs;
+            iov[cnt].iov_len = (size_t)spans[i].n * sizeof(struct input_instr);
+            cnt++;
+            n += spans[i].n;
+        }
+        if (writev_all(fileno(w->fp), iov, cnt) != 0) {
+            perror("writev");
+            fprintf(stderr, "Error: Write failed on %s\n", w->path);
+            return -1;
+        }
+        w->n_written += n;
+    }
+    return 0;
+}
+
+/* ========================================================================
+ * Copying unchanged spans (copy_file_range / FICLONERANGE)
+ * ======================================================================== */
+
+int trace_copy_mode_parse(const char *name) {
+    if (strcmp(name, "write") == 0) {
+        return TRACE_COPY_WRITE;
+    }
+    if (strcmp(name, "copy") == 0) {
+        return TRACE_COPY_RANGE;
+    }
+    if (strcmp(name, "reflink") == 0) {
+        return TRACE_COPY_REFLINK;
+    }
+    return -1;
+}
+
+/* errno values meaning "this filesystem / kernel cannot do that here" */
+static int copy_unsupported(int err) {
+    return err == EXDEV || err == EINVAL || err == ENOSYS ||
+           err == EOPNOTSUPP || err == ENOTTY || err == EPERM || err == EBADF;
+}
+
+/*
+ * copy_file_range() len bytes. Returns 0 on success, 1 if the very first
+ * call reports the operation as unsupported (nothing was copied), -1 on error.
+ */
+static int copy_range_bytes(struct trace_writer *w, int in_fd, off_t in_off,
+                            off_t out_off, uint64_t len) {
+    int first = 1;
+    while (len > 0) {
+        ssize_t got = copy_file_range(in_fd, &in_off, fileno(w->fp), &out_off, (size_t)len, 0);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (first && copy_unsupported(errno)) {
+                return 1;
+            }
+            perror("copy_file_range");
+            fprintf(stderr, "Error: Copy failed on %s\n", w->path);
+            return -1;
+        }
+        if (got == 0) {
+            fprintf(stderr, "Error: Input ended while copying into %s\n", w->path);
+            return -1;
+        }
+        len -= (uint64_t)got;
+        first = 0;
+    }
+    return 0;
+}
+
+/*
+ * Share len bytes with FICLONERANGE. Returns 0 on success, 1 if unsupported,
+ * -1 on error.
+ */
+static int reflink_bytes(struct trace_writer *w, int in_fd, off_t in_off,
+                         off_t out_off, uint64_t len) {
+#ifdef FICLONERANGE
+    struct file_clone_range arg;
+    arg.src_fd = in_fd;
+    arg.src_offset = (uint64_t)in_off;
+    arg.src_length = len;
+    arg.dest_offset = (uint64_t)out_off;
+    if (ioctl(fileno(w->fp), FICLONERANGE, &arg) == 0) {
+        return 0;
+    }
+    if (copy_unsupported(errno)) {
+        return 1;
+    }
+    perror("ioctl(FICLONERANGE)");
+    fprintf(stderr, "Error: Reflink failed on %s\n", w->path);
+    return -1;
+#else
+    (void)w; (void)in_fd; (void)in_off; (void)out_off; (void)len;
+    return 1;
+#endif
+}
+
+int trace_writer_copy_span(struct trace_writer *w, const struct trace_map *src,
+                           uint64_t first, uint64_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    if (w->is_xz || w->copy_mode == TRACE_COPY_WRITE) {
+        return trace_writer_write(w, src->recs + first, n);
+    }
+
+    /* Everything buffered by stdio must reach the file before the kernel copies behind it */
+    if (fflush(w->fp) != 0) {
+        perror("fflush");
+        fprintf(stderr, "Error: Write failed on %s\n", w->path);
+        return -1;
+    }
+
+    const uint64_t rec = sizeof(struct input_instr);
+    off_t in_off = (off_t)(first * rec);
+    off_t out_off = (off_t)(w->n_written * rec);
+    uint64_t len = n * rec;
+    uint64_t done = 0;  /* bytes of the span handled so far */
+    int rc = 0;
+
+    if (w->copy_mode == TRACE_COPY_REFLINK) {
+        /* Clone only whole blocks, and only if input and output are equally misaligned */
+        struct stat st;
+        uint64_t bs = (fstat(fileno(w->fp), &st) == 0 && st.st_blksize > 0) ? (uint64_t)st.st_blksize : 4096;
+        uint64_t head = (bs - (uint64_t)in_off % bs) % bs;
+
+        if ((uint64_t)in_off % bs == (uint64_t)out_off % bs && head + bs <= len) {
+            uint64_t body = (len - head) / bs * bs;
+            rc = copy_range_bytes(w, src->fd, in_off, out_off, head);
+            if (rc == 0) {
+                rc = reflink_bytes(w, src->fd, in_off + (off_t)head, out_off + (off_t)head, body);
+                if (rc == 0) {
+                    w->n_kernel_copied += head / rec;
+                    w->n_reflinked += body / rec;
+                    done = head + body;
+                } else if (rc == 1) {
+                    /* No reflinks here: the head was copied, carry on with copy_file_range */
+                    fprintf(stderr, "# Note: %s: reflink not supported, using copy_file_range\n", w->path);
+                    w->copy_mode = TRACE_COPY_RANGE;
+                    w->n_kernel_copied += head / rec;
+                    done = head;
+                    rc = 0;
+                }
+            }
+        }
+    }
+
+    if (rc == 0 && done < len) {
+        rc = copy_range_bytes(w, src->fd, in_off + (off_t)done, out_off + (off_t)done, len - done);
+        if (rc == 0) {
+            w->n_kernel_copied += (len - done) / rec;
+            done = len;
+        }
+    }
+
+    if (rc == 1) {
+        /* copy_file_range unsupported (e.g. across filesystems): write from the mapping */
+        fprintf(stderr, "# Note: %s: copy_file_range not supported, writing through userspace\n", w->path);
+        w->copy_mode = TRACE_COPY_WRITE;
+        rc = 0;
+    }
+    if (rc != 0) {
+        return -1;
+    }
+
+    /* Kernel copies use explicit offsets: move the stdio position past the span */
+    w->n_written += done / rec;
+    if (fseeko(w->fp, out_off + (off_t)done, SEEK_SET) != 0) {
+        perror("fseeko");
+        fprintf(stderr, "Error: Seek failed on %s\n", w->path);
+        return -1;
+    }
+    if (done < len) {
+        return trace_writer_write(w, src->recs + first + done / rec, n - done / rec);
+    }
+    return 0;
+}
+
+int64_t trace_copy_records(struct trace_reader *r, struct trace_writer *w, uint64_t n) {
+    uint64_t done = 0;
+    while (done < n) {
+        const struct input_instr *recs;
+        uint64_t want = n - done;
+        int64_t got = trace_reader_next(r, &recs, want < TRACE_READ_CHUNK ? want : TRACE_READ_CHUNK);
+        if (got < 0) {
+            return -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        if (trace_writer_write(w, recs, (uint64_t)got) != 0) {
+            return -1;
+        }
+        done += (uint64_t)got;
+    }
+    return (int64_t)done;
+}
+
+int trace_writer_close(struct trace_writer *w) {
+    int rc = 0;
+
+    if (w->is_xz) {
+        rc = xz_writer_finish(w);
+        xz_writer_free(w);
+    }
+    if (w->fp) {
+        if (fclose(w->fp) != 0 && rc == 0) {
+            perror("fclose");
+            fprintf(stderr, "Error: Failed to flush output file: %s\n", w->path);
+            rc = -1;
+        }
+        w->fp = NULL;
+    }
+    return rc;
+}
@@ -0,0 +1,303 @@
+/*
+ * trace_io.h - Shared trace I/O for the trace surgery tools
+ *
+ * All tools in this directory read the same ChampSim binary trace format.
+ * This header holds the single copy of struct input_instr and a small
+ * memory-mapped reader that exposes a whole trace file as a read-only
+ * array of records:
+ *
+ *     struct trace_map tm;
+ *     if (trace_map_open(&tm, path, TRACE_MAP_SEQUENTIAL) != 0) return 1;
+ *     for (uint64_t i = 0; i < tm.n_records; i++) { ... tm.recs[i] ... }
+ *     trace_map_close(&tm);
+ *
+ * A full pass over the trace is then a plain loop over memory instead of
+ * one fread() call per 64-byte record.
+ *
+ * Tools that only need a single forward pass use the streaming reader /
+ * writer instead, which also accept xz-compressed traces (any path ending
+ * in ".xz") so a 13 GB trace never has to be decompressed to disk:
+ *
+ *     struct trace_reader r;
+ *     const struct input_instr *recs;
+ *     int64_t n;
+ *     trace_reader_open(&r, path);
+ *     while ((n = trace_reader_next(&r, &recs, TRACE_READ_CHUNK)) > 0) { ... }
+ *     trace_reader_close(&r);
+ *
+ * Raw inputs are still served zero-copy out of the mapping; xz inputs are
+ * decoded into a bounded buffer.
+ */
+
+#ifndef TRACE_IO_H
+#define TRACE_IO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * ChampSim trace format (from inc/trace_instruction.h)
+ * This must match the exact binary layout used by the Pin tracer.
+ */
+#define NUM_INSTR_DESTINATIONS 2
+#define NUM_INSTR_SOURCES 4
+
+struct input_instr {
+    uint64_t ip;                                      /* instruction pointer */
+
+    uint8_t  is_branch;                               /* branch flag */
+    uint8_t  branch_taken;                            /* branch taken/not-taken */
+
+    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS]; /* dest reg IDs */
+    uint8_t  source_registers[NUM_INSTR_SOURCES];           /* src reg IDs */
+
+    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];    /* dest mem addresses */
+    uint64_t source_memory[NUM_INSTR_SOURCES];              /* src mem addresses */
+};
+
+/* First non-zero memory operand of rec (sources first), or 0 */
+static inline uint64_t trace_record_addr(const struct input_instr *rec) {
+    for (int k = 0; k < NUM_INSTR_SOURCES; k++) {
+        if (rec->source_memory[k] != 0) {
+            return rec->source_memory[k];
+        }
+    }
+    for (int k = 0; k < NUM_INSTR_DESTINATIONS; k++) {
+        if (rec->destination_memory[k] != 0) {
+            return rec->destination_memory[k];
+        }
+    }
+    return 0;
+}
+
+/* Most distinct lines one record can touch (one per memory operand) */
+#define TRACE_RECORD_MAX_LINES (NUM_INSTR_SOURCES + NUM_INSTR_DESTINATIONS)
+
+/*
+ * Lines (addr >> line_shift) touched by rec's memory operands into lines[]
+ * (room for TRACE_RECORD_MAX_LINES), duplicates removed, in operand order
+ * (sources first). Returns the count.
+ */
+static inline unsigned trace_record_lines(const struct input_instr *rec, unsigned line_shift,
+                                          uint64_t *lines) {
+    unsigned n = 0;
+    for (unsigned k = 0; k < TRACE_RECORD_MAX_LINES; k++) {
+        uint64_t addr = (k < NUM_INSTR_SOURCES) ? rec->source_memory[k]
+                                                 : rec->destination_memory[k - NUM_INSTR_SOURCES];
+        if (addr == 0) {
+            continue;
+        }
+        uint64_t line = addr >> line_shift;
+        unsigned j = 0;
+        while (j < n && lines[j] != line) {
+            j++;
+        }
+        if (j == n) {
+            lines[n++] = line;
+        }
+    }
+    return n;
+}
+
+/*
+ * Flags for trace_map_open():
+ *   TRACE_MAP_SEQUENTIAL - the caller will scan (most of) the file front to
+ *                          back: prefault it with MAP_POPULATE and tell the
+ *                          kernel to read ahead aggressively.
+ *   TRACE_MAP_SHARDED    - several threads will each scan a disjoint slice:
+ *                          same read-ahead hint, but no MAP_POPULATE, so the
+ *                          page faults are taken by the scanning threads in
+ *                          parallel instead of serially inside mmap().
+ *   0                    - random / sparse access (e.g. trace_inspect --start):
+ *                          pages are faulted in lazily on first touch.
+ */
+#define TRACE_MAP_SEQUENTIAL 0x1
+#define TRACE_MAP_SHARDED    0x2
+
+struct trace_map {
+    const char *path;
+    int fd;
+    const struct input_instr *recs;   /* NULL when the file is empty */
+    uint64_t n_records;
+    size_t bytes;
+};
+
+/*
+ * Open and map a raw trace file read-only.
+ * Validates that the file size is a multiple of sizeof(struct input_instr).
+ * Returns 0 on success, -1 on error (an error message is printed to stderr).
+ */
+int trace_map_open(struct trace_map *tm, const char *path, int flags);
+
+/* Unmap and close. Safe to call again, or after a failed trace_map_open(). */
+void trace_map_close(struct trace_map *tm);
+
+/*
+ * Write n records to fp in one call.
+ * Returns 0 on success, -1 on a short write (errno is left as set by fwrite).
+ */
+int trace_write_records(FILE *fp, const struct input_instr *recs, uint64_t n);
+
+/* Returns 1 if path names an xz-compressed trace (ends in ".xz") */
+int trace_path_is_xz(const char *path);
+
+/* ------------------------------------------------------------------------
+ * Streaming reader (raw or .xz)
+ * ------------------------------------------------------------------------ */
+
+/* n_records value when the total is not known in advance */
+#define TRACE_RECORDS_UNKNOWN UINT64_MAX
+
+/* Suggested batch size for trace_reader_next() (4 MiB of records) */
+#define TRACE_READ_CHUNK 65536
+
+struct trace_xz_reader;
+
+struct trace_reader {
+    const char *path;
+    int is_xz;
+    uint64_t n_records;   /* total records, or TRACE_RECORDS_UNKNOWN */
+    uint64_t pos;         /* records consumed so far */
+    struct trace_map map; /* raw input only */
+    struct trace_xz_reader *xz;
+};
+
+/*
+ * Open a trace for one forward pass. For .xz input the total record count
+ * is taken from the xz index when possible (no decompression needed).
+ * Returns 0 on success, -1 on error (message printed to stderr).
+ */
+int trace_reader_open(struct trace_reader *r, const char *path);
+
+/*
+ * Same as trace_reader_open(), but a raw input is mapped with map_flags
+ * instead of TRACE_MAP_SEQUENTIAL (e.g. 0 when most of the trace will be
+ * moved with trace_writer_copy_span() and never touched in userspace).
+ */
+int trace_reader_open_flags(struct trace_reader *r, const char *path, int map_flags);
+
+/*
+ * Return a pointer to the next (at most max) records in *recs.
+ * The pointer stays valid until the next call on this reader.
+ * Returns the number of records (0 at end of trace), or -1 on error.
+ */
+int64_t trace_reader_next(struct trace_reader *r, const struct input_instr **recs, uint64_t max);
+
+/*
+ * Copy the next n records into dst.
+ * Returns the number copied (< n only at end of trace), or -1 on error.
+ */
+int64_t trace_reader_read(struct trace_reader *r, struct input_instr *dst, uint64_t n);
+
+/*
+ * Consume the next n records and return them as one contiguous array in *recs:
+ * for raw input a pointer into the mapping (no copy; scratch may be NULL and
+ * the pointer stays valid until the reader is closed), for .xz input they are
+ * decoded into scratch, which must have room for n records.
+ * Returns the number of records (< n only at end of trace), or -1 on error.
+ */
+int64_t trace_reader_take(struct trace_reader *r, const struct input_instr **recs, uint64_t n,
+                          struct input_instr *scratch);
+
+/*
+ * Skip the next n records (no copy; for .xz input they are still decoded).
+ * Returns the number skipped (< n only at end of trace), or -1 on error.
+ */
+int64_t trace_reader_skip(struct trace_reader *r, uint64_t n);
+
+void trace_reader_close(struct trace_reader *r);
+
+/* ------------------------------------------------------------------------
+ * Streaming writer (raw or .xz)
+ * ------------------------------------------------------------------------ */
+
+/* xz preset used for compressed output (same as the xz command line default) */
+#define TRACE_XZ_PRESET 6
+
+struct trace_xz_writer;
+
+/*
+ * How trace_writer_copy_span() moves records that come unchanged from a raw
+ * input file into a raw output file:
+ *   TRACE_COPY_WRITE   - write() from the mapped input (the bytes pass
+ *                        through userspace)
+ *   TRACE_COPY_RANGE   - copy_file_range(2): the kernel copies (or, on
+ *                        filesystems that support it, shares) the data
+ *   TRACE_COPY_REFLINK - FICLONERANGE for the part of the span whose input
+ *                        and output offsets are filesystem-block aligned
+ *                        (XFS, btrfs: only extent metadata is written),
+ *                        copy_file_range(2) for the unaligned ends
+ * If the filesystem does not support a mode, the writer falls back to the
+ * next simpler one for the rest of the file. Output bytes are the same in
+ * every mode.
+ */
+#define TRACE_COPY_WRITE   0
+#define TRACE_COPY_RANGE   1
+#define TRACE_COPY_REFLINK 2
+
+struct trace_writer {
+    const char *path;
+    int is_xz;
+    FILE *fp;
+    uint64_t n_written;
+    int copy_mode;             /* TRACE_COPY_*, default TRACE_COPY_WRITE */
+    uint64_t n_reflinked;      /* records shared with FICLONERANGE */
+    uint64_t n_kernel_copied;  /* records moved with copy_file_range */
+    struct trace_xz_writer *xz;
+};
+
+/*
+ * Parse a copy mode name ("write", "copy", "reflink").
+ * Returns the TRACE_COPY_* value, or -1 if the name is unknown.
+ */
+int trace_copy_mode_parse(const char *name);
+
+/*
+ * Create an output trace. A path ending in ".xz" is compressed on the fly
+ * with the multithreaded xz encoder using xz_threads worker threads
+ * (0 = one per online CPU).
+ * Returns 0 on success, -1 on error (message printed to stderr).
+ */
+int trace_writer_open(struct trace_writer *w, const char *path, uint32_t xz_threads);
+
+/* Append n records. Returns 0 on success, -1 on error. */
+int trace_writer_write(struct trace_writer *w, const struct input_instr *recs, uint64_t n);
+
+/* A contiguous run of records, for trace_writer_writev() */
+struct trace_span {
+    const struct input_instr *recs;
+    uint64_t n;
+};
+
+/*
+ * Append several runs of records in order. Raw output goes out with a single
+ * writev() (after flushing anything buffered), so e.g. "records before the
+ * insertion point + inserted copy + originals" costs one system call and no
+ * staging copy. Returns 0 on success, -1 on error.
+ */
+int trace_writer_writev(struct trace_writer *w, const struct trace_span *spans, unsigned n_spans);
+
+/*
+ * Append records [first, first + n) of the raw input src, using w->copy_mode
+ * (see TRACE_COPY_*). For .xz output this is a plain trace_writer_write().
+ * src must stay open; with TRACE_COPY_WRITE (or after a fallback) its
+ * mapping is read, otherwise only its file descriptor is used.
+ * Returns 0 on success, -1 on error.
+ */
+int trace_writer_copy_span(struct trace_writer *w, const struct trace_map *src,
+                           uint64_t first, uint64_t n);
+
+/*
+ * Pass the next n records of r straight through to w (n = UINT64_MAX copies
+ * to the end of the trace). Returns the number copied, or -1 on error.
+ */
+int64_t trace_copy_records(struct trace_reader *r, struct trace_writer *w, uint64_t n);
+
+/*
+ * Finish the xz stream (if any), flush and close.
+ * Returns 0 on success, -1 on error. Must be called exactly once.
+ */
+int trace_writer_close(struct trace_writer *w);
+
+#endif /* TRACE_IO_H */
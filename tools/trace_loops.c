@@ -0,0 +1,132 @@
+/*
+ * trace_loops.c - Read trace_detect_loops JSON
+ *
+ * See trace_loops.h. The reader only understands what trace_detect_loops
+ * writes: one flat object whose integer fields are looked up by key.
+ */
+
+#include "trace_loops.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Largest loops file accepted (they are a few hundred bytes) */
+#define LOOPS_MAX_BYTES 65536
+
+/* Find "key": in text and return a pointer to its value (NULL if absent) */
+static const char *json_value(const char *text, const char *key) {
+    size_t klen = strlen(key);
+    for (const char *s = strchr(text, '"'); s; s = strchr(s + 1, '"')) {
+        if (strncmp(s + 1, key, klen) != 0 || s[1 + klen] != '"') {
+            continue;
+        }
+        const char *v = s + 2 + klen;
+        while (isspace((unsigned char)*v)) {
+            v++;
+        }
+        if (*v != ':') {
+            continue;
+        }
+        v++;
+        while (isspace((unsigned char)*v)) {
+            v++;
+        }
+        return v;
+    }
+    return NULL;
+}
+
+/* Find "key": <unsigned integer> in text */
+static int json_u64(const char *text, const char *key, uint64_t *out) {
+    const char *v = json_value(text, key);
+    if (!v || !isdigit((unsigned char)*v)) {
+        return -1;
+    }
+    *out = strtoull(v, NULL, 10);
+    return 0;
+}
+
+/* Find "key": ["0x...", ...] in text; at most max entries are kept */
+static int json_ip_list(const char *text, const char *key, uint64_t *ips, unsigned max, unsigned *n) {
+    const char *v = json_value(text, key);
+    if (!v || *v != '[') {
+        return -1;
+    }
+    *n = 0;
+    for (v++; *v && *v != ']'; v++) {
+        if (*v != '"') {
+            continue;
+        }
+        char *end;
+        uint64_t ip = strtoull(v + 1, &end, 16);
+        if (*end != '"') {
+            return -1;
+        }
+        if (*n < max) {
+            ips[(*n)++] = ip;
+        }
+        v = end;
+    }
+    return (*v == ']') ? 0 : -1;
+}
+
+int trace_loops_load(struct trace_loops *l, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        fprintf(stderr, "Error: Cannot open loops file: %s\n", path);
+        return -1;
+    }
+
+    char *text = malloc(LOOPS_MAX_BYTES + 1);
+    if (!text) {
+        fclose(fp);
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+    size_t n = fread(text, 1, LOOPS_MAX_BYTES, fp);
+    int too_big = !feof(fp);
+    fclose(fp);
+    text[n] = '\0';
+    if (too_big) {
+        fprintf(stderr, "Error: %s: loops file larger than %d bytes\n", path, LOOPS_MAX_BYTES);
+        free(text);
+        return -1;
+    }
+
+    static const struct {
+        const char *key;
+        size_t offset;
+    } fields[] = {
+        { "first_a_begin", offsetof(struct trace_loops, first_a_begin) },
+        { "a_len",         offsetof(struct trace_loops, a_len)         },
+        { "b_begin",       offsetof(struct trace_loops, b_begin)       },
+        { "b_access_len",  offsetof(struct trace_loops, b_access_len)  },
+        { "overhead_len",  offsetof(struct trace_loops, overhead_len)  },
+        { "b_len",         offsetof(struct trace_loops, b_len)         },
+        { "iterations",    offsetof(struct trace_loops, iterations)    },
+    };
+
+    int rc = 0;
+    for (size_t k = 0; k < sizeof(fields) / sizeof(fields[0]); k++) {
+        uint64_t *dst = (uint64_t *)((char *)l + fields[k].offset);
+        if (json_u64(text, fields[k].key, dst) != 0) {
+            fprintf(stderr, "Error: %s: missing or invalid \"%s\" (not a trace_detect_loops file?)\n",
+                    path, fields[k].key);
+            rc = -1;
+            break;
+        }
+    }
+    if (rc == 0 &&
+        (json_ip_list(text, "a_ips", l->a_ips, TRACE_LOOPS_MAX_IPS, &l->n_a_ips) != 0 ||
+         json_ip_list(text, "b_ips", l->b_ips, TRACE_LOOPS_MAX_IPS, &l->n_b_ips) != 0)) {
+        fprintf(stderr, "Error: %s: missing or invalid \"a_ips\" / \"b_ips\"\n", path);
+        rc = -1;
+    }
+
+    free(text);
+    return rc;
+}
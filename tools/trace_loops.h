@@ -0,0 +1,52 @@
+/*
+ * trace_loops.h - Loop structure of a wrongpath-bench kernel trace
+ *
+ * trace_detect_loops finds the outer-loop structure of run_kernel() in a
+ * trace and writes it as JSON:
+ *
+ *     {
+ *       "first_a_begin": 322141,     first A load of iteration 0
+ *       "a_len": 28679,              A sweep (+ B loop setup): A start -> first B load
+ *       "b_begin": 350820,           first B load of iteration 0
+ *       "b_access_len": 20476,       first -> last B load of iteration 0, inclusive
+ *       "overhead_len": 11,          last B load -> next A sweep (loop overhead)
+ *       "b_len": 20487,              b_access_len + overhead_len
+ *       "iterations": 4096,
+ *       "a_ips": ["0x400880", "0x40088c"],   loads of the A sweep
+ *       "b_ips": ["0x4008b3"],               loads of the B chunk
+ *       ...
+ *     }
+ *
+ * The same file can be passed to the surgery tools (--loops FILE, or
+ * loops=FILE in a trace_surgery plan) instead of the individual numbers.
+ */
+
+#ifndef TRACE_LOOPS_H
+#define TRACE_LOOPS_H
+
+#include <stdint.h>
+
+/* Most IPs listed per group in a loops file */
+#define TRACE_LOOPS_MAX_IPS 16
+
+struct trace_loops {
+    uint64_t first_a_begin;
+    uint64_t a_len;
+    uint64_t b_begin;
+    uint64_t b_access_len;
+    uint64_t overhead_len;
+    uint64_t b_len;
+    uint64_t iterations;
+    uint64_t a_ips[TRACE_LOOPS_MAX_IPS];
+    uint64_t b_ips[TRACE_LOOPS_MAX_IPS];
+    unsigned n_a_ips;
+    unsigned n_b_ips;
+};
+
+/*
+ * Read the fields above from a trace_detect_loops JSON file (other keys are
+ * ignored). Returns 0 on success, -1 on error (message printed to stderr).
+ */
+int trace_loops_load(struct trace_loops *l, const char *path);
+
+#endif /* TRACE_LOOPS_H */
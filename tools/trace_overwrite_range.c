@@ -1,10 +1,12 @@
 /*
  * trace_overwrite_range.c - Overwrite a range of trace records (Phase 3)
  *
- * Usage: trace_overwrite_range --in PATH --out PATH --src-begin I --src-end J --dst-begin K [--dry-run]
+ * Usage: trace_overwrite_range --in PATH --out PATH --src-begin I --src-end J --dst-begin K
+ *            [--xz-threads N] [--copy-mode MODE] [--dry-run]
  *
  * Copies records from [src_begin, src_end) to [dst_begin, dst_begin + (src_end - src_begin))
  * The total trace length remains unchanged (overwrite, not insert).
+ * Input and output may be raw traces or .xz (compressed/decompressed on the fly).
  */
 
 #include <stdio.h>
@@ -13,31 +15,23 @@
 #include <string.h>
 #include <getopt.h>
 
-/*
- * ChampSim trace format (from inc/trace_instruction.h)
- */
-#define NUM_INSTR_DESTINATIONS 2
-#define NUM_INSTR_SOURCES 4
-
-struct input_instr {
-    uint64_t ip;
-    uint8_t  is_branch;
-    uint8_t  branch_taken;
-    uint8_t  destination_registers[NUM_INSTR_DESTINATIONS];
-    uint8_t  source_registers[NUM_INSTR_SOURCES];
-    uint64_t destination_memory[NUM_INSTR_DESTINATIONS];
-    uint64_t source_memory[NUM_INSTR_SOURCES];
-};
+#include "trace_io.h"
 
 static void print_usage(const char *prog) {
-    fprintf(stderr, "Usage: %s --in PATH --out PATH --src-begin I --src-end J --dst-begin K [--dry-run]\n", prog);
+    fprintf(stderr, "Usage: %s --in PATH --out PATH --src-begin I --src-end J --dst-begin K\n", prog);
+    fprintf(stderr, "           [--xz-threads N] [--copy-mode MODE] [--dry-run]\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Options:\n");
-    fprintf(stderr, "  --in PATH        Input trace file (required)\n");
-    fprintf(stderr, "  --out PATH       Output trace file (required, unless --dry-run)\n");
+    fprintf(stderr, "  --in PATH        Input trace file, raw or .xz (required)\n");
+    fprintf(stderr, "  --out PATH       Output trace file, raw or .xz (required, unless --dry-run)\n");
     fprintf(stderr, "  --src-begin I    Source range start index, inclusive (required)\n");
     fprintf(stderr, "  --src-end J      Source range end index, exclusive (required)\n");
     fprintf(stderr, "  --dst-begin K    Destination start index (required)\n");
+    fprintf(stderr, "  --xz-threads N   Compression threads for .xz output (default: 0 = all CPUs)\n");
+    fprintf(stderr, "  --copy-mode MODE How to move records copied from a raw input (default: write)\n");
+    fprintf(stderr, "                   write   = through userspace\n");
+    fprintf(stderr, "                   copy    = copy_file_range(2), data stays in the kernel\n");
+    fprintf(stderr, "                   reflink = FICLONERANGE where block-aligned (XFS/btrfs), else copy\n");
     fprintf(stderr, "  --dry-run        Validate ranges without writing output\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Behavior:\n");
@@ -52,22 +46,26 @@ int main(int argc, char *argv[]) {
     int64_t src_begin = -1;
     int64_t src_end = -1;
     int64_t dst_begin = -1;
+    uint32_t xz_threads = 0;
+    int copy_mode = TRACE_COPY_WRITE;
     int dry_run = 0;
 
     /* Parse command line options */
     static struct option long_options[] = {
-        {"in",        required_argument, 0, 'i'},
-        {"out",       required_argument, 0, 'o'},
-        {"src-begin", required_argument, 0, 's'},
-        {"src-end",   required_argument, 0, 'e'},
-        {"dst-begin", required_argument, 0, 'd'},
-        {"dry-run",   no_argument,       0, 'r'},
-        {"help",      no_argument,       0, 'h'},
+        {"in",         required_argument, 0, 'i'},
+        {"out",        required_argument, 0, 'o'},
+        {"src-begin",  required_argument, 0, 's'},
+        {"src-end",    required_argument, 0, 'e'},
+        {"dst-begin",  required_argument, 0, 'd'},
+        {"xz-threads", required_argument, 0, 'x'},
+        {"copy-mode",  required_argument, 0, 'c'},
+        {"dry-run",    no_argument,       0, 'r'},
+        {"help",       no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "i:o:s:e:d:rh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:o:s:e:d:x:c:rh", long_options, NULL)) != -1) {
         switch (opt) {
             case 'i':
                 in_path = optarg;
@@ -84,6 +82,16 @@ int main(int argc, char *argv[]) {
             case 'd':
                 dst_begin = strtoll(optarg, NULL, 10);
                 break;
+            case 'x':
+                xz_threads = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                copy_mode = trace_copy_mode_parse(optarg);
+                if (copy_mode < 0) {
+                    fprintf(stderr, "Error: Unknown --copy-mode '%s' (write, copy, reflink)\n", optarg);
+                    return 1;
+                }
+                break;
             case 'r':
                 dry_run = 1;
                 break;
@@ -120,60 +128,51 @@ int main(int argc, char *argv[]) {
 
     int64_t copy_len = src_end - src_begin;
 
-    /* Open input file and get total records */
-    FILE *fp_in = fopen(in_path, "rb");
-    if (!fp_in) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot open input file: %s\n", in_path);
-        return 1;
-    }
-
-    fseek(fp_in, 0, SEEK_END);
-    long filesize = ftell(fp_in);
-    fseek(fp_in, 0, SEEK_SET);
-
-    if (filesize < 0) {
-        perror("ftell");
-        fclose(fp_in);
-        return 1;
-    }
-
-    if (filesize % sizeof(struct input_instr) != 0) {
-        fprintf(stderr, "Error: File size (%ld bytes) is not a multiple of sizeof(input_instr) (%zu bytes)\n",
-                filesize, sizeof(struct input_instr));
-        fclose(fp_in);
+    /*
+     * Open input file and get total records. With a kernel-side copy mode a
+     * raw input is moved as three spans and never read in userspace, so it
+     * is not prefaulted.
+     */
+    struct trace_reader rd;
+    int map_flags = (dry_run || copy_mode != TRACE_COPY_WRITE) ? 0 : TRACE_MAP_SEQUENTIAL;
+    if (trace_reader_open_flags(&rd, in_path, map_flags) != 0) {
         return 1;
     }
 
-    int64_t total_records = filesize / sizeof(struct input_instr);
+    int known_total = (rd.n_records != TRACE_RECORDS_UNKNOWN);
+    int64_t total_records = known_total ? (int64_t)rd.n_records : -1;
+    int64_t dst_end = dst_begin + copy_len;
 
     /* Print operation info */
     fprintf(stderr, "# Input file: %s\n", in_path);
-    fprintf(stderr, "# Total records: %ld\n", (long)total_records);
+    if (known_total) {
+        fprintf(stderr, "# Total records: %ld\n", (long)total_records);
+    } else {
+        fprintf(stderr, "# Total records: unknown (xz without index; ranges are checked while streaming)\n");
+    }
     fprintf(stderr, "# sizeof(input_instr) = %zu bytes\n", sizeof(struct input_instr));
     fprintf(stderr, "#\n");
     fprintf(stderr, "# Source range: [%ld, %ld) (%ld records)\n",
             (long)src_begin, (long)src_end, (long)copy_len);
     fprintf(stderr, "# Destination range: [%ld, %ld)\n",
-            (long)dst_begin, (long)(dst_begin + copy_len));
+            (long)dst_begin, (long)dst_end);
     fprintf(stderr, "#\n");
 
     /* Validate ranges against total records */
-    if (src_end > total_records) {
+    if (known_total && src_end > total_records) {
         fprintf(stderr, "Error: src_end (%ld) exceeds total records (%ld)\n",
                 (long)src_end, (long)total_records);
-        fclose(fp_in);
+        trace_reader_close(&rd);
         return 1;
     }
-    if (dst_begin + copy_len > total_records) {
+    if (known_total && dst_end > total_records) {
         fprintf(stderr, "Error: dst range [%ld, %ld) exceeds total records (%ld)\n",
-                (long)dst_begin, (long)(dst_begin + copy_len), (long)total_records);
-        fclose(fp_in);
+                (long)dst_begin, (long)dst_end, (long)total_records);
+        trace_reader_close(&rd);
         return 1;
     }
 
     /* Check for overlapping ranges (would require special handling) */
-    int64_t dst_end = dst_begin + copy_len;
     if ((src_begin < dst_end && src_end > dst_begin)) {
         fprintf(stderr, "Warning: Source and destination ranges overlap.\n");
         fprintf(stderr, "         This is supported but may produce unexpected results.\n");
@@ -182,90 +181,139 @@ int main(int argc, char *argv[]) {
 
     if (dry_run) {
         fprintf(stderr, "# Dry run: Range validation passed. No output written.\n");
-        fclose(fp_in);
+        trace_reader_close(&rd);
         return 0;
     }
 
-    /* Load source records into memory */
-    fprintf(stderr, "# Loading source records into memory...\n");
-    struct input_instr *src_records = malloc(copy_len * sizeof(struct input_instr));
-    if (!src_records) {
-        fprintf(stderr, "Error: Cannot allocate memory for %ld source records\n", (long)copy_len);
-        fclose(fp_in);
-        return 1;
-    }
+    /*
+     * Source records: a raw input is mapped, so they are used in place.
+     * An .xz input cannot be seeked, so they are decoded up front by a
+     * separate reader that stops at src_end (only the prefix is decoded).
+     */
+    const struct input_instr *src_records = NULL;
+    struct input_instr *src_buf = NULL;
 
-    /* Seek to source range and read */
-    if (fseek(fp_in, src_begin * sizeof(struct input_instr), SEEK_SET) != 0) {
-        perror("fseek");
-        free(src_records);
-        fclose(fp_in);
-        return 1;
-    }
+    if (!rd.is_xz) {
+        src_records = rd.map.recs + src_begin;
+    } else {
+        fprintf(stderr, "# Decoding source records into memory...\n");
+        src_buf = malloc(copy_len * sizeof(struct input_instr));
+        if (!src_buf) {
+            fprintf(stderr, "Error: Cannot allocate memory for %ld source records\n", (long)copy_len);
+            trace_reader_close(&rd);
+            return 1;
+        }
 
-    size_t read_count = fread(src_records, sizeof(struct input_instr), copy_len, fp_in);
-    if ((int64_t)read_count != copy_len) {
-        fprintf(stderr, "Error: Expected to read %ld records, got %zu\n", (long)copy_len, read_count);
-        free(src_records);
-        fclose(fp_in);
-        return 1;
+        struct trace_reader src_rd;
+        if (trace_reader_open(&src_rd, in_path) != 0) {
+            free(src_buf);
+            trace_reader_close(&rd);
+            return 1;
+        }
+        int64_t skipped = trace_reader_skip(&src_rd, src_begin);
+        int64_t got = (skipped == src_begin) ? trace_reader_read(&src_rd, src_buf, copy_len) : -1;
+        trace_reader_close(&src_rd);
+        if (got != copy_len) {
+            fprintf(stderr, "Error: Could not read source range [%ld, %ld) from input\n",
+                    (long)src_begin, (long)src_end);
+            free(src_buf);
+            trace_reader_close(&rd);
+            return 1;
+        }
+        src_records = src_buf;
     }
 
-    /* Reset input file to beginning */
-    fseek(fp_in, 0, SEEK_SET);
-
     /* Open output file */
-    FILE *fp_out = fopen(out_path, "wb");
-    if (!fp_out) {
-        perror("fopen");
-        fprintf(stderr, "Error: Cannot create output file: %s\n", out_path);
-        free(src_records);
-        fclose(fp_in);
+    struct trace_writer wr;
+    if (trace_writer_open(&wr, out_path, xz_threads) != 0) {
+        free(src_buf);
+        trace_reader_close(&rd);
         return 1;
     }
 
+    wr.copy_mode = copy_mode;
+
     fprintf(stderr, "# Writing output to: %s\n", out_path);
 
-    /* Process trace: copy with overwrite */
-    struct input_instr rec;
+    const struct input_instr *recs;
+    int64_t n = 0;
     int64_t idx = 0;
-    int64_t src_idx = 0;  /* Index into src_records array */
+    int rc = 0;
 
-    while (fread(&rec, sizeof(rec), 1, fp_in) == 1) {
-        if (idx >= dst_begin && idx < dst_begin + copy_len) {
-            /* In destination range: output from source records */
-            if (fwrite(&src_records[src_idx], sizeof(struct input_instr), 1, fp_out) != 1) {
-                perror("fwrite");
-                fprintf(stderr, "Error: Write failed at record %ld\n", (long)idx);
-                free(src_records);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
-            }
-            src_idx++;
-        } else {
-            /* Outside destination range: output original record */
-            if (fwrite(&rec, sizeof(struct input_instr), 1, fp_out) != 1) {
-                perror("fwrite");
-                fprintf(stderr, "Error: Write failed at record %ld\n", (long)idx);
-                free(src_records);
-                fclose(fp_in);
-                fclose(fp_out);
-                return 1;
+    if (copy_mode != TRACE_COPY_WRITE && rd.is_xz) {
+        fprintf(stderr, "# Note: --copy-mode ignored for .xz input\n");
+    }
+
+    if (copy_mode != TRACE_COPY_WRITE && !rd.is_xz) {
+        /*
+         * Kernel-side copy: the output is three spans of the input,
+         *   [0, dst_begin) + [src_begin, src_end) + [dst_end, total_records)
+         */
+        if (trace_writer_copy_span(&wr, &rd.map, 0, dst_begin) != 0 ||
+            trace_writer_copy_span(&wr, &rd.map, src_begin, copy_len) != 0 ||
+            trace_writer_copy_span(&wr, &rd.map, dst_end, total_records - dst_end) != 0) {
+            rc = -1;
+        }
+        idx = (int64_t)wr.n_written;
+    } else {
+        /*
+         * Process trace: copy with overwrite.
+         * Each input batch [lo, hi) is written as-is, except for the part that
+         * intersects [dst_begin, dst_end), which comes from the source records.
+         */
+        while (rc == 0 && (n = trace_reader_next(&rd, &recs, TRACE_READ_CHUNK)) > 0) {
+            int64_t lo = idx;
+            int64_t hi = idx + n;
+            int64_t ov_lo = (lo > dst_begin) ? lo : dst_begin;
+            int64_t ov_hi = (hi < dst_end) ? hi : dst_end;
+
+            if (ov_lo < ov_hi) {
+                /* Before / inside / after the destination range */
+                rc = trace_writer_write(&wr, recs, ov_lo - lo);
+                if (rc == 0) {
+                    rc = trace_writer_write(&wr, src_records + (ov_lo - dst_begin), ov_hi - ov_lo);
+                }
+                if (rc == 0) {
+                    rc = trace_writer_write(&wr, recs + (ov_hi - lo), hi - ov_hi);
+                }
+            } else {
+                rc = trace_writer_write(&wr, recs, n);
             }
+            idx = hi;
         }
-        idx++;
+        if (rc == 0 && n < 0) {
+            rc = -1;
+        }
+        if (rc == 0 && idx < dst_end) {
+            fprintf(stderr, "Error: Input ended at record %ld, before the end of the dst range (%ld)\n",
+                    (long)idx, (long)dst_end);
+            rc = -1;
+        }
+    }
+
+    if (rc != 0) {
+        fprintf(stderr, "Error: Aborted at input record %ld\n", (long)idx);
+    }
+
+    if (trace_writer_close(&wr) != 0) {
+        rc = -1;
+    }
+    free(src_buf);
+    trace_reader_close(&rd);
+    if (rc != 0) {
+        return 1;
     }
 
     fprintf(stderr, "#\n");
     fprintf(stderr, "# Wrote %ld records\n", (long)idx);
     fprintf(stderr, "# Overwritten %ld records at [%ld, %ld)\n",
-            (long)copy_len, (long)dst_begin, (long)(dst_begin + copy_len));
+            (long)copy_len, (long)dst_begin, (long)dst_end);
+    if (copy_mode != TRACE_COPY_WRITE) {
+        fprintf(stderr, "# Output: %lu records reflinked, %lu copied in kernel, %lu written\n",
+                (unsigned long)wr.n_reflinked, (unsigned long)wr.n_kernel_copied,
+                (unsigned long)(wr.n_written - wr.n_reflinked - wr.n_kernel_copied));
+    }
     fprintf(stderr, "# Done.\n");
 
-    free(src_records);
-    fclose(fp_in);
-    fclose(fp_out);
-
     return 0;
 }
@@ -0,0 +1,940 @@
+/*
+ * trace_plan.c - Declarative trace surgery plans
+ *
+ * See trace_plan.h for the plan syntax and interface.
+ */
+
+#include "trace_plan.h"
+#include "trace_loops.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+/* Largest sliding window kept for an .xz input (16M records = 1 GiB) */
+#define PLAN_MAX_WINDOW_RECORDS (1ULL << 24)
+
+/* Maximum key=value arguments on one plan line */
+#define PLAN_MAX_ARGS 16
+
+void trace_plan_init(struct trace_plan *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+void trace_plan_free(struct trace_plan *p) {
+    free(p->edits);
+    memset(p, 0, sizeof(*p));
+}
+
+void trace_plan_select(struct trace_plan *p, const unsigned *choice) {
+    p->choice = choice;
+}
+
+int trace_plan_dim_value(const struct trace_sweep_dim *d, unsigned k, char *buf, size_t len) {
+    const char *v = d->list;
+    for (unsigned i = 0; i < k && v; i++) {
+        v = strchr(v, ',');
+        if (v) {
+            v++;
+        }
+    }
+    if (!v) {
+        return -1;
+    }
+    size_t n = strcspn(v, ",");
+    if (n >= len) {
+        return -1;
+    }
+    memcpy(buf, v, n);
+    buf[n] = '\0';
+    return 0;
+}
+
+static int plan_push(struct trace_plan *p, uint64_t pos, uint64_t skip,
+                     uint64_t src_begin, uint64_t src_end, uint64_t repeat, unsigned line) {
+    if (p->n_edits == p->cap) {
+        size_t cap = p->cap ? 2 * p->cap : 64;
+        struct trace_edit *e = realloc(p->edits, cap * sizeof(*e));
+        if (!e) {
+            fprintf(stderr, "Error: Out of memory for plan edits\n");
+            return -1;
+        }
+        p->edits = e;
+        p->cap = cap;
+    }
+
+    struct trace_edit *e = &p->edits[p->n_edits];
+    e->pos = pos;
+    e->skip = skip;
+    e->src_begin = src_begin;
+    e->src_end = src_end;
+    e->repeat = repeat;
+    e->line = line;
+    e->seq = (unsigned)p->n_edits;
+    p->n_edits++;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Parsing
+ * ------------------------------------------------------------------------ */
+
+struct plan_args {
+    const char *where;
+    unsigned line;
+    int n;
+    char *key[PLAN_MAX_ARGS];
+    char *val[PLAN_MAX_ARGS];
+    int used[PLAN_MAX_ARGS];
+};
+
+static const char *arg_get(struct plan_args *a, const char *key) {
+    for (int i = 0; i < a->n; i++) {
+        if (strcmp(a->key[i], key) == 0) {
+            a->used[i] = 1;
+            return a->val[i];
+        }
+    }
+    return NULL;
+}
+
+static int arg_error(const struct plan_args *a, const char *msg, const char *key) {
+    fprintf(stderr, "Error: %s:%u: %s%s%s\n", a->where, a->line, msg,
+            key ? ": " : "", key ? key : "");
+    return -1;
+}
+
+static int parse_u64(const char *s, uint64_t *out) {
+    char *end;
+    if (!s || !*s || *s == '-') {
+        return -1;
+    }
+    *out = strtoull(s, &end, 0);
+    return (*end == '\0') ? 0 : -1;
+}
+
+/* Required unsigned integer argument */
+static int arg_u64(struct plan_args *a, const char *key, uint64_t *out) {
+    const char *v = arg_get(a, key);
+    if (!v) {
+        return arg_error(a, "missing argument", key);
+    }
+    if (parse_u64(v, out) != 0) {
+        return arg_error(a, "expected a non-negative integer for", key);
+    }
+    return 0;
+}
+
+/* Optional unsigned integer argument */
+static int arg_u64_opt(struct plan_args *a, const char *key, uint64_t *out, uint64_t dflt) {
+    if (!arg_get(a, key)) {
+        *out = dflt;
+        return 0;
+    }
+    return arg_u64(a, key, out);
+}
+
+/* Required ratio in [0, 1], or in (0, 1] unless allow_zero */
+static int arg_ratio(struct plan_args *a, const char *key, int allow_zero, double *out) {
+    const char *v = arg_get(a, key);
+    char *end;
+    if (!v) {
+        return arg_error(a, "missing argument", key);
+    }
+    *out = strtod(v, &end);
+    if (*end != '\0' || !((allow_zero ? *out >= 0.0 : *out > 0.0) && *out <= 1.0)) {
+        return arg_error(a, allow_zero ? "expected a ratio in [0.0, 1.0] for"
+                                       : "expected a ratio in (0.0, 1.0] for", key);
+    }
+    return 0;
+}
+
+/* Required half-open range "I:J" with I < J */
+static int arg_range(struct plan_args *a, const char *key, uint64_t *begin, uint64_t *end) {
+    const char *v = arg_get(a, key);
+    if (!v) {
+        return arg_error(a, "missing argument", key);
+    }
+
+    char buf[64];
+    const char *colon = strchr(v, ':');
+    size_t n = colon ? (size_t)(colon - v) : 0;
+    if (!colon || n >= sizeof(buf)) {
+        return arg_error(a, "expected a range I:J for", key);
+    }
+    memcpy(buf, v, n);
+    buf[n] = '\0';
+    if (parse_u64(buf, begin) != 0 || parse_u64(colon + 1, end) != 0) {
+        return arg_error(a, "expected a range I:J for", key);
+    }
+    if (*begin >= *end) {
+        return arg_error(a, "empty range (need I < J) for", key);
+    }
+    return 0;
+}
+
+/*
+ * Record the value list "key=v1,v2,..." as the next sweep dimension and
+ * narrow *val (in place) to the value selected by p->choice.
+ */
+static int sweep_pick(struct trace_plan *p, const struct plan_args *a, const char *key, char **val) {
+    if (p->n_dims == TRACE_PLAN_MAX_DIMS) {
+        return arg_error(a, "too many value lists, at", key);
+    }
+    struct trace_sweep_dim *d = &p->dims[p->n_dims];
+    if (strlen(key) >= sizeof(d->key) || strlen(*val) >= sizeof(d->list)) {
+        return arg_error(a, "value list too long for", key);
+    }
+    strcpy(d->key, key);
+    strcpy(d->list, *val);
+    d->line = a->line;
+    d->n_values = 1;
+    for (const char *c = *val; *c; c++) {
+        d->n_values += (*c == ',');
+    }
+
+    unsigned k = p->choice ? p->choice[p->n_dims] : 0;
+    if (k >= d->n_values) {
+        return arg_error(a, "sweep choice out of range for", key);
+    }
+    char *v = *val;
+    for (unsigned i = 0; i < k; i++) {
+        v = strchr(v, ',') + 1;
+    }
+    char *comma = strchr(v, ',');
+    if (comma) {
+        *comma = '\0';
+    }
+    if (!*v) {
+        return arg_error(a, "empty value in list for", key);
+    }
+    *val = v;
+    p->n_dims++;
+    return 0;
+}
+
+static int op_insert(struct trace_plan *p, struct plan_args *a) {
+    uint64_t at, sb, se, count;
+    if (arg_u64(a, "at", &at) || arg_range(a, "src", &sb, &se) || arg_u64_opt(a, "count", &count, 1)) {
+        return -1;
+    }
+    return plan_push(p, at, 0, sb, se, count, a->line);
+}
+
+static int op_overwrite(struct trace_plan *p, struct plan_args *a) {
+    uint64_t at, sb, se;
+    if (arg_u64(a, "at", &at) || arg_range(a, "src", &sb, &se)) {
+        return -1;
+    }
+    return plan_push(p, at, se - sb, sb, se, 1, a->line);
+}
+
+static int op_delete(struct trace_plan *p, struct plan_args *a) {
+    uint64_t b, e;
+    if (arg_range(a, "range", &b, &e)) {
+        return -1;
+    }
+    return plan_push(p, b, e - b, 0, 0, 0, a->line);
+}
+
+static int op_duplicate(struct trace_plan *p, struct plan_args *a) {
+    uint64_t b, e, count;
+    if (arg_range(a, "range", &b, &e) || arg_u64_opt(a, "count", &count, 1)) {
+        return -1;
+    }
+    /* The copies follow the original range */
+    return plan_push(p, e, 0, b, e, count, a->line);
+}
+
+/* Integer argument that is required unless loops (trace_detect_loops JSON) supplies it */
+static int arg_u64_loops(struct plan_args *a, const char *key, uint64_t *out,
+                         const struct trace_loops *loops, uint64_t from_loops) {
+    return loops ? arg_u64_opt(a, key, out, from_loops) : arg_u64(a, key, out);
+}
+
+static int op_iters(struct trace_plan *p, struct plan_args *a) {
+    uint64_t first_a_begin, a_len, b_len, iterations, every;
+    double a_pos, b_ratio;
+
+    struct trace_loops lp;
+    const struct trace_loops *loops = NULL;
+    memset(&lp, 0, sizeof(lp));
+    const char *loops_path = arg_get(a, "loops");
+    if (loops_path) {
+        if (trace_loops_load(&lp, loops_path) != 0) {
+            return arg_error(a, "cannot use loops file", loops_path);
+        }
+        loops = &lp;
+    }
+
+    if (arg_u64_loops(a, "first_a_begin", &first_a_begin, loops, lp.first_a_begin) ||
+        arg_u64_loops(a, "a_len", &a_len, loops, lp.a_len) ||
+        arg_u64_loops(a, "b_len", &b_len, loops, lp.b_len) ||
+        arg_u64_loops(a, "iterations", &iterations, loops, lp.iterations) ||
+        arg_ratio(a, "a_pos", 1, &a_pos) || arg_ratio(a, "b_ratio", 0, &b_ratio) ||
+        arg_u64_opt(a, "every", &every, 1)) {
+        return -1;
+    }
+
+    int overwrite = 0;
+    const char *mode = arg_get(a, "mode");
+    if (mode && strcmp(mode, "overwrite") == 0) {
+        overwrite = 1;
+    } else if (mode && strcmp(mode, "insert") != 0) {
+        return arg_error(a, "mode must be insert or overwrite, got", mode);
+    }
+    if (a_len == 0 || b_len == 0) {
+        return arg_error(a, "a_len and b_len must be positive", NULL);
+    }
+
+    /* Same arithmetic as trace_insert_all_iters */
+    uint64_t iter_len = a_len + b_len;
+    uint64_t b_insert_len = (uint64_t)(b_len * b_ratio);
+    if (b_insert_len == 0) {
+        b_insert_len = 1;  /* At minimum, insert 1 record */
+    }
+    uint64_t a_offset = (uint64_t)(a_len * a_pos);
+
+    if (every == 0) {
+        return 0;  /* No insertions (validation only) */
+    }
+    for (uint64_t i = 0; i < iterations; i += every) {
+        uint64_t a_begin_i = first_a_begin + i * iter_len;
+        uint64_t b_begin_i = a_begin_i + a_len;
+        if (plan_push(p, a_begin_i + a_offset, overwrite ? b_insert_len : 0,
+                      b_begin_i, b_begin_i + b_insert_len, 1, a->line) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int trace_plan_add_line(struct trace_plan *p, const char *text, const char *where, unsigned line) {
+    char buf[1024];
+    size_t len = strlen(text);
+    if (len >= sizeof(buf)) {
+        fprintf(stderr, "Error: %s:%u: line too long\n", where, line);
+        return -1;
+    }
+    memcpy(buf, text, len + 1);
+
+    char *hash = strchr(buf, '#');
+    if (hash) {
+        *hash = '\0';
+    }
+
+    /* Split into whitespace-separated words: op key=value ... */
+    char *words[PLAN_MAX_ARGS + 1];
+    int n_words = 0;
+    for (char *s = buf; *s; ) {
+        while (*s && isspace((unsigned char)*s)) {
+            *s++ = '\0';
+        }
+        if (!*s) {
+            break;
+        }
+        if (n_words == PLAN_MAX_ARGS + 1) {
+            fprintf(stderr, "Error: %s:%u: too many arguments\n", where, line);
+            return -1;
+        }
+        words[n_words++] = s;
+        while (*s && !isspace((unsigned char)*s)) {
+            s++;
+        }
+    }
+    if (n_words == 0) {
+        return 0;
+    }
+
+    struct plan_args a;
+    memset(&a, 0, sizeof(a));
+    a.where = where;
+    a.line = line;
+    for (int i = 1; i < n_words; i++) {
+        char *eq = strchr(words[i], '=');
+        if (!eq || eq == words[i]) {
+            return arg_error(&a, "expected key=value, got", words[i]);
+        }
+        *eq = '\0';
+        a.key[a.n] = words[i];
+        a.val[a.n] = eq + 1;
+        if (strchr(a.val[a.n], ',') && sweep_pick(p, &a, a.key[a.n], &a.val[a.n]) != 0) {
+            return -1;
+        }
+        a.n++;
+    }
+
+    static const struct {
+        const char *name;
+        int (*fn)(struct trace_plan *, struct plan_args *);
+    } ops[] = {
+        { "insert",    op_insert    },
+        { "overwrite", op_overwrite },
+        { "delete",    op_delete    },
+        { "duplicate", op_duplicate },
+        { "iters",     op_iters     },
+    };
+
+    for (size_t k = 0; k < sizeof(ops) / sizeof(ops[0]); k++) {
+        if (strcmp(words[0], ops[k].name) != 0) {
+            continue;
+        }
+        if (ops[k].fn(p, &a) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < a.n; i++) {
+            if (!a.used[i]) {
+                return arg_error(&a, "unknown argument", a.key[i]);
+            }
+        }
+        p->n_ops++;
+        return 0;
+    }
+
+    return arg_error(&a, "unknown operation", words[0]);
+}
+
+int trace_plan_load(struct trace_plan *p, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        fprintf(stderr, "Error: Cannot open plan file: %s\n", path);
+        return -1;
+    }
+
+    char line[1024];
+    unsigned lineno = 0;
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), fp)) {
+        lineno++;
+        line[strcspn(line, "\r\n")] = '\0';
+        rc = trace_plan_add_line(p, line, path, lineno);
+    }
+    fclose(fp);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------
+ * Compile
+ * ------------------------------------------------------------------------ */
+
+static int edit_cmp(const void *pa, const void *pb) {
+    const struct trace_edit *a = pa;
+    const struct trace_edit *b = pb;
+    if (a->pos != b->pos) {
+        return (a->pos < b->pos) ? -1 : 1;
+    }
+    return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+int trace_plan_compile(struct trace_plan *p, uint64_t n_records) {
+    if (p->n_edits > 1) {
+        qsort(p->edits, p->n_edits, sizeof(struct trace_edit), edit_cmp);
+    }
+
+    int known = (n_records != TRACE_RECORDS_UNKNOWN);
+    for (size_t i = 0; i < p->n_edits; i++) {
+        const struct trace_edit *e = &p->edits[i];
+        if (known && e->pos + e->skip > n_records) {
+            fprintf(stderr, "Error: plan line %u: position [%lu, %lu) exceeds total records (%lu)\n",
+                    e->line, (unsigned long)e->pos, (unsigned long)(e->pos + e->skip),
+                    (unsigned long)n_records);
+            return -1;
+        }
+        if (known && e->repeat > 0 && e->src_end > n_records) {
+            fprintf(stderr, "Error: plan line %u: source [%lu, %lu) exceeds total records (%lu)\n",
+                    e->line, (unsigned long)e->src_begin, (unsigned long)e->src_end,
+                    (unsigned long)n_records);
+            return -1;
+        }
+        if (i > 0) {
+            const struct trace_edit *prev = &p->edits[i - 1];
+            if (e->pos < prev->pos + prev->skip) {
+                fprintf(stderr, "Error: plan lines %u and %u: edit at %lu falls inside the range [%lu, %lu) "
+                        "replaced by an earlier edit\n",
+                        prev->line, e->line, (unsigned long)e->pos,
+                        (unsigned long)prev->pos, (unsigned long)(prev->pos + prev->skip));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+uint64_t trace_plan_output_records(const struct trace_plan *p, uint64_t n_records) {
+    uint64_t out = n_records;
+    for (size_t i = 0; i < p->n_edits; i++) {
+        const struct trace_edit *e = &p->edits[i];
+        out += (e->src_end - e->src_begin) * e->repeat;
+        out -= e->skip;
+    }
+    return out;
+}
+
+/* ------------------------------------------------------------------------
+ * Apply
+ * ------------------------------------------------------------------------ */
+
+/*
+ * Sliding window over a streamed (.xz) input: holds input records
+ * [base, base + len). Records are decoded on demand and dropped once no
+ * remaining edit can refer to them.
+ */
+struct plan_window {
+    struct trace_reader *r;
+    struct input_instr *buf;
+    uint64_t base;
+    uint64_t len;
+    uint64_t cap;
+};
+
+/* Return input records [lo, hi); lo must not have been released */
+static const struct input_instr *window_get(struct plan_window *w, uint64_t lo, uint64_t hi) {
+    if (hi - w->base > w->cap) {
+        uint64_t cap = w->cap ? w->cap : TRACE_READ_CHUNK;
+        while (cap < hi - w->base) {
+            cap *= 2;
+        }
+        if (cap > PLAN_MAX_WINDOW_RECORDS && hi - w->base <= PLAN_MAX_WINDOW_RECORDS) {
+            cap = PLAN_MAX_WINDOW_RECORDS;
+        }
+        if (cap > PLAN_MAX_WINDOW_RECORDS) {
+            fprintf(stderr, "Error: Plan needs %lu input records in memory at once (limit %llu) for .xz input;\n"
+                    "       decompress the trace first (sources far from their insertion point)\n",
+                    (unsigned long)(hi - w->base), PLAN_MAX_WINDOW_RECORDS);
+            return NULL;
+        }
+        struct input_instr *buf = realloc(w->buf, cap * sizeof(struct input_instr));
+        if (!buf) {
+            fprintf(stderr, "Error: Cannot allocate %lu records for the plan window\n", (unsigned long)cap);
+            return NULL;
+        }
+        w->buf = buf;
+        w->cap = cap;
+    }
+
+    while (w->base + w->len < hi) {
+        int64_t got = trace_reader_read(w->r, w->buf + w->len, hi - (w->base + w->len));
+        if (got < 0) {
+            return NULL;
+        }
+        if (got == 0) {
+            fprintf(stderr, "Error: Input ended at record %lu, but the plan needs records up to %lu\n",
+                    (unsigned long)(w->base + w->len), (unsigned long)hi);
+            return NULL;
+        }
+        w->len += (uint64_t)got;
+    }
+    return w->buf + (lo - w->base);
+}
+
+/* Drop records before lo (at most the buffered ones) */
+static void window_release(struct plan_window *w, uint64_t lo) {
+    if (lo <= w->base) {
+        return;
+    }
+    uint64_t drop = lo - w->base;
+    if (drop >= w->len) {
+        /* Nothing buffered is needed: skip ahead without decoding into the buffer */
+        w->base += w->len;
+        w->len = 0;
+        return;
+    }
+    /* Compact only once half the buffer is dead, so each record moves O(1) times */
+    if (2 * drop >= w->len) {
+        memmove(w->buf, w->buf + drop, (size_t)(w->len - drop) * sizeof(struct input_instr));
+        w->base = lo;
+        w->len -= drop;
+    }
+}
+
+/*
+ * Pass input [lo, hi) through the window in bounded pieces, writing it to out
+ * (or discarding it if out is NULL) and releasing everything below keep.
+ */
+static int window_emit(struct plan_window *w, struct trace_writer *out,
+                       uint64_t lo, uint64_t hi, uint64_t keep) {
+    while (lo < hi) {
+        uint64_t n = hi - lo;
+        if (n > TRACE_READ_CHUNK) {
+            n = TRACE_READ_CHUNK;
+        }
+        const struct input_instr *recs = window_get(w, lo, lo + n);
+        if (!recs || (out && trace_writer_write(out, recs, n) != 0)) {
+            return -1;
+        }
+        lo += n;
+        window_release(w, lo < keep ? lo : keep);
+    }
+    return 0;
+}
+
+/*
+ * keep[i]: lowest input index that edits i.. still read from (UINT64_MAX
+ * for i = n_edits). Records below min(output position, keep[i]) can be
+ * dropped from memory. Returns a malloc'd array, or NULL.
+ */
+static uint64_t *plan_keep(const struct trace_plan *p) {
+    uint64_t *keep = malloc((p->n_edits + 1) * sizeof(uint64_t));
+    if (!keep) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    keep[p->n_edits] = UINT64_MAX;
+    for (size_t i = p->n_edits; i > 0; i--) {
+        const struct trace_edit *e = &p->edits[i - 1];
+        uint64_t k = keep[i];
+        if (e->repeat > 0 && e->src_begin < k) {
+            k = e->src_begin;
+        }
+        keep[i - 1] = k;
+    }
+    return keep;
+}
+
+static int apply_streamed(const struct trace_plan *p, struct trace_reader *r, struct trace_writer *w) {
+    uint64_t *keep = plan_keep(p);
+    if (!keep) {
+        return -1;
+    }
+
+    struct plan_window win;
+    memset(&win, 0, sizeof(win));
+    win.r = r;
+
+    uint64_t cur = 0;
+    int rc = 0;
+    for (size_t i = 0; i < p->n_edits && rc == 0; i++) {
+        const struct trace_edit *e = &p->edits[i];
+
+        /* Unchanged input up to the edit */
+        rc = window_emit(&win, w, cur, e->pos, keep[i]);
+
+        /* The edit's source records */
+        uint64_t len = e->src_end - e->src_begin;
+        for (uint64_t k = 0; k < e->repeat && rc == 0; k++) {
+            const struct input_instr *src = window_get(&win, e->src_begin, e->src_end);
+            if (!src || trace_writer_write(w, src, len) != 0) {
+                rc = -1;
+            }
+        }
+
+        /* Records dropped by the edit */
+        if (rc == 0) {
+            rc = window_emit(&win, NULL, e->pos, e->pos + e->skip, keep[i + 1]);
+        }
+        cur = e->pos + e->skip;
+        window_release(&win, cur < keep[i + 1] ? cur : keep[i + 1]);
+    }
+
+    /* Rest of the input: nothing is kept any more, stream it straight through */
+    if (rc == 0) {
+        rc = window_emit(&win, w, cur, win.base + win.len, UINT64_MAX);
+    }
+    if (rc == 0 && trace_copy_records(r, w, UINT64_MAX) < 0) {
+        rc = -1;
+    }
+
+    free(win.buf);
+    free(keep);
+    return rc;
+}
+
+static int apply_mapped(const struct trace_plan *p, struct trace_reader *r, struct trace_writer *w) {
+    const struct trace_map *m = &r->map;
+    uint64_t cur = 0;
+
+    for (size_t i = 0; i < p->n_edits; i++) {
+        const struct trace_edit *e = &p->edits[i];
+        if (trace_writer_copy_span(w, m, cur, e->pos - cur) != 0) {
+            return -1;
+        }
+        for (uint64_t k = 0; k < e->repeat; k++) {
+            if (trace_writer_copy_span(w, m, e->src_begin, e->src_end - e->src_begin) != 0) {
+                return -1;
+            }
+        }
+        cur = e->pos + e->skip;
+    }
+    if (trace_writer_copy_span(w, m, cur, m->n_records - cur) != 0) {
+        return -1;
+    }
+
+    r->pos = m->n_records;
+    return 0;
+}
+
+int trace_plan_apply(const struct trace_plan *p, struct trace_reader *r, struct trace_writer *w) {
+    return r->is_xz ? apply_streamed(p, r, w) : apply_mapped(p, r, w);
+}
+
+/* ------------------------------------------------------------------------
+ * Fan-out: one input pass, many outputs
+ * ------------------------------------------------------------------------ */
+
+/*
+ * Input ring shared by the writer threads. Input record i lives in slot
+ * (i / chunk) % n_slots at offset i % chunk; records [base, end) are
+ * available. The reader only refills a slot once every writer has released
+ * all records in it (low[] is each writer's release mark).
+ */
+struct fanout {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;   /* broadcast on every change of end, low[] or failed */
+
+    uint64_t chunk;
+    unsigned n_slots;
+    const struct input_instr **slot;
+    struct input_instr *buf;   /* .xz input only: n_slots * chunk records */
+
+    uint64_t base;
+    uint64_t end;
+    int eof;
+    int failed;
+    uint64_t *low;
+};
+
+struct fanout_writer {
+    struct fanout *f;
+    struct trace_plan_target *t;
+    unsigned id;
+    uint64_t low;   /* own copy of f->low[id] */
+};
+
+static void fanout_fail(struct fanout *f) {
+    pthread_mutex_lock(&f->lock);
+    f->failed = 1;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+}
+
+/* Release records below lo (published once per chunk to limit lock traffic) */
+static void fanout_release(struct fanout_writer *fw, uint64_t lo) {
+    struct fanout *f = fw->f;
+    if (lo <= fw->low) {
+        return;
+    }
+    int publish = (lo == UINT64_MAX) || (lo / f->chunk != fw->low / f->chunk);
+    fw->low = lo;
+    if (publish) {
+        pthread_mutex_lock(&f->lock);
+        f->low[fw->id] = lo;
+        pthread_cond_broadcast(&f->cond);
+        pthread_mutex_unlock(&f->lock);
+    }
+}
+
+/* Wait until input [.., hi) is available; returns the available end (< hi only at EOF or on failure) */
+static uint64_t fanout_wait(struct fanout *f, uint64_t hi, int *failed) {
+    pthread_mutex_lock(&f->lock);
+    while (f->end < hi && !f->eof && !f->failed) {
+        pthread_cond_wait(&f->cond, &f->lock);
+    }
+    uint64_t end = f->end;
+    *failed = f->failed;
+    pthread_mutex_unlock(&f->lock);
+    return end;
+}
+
+/*
+ * Pass input [lo, hi) to out (or drop it if out is NULL) one ring chunk at
+ * a time, releasing everything below keep as the output moves on.
+ */
+static int fanout_emit(struct fanout_writer *fw, struct trace_writer *out,
+                       uint64_t lo, uint64_t hi, uint64_t keep) {
+    struct fanout *f = fw->f;
+    uint64_t window = (uint64_t)f->n_slots * f->chunk;
+
+    while (lo < hi) {
+        uint64_t piece_end = (lo / f->chunk + 1) * f->chunk;
+        if (piece_end > hi) {
+            piece_end = hi;
+        }
+        /* The release mark rounds down to a chunk: keep one chunk of slack */
+        if (piece_end - fw->low > window - f->chunk) {
+            fprintf(stderr, "Error: %s: plan reads input %lu while still holding input %lu; "
+                    "more than the fan-out window (%lu records) apart (raise --window)\n",
+                    fw->t->w->path, (unsigned long)lo, (unsigned long)fw->low, (unsigned long)window);
+            return -1;
+        }
+
+        int failed;
+        uint64_t end = fanout_wait(f, piece_end, &failed);
+        if (failed) {
+            return -1;
+        }
+        if (end < piece_end) {
+            fprintf(stderr, "Error: %s: input ended at record %lu, but the plan needs records up to %lu\n",
+                    fw->t->w->path, (unsigned long)end, (unsigned long)hi);
+            return -1;
+        }
+
+        const struct input_instr *recs = f->slot[(lo / f->chunk) % f->n_slots] + lo % f->chunk;
+        if (out && trace_writer_write(out, recs, piece_end - lo) != 0) {
+            return -1;
+        }
+        lo = piece_end;
+        fanout_release(fw, lo < keep ? lo : keep);
+    }
+    return 0;
+}
+
+static int fanout_run(struct fanout_writer *fw, const uint64_t *keep) {
+    struct fanout *f = fw->f;
+    const struct trace_plan *p = fw->t->plan;
+    struct trace_writer *w = fw->t->w;
+    uint64_t cur = 0;
+
+    for (size_t i = 0; i < p->n_edits; i++) {
+        const struct trace_edit *e = &p->edits[i];
+        if (fanout_emit(fw, w, cur, e->pos, keep[i]) != 0) {
+            return -1;
+        }
+        for (uint64_t k = 0; k < e->repeat; k++) {
+            if (fanout_emit(fw, w, e->src_begin, e->src_end, 0) != 0) {
+                return -1;
+            }
+        }
+        if (fanout_emit(fw, NULL, e->pos, e->pos + e->skip, keep[i + 1]) != 0) {
+            return -1;
+        }
+        cur = e->pos + e->skip;
+        fanout_release(fw, cur < keep[i + 1] ? cur : keep[i + 1]);
+    }
+
+    /* Rest of the input, up to wherever it ends */
+    for (;;) {
+        int failed;
+        uint64_t end = fanout_wait(f, cur + 1, &failed);
+        if (failed) {
+            return -1;
+        }
+        if (end <= cur) {
+            return 0;
+        }
+        if (fanout_emit(fw, w, cur, end, UINT64_MAX) != 0) {
+            return -1;
+        }
+        cur = end;
+    }
+}
+
+static void *fanout_worker(void *arg) {
+    struct fanout_writer *fw = arg;
+    uint64_t *keep = plan_keep(fw->t->plan);
+
+    fw->t->rc = keep ? fanout_run(fw, keep) : -1;
+    free(keep);
+    if (fw->t->rc != 0) {
+        fanout_fail(fw->f);
+    }
+    fanout_release(fw, UINT64_MAX);
+    return NULL;
+}
+
+int trace_plan_apply_fanout(struct trace_plan_target *t, unsigned n, struct trace_reader *r,
+                            uint64_t window_records) {
+    struct fanout f;
+    memset(&f, 0, sizeof(f));
+    f.chunk = TRACE_READ_CHUNK;
+    f.n_slots = (unsigned)(window_records / f.chunk);
+    if (f.n_slots < 2) {
+        f.n_slots = 2;
+    }
+
+    f.slot = calloc(f.n_slots, sizeof(*f.slot));
+    f.low = calloc(n, sizeof(*f.low));
+    struct fanout_writer *fw = calloc(n, sizeof(*fw));
+    pthread_t *threads = calloc(n, sizeof(*threads));
+    if (r->is_xz) {
+        f.buf = malloc((size_t)f.n_slots * f.chunk * sizeof(struct input_instr));
+    }
+    if (!f.slot || !f.low || !fw || !threads || (r->is_xz && !f.buf)) {
+        fprintf(stderr, "Error: Cannot allocate the fan-out window (%lu records)\n",
+                (unsigned long)((uint64_t)f.n_slots * f.chunk));
+        free(f.slot);
+        free(f.low);
+        free(fw);
+        free(threads);
+        free(f.buf);
+        return -1;
+    }
+    pthread_mutex_init(&f.lock, NULL);
+    pthread_cond_init(&f.cond, NULL);
+
+    unsigned started = 0;
+    for (; started < n; started++) {
+        t[started].rc = -1;
+        fw[started].f = &f;
+        fw[started].t = &t[started];
+        fw[started].id = started;
+        if (pthread_create(&threads[started], NULL, fanout_worker, &fw[started]) != 0) {
+            fprintf(stderr, "Error: Cannot start writer thread %u\n", started);
+            fanout_fail(&f);
+            break;
+        }
+    }
+
+    /* Reader: fill the ring as fast as the slowest writer frees it */
+    int rc = (started == n) ? 0 : -1;
+    while (rc == 0) {
+        pthread_mutex_lock(&f.lock);
+        for (;;) {
+            uint64_t min_low = UINT64_MAX;
+            for (unsigned k = 0; k < n; k++) {
+                if (f.low[k] < min_low) {
+                    min_low = f.low[k];
+                }
+            }
+            f.base = (min_low == UINT64_MAX) ? f.end : min_low / f.chunk * f.chunk;
+            if (f.failed || f.end - f.base < (uint64_t)f.n_slots * f.chunk) {
+                break;
+            }
+            pthread_cond_wait(&f.cond, &f.lock);
+        }
+        int failed = f.failed;
+        pthread_mutex_unlock(&f.lock);
+        if (failed) {
+            rc = -1;
+            break;
+        }
+
+        unsigned s = (unsigned)((f.end / f.chunk) % f.n_slots);
+        const struct input_instr *recs;
+        int64_t got = trace_reader_take(r, &recs, f.chunk, f.buf ? f.buf + (size_t)s * f.chunk : NULL);
+
+        pthread_mutex_lock(&f.lock);
+        if (got < 0) {
+            f.failed = 1;
+            rc = -1;
+        } else {
+            f.slot[s] = recs;
+            f.end += (uint64_t)got;
+            f.eof = ((uint64_t)got < f.chunk);
+        }
+        pthread_cond_broadcast(&f.cond);
+        int done = f.eof;
+        pthread_mutex_unlock(&f.lock);
+        if (done) {
+            break;
+        }
+    }
+
+    for (unsigned k = 0; k < started; k++) {
+        pthread_join(threads[k], NULL);
+        if (t[k].rc != 0) {
+            rc = -1;
+        }
+    }
+
+    pthread_cond_destroy(&f.cond);
+    pthread_mutex_destroy(&f.lock);
+    free(f.slot);
+    free(f.low);
+    free(fw);
+    free(threads);
+    free(f.buf);
+    return rc;
+}
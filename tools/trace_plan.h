@@ -0,0 +1,144 @@
+/*
+ * trace_plan.h - Declarative trace surgery plans
+ *
+ * A plan is a list of operations on an input trace, written one per line:
+ *
+ *     # comment
+ *     insert    at=K src=I:J [count=N]   insert input [I, J) before input record K
+ *     overwrite at=K src=I:J             replace input [K, K + J - I) with input [I, J)
+ *     delete    range=I:J                drop input [I, J)
+ *     duplicate range=I:J [count=N]      repeat input [I, J) N more times (default 1)
+ *     iters     first_a_begin=IDX a_len=N b_len=N iterations=N
+ *               a_pos=RATIO b_ratio=RATIO [every=N] [mode=insert|overwrite]
+ *                                        per-iteration template (as trace_insert_all_iters):
+ *                                        in every N-th iteration i, the first b_len*b_ratio
+ *                                        records of B_i go at A_i + a_len*a_pos
+ *     iters     loops=FILE a_pos=RATIO b_ratio=RATIO ...
+ *                                        same, with the loop structure taken from
+ *                                        trace_detect_loops JSON (explicit keys override)
+ *
+ * All indices refer to the ORIGINAL input trace, so operations do not shift
+ * each other and their order in the plan does not matter (except that
+ * several inserts at the same position are emitted in plan order). Numbers
+ * may be decimal or 0x-prefixed hex.
+ *
+ * A value may also be a comma-separated list ("a_pos=0.25,0.5,0.75"). Each
+ * list is a sweep dimension: the plan then describes one variant per
+ * combination of list values, selected with trace_plan_select().
+ *
+ * The plan is compiled into an edit list sorted by input position and then
+ * applied in one streaming pass: every output record is copied straight from
+ * its input offset, so any number of operations costs a single read of the
+ * input and a single write of the output.
+ */
+
+#ifndef TRACE_PLAN_H
+#define TRACE_PLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace_io.h"
+
+/*
+ * One compiled edit: at input position pos, drop input [pos, pos + skip) and
+ * emit input [src_begin, src_end) repeat times in its place.
+ */
+struct trace_edit {
+    uint64_t pos;
+    uint64_t skip;
+    uint64_t src_begin;
+    uint64_t src_end;
+    uint64_t repeat;
+    unsigned line;   /* plan line the edit came from (for messages) */
+    unsigned seq;    /* creation order, keeps equal positions in plan order */
+};
+
+/* Maximum number of sweep dimensions (value lists) in one plan */
+#define TRACE_PLAN_MAX_DIMS 8
+
+/* A value list "key=v1,v2,..." found while parsing */
+struct trace_sweep_dim {
+    char key[32];
+    char list[128];     /* the values as written */
+    unsigned n_values;
+    unsigned line;
+};
+
+struct trace_plan {
+    struct trace_edit *edits;
+    size_t n_edits;
+    size_t cap;
+    uint64_t n_ops;  /* plan lines with an operation */
+
+    struct trace_sweep_dim dims[TRACE_PLAN_MAX_DIMS];
+    unsigned n_dims;
+    const unsigned *choice;  /* value index per dimension, NULL = first values */
+};
+
+void trace_plan_init(struct trace_plan *p);
+void trace_plan_free(struct trace_plan *p);
+
+/*
+ * Pick the sweep variant to build: choice[d] is the value index for the d-th
+ * value list in plan order (the array must outlive parsing). Call before
+ * adding lines; a plan parsed without a choice takes the first values.
+ */
+void trace_plan_select(struct trace_plan *p, const unsigned *choice);
+
+/* Copy value k of a sweep dimension into buf. Returns 0, or -1 if it does not fit. */
+int trace_plan_dim_value(const struct trace_sweep_dim *d, unsigned k, char *buf, size_t len);
+
+/*
+ * Parse one plan line and append its edits. where/line are used in error
+ * messages ("plan.txt:12: ..."). Blank lines and # comments are accepted.
+ * Returns 0 on success, -1 on a syntax error (message printed to stderr).
+ */
+int trace_plan_add_line(struct trace_plan *p, const char *text, const char *where, unsigned line);
+
+/* Parse a whole plan file. Returns 0 on success, -1 on error. */
+int trace_plan_load(struct trace_plan *p, const char *path);
+
+/*
+ * Sort the edits by input position and check them: ranges must be non-empty
+ * where required, lie inside the input (if n_records is known, i.e. not
+ * TRACE_RECORDS_UNKNOWN) and the dropped ranges must not overlap.
+ * Returns 0 on success, -1 on error (message printed to stderr).
+ */
+int trace_plan_compile(struct trace_plan *p, uint64_t n_records);
+
+/* Number of output records for an input of n_records (compiled plan) */
+uint64_t trace_plan_output_records(const struct trace_plan *p, uint64_t n_records);
+
+/*
+ * Apply a compiled plan in one pass from r to w. A raw input is used in place
+ * through its mapping (and honours w->copy_mode); an .xz input is decoded
+ * once through a sliding window that holds just the records later edits
+ * still need. Returns 0 on success, -1 on error.
+ */
+int trace_plan_apply(const struct trace_plan *p, struct trace_reader *r, struct trace_writer *w);
+
+/* One output of trace_plan_apply_fanout() */
+struct trace_plan_target {
+    const struct trace_plan *plan;
+    struct trace_writer *w;
+    int rc;   /* 0 on success, -1 if this output failed */
+};
+
+/* Default input window shared by the fan-out writers (2M records = 128 MiB) */
+#define TRACE_FANOUT_WINDOW_RECORDS (1ULL << 21)
+
+/*
+ * Apply n compiled plans to the same input in one pass, writing n outputs.
+ * The calling thread reads the input once into a ring of window_records
+ * records (for raw input the ring just points into the mapping); each
+ * output has its own writer thread that walks its edit list over the ring.
+ * Slow writers hold the reader back, so the input is never read twice.
+ * An edit must not refer to records more than the window size behind the
+ * output position. Always writes with trace_writer_write() (w->copy_mode is
+ * not used). Returns 0 if every output succeeded, -1 otherwise.
+ */
+int trace_plan_apply_fanout(struct trace_plan_target *t, unsigned n, struct trace_reader *r,
+                            uint64_t window_records);
+
+#endif /* TRACE_PLAN_H */
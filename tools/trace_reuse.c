@@ -0,0 +1,284 @@
+/*
+ * trace_reuse.c - LRU stack-distance profiler (Fenwick tree, optional SHARDS sampling)
+ *
+ * See trace_reuse.h. Time t (1-based) is the t-th access that needed a
+ * lookup; the tree holds a 1 at the last access time of every line, so the
+ * stack distance of an access to a line last seen at time t0 is the number
+ * of ones in (t0, now).
+ */
+
+#include "trace_reuse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initial sizes; both grow on demand */
+#define MAP_INITIAL_CAP (1ULL << 16)
+#define BIT_MIN_CAP     (1ULL << 20)
+
+/* splitmix64 finalizer: map slot from the high bits, sampling from the low bits */
+static inline uint64_t line_hash(uint64_t line) {
+    uint64_t z = line + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void bit_add(uint32_t *bit, uint64_t cap, uint64_t i, int32_t v) {
+    for (; i <= cap; i += i & (~i + 1)) {
+        bit[i] += (uint32_t)v;
+    }
+}
+
+/* Ones in times 1..i */
+static uint64_t bit_sum(const uint32_t *bit, uint64_t i) {
+    uint64_t s = 0;
+    for (; i > 0; i &= i - 1) {
+        s += bit[i];
+    }
+    return s;
+}
+
+static int map_alloc(struct reuse_profiler *p, uint64_t cap) {
+    p->keys = calloc(cap, sizeof(*p->keys));
+    p->times = malloc(cap * sizeof(*p->times));
+    if (!p->keys || !p->times) {
+        fprintf(stderr, "Error: Out of memory for %lu tracked lines\n", (unsigned long)cap / 2);
+        return -1;
+    }
+    p->map_cap = cap;
+    p->map_shift = 64;
+    while ((1ULL << (64 - p->map_shift)) < cap) {
+        p->map_shift--;
+    }
+    return 0;
+}
+
+/* Slot of line, or of the empty slot where it would go */
+static inline uint64_t map_slot(const struct reuse_profiler *p, uint64_t key, uint64_t hash) {
+    uint64_t mask = p->map_cap - 1;
+    uint64_t i = hash >> p->map_shift;
+    while (p->keys[i] != 0 && p->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static int map_grow(struct reuse_profiler *p) {
+    uint64_t *keys = p->keys;
+    uint64_t *times = p->times;
+    uint64_t cap = p->map_cap;
+
+    if (map_alloc(p, 2 * cap) != 0) {
+        free(keys);
+        free(times);
+        return -1;
+    }
+    for (uint64_t i = 0; i < cap; i++) {
+        if (keys[i] != 0) {
+            uint64_t j = map_slot(p, keys[i], line_hash(keys[i] - 1));
+            p->keys[j] = keys[i];
+            p->times[j] = times[i];
+        }
+    }
+    free(keys);
+    free(times);
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * The time axis is full: renumber the live last-access times 1..n_lines in
+ * their order (distances only depend on the order) and rebuild the tree,
+ * with room for at least as many new accesses again.
+ */
+static int compact_times(struct reuse_profiler *p) {
+    uint64_t n = p->n_lines;
+    uint64_t cap = 2 * n > BIT_MIN_CAP ? 2 * n : BIT_MIN_CAP;
+
+    /* New time of a line = rank of its old one among the live times */
+    uint64_t *sorted = malloc((n ? n : 1) * sizeof(*sorted));
+    uint32_t *bit = calloc(cap + 1, sizeof(*bit));
+    if (!sorted || !bit) {
+        fprintf(stderr, "Error: Out of memory for a %lu-entry time axis\n", (unsigned long)cap);
+        free(sorted);
+        free(bit);
+        return -1;
+    }
+    uint64_t k = 0;
+    for (uint64_t i = 0; i < p->map_cap; i++) {
+        if (p->keys[i] != 0) {
+            sorted[k++] = p->times[i];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), cmp_u64);
+    for (uint64_t i = 0; i < p->map_cap; i++) {
+        if (p->keys[i] != 0) {
+            uint64_t *pos = bsearch(&p->times[i], sorted, n, sizeof(*sorted), cmp_u64);
+            p->times[i] = (uint64_t)(pos - sorted) + 1;
+        }
+    }
+    free(sorted);
+
+    /* Ones at 1..n, built in O(cap) */
+    for (uint64_t t = 1; t <= n; t++) {
+        bit[t] = 1;
+    }
+    for (uint64_t t = 1; t <= cap; t++) {
+        uint64_t parent = t + (t & (~t + 1));
+        if (parent <= cap) {
+            bit[parent] += bit[t];
+        }
+    }
+
+    free(p->bit);
+    p->bit = bit;
+    p->bit_cap = cap;
+    p->now = n + 1;
+    return 0;
+}
+
+static int hist_add(struct reuse_hist *h, uint64_t d) {
+    if (d >= h->len) {
+        uint64_t len = h->len ? h->len : 1024;
+        while (len <= d) {
+            len *= 2;
+        }
+        uint64_t *count = realloc(h->count, len * sizeof(*count));
+        if (!count) {
+            fprintf(stderr, "Error: Out of memory for a %lu-entry histogram\n", (unsigned long)len);
+            return -1;
+        }
+        memset(count + h->len, 0, (len - h->len) * sizeof(*count));
+        h->count = count;
+        h->len = len;
+    }
+    h->count[d]++;
+    return 0;
+}
+
+int reuse_init(struct reuse_profiler *p, unsigned n_streams, double sample_rate) {
+    memset(p, 0, sizeof(*p));
+    if (n_streams == 0 || n_streams > REUSE_MAX_STREAMS) {
+        fprintf(stderr, "Error: %u streams (1..%d)\n", n_streams, REUSE_MAX_STREAMS);
+        return -1;
+    }
+    if (!(sample_rate > 0.0 && sample_rate <= 1.0)) {
+        fprintf(stderr, "Error: Sample rate %g is not in (0, 1]\n", sample_rate);
+        return -1;
+    }
+    p->n_streams = n_streams;
+    p->sample_rate = sample_rate;
+    p->threshold = (uint64_t)(sample_rate * (double)(REUSE_SAMPLE_MASK + 1));
+    if (p->threshold == 0) {
+        p->threshold = 1;
+    }
+    p->last_line = UINT64_MAX;
+
+    if (map_alloc(p, MAP_INITIAL_CAP) != 0) {
+        reuse_free(p);
+        return -1;
+    }
+    p->bit_cap = BIT_MIN_CAP;
+    p->bit = calloc(p->bit_cap + 1, sizeof(*p->bit));
+    if (!p->bit) {
+        fprintf(stderr, "Error: Out of memory for the time axis\n");
+        reuse_free(p);
+        return -1;
+    }
+    p->now = 1;
+    return 0;
+}
+
+void reuse_free(struct reuse_profiler *p) {
+    for (unsigned s = 0; s < REUSE_MAX_STREAMS; s++) {
+        free(p->hist[s].count);
+        p->hist[s].count = NULL;
+    }
+    free(p->keys);
+    free(p->times);
+    free(p->bit);
+    p->keys = NULL;
+    p->times = NULL;
+    p->bit = NULL;
+}
+
+int reuse_access(struct reuse_profiler *p, uint64_t line, unsigned stream) {
+    uint64_t hash = line_hash(line);
+    if ((hash & REUSE_SAMPLE_MASK) >= p->threshold) {
+        return 0;
+    }
+    struct reuse_hist *h = &p->hist[stream];
+    h->accesses++;
+
+    /* Same line as the previous sampled access: distance 0, nothing moves */
+    if (line == p->last_line) {
+        return hist_add(h, 0);
+    }
+    p->last_line = line;
+
+    if (p->now > p->bit_cap && compact_times(p) != 0) {
+        return -1;
+    }
+    uint64_t key = line + 1;
+    uint64_t i = map_slot(p, key, hash);
+    uint64_t t = p->now++;
+
+    if (p->keys[i] == 0) {
+        h->cold++;
+        p->keys[i] = key;
+        p->times[i] = t;
+        bit_add(p->bit, p->bit_cap, t, 1);
+        if (++p->n_lines * 2 > p->map_cap) {
+            return map_grow(p);
+        }
+        return 0;
+    }
+
+    /* Every line has its one bit below t, so ones in (t0, t) = n_lines - ones in 1..t0 */
+    uint64_t t0 = p->times[i];
+    uint64_t d = p->n_lines - bit_sum(p->bit, t0);
+    bit_add(p->bit, p->bit_cap, t0, -1);
+    bit_add(p->bit, p->bit_cap, t, 1);
+    p->times[i] = t;
+    return hist_add(h, d);
+}
+
+void reuse_finish(struct reuse_profiler *p) {
+    for (unsigned s = 0; s < p->n_streams; s++) {
+        struct reuse_hist *h = &p->hist[s];
+        for (uint64_t d = h->len; d-- > 1;) {
+            h->count[d - 1] += h->count[d];
+        }
+    }
+}
+
+uint64_t reuse_bin_distance(const struct reuse_profiler *p, uint64_t bin) {
+    if (p->sample_rate < 1.0) {
+        return (uint64_t)((double)bin / p->sample_rate);
+    }
+    return bin;
+}
+
+uint64_t reuse_misses(const struct reuse_profiler *p, unsigned stream, uint64_t lines) {
+    const struct reuse_hist *h = &p->hist[stream];
+
+    /* First bin whose scaled distance is >= lines (no hit in a cache of `lines` lines) */
+    uint64_t bin = lines;
+    if (p->sample_rate < 1.0) {
+        bin = (uint64_t)((double)lines * p->sample_rate);
+        while (bin > 0 && reuse_bin_distance(p, bin - 1) >= lines) {
+            bin--;
+        }
+        while (reuse_bin_distance(p, bin) < lines) {
+            bin++;
+        }
+    }
+    return h->cold + (bin < h->len ? h->count[bin] : 0);
+}
@@ -0,0 +1,104 @@
+/*
+ * trace_reuse.h - LRU stack-distance (reuse distance) profiler
+ *
+ * Feeds a stream of line addresses and builds, per stream class (e.g. the A
+ * and B load IPs), a histogram of LRU stack distances: the number of
+ * distinct other lines touched since the previous access to the same line.
+ * A fully-associative LRU cache of C lines hits exactly the accesses with
+ * distance < C, so one pass gives the miss ratio of every cache size:
+ *
+ *     struct reuse_profiler p;
+ *     reuse_init(&p, 2, 1.0);
+ *     reuse_access(&p, addr >> 6, stream);    ...for every access
+ *     reuse_finish(&p);
+ *     reuse_misses(&p, stream, lines)         misses of a cache of `lines`
+ *     reuse_free(&p);
+ *
+ * Distances are computed with a Fenwick tree over access times (one bit per
+ * line, set at its last access), O(log n) per access; the time axis is
+ * compacted to the live lines when it fills up.
+ *
+ * With sample_rate < 1 only lines whose hash falls below the rate are
+ * tracked and their distances are scaled by 1 / rate (fixed-rate SHARDS,
+ * Waldspurger et al., FAST '15): memory and time shrink by the rate, the
+ * miss ratios stay unbiased estimates. The histograms keep the distances
+ * among the sampled lines, i.e. bins of 1 / rate lines, so they shrink with
+ * the rate as well; reuse_bin_distance() gives the scaled distance of a bin.
+ */
+
+#ifndef TRACE_REUSE_H
+#define TRACE_REUSE_H
+
+#include <stdint.h>
+
+/* Most stream classes of one profiler */
+#define REUSE_MAX_STREAMS 40
+
+struct reuse_hist {
+    uint64_t *count;        /* count[b]: sampled accesses in bin b (sampled distance b,
+                               scaled reuse_bin_distance(b)); after reuse_finish,
+                               those in bins >= b */
+    uint64_t len;           /* entries allocated in count[] */
+    uint64_t cold;          /* first accesses (infinite distance) */
+    uint64_t accesses;      /* sampled accesses */
+};
+
+struct reuse_profiler {
+    unsigned n_streams;
+    struct reuse_hist hist[REUSE_MAX_STREAMS];
+
+    /* Sampling: keep a line if (hash & REUSE_SAMPLE_MASK) < threshold */
+    double sample_rate;
+    uint64_t threshold;
+
+    /* line -> time of its last access (open addressing, key = line + 1, 0 = empty) */
+    uint64_t *keys;
+    uint64_t *times;
+    uint64_t map_cap;       /* power of two */
+    unsigned map_shift;     /* 64 - log2(map_cap) */
+    uint64_t n_lines;       /* distinct sampled lines so far */
+
+    /* Fenwick tree over times 1..bit_cap; bit t is set iff t is some line's last access */
+    uint32_t *bit;
+    uint64_t bit_cap;
+    uint64_t now;           /* next time to hand out */
+
+    uint64_t last_line;     /* previous sampled line (distance 0 without a lookup) */
+};
+
+#define REUSE_SAMPLE_BITS 24
+#define REUSE_SAMPLE_MASK ((1ULL << REUSE_SAMPLE_BITS) - 1)
+
+/*
+ * Set up an empty profiler with n_streams histograms, tracking a sample_rate
+ * (0 < rate <= 1) fraction of the lines.
+ * Returns 0, or -1 on error (message printed to stderr).
+ */
+int reuse_init(struct reuse_profiler *p, unsigned n_streams, double sample_rate);
+
+void reuse_free(struct reuse_profiler *p);
+
+/*
+ * Record an access to line (an address >> line shift) by stream.
+ * Returns 0, or -1 when out of memory (message printed to stderr).
+ */
+int reuse_access(struct reuse_profiler *p, uint64_t line, unsigned stream);
+
+/*
+ * Turn the histograms into suffix sums for reuse_misses(). Call once after
+ * the last reuse_access().
+ */
+void reuse_finish(struct reuse_profiler *p);
+
+/* Scaled stack distance of histogram bin (bin itself when sample_rate == 1) */
+uint64_t reuse_bin_distance(const struct reuse_profiler *p, uint64_t bin);
+
+/*
+ * Sampled misses of stream in a fully-associative LRU cache of `lines`
+ * lines, cold misses included (after reuse_finish). Divide by sample_rate
+ * for an estimate of the full count; the ratio to hist[stream].accesses is
+ * the miss ratio.
+ */
+uint64_t reuse_misses(const struct reuse_profiler *p, unsigned stream, uint64_t lines);
+
+#endif /* TRACE_REUSE_H */
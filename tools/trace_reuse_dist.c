@@ -0,0 +1,517 @@
+/*
+ * trace_reuse_dist.c - LRU stack-distance profile and miss curve of a trace
+ *
+ * Usage: trace_reuse_dist (--trace PATH | --synthetic A,B,CHUNK[,MODE[,STRIDE[,SCALE]]])
+ *            [--loops FILE | --a-ip IP ... --b-ip IP ...] [--line BYTES]
+ *            [--sample RATE] [--points N | --sizes LIST] [--max N]
+ *
+ * Builds the reuse-distance histogram of the memory operands in one pass
+ * (see trace_reuse.h) and prints the fully-associative LRU miss ratio for
+ * every cache size: total, and per A / B load IP so that the array driving
+ * the misses is visible. Meant for choosing A_bytes / chunk_bytes in
+ * configs/cases.csv without sweeping sizes on the machine.
+ *
+ * --synthetic generates the address stream of benchmark.c's run_kernel()
+ * from the same arguments (A sweep, then one B chunk, per outer iteration)
+ * instead of reading a trace; its streams are simply A and B.
+ */
+
+#define _GNU_SOURCE  /* clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "trace_io.h"
+#include "trace_loops.h"
+#include "trace_reuse.h"
+
+#define DEFAULT_LINE   64
+#define DEFAULT_POINTS 4
+
+/* Most --sizes entries */
+#define MAX_SIZES 256
+
+/* Where --synthetic places the arrays (line aligned, far apart) */
+#define SYNTH_A_BASE 0x10000000ULL
+#define SYNTH_B_BASE 0x10000000000ULL
+
+struct synth_params {
+    uint64_t a_bytes;
+    uint64_t b_bytes;
+    uint64_t chunk_bytes;
+    int access_mode;        /* 0 = dense, 1 = strided */
+    uint64_t stride_elems;  /* as passed; only used when access_mode = 1 */
+    uint64_t outer_scale;
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s (--trace PATH | --synthetic A,B,CHUNK[,MODE[,STRIDE[,SCALE]]])\n", prog);
+    fprintf(stderr, "           [--loops FILE | --a-ip IP ... --b-ip IP ...] [--line BYTES]\n");
+    fprintf(stderr, "           [--sample RATE] [--points N | --sizes LIST] [--max N]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --trace PATH     Trace file, raw or .xz\n");
+    fprintf(stderr, "  --synthetic ARGS benchmark arguments A_bytes,B_bytes,chunk_bytes[,access_mode\n");
+    fprintf(stderr, "                   [,stride_elems[,outer_scale]]]: profile run_kernel()'s address\n");
+    fprintf(stderr, "                   stream instead of a trace (outer_scale 2 already shows the reuse)\n");
+    fprintf(stderr, "  --loops FILE     Break the misses down by the A / B load IPs of trace_detect_loops JSON\n");
+    fprintf(stderr, "  --a-ip IP        A sweep load IP (hex, repeatable)\n");
+    fprintf(stderr, "  --b-ip IP        B chunk load IP (hex, repeatable)\n");
+    fprintf(stderr, "  --line BYTES     Line size (default: %d)\n", DEFAULT_LINE);
+    fprintf(stderr, "  --sample RATE    Track only this fraction of the lines (SHARDS, e.g. 0.01; default: 1 = exact)\n");
+    fprintf(stderr, "  --points N       Evenly spaced cache sizes per doubling, up to the largest reuse distance\n");
+    fprintf(stderr, "                   (default: %d: 32K, 40K, 48K, 56K, 64K, ...);\n", DEFAULT_POINTS);
+    fprintf(stderr, "                   0 = every size at which a miss count changes\n");
+    fprintf(stderr, "  --sizes LIST     Only these cache sizes, e.g. 32K,48K,512K,2M\n");
+    fprintf(stderr, "  --max N          Stop after N trace records (default: 0 = whole trace)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Output (CSV, one line per cache size):\n");
+    fprintf(stderr, "  cache_bytes,lines,misses,miss_ratio[,<stream>_misses,<stream>_miss_ratio...]\n");
+    fprintf(stderr, "  streams: A_<ip>, B_<ip>, other (trace) or A, B (--synthetic)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples:\n");
+    fprintf(stderr, "  %s --trace wp.trace.xz --loops wp.loops.json --sample 0.01\n", prog);
+    fprintf(stderr, "  %s --synthetic 32768,67108864,524288,1,1,2 --sizes 32K,48K,512K,2M\n", prog);
+}
+
+/* "123", "32K", "2M", "1G" -> bytes; *end is left after the suffix */
+static uint64_t parse_size(const char *s, char **end) {
+    uint64_t v = strtoull(s, end, 0);
+    switch (**end) {
+        case 'K': case 'k': v <<= 10; (*end)++; break;
+        case 'M': case 'm': v <<= 20; (*end)++; break;
+        case 'G': case 'g': v <<= 30; (*end)++; break;
+        default: break;
+    }
+    return v;
+}
+
+static int parse_synthetic(struct synth_params *sp, const char *arg) {
+    uint64_t v[6] = { 0, 0, 0, 0, 8, 1 };  /* benchmark.c defaults */
+    unsigned n = 0;
+    const char *s = arg;
+    while (n < 6) {
+        char *end;
+        v[n++] = strtoull(s, &end, 0);
+        if (*end != ',') {
+            s = end;
+            break;
+        }
+        s = end + 1;
+    }
+    if (n < 3 || *s != '\0') {
+        fprintf(stderr, "Error: --synthetic expects A_bytes,B_bytes,chunk_bytes[,access_mode[,stride_elems[,outer_scale]]], got '%s'\n", arg);
+        return -1;
+    }
+    sp->a_bytes = v[0];
+    sp->b_bytes = v[1];
+    sp->chunk_bytes = v[2];
+    sp->access_mode = (int)v[3];
+    sp->stride_elems = v[4];
+    sp->outer_scale = v[5];
+
+    /* Same checks as benchmark.c */
+    if (sp->stride_elems == 0 || sp->outer_scale == 0) {
+        fprintf(stderr, "Error: --synthetic: stride_elems and outer_scale must be >= 1\n");
+        return -1;
+    }
+    if (sp->a_bytes < sizeof(double) || sp->b_bytes < sizeof(double) || sp->chunk_bytes < sizeof(double)) {
+        fprintf(stderr, "Error: --synthetic: A_bytes, B_bytes, chunk_bytes must be >= sizeof(double)\n");
+        return -1;
+    }
+    if ((sp->b_bytes / sizeof(double)) % (sp->chunk_bytes / sizeof(double)) != 0) {
+        fprintf(stderr, "Error: --synthetic: B_bytes must be a multiple of chunk_bytes\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* run_kernel()'s loads, outer_scale times. Returns accesses fed, or -1 on error. */
+static int64_t profile_synthetic(struct reuse_profiler *p, const struct synth_params *sp, unsigned line_shift) {
+    uint64_t a_elems = sp->a_bytes / sizeof(double);
+    uint64_t b_elems = sp->b_bytes / sizeof(double);
+    uint64_t per_iter = sp->chunk_bytes / sizeof(double);
+    uint64_t stride = (sp->access_mode == 0) ? 1 : sp->stride_elems;
+    uint64_t outer_iters = b_elems / per_iter;
+    uint64_t n = 0;
+
+    for (uint64_t rep = 0; rep < sp->outer_scale; rep++) {
+        for (uint64_t outer = 0; outer < outer_iters; outer++) {
+            for (uint64_t i = 0; i < a_elems; i++) {
+                if (reuse_access(p, (SYNTH_A_BASE + i * sizeof(double)) >> line_shift, 0) != 0) {
+                    return -1;
+                }
+            }
+            uint64_t base = outer * per_iter * stride;
+            for (uint64_t j = 0; j < per_iter; j++) {
+                uint64_t addr = SYNTH_B_BASE + (base + j * stride) * sizeof(double);
+                if (reuse_access(p, addr >> line_shift, 1) != 0) {
+                    return -1;
+                }
+            }
+            n += a_elems + per_iter;
+        }
+    }
+    return (int64_t)n;
+}
+
+/*
+ * Feed the memory operands of a trace; operands of one record in the same
+ * line are one access (as in trace_cachesim). The stream of an operand is
+ * the index of its record's IP in ips[], or n_ips for any other IP.
+ * Returns records read, or -1 on error.
+ */
+static int64_t profile_trace(struct reuse_profiler *p, const char *path, const uint64_t *ips, unsigned n_ips,
+                             unsigned line_shift, uint64_t max_records) {
+    struct trace_reader rd;
+    if (trace_reader_open(&rd, path) != 0) {
+        return -1;
+    }
+
+    uint64_t idx = 0;
+    uint64_t limit = max_records ? max_records : UINT64_MAX;
+    const struct input_instr *recs;
+    int64_t n = 0;
+    while (idx < limit) {
+        uint64_t want = limit - idx;
+        n = trace_reader_next(&rd, &recs, want < TRACE_READ_CHUNK ? want : TRACE_READ_CHUNK);
+        if (n <= 0) {
+            break;
+        }
+        for (int64_t i = 0; i < n; i++) {
+            const struct input_instr *rec = &recs[i];
+            uint64_t lines[TRACE_RECORD_MAX_LINES];
+            unsigned n_lines = trace_record_lines(rec, line_shift, lines);
+            if (n_lines == 0) {
+                continue;
+            }
+            unsigned stream = 0;
+            while (stream < n_ips && ips[stream] != rec->ip) {
+                stream++;
+            }
+            for (unsigned j = 0; j < n_lines; j++) {
+                if (reuse_access(p, lines[j], stream) != 0) {
+                    trace_reader_close(&rd);
+                    return -1;
+                }
+            }
+        }
+        idx += (uint64_t)n;
+    }
+    trace_reader_close(&rd);
+    return (n < 0) ? -1 : (int64_t)idx;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = NULL;
+    const char *synth_arg = NULL;
+    const char *loops_path = NULL;
+    const char *sizes_arg = NULL;
+    uint64_t a_ips[TRACE_LOOPS_MAX_IPS];
+    uint64_t b_ips[TRACE_LOOPS_MAX_IPS];
+    unsigned n_a = 0;
+    unsigned n_b = 0;
+    unsigned line = DEFAULT_LINE;
+    double sample_rate = 1.0;
+    long points = DEFAULT_POINTS;
+    uint64_t max_records = 0;
+
+    /* Parse command line options */
+    static struct option long_options[] = {
+        {"trace",     required_argument, 0, 't'},
+        {"synthetic", required_argument, 0, 'y'},
+        {"loops",     required_argument, 0, 'L'},
+        {"a-ip",      required_argument, 0, 'a'},
+        {"b-ip",      required_argument, 0, 'b'},
+        {"line",      required_argument, 0, 'l'},
+        {"sample",    required_argument, 0, 's'},
+        {"points",    required_argument, 0, 'p'},
+        {"sizes",     required_argument, 0, 'z'},
+        {"max",       required_argument, 0, 'm'},
+        {"help",      no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:y:L:a:b:l:s:p:z:m:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'y':
+                synth_arg = optarg;
+                break;
+            case 'L':
+                loops_path = optarg;
+                break;
+            case 'a':
+            case 'b': {
+                uint64_t *ips = (opt == 'a') ? a_ips : b_ips;
+                unsigned *n = (opt == 'a') ? &n_a : &n_b;
+                if (*n == TRACE_LOOPS_MAX_IPS) {
+                    fprintf(stderr, "Error: At most %d --%c-ip options\n", TRACE_LOOPS_MAX_IPS, opt);
+                    return 1;
+                }
+                ips[(*n)++] = strtoull(optarg, NULL, 16);
+                break;
+            }
+            case 'l':
+                line = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                sample_rate = strtod(optarg, NULL);
+                break;
+            case 'p':
+                points = strtol(optarg, NULL, 10);
+                break;
+            case 'z':
+                sizes_arg = optarg;
+                break;
+            case 'm':
+                max_records = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!trace_path == !synth_arg) {
+        fprintf(stderr, "Error: Exactly one of --trace and --synthetic is required\n\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (line == 0 || (line & (line - 1)) != 0) {
+        fprintf(stderr, "Error: --line %u is not a power of two\n", line);
+        return 1;
+    }
+    if (points < 0 || points > 64) {
+        fprintf(stderr, "Error: --points must be 0..64\n");
+        return 1;
+    }
+    unsigned line_shift = 0;
+    while ((1u << line_shift) < line) {
+        line_shift++;
+    }
+
+    /* --sizes, in lines */
+    uint64_t sizes[MAX_SIZES];
+    unsigned n_sizes = 0;
+    if (sizes_arg) {
+        const char *s = sizes_arg;
+        for (;;) {
+            char *end;
+            uint64_t bytes = parse_size(s, &end);
+            if (bytes < line || (*end != ',' && *end != '\0') || n_sizes == MAX_SIZES) {
+                fprintf(stderr, "Error: --sizes expects up to %d sizes of at least one line, got '%s'\n",
+                        MAX_SIZES, sizes_arg);
+                return 1;
+            }
+            sizes[n_sizes++] = bytes / line;
+            if (*end == '\0') {
+                break;
+            }
+            s = end + 1;
+        }
+    }
+
+    /* Streams: one per A / B IP plus "other" for a trace, A and B for --synthetic */
+    struct synth_params sp;
+    char stream_names[REUSE_MAX_STREAMS][32];
+    uint64_t ips[2 * TRACE_LOOPS_MAX_IPS];
+    unsigned n_ips = 0;
+    unsigned n_streams;
+    if (synth_arg) {
+        if (parse_synthetic(&sp, synth_arg) != 0) {
+            return 1;
+        }
+        strcpy(stream_names[0], "A");
+        strcpy(stream_names[1], "B");
+        n_streams = 2;
+    } else {
+        if (loops_path) {
+            struct trace_loops lp;
+            if (trace_loops_load(&lp, loops_path) != 0) {
+                return 1;
+            }
+            if (n_a == 0) {
+                memcpy(a_ips, lp.a_ips, sizeof(a_ips));
+                n_a = lp.n_a_ips;
+            }
+            if (n_b == 0) {
+                memcpy(b_ips, lp.b_ips, sizeof(b_ips));
+                n_b = lp.n_b_ips;
+            }
+        }
+        for (unsigned k = 0; k < n_a + n_b; k++) {
+            ips[n_ips] = (k < n_a) ? a_ips[k] : b_ips[k - n_a];
+            snprintf(stream_names[n_ips], sizeof(stream_names[0]), "%s_0x%lx",
+                     (k < n_a) ? "A" : "B", (unsigned long)ips[n_ips]);
+            n_ips++;
+        }
+        strcpy(stream_names[n_ips], "other");
+        n_streams = n_ips + 1;
+    }
+
+    struct reuse_profiler prof;
+    if (reuse_init(&prof, n_streams, sample_rate) != 0) {
+        return 1;
+    }
+
+    if (synth_arg) {
+        fprintf(stderr, "# Synthetic: A_bytes=%lu B_bytes=%lu chunk_bytes=%lu access_mode=%d stride_elems=%lu outer_scale=%lu\n",
+                (unsigned long)sp.a_bytes, (unsigned long)sp.b_bytes, (unsigned long)sp.chunk_bytes,
+                sp.access_mode, (unsigned long)sp.stride_elems, (unsigned long)sp.outer_scale);
+    } else {
+        fprintf(stderr, "# Trace file: %s\n", trace_path);
+    }
+    fprintf(stderr, "# Line: %u B, sample rate: %g\n", line, sample_rate);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int64_t n = synth_arg ? profile_synthetic(&prof, &sp, line_shift)
+                          : profile_trace(&prof, trace_path, ips, n_ips, line_shift, max_records);
+    if (n < 0) {
+        reuse_free(&prof);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double sec = (double)(t1.tv_sec - t0.tv_sec) + 1e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+
+    /* Cache that hits the largest distance seen: from there on only cold misses remain */
+    uint64_t max_lines = 1;
+    for (unsigned s = 0; s < n_streams; s++) {
+        for (uint64_t d = prof.hist[s].len; d-- > 0;) {
+            if (prof.hist[s].count[d] != 0) {
+                uint64_t lines = reuse_bin_distance(&prof, d) + 1;
+                max_lines = (lines > max_lines) ? lines : max_lines;
+                break;
+            }
+        }
+    }
+
+    /* Report sizes: every change point (--points 0) or a geometric series */
+    uint64_t *report = sizes;
+    uint64_t n_report = n_sizes;
+    uint64_t *points_buf = NULL;
+    if (!sizes_arg) {
+        uint64_t cap = 2;
+        if (points == 0) {
+            for (uint64_t d = 0; reuse_bin_distance(&prof, d) + 1 < max_lines; d++) {
+                for (unsigned s = 0; s < n_streams; s++) {
+                    if (d < prof.hist[s].len && prof.hist[s].count[d] != 0) {
+                        cap++;
+                        break;
+                    }
+                }
+            }
+        } else {
+            for (uint64_t v = max_lines; v > 0; v >>= 1) {
+                cap += (uint64_t)points;
+            }
+        }
+        points_buf = malloc(cap * sizeof(*points_buf));
+        if (!points_buf) {
+            fprintf(stderr, "Error: Out of memory for %lu report sizes\n", (unsigned long)cap);
+            reuse_free(&prof);
+            return 1;
+        }
+        n_report = 0;
+        if (points == 0) {
+            /* A cache of d + 1 lines is the first to hit distance d (of bin b) */
+            for (uint64_t b = 0; reuse_bin_distance(&prof, b) + 1 < max_lines; b++) {
+                for (unsigned s = 0; s < n_streams; s++) {
+                    if (b < prof.hist[s].len && prof.hist[s].count[b] != 0) {
+                        points_buf[n_report++] = reuse_bin_distance(&prof, b) + 1;
+                        break;
+                    }
+                }
+            }
+        } else {
+            /* points evenly spaced sizes per doubling: 32K, 40K, 48K, 56K, 64K, ... */
+            for (uint64_t octave = 1; octave < max_lines; octave <<= 1) {
+                for (long k = 0; k < points; k++) {
+                    uint64_t v = octave + octave * (uint64_t)k / (uint64_t)points;
+                    if (v >= max_lines) {
+                        break;
+                    }
+                    if (n_report == 0 || v != points_buf[n_report - 1]) {
+                        points_buf[n_report++] = v;
+                    }
+                }
+            }
+        }
+        points_buf[n_report++] = max_lines;
+        report = points_buf;
+    }
+    qsort(report, n_report, sizeof(*report), cmp_u64);
+
+    reuse_finish(&prof);
+
+    /* Summary */
+    uint64_t accesses = 0;
+    uint64_t cold = 0;
+    for (unsigned s = 0; s < n_streams; s++) {
+        accesses += prof.hist[s].accesses;
+        cold += prof.hist[s].cold;
+    }
+    fprintf(stderr, "# %s: %lu %s in %.2f s\n", synth_arg ? "Stream" : "Trace",
+            (unsigned long)n, synth_arg ? "loads" : "records", sec);
+    fprintf(stderr, "# Accesses: %.0f, distinct lines: %.0f (%.1f KiB)%s\n",
+            (double)accesses / sample_rate, (double)cold / sample_rate,
+            (double)cold / sample_rate * line / 1024.0, sample_rate < 1.0 ? " (estimated)" : "");
+    for (unsigned s = 0; s < n_streams; s++) {
+        const struct reuse_hist *h = &prof.hist[s];
+        if (h->accesses == 0) {
+            continue;
+        }
+        /* Smallest cache in which every reuse of the stream hits */
+        uint64_t fit = 1;
+        while (fit < max_lines && reuse_misses(&prof, s, fit) > h->cold) {
+            fit++;
+        }
+        fprintf(stderr, "#   %-16s accesses %12.0f  cold %10.0f  all reuses hit from %.1f KiB\n", stream_names[s],
+                (double)h->accesses / sample_rate, (double)h->cold / sample_rate, (double)fit * line / 1024.0);
+    }
+    fprintf(stderr, "#\n");
+
+    printf("cache_bytes,lines,misses,miss_ratio");
+    if (n_streams > 1) {
+        for (unsigned s = 0; s < n_streams; s++) {
+            printf(",%s_misses,%s_miss_ratio", stream_names[s], stream_names[s]);
+        }
+    }
+    printf("\n");
+    for (uint64_t r = 0; r < n_report; r++) {
+        uint64_t lines = report[r];
+        uint64_t misses = 0;
+        for (unsigned s = 0; s < n_streams; s++) {
+            misses += reuse_misses(&prof, s, lines);
+        }
+        printf("%lu,%lu,%.0f,%.6f", (unsigned long)(lines * line), (unsigned long)lines,
+               (double)misses / sample_rate, accesses ? (double)misses / (double)accesses : 0.0);
+        if (n_streams > 1) {
+            for (unsigned s = 0; s < n_streams; s++) {
+                uint64_t m = reuse_misses(&prof, s, lines);
+                printf(",%.0f,%.6f", (double)m / sample_rate,
+                       prof.hist[s].accesses ? (double)m / (double)prof.hist[s].accesses : 0.0);
+            }
+        }
+        printf("\n");
+    }
+
+    free(points_buf);
+    reuse_free(&prof);
+    return 0;
+}
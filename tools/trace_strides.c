@@ -0,0 +1,559 @@
+/*
+ * trace_strides.c - Per-IP address delta (stride) histograms
+ *
+ * Usage: trace_strides --trace PATH [--region R] [--iters I:J] [--loops FILE]
+ *            [--ip IP ...] [--top K] [--hist] [--min N] [--max N]
+ *
+ * Follows the address of every memory-accessing IP through the trace and
+ * histograms the deltas between its consecutive accesses, i.e. what a
+ * per-IP stride prefetcher is trained on. Per IP it reports the dominant
+ * delta and its share, how often a delta repeats the previous one (the
+ * stride prefetcher's confirmation rate) and how often consecutive accesses
+ * cross a cache line or a 4 KiB page.
+ *
+ * With --region / --iters only those regions of the outer iterations are
+ * scanned, located through the trace's .tidx index (trace_build_index); an
+ * IP's state carries over between regions, as it would in the prefetcher.
+ *
+ * The address of a record is its first non-zero source operand, or for a
+ * pure store its first non-zero destination operand.
+ */
+
+#define _GNU_SOURCE  /* clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "trace_io.h"
+#include "trace_loops.h"
+#include "trace_index.h"
+
+/* Distinct deltas kept per IP; further ones only count as "other" */
+#define DELTA_SLOTS 64
+
+#define DEFAULT_TOP  4
+#define DEFAULT_LINE 64
+#define DEFAULT_PAGE 4096
+
+/* Most --ip options */
+#define MAX_IP_FILTER 64
+
+struct delta_slot {
+    int64_t delta;
+    uint64_t count;             /* 0 = empty slot */
+};
+
+struct ip_stats {
+    uint64_t ip;
+    uint64_t last_addr;
+    int64_t last_delta;
+    uint64_t accesses;
+    uint64_t repeats;           /* deltas equal to the previous delta */
+    uint64_t line_cross;
+    uint64_t page_cross;
+    uint64_t other;             /* deltas that found no free slot */
+    unsigned n_distinct;
+    struct delta_slot slots[DELTA_SLOTS];
+};
+
+/* IP -> ip_stats (open addressing; slot holds index + 1, 0 = empty) */
+struct ip_table {
+    struct ip_stats *stats;
+    uint64_t n;
+    uint64_t cap;
+    uint32_t *slot;
+    uint64_t slot_cap;          /* power of two, at most half full */
+};
+
+/* Records [begin, end) to scan */
+struct scan_span {
+    uint64_t begin;
+    uint64_t end;
+};
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s --trace PATH [--region R] [--iters I:J] [--loops FILE]\n", prog);
+    fprintf(stderr, "           [--ip IP ...] [--top K] [--hist] [--min N] [--max N]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --trace PATH     Trace file, raw or .xz (required)\n");
+    fprintf(stderr, "  --region R       Only region R (A, B or overhead) of every iteration, from PATH%s\n", TRACE_INDEX_SUFFIX);
+    fprintf(stderr, "  --iters I:J      Only outer iterations [I, J), from PATH%s\n", TRACE_INDEX_SUFFIX);
+    fprintf(stderr, "  --loops FILE     Label the A / B load IPs from trace_detect_loops JSON\n");
+    fprintf(stderr, "                   (with --region / --iters the index's IPs are used)\n");
+    fprintf(stderr, "  --ip IP          Only this IP (hex, repeatable)\n");
+    fprintf(stderr, "  --top K          Deltas listed per IP in top_deltas (default: %d)\n", DEFAULT_TOP);
+    fprintf(stderr, "  --hist           Print the full delta histogram of every IP instead\n");
+    fprintf(stderr, "  --min N          Skip IPs with fewer than N accesses (default: 2)\n");
+    fprintf(stderr, "  --line BYTES     Cache line size for line_cross_rate (default: %d)\n", DEFAULT_LINE);
+    fprintf(stderr, "  --page BYTES     Page size for page_cross_rate (default: %d)\n", DEFAULT_PAGE);
+    fprintf(stderr, "  --max N          Stop after N scanned records (default: 0 = all)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Output (CSV, one line per IP, most accesses first):\n");
+    fprintf(stderr, "  ip,role,accesses,distinct_deltas,dominant_delta,dominant_share,repeat_rate,\n");
+    fprintf(stderr, "  line_cross_rate,page_cross_rate,top_deltas\n");
+    fprintf(stderr, "  (--hist: ip,role,delta,count,share)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Example:\n");
+    fprintf(stderr, "  %s --trace wp.trace.xz --region B\n", prog);
+}
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static int ip_table_init(struct ip_table *t) {
+    memset(t, 0, sizeof(*t));
+    t->slot_cap = 1024;
+    t->slot = calloc(t->slot_cap, sizeof(*t->slot));
+    if (!t->slot) {
+        fprintf(stderr, "Error: Out of memory for the IP table\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void ip_table_free(struct ip_table *t) {
+    free(t->stats);
+    free(t->slot);
+}
+
+static uint64_t ip_table_probe(const struct ip_table *t, uint64_t ip) {
+    uint64_t mask = t->slot_cap - 1;
+    uint64_t i = mix64(ip) & mask;
+    while (t->slot[i] != 0 && t->stats[t->slot[i] - 1].ip != ip) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* Stats of ip, created on first use. NULL when out of memory. */
+static struct ip_stats *ip_table_get(struct ip_table *t, uint64_t ip) {
+    uint64_t i = ip_table_probe(t, ip);
+    if (t->slot[i] != 0) {
+        return &t->stats[t->slot[i] - 1];
+    }
+
+    if (t->n == t->cap) {
+        uint64_t cap = t->cap ? 2 * t->cap : 256;
+        struct ip_stats *stats = realloc(t->stats, cap * sizeof(*stats));
+        if (!stats) {
+            fprintf(stderr, "Error: Out of memory for %lu IPs\n", (unsigned long)cap);
+            return NULL;
+        }
+        t->stats = stats;
+        t->cap = cap;
+    }
+    struct ip_stats *s = &t->stats[t->n];
+    memset(s, 0, sizeof(*s));
+    s->ip = ip;
+    t->slot[i] = (uint32_t)++t->n;
+
+    if (2 * t->n > t->slot_cap) {
+        uint32_t *old = t->slot;
+        uint64_t old_cap = t->slot_cap;
+        t->slot = calloc(2 * old_cap, sizeof(*t->slot));
+        if (!t->slot) {
+            fprintf(stderr, "Error: Out of memory for the IP table\n");
+            t->slot = old;
+            return NULL;
+        }
+        t->slot_cap = 2 * old_cap;
+        for (uint64_t k = 0; k < old_cap; k++) {
+            if (old[k] != 0) {
+                t->slot[ip_table_probe(t, t->stats[old[k] - 1].ip)] = old[k];
+            }
+        }
+        free(old);
+    }
+    return s;
+}
+
+static void add_delta(struct ip_stats *s, int64_t delta) {
+    unsigned i = (unsigned)(mix64((uint64_t)delta) & (DELTA_SLOTS - 1));
+    for (unsigned probe = 0; probe < DELTA_SLOTS; probe++) {
+        struct delta_slot *d = &s->slots[i];
+        if (d->count == 0) {
+            d->delta = delta;
+            d->count = 1;
+            s->n_distinct++;
+            return;
+        }
+        if (d->delta == delta) {
+            d->count++;
+            return;
+        }
+        i = (i + 1) & (DELTA_SLOTS - 1);
+    }
+    s->other++;
+}
+
+struct scan_opts {
+    const uint64_t *ip_filter;
+    unsigned n_ip_filter;
+    unsigned line_shift;
+    unsigned page_shift;
+};
+
+/*
+ * Accumulate the spans of r (in increasing order) into t, reading at most
+ * max_records. Stores the number of records scanned. Returns 0, or -1 on a
+ * read error or when out of memory.
+ */
+static int scan(struct trace_reader *r, const struct scan_span *spans, uint64_t n_spans,
+                const struct scan_opts *o, uint64_t max_records, struct ip_table *t, uint64_t *scanned) {
+    struct ip_stats *last = NULL;   /* consecutive records often share an IP */
+    const struct input_instr *recs;
+    int64_t n = 0;
+    uint64_t budget = max_records ? max_records : UINT64_MAX;
+
+    *scanned = 0;
+    for (uint64_t k = 0; k < n_spans && budget > 0; k++) {
+        if (spans[k].begin > r->pos) {
+            if (trace_reader_skip(r, spans[k].begin - r->pos) < 0) {
+                return -1;
+            }
+            if (r->pos < spans[k].begin) {
+                break;  /* end of trace */
+            }
+        }
+        uint64_t left = spans[k].end - r->pos;
+        if (left > budget) {
+            left = budget;
+        }
+        while (left > 0 && (n = trace_reader_next(r, &recs, left < TRACE_READ_CHUNK ? left : TRACE_READ_CHUNK)) > 0) {
+            for (int64_t i = 0; i < n; i++) {
+                uint64_t addr = trace_record_addr(&recs[i]);
+                if (addr == 0) {
+                    continue;
+                }
+                uint64_t ip = recs[i].ip;
+                if (o->n_ip_filter > 0) {
+                    unsigned f = 0;
+                    while (f < o->n_ip_filter && o->ip_filter[f] != ip) {
+                        f++;
+                    }
+                    if (f == o->n_ip_filter) {
+                        continue;
+                    }
+                }
+                struct ip_stats *s = (last && last->ip == ip) ? last : ip_table_get(t, ip);
+                if (!s) {
+                    return -1;
+                }
+                last = s;
+
+                if (s->accesses++ > 0) {
+                    int64_t delta = (int64_t)(addr - s->last_addr);
+                    add_delta(s, delta);
+                    s->repeats += (s->accesses > 2 && delta == s->last_delta);
+                    s->line_cross += ((addr >> o->line_shift) != (s->last_addr >> o->line_shift));
+                    s->page_cross += ((addr >> o->page_shift) != (s->last_addr >> o->page_shift));
+                    s->last_delta = delta;
+                }
+                s->last_addr = addr;
+            }
+            left -= (uint64_t)n;
+            budget -= (uint64_t)n;
+            *scanned += (uint64_t)n;
+        }
+        if (n < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int cmp_stats_accesses(const void *a, const void *b) {
+    const struct ip_stats *x = a;
+    const struct ip_stats *y = b;
+    if (x->accesses != y->accesses) {
+        return (x->accesses < y->accesses) ? 1 : -1;
+    }
+    return (x->ip > y->ip) - (x->ip < y->ip);
+}
+
+static int cmp_slot_count(const void *a, const void *b) {
+    const struct delta_slot *x = a;
+    const struct delta_slot *y = b;
+    if (x->count != y->count) {
+        return (x->count < y->count) ? 1 : -1;
+    }
+    return (x->delta > y->delta) - (x->delta < y->delta);
+}
+
+static const char *ip_role(uint64_t ip, const uint64_t *a_ips, unsigned n_a, const uint64_t *b_ips, unsigned n_b) {
+    for (unsigned k = 0; k < n_a; k++) {
+        if (a_ips[k] == ip) {
+            return "A";
+        }
+    }
+    for (unsigned k = 0; k < n_b; k++) {
+        if (b_ips[k] == ip) {
+            return "B";
+        }
+    }
+    return "";
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace_path = NULL;
+    const char *loops_path = NULL;
+    const char *iters_arg = NULL;
+    int region = -1;
+    uint64_t ip_filter[MAX_IP_FILTER];
+    unsigned n_ip_filter = 0;
+    long top = DEFAULT_TOP;
+    int hist = 0;
+    uint64_t min_accesses = 2;
+    unsigned line = DEFAULT_LINE;
+    unsigned page = DEFAULT_PAGE;
+    uint64_t max_records = 0;
+
+    /* Parse command line options */
+    static struct option long_options[] = {
+        {"trace",  required_argument, 0, 't'},
+        {"region", required_argument, 0, 'r'},
+        {"iters",  required_argument, 0, 'k'},
+        {"loops",  required_argument, 0, 'L'},
+        {"ip",     required_argument, 0, 'i'},
+        {"top",    required_argument, 0, 'n'},
+        {"hist",   no_argument,       0, 'H'},
+        {"min",    required_argument, 0, 'c'},
+        {"line",   required_argument, 0, 'l'},
+        {"page",   required_argument, 0, 'p'},
+        {"max",    required_argument, 0, 'm'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:r:k:L:i:n:Hc:l:p:m:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                trace_path = optarg;
+                break;
+            case 'r':
+                region = trace_region_parse(optarg);
+                if (region < 0) {
+                    fprintf(stderr, "Error: Unknown --region '%s' (A, B, overhead)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k':
+                iters_arg = optarg;
+                break;
+            case 'L':
+                loops_path = optarg;
+                break;
+            case 'i':
+                if (n_ip_filter == MAX_IP_FILTER) {
+                    fprintf(stderr, "Error: At most %d --ip options\n", MAX_IP_FILTER);
+                    return 1;
+                }
+                ip_filter[n_ip_filter++] = strtoull(optarg, NULL, 16);
+                break;
+            case 'n':
+                top = strtol(optarg, NULL, 10);
+                break;
+            case 'H':
+                hist = 1;
+                break;
+            case 'c':
+                min_accesses = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                line = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                page = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                max_records = strtoull(optarg, NULL, 10);
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (!trace_path) {
+        fprintf(stderr, "Error: --trace is required\n\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (line == 0 || (line & (line - 1)) != 0 || page == 0 || (page & (page - 1)) != 0) {
+        fprintf(stderr, "Error: --line and --page must be powers of two\n");
+        return 1;
+    }
+    if (top < 0) {
+        top = 0;
+    }
+    struct scan_opts so;
+    so.ip_filter = ip_filter;
+    so.n_ip_filter = n_ip_filter;
+    so.line_shift = 0;
+    so.page_shift = 0;
+    while ((1u << so.line_shift) < line) {
+        so.line_shift++;
+    }
+    while ((1u << so.page_shift) < page) {
+        so.page_shift++;
+    }
+
+    /* A / B IPs for the role column */
+    uint64_t a_ips[TRACE_LOOPS_MAX_IPS];
+    uint64_t b_ips[TRACE_LOOPS_MAX_IPS];
+    unsigned n_a = 0;
+    unsigned n_b = 0;
+    if (loops_path) {
+        struct trace_loops lp;
+        if (trace_loops_load(&lp, loops_path) != 0) {
+            return 1;
+        }
+        memcpy(a_ips, lp.a_ips, sizeof(a_ips));
+        memcpy(b_ips, lp.b_ips, sizeof(b_ips));
+        n_a = lp.n_a_ips;
+        n_b = lp.n_b_ips;
+    }
+
+    /* Records to scan: the whole trace, or the selected regions of the selected iterations */
+    struct scan_span whole = { 0, UINT64_MAX };
+    struct scan_span *spans = &whole;
+    uint64_t n_spans = 1;
+    if (region >= 0 || iters_arg) {
+        struct trace_index ix;
+        if (trace_index_load(&ix, trace_path) != 0) {
+            return 1;
+        }
+        uint64_t iter_first = 0;
+        uint64_t iter_end = ix.h.n_iters;
+        if (iters_arg) {
+            char *sep;
+            iter_first = strtoull(iters_arg, &sep, 10);
+            iter_end = (*sep == ':') ? strtoull(sep + 1, NULL, 10) : 0;
+            if (*sep != ':' || iter_end <= iter_first || iter_end > ix.h.n_iters) {
+                fprintf(stderr, "Error: --iters expects I:J with I < J <= %lu, got '%s'\n",
+                        (unsigned long)ix.h.n_iters, iters_arg);
+                trace_index_free(&ix);
+                return 1;
+            }
+        }
+        spans = malloc((iter_end - iter_first + 1) * sizeof(*spans));
+        if (!spans) {
+            fprintf(stderr, "Error: Out of memory\n");
+            trace_index_free(&ix);
+            return 1;
+        }
+        n_spans = 0;
+        for (uint64_t k = iter_first; k < iter_end; k++) {
+            uint64_t begin, end;
+            trace_index_region(&ix, k, region >= 0 ? region : TRACE_REGIONS, &begin, &end);
+            if (begin == end) {
+                continue;
+            }
+            if (n_spans > 0 && spans[n_spans - 1].end == begin) {
+                spans[n_spans - 1].end = end;
+            } else {
+                spans[n_spans].begin = begin;
+                spans[n_spans++].end = end;
+            }
+        }
+        memcpy(a_ips, ix.h.a_ips, sizeof(a_ips));
+        memcpy(b_ips, ix.h.b_ips, sizeof(b_ips));
+        n_a = ix.h.n_a_ips;
+        n_b = ix.h.n_b_ips;
+        fprintf(stderr, "# Iterations [%lu, %lu), %s\n", (unsigned long)iter_first, (unsigned long)iter_end,
+                trace_region_name(region >= 0 ? region : TRACE_REGIONS));
+        trace_index_free(&ix);
+    }
+
+    struct trace_reader rd;
+    struct ip_table t;
+    if (trace_reader_open(&rd, trace_path) != 0 || ip_table_init(&t) != 0) {
+        if (spans != &whole) {
+            free(spans);
+        }
+        return 1;
+    }
+
+    fprintf(stderr, "# Trace file: %s\n", trace_path);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t scanned;
+    int rc = scan(&rd, spans, n_spans, &so, max_records, &t, &scanned);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    trace_reader_close(&rd);
+    if (spans != &whole) {
+        free(spans);
+    }
+    if (rc != 0) {
+        ip_table_free(&t);
+        return 1;
+    }
+    double sec = (double)(t1.tv_sec - t0.tv_sec) + 1e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+    fprintf(stderr, "# Scanned %lu records in %.2f s (%.1f M records/s), %lu memory IPs\n",
+            (unsigned long)scanned, sec, sec > 0 ? (double)scanned / sec / 1e6 : 0.0, (unsigned long)t.n);
+    fprintf(stderr, "#\n");
+
+    qsort(t.stats, t.n, sizeof(*t.stats), cmp_stats_accesses);
+
+    if (hist) {
+        printf("ip,role,delta,count,share\n");
+    } else {
+        printf("ip,role,accesses,distinct_deltas,dominant_delta,dominant_share,repeat_rate,"
+               "line_cross_rate,page_cross_rate,top_deltas\n");
+    }
+    for (uint64_t k = 0; k < t.n; k++) {
+        struct ip_stats *s = &t.stats[k];
+        if (s->accesses < min_accesses) {
+            continue;
+        }
+        const char *role = ip_role(s->ip, a_ips, n_a, b_ips, n_b);
+        uint64_t n_deltas = s->accesses - 1;
+        double per = n_deltas ? 1.0 / (double)n_deltas : 0.0;
+
+        /* Slots by count, most frequent first (the table is not needed afterwards) */
+        qsort(s->slots, DELTA_SLOTS, sizeof(s->slots[0]), cmp_slot_count);
+
+        if (hist) {
+            for (unsigned d = 0; d < s->n_distinct; d++) {
+                printf("0x%lx,%s,%ld,%lu,%.6f\n", (unsigned long)s->ip, role, (long)s->slots[d].delta,
+                       (unsigned long)s->slots[d].count, (double)s->slots[d].count * per);
+            }
+            if (s->other > 0) {
+                printf("0x%lx,%s,other,%lu,%.6f\n", (unsigned long)s->ip, role,
+                       (unsigned long)s->other, (double)s->other * per);
+            }
+            continue;
+        }
+
+        printf("0x%lx,%s,%lu,%u%s,", (unsigned long)s->ip, role, (unsigned long)s->accesses,
+               s->n_distinct, s->other ? "+" : "");
+        if (s->n_distinct > 0) {
+            printf("%ld,%.6f", (long)s->slots[0].delta, (double)s->slots[0].count * per);
+        } else {
+            printf(",");
+        }
+        printf(",%.6f,%.6f,%.6f,", n_deltas > 1 ? (double)s->repeats / (double)(n_deltas - 1) : 0.0,
+               (double)s->line_cross * per, (double)s->page_cross * per);
+        for (unsigned d = 0; d < s->n_distinct && d < (unsigned)top; d++) {
+            printf("%s%ld:%.4f", d ? " " : "", (long)s->slots[d].delta, (double)s->slots[d].count * per);
+        }
+        if (s->other > 0 && top > 0) {
+            printf(" other:%.4f", (double)s->other * per);
+        }
+        printf("\n");
+    }
+
+    ip_table_free(&t);
+    return 0;
+}
@@ -0,0 +1,491 @@
+/*
+ * trace_surgery.c - Apply a plan of insert/overwrite/delete/duplicate edits in one pass
+ *
+ * Usage: trace_surgery --in PATH --out PATH [--plan FILE] [--op "LINE"]...
+ *            [--xz-threads N] [--copy-mode MODE] [--window N] [--dry-run]
+ *
+ * Reads a plan (see trace_plan.h for the syntax), compiles it into an edit
+ * list sorted by input position and writes the edited trace with a single
+ * streaming pass over the input. Replaces chains of trace_insert_range /
+ * trace_overwrite_range / trace_insert_all_iters runs, each of which would
+ * read and write the whole trace again.
+ *
+ * If plan values are lists (a_pos=0.25,0.5), every combination becomes its
+ * own output, named by substituting {key} in --out. All outputs are written
+ * from the same single input pass, one writer thread per output.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "trace_io.h"
+#include "trace_plan.h"
+
+/* Edits listed individually before the summary line */
+#define SHOW_EDITS 20
+
+/* Maximum number of sweep variants (one writer thread and file each) */
+#define MAX_VARIANTS 256
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s --in PATH --out PATH [--plan FILE] [--op \"LINE\"]...\n", prog);
+    fprintf(stderr, "           [--xz-threads N] [--copy-mode MODE] [--window N] [--dry-run]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --in PATH        Input trace file (required; .xz is decompressed on the fly)\n");
+    fprintf(stderr, "  --out PATH       Output trace file (required, unless --dry-run; .xz is compressed)\n");
+    fprintf(stderr, "                   For a sweep, a template with {key} for every value list\n");
+    fprintf(stderr, "  --plan FILE      Plan file, one operation per line\n");
+    fprintf(stderr, "  --op LINE        One plan line given on the command line (repeatable)\n");
+    fprintf(stderr, "  --xz-threads N   xz encoder threads per .xz output (default: 0 = all CPUs)\n");
+    fprintf(stderr, "  --copy-mode MODE How to move records copied from the input (default: write)\n");
+    fprintf(stderr, "                   write   = through userspace from the mapped input\n");
+    fprintf(stderr, "                   copy    = copy_file_range(2), data stays in the kernel\n");
+    fprintf(stderr, "                   reflink = FICLONERANGE where block-aligned (XFS/btrfs), else copy\n");
+    fprintf(stderr, "                   (single output only)\n");
+    fprintf(stderr, "  --window N       Sweep: input records shared by the writers (default: %llu)\n",
+            TRACE_FANOUT_WINDOW_RECORDS);
+    fprintf(stderr, "  --dry-run        Compile and validate the plan without writing output\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Plan operations (indices refer to the ORIGINAL input, [I, J) half-open):\n");
+    fprintf(stderr, "  insert    at=K src=I:J [count=N]   Insert [I, J) (N times) before record K\n");
+    fprintf(stderr, "  overwrite at=K src=I:J             Replace [K, K + J - I) with [I, J)\n");
+    fprintf(stderr, "  delete    range=I:J                Drop [I, J)\n");
+    fprintf(stderr, "  duplicate range=I:J [count=N]      Repeat [I, J) N more times\n");
+    fprintf(stderr, "  iters     first_a_begin=IDX a_len=N b_len=N iterations=N\n");
+    fprintf(stderr, "            a_pos=RATIO b_ratio=RATIO [every=N] [mode=insert|overwrite]\n");
+    fprintf(stderr, "                                     Same edits as trace_insert_all_iters\n");
+    fprintf(stderr, "  iters     loops=FILE a_pos=RATIO b_ratio=RATIO ...\n");
+    fprintf(stderr, "                                     Loop structure from trace_detect_loops JSON\n");
+    fprintf(stderr, "  Any value may be a list v1,v2,...: one output per combination (sweep)\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples:\n");
+    fprintf(stderr, "  # B at A midpoint every 8th iteration, and drop the prelude\n");
+    fprintf(stderr, "  %s --in trace.champsimtrace --out out.champsimtrace \\\n", prog);
+    fprintf(stderr, "      --op \"iters first_a_begin=1000 a_len=227 b_len=171 iterations=4096 a_pos=0.5 b_ratio=1.0 every=8\" \\\n");
+    fprintf(stderr, "      --op \"delete range=0:1000\"\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  # 3 x 2 sweep: six outputs from one read of the input\n");
+    fprintf(stderr, "  %s --in trace.xz --out 'out_A{a_pos}_B{b_ratio}.xz' \\\n", prog);
+    fprintf(stderr, "      --op \"iters first_a_begin=1000 a_len=227 b_len=171 iterations=4096 a_pos=0.25,0.5,0.75 b_ratio=0.5,1.0\"\n");
+}
+
+/* Parse the plan: file first, then --op lines in command line order */
+static int load_plan(struct trace_plan *p, const char *plan_path, const char **ops, int n_ops,
+                     const unsigned *choice) {
+    trace_plan_init(p);
+    trace_plan_select(p, choice);
+    if (plan_path && trace_plan_load(p, plan_path) != 0) {
+        return -1;
+    }
+    for (int k = 0; k < n_ops; k++) {
+        if (trace_plan_add_line(p, ops[k], "--op", (unsigned)(k + 1)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void print_plan(const struct trace_plan *plan, uint64_t total_records, int verbose) {
+    uint64_t inserted = 0;
+    uint64_t dropped = 0;
+    for (size_t i = 0; i < plan->n_edits; i++) {
+        inserted += (plan->edits[i].src_end - plan->edits[i].src_begin) * plan->edits[i].repeat;
+        dropped += plan->edits[i].skip;
+    }
+
+    fprintf(stderr, "# Plan: %lu operations -> %lu edits\n",
+            (unsigned long)plan->n_ops, (unsigned long)plan->n_edits);
+    for (size_t i = 0; verbose && i < plan->n_edits && i < SHOW_EDITS; i++) {
+        const struct trace_edit *e = &plan->edits[i];
+        fprintf(stderr, "#   at %lu:", (unsigned long)e->pos);
+        if (e->skip > 0) {
+            fprintf(stderr, " drop [%lu, %lu)", (unsigned long)e->pos, (unsigned long)(e->pos + e->skip));
+        }
+        if (e->repeat > 0) {
+            fprintf(stderr, " emit [%lu, %lu)", (unsigned long)e->src_begin, (unsigned long)e->src_end);
+            if (e->repeat > 1) {
+                fprintf(stderr, " x%lu", (unsigned long)e->repeat);
+            }
+        }
+        fprintf(stderr, "  (line %u)\n", e->line);
+    }
+    if (verbose && plan->n_edits > SHOW_EDITS) {
+        fprintf(stderr, "#   ... (%lu more)\n", (unsigned long)(plan->n_edits - SHOW_EDITS));
+    }
+    fprintf(stderr, "# Records inserted: %lu, dropped: %lu\n", (unsigned long)inserted, (unsigned long)dropped);
+    if (total_records != TRACE_RECORDS_UNKNOWN) {
+        fprintf(stderr, "# Output records: %lu\n",
+                (unsigned long)trace_plan_output_records(plan, total_records));
+    }
+}
+
+/*
+ * Expand the --out template for one sweep variant: every {key} becomes the
+ * selected value of that dimension. Returns a malloc'd path, or NULL.
+ */
+static char *variant_path(const char *tmpl, const struct trace_plan *p, const unsigned *choice) {
+    /* Every {key} can expand to at most one whole value list */
+    size_t cap = strlen(tmpl) + 1;
+    for (const char *s = strchr(tmpl, '{'); s; s = strchr(s + 1, '{')) {
+        cap += sizeof(p->dims[0].list);
+    }
+    char *path = malloc(cap);
+    if (!path) {
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (const char *s = tmpl; *s; ) {
+        const char *close = (*s == '{') ? strchr(s, '}') : NULL;
+        unsigned d = p->n_dims;
+        if (close) {
+            for (d = 0; d < p->n_dims; d++) {
+                size_t klen = strlen(p->dims[d].key);
+                if ((size_t)(close - s - 1) == klen && strncmp(s + 1, p->dims[d].key, klen) == 0) {
+                    break;
+                }
+            }
+        }
+        if (d < p->n_dims) {
+            trace_plan_dim_value(&p->dims[d], choice[d], path + n, cap - n);
+            n += strlen(path + n);
+            s = close + 1;
+        } else {
+            path[n++] = *s++;
+        }
+    }
+    path[n] = '\0';
+    return path;
+}
+
+static int run_single(struct trace_plan *plan, struct trace_reader *rd, const char *out_path,
+                      uint32_t xz_threads, int copy_mode, int dry_run) {
+    if (trace_plan_compile(plan, rd->n_records) != 0) {
+        return -1;
+    }
+    print_plan(plan, rd->n_records, 1);
+    fprintf(stderr, "#\n");
+
+    if (dry_run) {
+        fprintf(stderr, "# Dry run: Plan validation passed. No output written.\n");
+        return 0;
+    }
+
+    /* Open output file */
+    struct trace_writer wr;
+    if (trace_writer_open(&wr, out_path, xz_threads) != 0) {
+        return -1;
+    }
+    wr.copy_mode = copy_mode;
+
+    fprintf(stderr, "# Writing output to: %s\n", out_path);
+
+    int rc = trace_plan_apply(plan, rd, &wr);
+    if (rc != 0) {
+        fprintf(stderr, "Error: Applying the plan failed at output index %lu\n", (unsigned long)wr.n_written);
+    }
+
+    if (rc == 0) {
+        fprintf(stderr, "#\n");
+        fprintf(stderr, "# Read %lu input records\n", (unsigned long)rd->pos);
+        fprintf(stderr, "# Wrote %lu output records\n", (unsigned long)wr.n_written);
+        if (copy_mode != TRACE_COPY_WRITE) {
+            fprintf(stderr, "# Output: %lu records reflinked, %lu copied in kernel, %lu written\n",
+                    (unsigned long)wr.n_reflinked, (unsigned long)wr.n_kernel_copied,
+                    (unsigned long)(wr.n_written - wr.n_reflinked - wr.n_kernel_copied));
+        }
+        fprintf(stderr, "# Done.\n");
+    }
+
+    if (trace_writer_close(&wr) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+static int run_sweep(const struct trace_plan *proto, const char *plan_path, const char **ops, int n_ops,
+                     struct trace_reader *rd, const char *out_tmpl, uint32_t xz_threads,
+                     uint64_t window, int dry_run) {
+    unsigned n_dims = proto->n_dims;
+    unsigned n_variants = 1;
+    for (unsigned d = 0; d < n_dims; d++) {
+        n_variants *= proto->dims[d].n_values;
+        if (n_variants > MAX_VARIANTS) {
+            fprintf(stderr, "Error: Sweep has more than %d variants\n", MAX_VARIANTS);
+            return -1;
+        }
+        for (unsigned e = 0; e < d; e++) {
+            if (strcmp(proto->dims[d].key, proto->dims[e].key) == 0) {
+                fprintf(stderr, "Error: Value lists on lines %u and %u both use key '%s'; "
+                        "output names would be ambiguous\n",
+                        proto->dims[e].line, proto->dims[d].line, proto->dims[d].key);
+                return -1;
+            }
+        }
+        if (out_tmpl) {
+            char field[40];
+            snprintf(field, sizeof(field), "{%s}", proto->dims[d].key);
+            if (!strstr(out_tmpl, field)) {
+                fprintf(stderr, "Error: --out must contain %s to name the sweep outputs\n", field);
+                return -1;
+            }
+        }
+    }
+
+    fprintf(stderr, "# Sweep: %u variants (", n_variants);
+    for (unsigned d = 0; d < n_dims; d++) {
+        fprintf(stderr, "%s%s=%s", d ? " x " : "", proto->dims[d].key, proto->dims[d].list);
+    }
+    fprintf(stderr, ")\n");
+    fprintf(stderr, "#\n");
+
+    struct trace_plan *plans = calloc(n_variants, sizeof(*plans));
+    unsigned *choices = calloc((size_t)n_variants * n_dims, sizeof(*choices));
+    char **paths = calloc(n_variants, sizeof(*paths));
+    struct trace_writer *writers = calloc(n_variants, sizeof(*writers));
+    struct trace_plan_target *targets = calloc(n_variants, sizeof(*targets));
+    if (!plans || !choices || !paths || !writers || !targets) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(plans);
+        free(choices);
+        free(paths);
+        free(writers);
+        free(targets);
+        return -1;
+    }
+
+    /* Build, compile and name every variant (odometer over the value lists) */
+    int rc = 0;
+    unsigned n_built = 0;
+    for (unsigned v = 0; v < n_variants && rc == 0; v++) {
+        unsigned *choice = &choices[(size_t)v * n_dims];
+        unsigned rest = v;
+        for (unsigned d = n_dims; d > 0; d--) {
+            choice[d - 1] = rest % proto->dims[d - 1].n_values;
+            rest /= proto->dims[d - 1].n_values;
+        }
+
+        rc = load_plan(&plans[v], plan_path, ops, n_ops, choice);
+        n_built = v + 1;
+        if (rc == 0) {
+            rc = trace_plan_compile(&plans[v], rd->n_records);
+        }
+        if (rc == 0 && out_tmpl) {
+            paths[v] = variant_path(out_tmpl, &plans[v], choice);
+            if (!paths[v]) {
+                fprintf(stderr, "Error: Out of memory\n");
+                rc = -1;
+            }
+            for (unsigned k = 0; k < v && rc == 0; k++) {
+                if (strcmp(paths[k], paths[v]) == 0) {
+                    fprintf(stderr, "Error: Sweep variants %u and %u both write %s\n", k, v, paths[v]);
+                    rc = -1;
+                }
+            }
+        }
+        if (rc == 0) {
+            fprintf(stderr, "# Variant %u: %s\n", v, paths[v] ? paths[v] : "(no output)");
+            print_plan(&plans[v], rd->n_records, 0);
+        }
+    }
+    fprintf(stderr, "#\n");
+
+    if (rc == 0 && dry_run) {
+        fprintf(stderr, "# Dry run: Plan validation passed. No output written.\n");
+    } else if (rc == 0) {
+        /* Open all outputs, then write them from one input pass */
+        unsigned n_open = 0;
+        for (; n_open < n_variants; n_open++) {
+            if (trace_writer_open(&writers[n_open], paths[n_open], xz_threads) != 0) {
+                rc = -1;
+                break;
+            }
+            targets[n_open].plan = &plans[n_open];
+            targets[n_open].w = &writers[n_open];
+        }
+
+        if (rc == 0) {
+            fprintf(stderr, "# Writing %u outputs (%u writer threads, window %lu records)\n",
+                    n_variants, n_variants, (unsigned long)window);
+            rc = trace_plan_apply_fanout(targets, n_variants, rd, window);
+        }
+
+        if (rc == 0) {
+            fprintf(stderr, "#\n");
+            fprintf(stderr, "# Read %lu input records (once)\n", (unsigned long)rd->pos);
+            for (unsigned v = 0; v < n_variants; v++) {
+                fprintf(stderr, "# Wrote %lu output records to %s\n",
+                        (unsigned long)writers[v].n_written, paths[v]);
+            }
+            fprintf(stderr, "# Done.\n");
+        }
+        for (unsigned v = 0; v < n_open; v++) {
+            if (trace_writer_close(&writers[v]) != 0) {
+                rc = -1;
+            }
+        }
+    }
+
+    for (unsigned v = 0; v < n_built; v++) {
+        trace_plan_free(&plans[v]);
+        free(paths[v]);
+    }
+    free(plans);
+    free(choices);
+    free(paths);
+    free(writers);
+    free(targets);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    const char *in_path = NULL;
+    const char *out_path = NULL;
+    const char *plan_path = NULL;
+    const char **ops = NULL;
+    int n_ops = 0;
+    uint32_t xz_threads = 0;
+    int copy_mode = TRACE_COPY_WRITE;
+    uint64_t window = TRACE_FANOUT_WINDOW_RECORDS;
+    int dry_run = 0;
+
+    /* Parse command line options */
+    static struct option long_options[] = {
+        {"in",         required_argument, 0, 'i'},
+        {"out",        required_argument, 0, 'o'},
+        {"plan",       required_argument, 0, 'p'},
+        {"op",         required_argument, 0, 'O'},
+        {"xz-threads", required_argument, 0, 'x'},
+        {"copy-mode",  required_argument, 0, 'c'},
+        {"window",     required_argument, 0, 'w'},
+        {"dry-run",    no_argument,       0, 'r'},
+        {"help",       no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    /* At most one --op per argument */
+    ops = calloc((size_t)argc, sizeof(*ops));
+    if (!ops) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:o:p:O:x:c:w:rh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i':
+                in_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'p':
+                plan_path = optarg;
+                break;
+            case 'O':
+                ops[n_ops++] = optarg;
+                break;
+            case 'x':
+                xz_threads = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                copy_mode = trace_copy_mode_parse(optarg);
+                if (copy_mode < 0) {
+                    fprintf(stderr, "Error: Unknown --copy-mode '%s' (write, copy, reflink)\n", optarg);
+                    free(ops);
+                    return 1;
+                }
+                break;
+            case 'w':
+                window = strtoull(optarg, NULL, 0);
+                break;
+            case 'r':
+                dry_run = 1;
+                break;
+            case 'h':
+            default:
+                print_usage(argv[0]);
+                free(ops);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    /* Validate required arguments */
+    if (!in_path) {
+        fprintf(stderr, "Error: --in is required\n\n");
+        print_usage(argv[0]);
+        free(ops);
+        return 1;
+    }
+    if (!out_path && !dry_run) {
+        fprintf(stderr, "Error: --out is required (or use --dry-run)\n\n");
+        print_usage(argv[0]);
+        free(ops);
+        return 1;
+    }
+    if (!plan_path && n_ops == 0) {
+        fprintf(stderr, "Error: --plan or --op is required\n\n");
+        print_usage(argv[0]);
+        free(ops);
+        return 1;
+    }
+    if (window < 2 * TRACE_READ_CHUNK) {
+        fprintf(stderr, "Error: --window must be at least %d records\n", 2 * TRACE_READ_CHUNK);
+        free(ops);
+        return 1;
+    }
+
+    struct trace_plan plan;
+    if (load_plan(&plan, plan_path, ops, n_ops, NULL) != 0) {
+        trace_plan_free(&plan);
+        free(ops);
+        return 1;
+    }
+    int sweep = (plan.n_dims > 0);
+    if (sweep && copy_mode != TRACE_COPY_WRITE) {
+        fprintf(stderr, "# Note: --copy-mode is ignored for a sweep (all outputs are written from one read)\n");
+        copy_mode = TRACE_COPY_WRITE;
+    }
+
+    /*
+     * Open input. The kernel-side copy modes never read the mapping, so it
+     * is only prefaulted for a plain write.
+     */
+    struct trace_reader rd;
+    int map_flags = (dry_run || copy_mode != TRACE_COPY_WRITE) ? 0 : TRACE_MAP_SEQUENTIAL;
+    if (trace_reader_open_flags(&rd, in_path, map_flags) != 0) {
+        trace_plan_free(&plan);
+        free(ops);
+        return 1;
+    }
+
+    /* Print operation info */
+    fprintf(stderr, "# Input file: %s\n", in_path);
+    if (rd.n_records != TRACE_RECORDS_UNKNOWN) {
+        fprintf(stderr, "# Total input records: %lu\n", (unsigned long)rd.n_records);
+    } else {
+        fprintf(stderr, "# Total input records: unknown (xz stream without index)\n");
+    }
+    fprintf(stderr, "# sizeof(input_instr) = %zu bytes\n", sizeof(struct input_instr));
+    fprintf(stderr, "#\n");
+
+    int rc;
+    if (sweep) {
+        rc = run_sweep(&plan, plan_path, ops, n_ops, &rd, out_path, xz_threads, window, dry_run);
+    } else {
+        rc = run_single(&plan, &rd, out_path, xz_threads, copy_mode, dry_run);
+    }
+
+    trace_plan_free(&plan);
+    trace_reader_close(&rd);
+    free(ops);
+    if (rc != 0) {
+        return 1;
+    }
+
+    return 0;
+}